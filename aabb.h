@@ -0,0 +1,92 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+// class aabb
+// - axis-aligned bounding box, stored as its minimum and maximum corners
+class aabb {
+
+    public:
+        // MEMBERS
+        point3 minimum;
+        point3 maximum;
+
+    public:
+        // CONSTRUCTORS
+        // - the default box is empty (inverted) so that growing it by any point works
+        aabb()
+            : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+        aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+        point3 min() const { return minimum; }
+        point3 max() const { return maximum; }
+
+        point3 centroid() const { return 0.5 * (minimum + maximum); }
+        vec3 extent() const { return maximum - minimum; }
+
+        bool empty() const { return minimum.x() > maximum.x(); }
+
+        // real surface_area() const
+        // - used by the SAH: the chance that a random ray hits a box is
+        //   proportional to its surface area
+        real surface_area() const {
+            if (empty()) return 0;
+            auto d = extent();
+            return 2 * ((d.x() * d.y()) + (d.y() * d.z()) + (d.z() * d.x()));
+        }
+
+        int longest_axis() const {
+            auto d = extent();
+            if (d.x() > d.y() && d.x() > d.z()) return 0;
+            return (d.y() > d.z()) ? 1 : 2;
+        }
+
+        // void grow(const point3& p), void grow(const aabb& box)
+        // - plain comparisons rather than fmin/fmax, which are library calls
+        //   unless NaNs are ruled out, and the BVH builders grow boxes hundreds
+        //   of millions of times; a NaN coordinate is ignored either way
+        void grow(const point3& p) {
+            for (int a = 0 ; a < 3 ; a++) {
+                if (p[a] < minimum[a]) minimum[a] = p[a];
+                if (p[a] > maximum[a]) maximum[a] = p[a];
+            }
+        }
+
+        void grow(const aabb& box) {
+            for (int a = 0 ; a < 3 ; a++) {
+                if (box.minimum[a] < minimum[a]) minimum[a] = box.minimum[a];
+                if (box.maximum[a] > maximum[a]) maximum[a] = box.maximum[a];
+            }
+        }
+
+        // bool hit(const point3& orig, const vec3& inv_dir, real t_min, real t_max) const
+        // - slab test; inv_dir is 1 / ray direction, computed once per ray by the caller
+        bool hit(const point3& orig, const vec3& inv_dir, real t_min, real t_max) const {
+            for (int a = 0 ; a < 3 ; a++) {
+                auto t0 = (minimum[a] - orig[a]) * inv_dir[a];
+                auto t1 = (maximum[a] - orig[a]) * inv_dir[a];
+                if (inv_dir[a] < 0.0)
+                    swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max < t_min)
+                    return false;
+            }
+            return true;
+        }
+
+        bool hit(const ray& r, real t_min, real t_max) const {
+            auto d = r.direction();
+            return hit(r.origin(), vec3(1 / d.x(), 1 / d.y(), 1 / d.z()), t_min, t_max);
+        }
+
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    aabb box = box0;
+    box.grow(box1);
+    return box;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "rtweekend.h"
+
+#include "integrator.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// struct adaptive_settings
+// - min_samples every pixel gets before its variance is trusted, max_samples no
+//   pixel goes past, batch samples added to a noisy pixel per round
+// - threshold is the standard error of the pixel's gamma-corrected luminance
+//   (display units, 1/255 is one 8-bit step) below which it counts as converged
+// - sample_budget caps the total samples, time_budget (seconds, 0 = none) the
+//   wall time after the first round
+struct adaptive_settings {
+    int min_samples = 8;
+    int max_samples = 400;
+    int batch = 8;
+    double threshold = 0.01;
+    uint64_t sample_budget = 0;
+    double time_budget = 0;
+};
+
+// class adaptive_renderer
+// - renders in rounds: first min_samples for every pixel, then batches of
+//   samples for the pixels whose running variance (Welford, on luminance) says
+//   they are still noisy, until every pixel converged or the budget is spent
+// - when the budget cannot cover every noisy pixel the noisiest go first
+// - a pixel's error is the maximum over its 3x3 neighbourhood, so a pixel that
+//   looks converged next to a noisy one keeps sampling; this catches edges and
+//   caustics that a handful of samples can miss
+// - sample s of a pixel is seeded exactly as in the uniform renderer, so a pixel
+//   that ends with n samples holds the sum of its first n uniform samples
+class adaptive_renderer {
+
+    public:
+        // MEMBERS
+        int rounds = 0;
+        uint64_t samples_spent = 0;
+        int converged = 0;
+
+    public:
+        // CONSTRUCTORS
+        adaptive_renderer(const tile_renderer& r, framebuffer& target, const adaptive_settings& s)
+            : renderer(r), fb(target), settings(s), variance(target.pixels.size()),
+              assigned(target.pixels.size(), 0) {
+            fb.sample_counts.assign(fb.pixels.size(), 0);
+        }
+
+        // void render(const function<color(int, int, int)>& trace_sample)
+        // - trace_sample(i, j, s) returns sample s of pixel (i, j)
+        void render(const function<color(int, int, int)>& trace_sample) {
+            const size_t pixel_count = fb.pixels.size();
+            uint64_t budget = settings.sample_budget;
+
+            // first round: the same min_samples everywhere, less if the budget is
+            // tiny; with one sample a pixel's variance is unknown, so it counts
+            // as noisy, but the budget is spent and the rounds stop there
+            int first = settings.min_samples;
+            if (budget && uint64_t(first) * pixel_count > budget)
+                first = max(1, static_cast<int>(budget / pixel_count));
+            fill(assigned.begin(), assigned.end(), first);
+            run_round(trace_sample);
+
+            auto start = chrono::steady_clock::now();
+            vector<float> error(pixel_count), dilated(pixel_count);
+            vector<int> noisy;
+            while (true) {
+                // the errors come first so converged counts the last round too,
+                // however the rounds stop
+                for (size_t k = 0 ; k < pixel_count ; ++k)
+                    error[k] = static_cast<float>(pixel_error(k));
+                dilate(error, dilated);
+
+                noisy.clear();
+                converged = 0;
+                for (size_t k = 0 ; k < pixel_count ; ++k) {
+                    if (dilated[k] <= settings.threshold) converged++;
+                    else if (fb.sample_counts[k] < settings.max_samples) noisy.push_back(static_cast<int>(k));
+                }
+                if (noisy.empty())
+                    break;
+                if (settings.time_budget > 0 &&
+                    chrono::duration<double>(chrono::steady_clock::now() - start).count() >= settings.time_budget)
+                    break;
+                if (budget && samples_spent >= budget)
+                    break;
+
+                // spend what is left of the budget on the noisiest pixels first,
+                // the last of them taking only the samples still left
+                uint64_t left = budget ? budget - samples_spent : numeric_limits<uint64_t>::max();
+                if (budget) {
+                    uint64_t affordable = (left + settings.batch - 1) / settings.batch;
+                    if (noisy.size() > affordable) {
+                        nth_element(noisy.begin(), noisy.begin() + affordable, noisy.end(),
+                                    [&](int a, int b) { return dilated[a] > dilated[b]; });
+                        noisy.resize(affordable);
+                    }
+                }
+
+                fill(assigned.begin(), assigned.end(), 0);
+                for (int k : noisy) {
+                    int wanted = min(settings.batch, settings.max_samples - fb.sample_counts[k]);
+                    assigned[k] = static_cast<int>(min<uint64_t>(wanted, left));
+                    left -= assigned[k];
+                }
+                run_round(trace_sample);
+            }
+        }
+
+        // void heatmap(vector<uint8_t>& rgb) const
+        // - the samples spent per pixel as an 8-bit image (rows top to bottom),
+        //   black through red and yellow to white at the largest count
+        void heatmap(vector<uint8_t>& rgb) const {
+            int most = max(1, *max_element(fb.sample_counts.begin(), fb.sample_counts.end()));
+            rgb.resize(fb.pixels.size() * 3);
+            for (int y = 0 ; y < fb.height ; ++y) {
+                for (int x = 0 ; x < fb.width ; ++x) {
+                    double t = double(fb.sample_counts[static_cast<size_t>(fb.height - 1 - y) * fb.width + x]) / most;
+                    uint8_t* dst = &rgb[(static_cast<size_t>(y) * fb.width + x) * 3];
+                    dst[0] = static_cast<uint8_t>(255 * clamp(3 * t, 0.0, 1.0));
+                    dst[1] = static_cast<uint8_t>(255 * clamp((3 * t) - 1, 0.0, 1.0));
+                    dst[2] = static_cast<uint8_t>(255 * clamp((3 * t) - 2, 0.0, 1.0));
+                }
+            }
+        }
+
+    private:
+        // running mean and sum of squared deviations of a pixel's luminance
+        struct welford {
+            double mean = 0;
+            double m2 = 0;
+        };
+
+        const tile_renderer& renderer;
+        framebuffer& fb;
+        adaptive_settings settings;
+        vector<welford> variance;
+        vector<int> assigned;       // samples each pixel takes in the current round
+
+        // void run_round(const function<color(int, int, int)>& trace_sample)
+        // - takes the assigned samples of every pixel on the worker pool
+        void run_round(const function<color(int, int, int)>& trace_sample) {
+            renderer.render_tiles(fb.width, fb.height, [&](const tile& t) {
+                for (int j = t.y0 ; j < t.y1 ; ++j) {
+                    for (int i = t.x0 ; i < t.x1 ; ++i) {
+                        size_t k = static_cast<size_t>(j) * fb.width + i;
+                        int& n = fb.sample_counts[k];
+                        welford& w = variance[k];
+                        for (int end = n + assigned[k] ; n < end ; ) {
+                            color c = trace_sample(i, j, n);
+                            fb.pixels[k] += c;
+
+                            double lum = (0.2126 * c.x()) + (0.7152 * c.y()) + (0.0722 * c.z());
+                            ++n;
+                            double delta = lum - w.mean;
+                            w.mean += delta / n;
+                            w.m2 += delta * (lum - w.mean);
+                        }
+                    }
+                }
+                flush_render_stats();
+            });
+
+            for (int a : assigned)
+                samples_spent += a;
+            rounds++;
+        }
+
+        // double pixel_error(size_t k) const
+        // - standard error of the pixel's mean luminance, carried through the
+        //   gamma 2 curve of the output (d sqrt(L) = dL / (2 sqrt(L)))
+        double pixel_error(size_t k) const {
+            int n = fb.sample_counts[k];
+            if (n < 2) return infinity;
+            double standard_error = sqrt(variance[k].m2 / (double(n - 1) * n));
+            return standard_error / (2 * sqrt(fmax(variance[k].mean, 1e-4)));
+        }
+
+        void dilate(const vector<float>& in, vector<float>& out) const {
+            for (int y = 0 ; y < fb.height ; ++y) {
+                for (int x = 0 ; x < fb.width ; ++x) {
+                    float m = 0;
+                    for (int dy = max(0, y - 1) ; dy <= min(fb.height - 1, y + 1) ; ++dy)
+                        for (int dx = max(0, x - 1) ; dx <= min(fb.width - 1, x + 1) ; ++dx)
+                            m = max(m, in[static_cast<size_t>(dy) * fb.width + dx]);
+                    out[static_cast<size_t>(y) * fb.width + x] = m;
+                }
+            }
+        }
+
+};
+
+#endif
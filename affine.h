@@ -0,0 +1,157 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <limits>
+
+using namespace std;
+
+// class affine
+// - an affine map from an object's own space to the world: a 3x3 linear part
+//   and a translation, with its inverse kept alongside so rays can be taken
+//   the other way without inverting per ray
+// - stored as float whatever the build's precision, like mesh vertices: that
+//   is all the precision a placement needs and keeps the million-instance
+//   tables small; the arithmetic is done in real
+// - a point p maps to m * (p, 1), a direction d to m * (d, 0) and a normal n
+//   to transpose(inv) * n, which keeps it perpendicular to the surface under
+//   any scale or shear
+class affine {
+
+    public:
+        // MEMBERS
+        float m[3][4];          // object to world; column 3 is the translation
+        float inv[3][4];        // world to object
+
+    public:
+        // CONSTRUCTORS
+        // - the identity
+        affine() {
+            for (int r = 0 ; r < 3 ; r++)
+                for (int c = 0 ; c < 4 ; c++) m[r][c] = inv[r][c] = r == c ? 1.0f : 0.0f;
+        }
+
+        // affine(const double a[3][4])
+        // - the map a, whose linear part must be invertible
+        explicit affine(const double a[3][4]) {
+            double b[3][4];
+            invert(a, b);
+            for (int r = 0 ; r < 3 ; r++) {
+                for (int c = 0 ; c < 4 ; c++) {
+                    m[r][c] = static_cast<float>(a[r][c]);
+                    inv[r][c] = static_cast<float>(b[r][c]);
+                }
+            }
+        }
+
+        static affine translate(const vec3& offset) {
+            double a[3][4] = { { 1, 0, 0, offset.x() }, { 0, 1, 0, offset.y() }, { 0, 0, 1, offset.z() } };
+            return affine(a);
+        }
+
+        static affine scale(const vec3& factors) {
+            double a[3][4] = { { factors.x(), 0, 0, 0 }, { 0, factors.y(), 0, 0 }, { 0, 0, factors.z(), 0 } };
+            return affine(a);
+        }
+
+        static affine scale(double factor) { return scale(vec3(factor, factor, factor)); }
+
+        // static affine rotate(const vec3& axis, double degrees)
+        // - counterclockwise about axis, looking down it towards the origin
+        static affine rotate(const vec3& axis, double degrees) {
+            vec3 k = unit_vector(axis);
+            double s = sin(degrees_to_radians(degrees));
+            double c = cos(degrees_to_radians(degrees));
+            double x = k.x(), y = k.y(), z = k.z();
+            double a[3][4] = {
+                { c + (x * x * (1 - c)), (x * y * (1 - c)) - (z * s), (x * z * (1 - c)) + (y * s), 0 },
+                { (y * x * (1 - c)) + (z * s), c + (y * y * (1 - c)), (y * z * (1 - c)) - (x * s), 0 },
+                { (z * x * (1 - c)) - (y * s), (z * y * (1 - c)) + (x * s), c + (z * z * (1 - c)), 0 },
+            };
+            return affine(a);
+        }
+
+        // affine operator*(const affine& inner) const
+        // - inner first, then this one
+        affine operator*(const affine& inner) const {
+            double a[3][4];
+            for (int r = 0 ; r < 3 ; r++) {
+                for (int c = 0 ; c < 4 ; c++) {
+                    double sum = c == 3 ? double(m[r][3]) : 0.0;
+                    for (int k = 0 ; k < 3 ; k++) sum += double(m[r][k]) * inner.m[k][c];
+                    a[r][c] = sum;
+                }
+            }
+            return affine(a);
+        }
+
+        point3 point(const point3& p) const { return apply(m, p, 1); }
+        vec3 vector(const vec3& d) const { return apply(m, d, 0); }
+        point3 inverse_point(const point3& p) const { return apply(inv, p, 1); }
+        vec3 inverse_vector(const vec3& d) const { return apply(inv, d, 0); }
+
+        // vec3 normal(const vec3& n) const
+        // - an object space normal in world space, not normalized
+        vec3 normal(const vec3& n) const {
+            return vec3((inv[0][0] * n.x()) + (inv[1][0] * n.y()) + (inv[2][0] * n.z()),
+                        (inv[0][1] * n.x()) + (inv[1][1] * n.y()) + (inv[2][1] * n.z()),
+                        (inv[0][2] * n.x()) + (inv[1][2] * n.y()) + (inv[2][2] * n.z()));
+        }
+
+        // real max_scale() const
+        // - a bound on how much the map stretches any distance (the largest
+        //   row sum of the linear part)
+        real max_scale() const {
+            real most = 0;
+            for (int r = 0 ; r < 3 ; r++)
+                most = fmax(most, static_cast<real>(fabs(m[r][0]) + fabs(m[r][1]) + fabs(m[r][2])));
+            return most;
+        }
+
+        // aabb box(const aabb& b) const
+        // - a box around the image of b: the eight corners mapped, grown by a
+        //   few ulps so rounding in the ray's trip the other way cannot step
+        //   outside it
+        aabb box(const aabb& b) const {
+            aabb out;
+            for (int k = 0 ; k < 8 ; k++) {
+                point3 corner((k & 1) ? b.maximum.x() : b.minimum.x(),
+                              (k & 2) ? b.maximum.y() : b.minimum.y(),
+                              (k & 4) ? b.maximum.z() : b.minimum.z());
+                out.grow(point(corner));
+            }
+            for (int a = 0 ; a < 3 ; a++) {
+                real pad = 4 * numeric_limits<float>::epsilon() * fmax(fabs(out.minimum[a]), fabs(out.maximum[a]));
+                out.minimum[a] -= pad;
+                out.maximum[a] += pad;
+            }
+            return out;
+        }
+
+    private:
+        static vec3 apply(const float a[3][4], const vec3& v, real w) {
+            return vec3((a[0][0] * v.x()) + (a[0][1] * v.y()) + (a[0][2] * v.z()) + (a[0][3] * w),
+                        (a[1][0] * v.x()) + (a[1][1] * v.y()) + (a[1][2] * v.z()) + (a[1][3] * w),
+                        (a[2][0] * v.x()) + (a[2][1] * v.y()) + (a[2][2] * v.z()) + (a[2][3] * w));
+        }
+
+        // the inverse of an affine map, by the adjugate of its linear part
+        static void invert(const double a[3][4], double b[3][4]) {
+            double c[3][3] = {
+                { (a[1][1] * a[2][2]) - (a[1][2] * a[2][1]), (a[0][2] * a[2][1]) - (a[0][1] * a[2][2]), (a[0][1] * a[1][2]) - (a[0][2] * a[1][1]) },
+                { (a[1][2] * a[2][0]) - (a[1][0] * a[2][2]), (a[0][0] * a[2][2]) - (a[0][2] * a[2][0]), (a[0][2] * a[1][0]) - (a[0][0] * a[1][2]) },
+                { (a[1][0] * a[2][1]) - (a[1][1] * a[2][0]), (a[0][1] * a[2][0]) - (a[0][0] * a[2][1]), (a[0][0] * a[1][1]) - (a[0][1] * a[1][0]) },
+            };
+            double det = (a[0][0] * c[0][0]) + (a[0][1] * c[1][0]) + (a[0][2] * c[2][0]);
+            for (int r = 0 ; r < 3 ; r++) {
+                for (int k = 0 ; k < 3 ; k++) b[r][k] = c[r][k] / det;
+                b[r][3] = -((b[r][0] * a[0][3]) + (b[r][1] * a[1][3]) + (b[r][2] * a[2][3]));
+            }
+        }
+
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// class arena
+// - bump allocator: memory is handed out from large blocks in order and only
+//   given back all at once, by reset() or when the arena goes away
+// - create<T>() constructs an object in the arena; objects whose destructor is
+//   not trivial are destroyed, last first, on reset() and destruction
+// - reset() keeps the blocks, so an arena that is reset and refilled with about
+//   the same amount (a tile's scratch data) stops allocating after the first use
+// - not thread safe: one arena per builder or per thread
+class arena {
+
+    public:
+        // CONSTRUCTORS
+        explicit arena(size_t block_size = 1 << 20) : block_bytes(block_size) {}
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        ~arena() {
+            reset();
+            for (block& b : blocks)
+                ::operator delete(b.data);
+        }
+
+        // void* allocate(size_t bytes, size_t align)
+        // - bytes of uninitialized memory aligned to align (a power of two)
+        void* allocate(size_t bytes, size_t align) {
+            while (current < blocks.size()) {
+                block& b = blocks[current];
+                uintptr_t base = reinterpret_cast<uintptr_t>(b.data);
+                size_t start = ((base + b.used + align - 1) & ~(uintptr_t(align) - 1)) - base;
+                if (start + bytes <= b.size) {
+                    b.used = start + bytes;
+                    used += bytes;
+                    return b.data + start;
+                }
+                ++current;
+            }
+            // allocations larger than a block get a block of their own
+            size_t size = max(block_bytes, bytes + align);
+            blocks.push_back({ static_cast<char*>(::operator new(size)), size, 0 });
+            reserved += size;
+            return allocate(bytes, align);
+        }
+
+        // template <typename T, typename... Args> T* create(Args&&... args)
+        // - a T built from args in the arena's memory
+        template <typename T, typename... Args>
+        T* create(Args&&... args) {
+            T* object = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+            if (!is_trivially_destructible<T>::value)
+                destructors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+            return object;
+        }
+
+        // void reset()
+        // - destroys the objects and makes all the memory available again
+        void reset() {
+            for (auto it = destructors.rbegin() ; it != destructors.rend() ; ++it)
+                it->destroy(it->object);
+            destructors.clear();
+            for (block& b : blocks)
+                b.used = 0;
+            current = 0;
+            used = 0;
+        }
+
+        size_t bytes_used() const { return used; }
+        size_t bytes_reserved() const { return reserved; }
+        size_t block_count() const { return blocks.size(); }
+
+    private:
+        struct block {
+            char* data;
+            size_t size;
+            size_t used;
+        };
+
+        struct destructor {
+            void* object;
+            void (*destroy)(void*);
+        };
+
+        size_t block_bytes;
+        vector<block> blocks;
+        vector<destructor> destructors;
+        size_t current = 0;
+        size_t used = 0;
+        size_t reserved = 0;
+
+};
+
+// class arena_allocator<T>
+// - standard allocator over an arena, so containers of transient data can live
+//   in it; deallocate() does nothing, the memory comes back with arena::reset()
+template <typename T>
+class arena_allocator {
+
+    public:
+        typedef T value_type;
+
+        // MEMBERS
+        arena* source;
+
+    public:
+        // CONSTRUCTORS
+        explicit arena_allocator(arena& a) : source(&a) {}
+        template <typename U>
+        arena_allocator(const arena_allocator<U>& other) : source(other.source) {}
+
+        T* allocate(size_t n) { return static_cast<T*>(source->allocate(n * sizeof(T), alignof(T))); }
+        void deallocate(T*, size_t) {}
+
+        template <typename U>
+        bool operator==(const arena_allocator<U>& other) const { return source == other.source; }
+        template <typename U>
+        bool operator!=(const arena_allocator<U>& other) const { return source != other.source; }
+
+};
+
+template <typename T>
+using arena_vector = vector<T, arena_allocator<T>>;
+
+// arena& thread_scratch()
+// - the calling thread's arena for data that lives no longer than one tile;
+//   whoever starts a tile resets it
+inline arena& thread_scratch() {
+    thread_local arena scratch(256 << 10);
+    return scratch;
+}
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "image_io.h"
+#include "integrator.h"
+#include "light.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "random_scene.h"
+#include "renderer.h"
+#include "sampler.h"
+#include "scene.h"
+#include "tracer.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+// BATCH RENDERING
+// - raytracer --batch JOBS renders every job of a job file in one process: a
+//   scene is loaded and its hierarchy built the first time a job needs it and
+//   kept in a cache keyed by the hash of its content, so a hundred jobs over
+//   one scene with different cameras, sizes and sample counts build it once
+// - jobs run highest priority first (in file order among equals), one at a
+//   time, each spread over every core by the tile renderer's work stealing
+// - every job and the whole batch report their throughput on stderr; a job
+//   that fails (a scene that does not load, an image that cannot be written)
+//   is reported and the rest still run
+// - a job renders exactly what raytracer renders for the same scene and
+//   settings, one ray at a time through a bvh (scalar_tracer, tracer.h); a
+//   camera a job leaves degenerate fails that job
+//
+// job file, one job per line, '#' starts a comment:
+//   <scene> <output> [width N] [aspect X] [spp N] [depth N] [seed N] [priority N] [frame N]
+//                    [lookfrom x y z] [lookat x y z] [vup x y z] [vfov f] [aperture f] [focus f]
+// (<scene> is a scene file, or random or random:<grid> for random_scene();
+// the output's extension picks its format; what a job leaves out comes from the
+// command line, and the camera from the scene, at the frame's time if it is
+// animated)
+
+// struct batch_job
+struct batch_job {
+    int line = 0;
+    string scene;
+    string output;
+    int width = 0;
+    double aspect_ratio = 0;
+    int samples_per_pixel = 0;
+    int max_depth = 0;
+    uint64_t seed = 0;
+    int priority = 0;
+    int frame = 0;
+    scene_camera cam;
+    unsigned camera_fields = 0;     // which of cam's fields the job sets, camera_field bits
+
+    enum camera_field : unsigned { lookfrom = 1, lookat = 2, vup = 4, vfov = 8, aperture = 16, focus = 32 };
+};
+
+// struct batch_settings
+// - what the jobs share, from the command line
+struct batch_settings {
+    batch_job defaults;             // the settings a job leaves out
+    int rr_depth = 3;
+    bool nee = true;
+    sample_pattern sampler = sample_pattern::random;
+    int tile_size = 32;
+    int threads = 0;
+    size_t cache_scenes = 4;
+    int scene_grid = 11;            // random_scene()'s parameters
+    bool motion = false;
+    bool instanced = false;
+    double fps = 24;
+    double shutter = 0.5;
+    size_t texture_cache_bytes = size_t(64) << 20;     // per scene, see texture.h
+};
+
+// bool parse_job_file(const string& path, const batch_job& defaults, vector<batch_job>& jobs, string& error)
+// - the jobs of path, with defaults' settings where a job has none
+inline bool parse_job_file(const string& path, const batch_job& defaults, vector<batch_job>& jobs, string& error) {
+    ifstream in(path);
+    if (!in) {
+        error = "cannot read " + path;
+        return false;
+    }
+    string text;
+    for (int line = 1 ; getline(in, text) ; ++line) {
+        size_t comment = text.find('#');
+        if (comment != string::npos) text.erase(comment);
+        istringstream words(text);
+        batch_job job = defaults;
+        if (!(words >> job.scene)) continue;
+        auto fail = [&](const string& why) {
+            error = path + ":" + to_string(line) + ": " + why;
+            return false;
+        };
+        if (!(words >> job.output)) return fail("a job needs a scene and an output file");
+        job.line = line;
+
+        auto read_vec = [&](vec3& v) {
+            double x, y, z;
+            if (!(words >> x >> y >> z)) return false;
+            v = vec3(x, y, z);
+            return true;
+        };
+        string key;
+        while (words >> key) {
+            bool ok;
+            if (key == "width") ok = bool(words >> job.width) && job.width > 0;
+            else if (key == "aspect") ok = bool(words >> job.aspect_ratio) && job.aspect_ratio > 0;
+            else if (key == "spp") ok = bool(words >> job.samples_per_pixel) && job.samples_per_pixel > 0;
+            else if (key == "depth") ok = bool(words >> job.max_depth) && job.max_depth > 0;
+            else if (key == "seed") ok = bool(words >> job.seed);
+            else if (key == "priority") ok = bool(words >> job.priority);
+            else if (key == "frame") ok = bool(words >> job.frame) && job.frame >= 0;
+            else if (key == "lookfrom") { ok = read_vec(job.cam.lookfrom); job.camera_fields |= batch_job::lookfrom; }
+            else if (key == "lookat") { ok = read_vec(job.cam.lookat); job.camera_fields |= batch_job::lookat; }
+            else if (key == "vup") { ok = read_vec(job.cam.vup); job.camera_fields |= batch_job::vup; }
+            else if (key == "vfov") { ok = bool(words >> job.cam.vfov); job.camera_fields |= batch_job::vfov; }
+            else if (key == "aperture") { ok = bool(words >> job.cam.aperture); job.camera_fields |= batch_job::aperture; }
+            else if (key == "focus") { ok = bool(words >> job.cam.focus_dist); job.camera_fields |= batch_job::focus; }
+            else return fail("unknown setting '" + key + "'");
+            if (!ok) return fail("bad value for " + key);
+        }
+        if (static_cast<int>(job.width / job.aspect_ratio) <= 0) return fail("the image has no rows");
+        // what the job's camera fields alone show is wrong; the whole camera is
+        // checked once it is combined with the scene's
+        const scene_camera& c = job.cam;
+        if (((job.camera_fields & batch_job::vfov) && !(c.vfov > 0 && c.vfov < 180)) ||
+            ((job.camera_fields & batch_job::aperture) && !(c.aperture >= 0)) ||
+            ((job.camera_fields & batch_job::focus) && !(c.focus_dist > 0)) ||
+            ((job.camera_fields & batch_job::lookfrom) && (job.camera_fields & batch_job::lookat) &&
+             (c.lookfrom - c.lookat).near_zero()))
+            return fail("the camera needs 0 < vfov < 180, aperture >= 0, focus > 0 and lookfrom away from lookat");
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// struct cached_scene
+// - a scene ready to render: its description, materials, lights and bvh
+struct cached_scene {
+    uint64_t key;
+    string name;                // the scene of the job that loaded it
+    scene_desc desc;
+    material_table materials;
+    light_list lights;
+    shared_ptr<bvh> tree;
+    double load_ms = 0;         // reading the file or generating the scene
+    double build_ms = 0;        // materials, objects, bvh and lights
+    uint64_t last_used = 0;
+};
+
+// class scene_cache
+// - at most capacity scenes, the least recently used dropped first
+// - the key of a scene file is the hash of its bytes and of the directory it is
+//   in (the paths of its meshes are relative to that), remembered per path,
+//   size and modification time so an unchanged file is read once; the key of
+//   random_scene() is the hash of its parameters
+class scene_cache {
+
+    public:
+        // MEMBERS
+        size_t capacity;
+        size_t hits = 0;
+        size_t misses = 0;
+        double load_ms = 0;
+        double build_ms = 0;
+
+    public:
+        // CONSTRUCTORS
+        explicit scene_cache(size_t max_scenes) : capacity(max(max_scenes, size_t(1))) {}
+
+        // const cached_scene* get(const string& scene, const batch_settings& settings, bool& hit, string& error)
+        // - the scene named scene, from the cache or loaded into it; null with the
+        //   reason in error if it cannot be loaded
+        const cached_scene* get(const string& scene, const batch_settings& settings, bool& hit, string& error) {
+            uint64_t key;
+            int grid = settings.scene_grid;
+            bool random = scene == "random" || scene.compare(0, 7, "random:") == 0;
+            if (random) {
+                if (scene.size() > 7) grid = atoi(scene.c_str() + 7);
+                if (grid <= 0) {
+                    error = "bad grid in " + scene;
+                    return nullptr;
+                }
+                int params[3] = { grid, settings.motion, settings.instanced };
+                key = fnv1a(params, sizeof(params), fnv1a("random_scene", 12));
+            } else if (!file_key(scene, key)) {
+                error = "cannot read " + scene;
+                return nullptr;
+            }
+
+            for (auto& entry : entries) {
+                if (entry->key != key) continue;
+                entry->last_used = ++clock;
+                hits++;
+                hit = true;
+                return entry.get();
+            }
+
+            hit = false;
+            misses++;
+            auto entry = make_unique<cached_scene>();
+            entry->key = key;
+            entry->name = scene;
+            auto start = chrono::steady_clock::now();
+            if (random) {
+                // random_scene() draws from the thread's generator: started afresh,
+                // as in a new process, the scene is the same every time
+                thread_rng() = pcg32();
+                entry->desc = random_scene(grid, settings.motion, settings.instanced);
+            } else if (!load_scene(scene, entry->desc, error)) {
+                return nullptr;
+            }
+            auto loaded = chrono::steady_clock::now();
+            if (!entry->desc.textures.empty())
+                entry->materials.textures = make_shared<texture_cache>(settings.texture_cache_bytes);
+            hittable_list objects = entry->desc.build(entry->materials);
+            entry->desc.build_lights(entry->lights);
+            entry->tree = make_shared<bvh>(objects);
+            entry->load_ms = chrono::duration<double, milli>(loaded - start).count();
+            entry->build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - loaded).count();
+            load_ms += entry->load_ms;
+            build_ms += entry->build_ms;
+            entry->last_used = ++clock;
+
+            if (entries.size() >= capacity) {
+                size_t oldest = 0;
+                for (size_t k = 1 ; k < entries.size() ; ++k)
+                    if (entries[k]->last_used < entries[oldest]->last_used) oldest = k;
+                entries.erase(entries.begin() + oldest);
+            }
+            entries.push_back(move(entry));
+            return entries.back().get();
+        }
+
+    private:
+        struct file_stamp {
+            string path;
+            off_t size;
+            time_t mtime;
+            uint64_t key;
+        };
+
+        vector<unique_ptr<cached_scene>> entries;
+        vector<file_stamp> stamps;
+        uint64_t clock = 0;
+
+        bool file_key(const string& path, uint64_t& key) {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) return false;
+            for (const file_stamp& s : stamps) {
+                if (s.path == path && s.size == st.st_size && s.mtime == st.st_mtime) {
+                    key = s.key;
+                    return true;
+                }
+            }
+            mapped_file file(path);
+            if (!file.ok()) return false;
+            size_t slash = path.find_last_of('/');
+            string dir = slash == string::npos ? "." : path.substr(0, slash);
+            char resolved[PATH_MAX];
+            if (realpath(dir.c_str(), resolved)) dir = resolved;
+            key = fnv1a(file.data, file.size, fnv1a(dir.data(), dir.size()));
+            stamps.push_back({ path, st.st_size, st.st_mtime, key });
+            return true;
+        }
+
+};
+
+// struct batch_stats
+struct batch_stats {
+    int jobs = 0;
+    int failed = 0;
+    double seconds = 0;
+    double render_seconds = 0;
+    uint64_t rays = 0;
+    uint64_t samples = 0;       // camera samples, width * height * spp summed over the jobs
+};
+
+inline ostream& operator<<(ostream& out, const batch_stats& s) {
+    return out << "Batch: " << s.jobs << " jobs (" << s.failed << " failed) in " << s.seconds << " s, "
+               << (s.samples / s.seconds) * 1e-6 << " Msamples/s, " << (s.rays / s.seconds) * 1e-6 << " Mrays/s; "
+               << 100.0 * s.render_seconds / s.seconds << "% of the time rendering";
+}
+
+// class batch_runner
+class batch_runner {
+
+    public:
+        // MEMBERS
+        batch_stats stats;
+        scene_cache cache;
+        ostream* log = &cerr;       // the job and batch reports, null for none
+
+    public:
+        // CONSTRUCTORS
+        batch_runner(const batch_settings& s) : cache(s.cache_scenes), settings(s), renderer(s.tile_size, s.threads) {
+            renderer.show_progress = false;
+        }
+
+        // bool run(const vector<batch_job>& jobs)
+        // - renders the jobs; false if any of them failed
+        bool run(const vector<batch_job>& jobs) {
+            auto order = [&](size_t a, size_t b) {
+                if (jobs[a].priority != jobs[b].priority) return jobs[a].priority < jobs[b].priority;
+                return a > b;
+            };
+            priority_queue<size_t, vector<size_t>, decltype(order)> queue(order);
+            for (size_t k = 0 ; k < jobs.size() ; ++k)
+                queue.push(k);
+
+            auto start = chrono::steady_clock::now();
+            while (!queue.empty()) {
+                const batch_job& job = jobs[queue.top()];
+                queue.pop();
+                stats.jobs++;
+                if (log) *log << "job " << stats.jobs << '/' << jobs.size() << " (line " << job.line << ", priority "
+                              << job.priority << "): ";
+                if (!render(job)) stats.failed++;
+            }
+            stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            if (log) *log << stats << '\n'
+                          << "scenes: " << cache.misses << " loaded (" << cache.load_ms << " ms reading, " << cache.build_ms
+                          << " ms building), " << cache.hits << " jobs from the cache\n"
+                          << total_path_stats() << '\n';
+            return stats.failed == 0;
+        }
+
+    private:
+        batch_settings settings;
+        tile_renderer renderer;
+
+        bool render(const batch_job& job) {
+            bool hit;
+            string error;
+            const cached_scene* scene = cache.get(job.scene, settings, hit, error);
+            if (!scene) {
+                if (log) *log << error << '\n';
+                return false;
+            }
+
+            // the camera of the scene at the frame's time, with the job's changes
+            const double time0 = job.frame / settings.fps;
+            const double time1 = time0 + (scene->desc.motions.empty() ? 0 : settings.shutter / settings.fps);
+            scene_camera c = scene->desc.camera_at(time0);
+            if (job.camera_fields & batch_job::lookfrom) c.lookfrom = job.cam.lookfrom;
+            if (job.camera_fields & batch_job::lookat) c.lookat = job.cam.lookat;
+            if (job.camera_fields & batch_job::vup) c.vup = job.cam.vup;
+            if (job.camera_fields & batch_job::vfov) c.vfov = job.cam.vfov;
+            if (job.camera_fields & batch_job::aperture) c.aperture = job.cam.aperture;
+            if (job.camera_fields & batch_job::focus) c.focus_dist = job.cam.focus_dist;
+            if (!check_camera(c, error)) {
+                if (log) *log << "line " << job.line << ": " << error << '\n';
+                return false;
+            }
+            camera cam(c.lookfrom, c.lookat, c.vup, c.vfov, job.aspect_ratio, c.aperture, c.focus_dist, time0, time1);
+            scene->tree->update(time0, time1);
+            const light_list* lights = settings.nee && !scene->lights.empty() ? &scene->lights : nullptr;
+
+            const int width = job.width;
+            const int height = static_cast<int>(width / job.aspect_ratio);
+            const int spp = job.samples_per_pixel;
+            framebuffer fb(width, height);
+            uint64_t rays_before = total_ray_count();
+            auto start = chrono::steady_clock::now();
+            scalar_tracer tracer(*scene->tree, scene->materials, cam, width, height, job.max_depth, settings.rr_depth,
+                                 settings.sampler, job.seed, lights);
+            renderer.render_tiles(width, height, [&](const tile& t) { tracer.render_tile(t, fb, 0, spp); });
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            uint64_t rays = total_ray_count() - rays_before;
+            uint64_t samples = uint64_t(width) * height * spp;
+            stats.render_seconds += seconds;
+            stats.rays += rays;
+            stats.samples += samples;
+
+            char line[256];
+            if (hit) snprintf(line, sizeof(line), "cached");
+            else snprintf(line, sizeof(line), "loaded in %.1f + %.1f ms", scene->load_ms, scene->build_ms);
+            if (log) *log << job.scene << ' ' << hex << scene->key << dec << " (" << line << "), ";
+            snprintf(line, sizeof(line), "%dx%d %d spp in %.3f s, %.2f Msamples/s, %.2f Mrays/s -> ", width, height, spp,
+                     seconds, (samples / seconds) * 1e-6, (rays / seconds) * 1e-6);
+            if (log) *log << line << job.output << '\n';
+
+            if (!write_image(fb, spp, format_from_path(job.output, image_format::ppm), job.output)) {
+                if (log) *log << "cannot write " << job.output << '\n';
+                return false;
+            }
+            return true;
+        }
+
+};
+
+#endif
@@ -0,0 +1,1304 @@
+// bench: microbenchmarks of the render core and fixed-seed end-to-end renders
+// - prints a table to stderr and, with --json FILE, writes the same numbers as
+//   JSON so two builds can be compared by a script
+// - every end-to-end render also reports a hash of its framebuffer: the same
+//   seed must give the same hash, so a speedup that changes the image shows up
+// - mesh.torus writes a generated OBJ, then times loading it, building its
+//   hierarchy and rendering it
+// - instance.forest places a million instances of a small mesh and a sphere
+//   and reports what they cost against what the same triangles would
+// - lights.cornell renders a closed room lit by one small lamp with and
+//   without direct light sampling and compares the noise of the two
+// - denoise.* renders at 8 spp, denoises and measures the error, together with
+//   that of plain 50 spp renders, against a high sample count reference
+// - preview.random_scene edits the camera and a material of a preview session
+//   and times how soon the image comes back
+// - batch.random_scenes runs small jobs over two scenes with and without
+//   room in the scene cache for both
+// - textures.paged renders a scene textured with one large image with a tile
+//   cache far smaller than its pyramid and with one that holds all of it
+// - sequence.refit times an animation that keeps its bvh and refits it per frame
+// - bench_float is the same program built with float precision; --save-images
+//   and --reference measure how far its renders are from the double ones
+
+#include "rtweekend.h"
+
+#include "batch.h"
+#include "bvh.h"
+#include "camera.h"
+#include "denoise.h"
+#include "hittable_list.h"
+#include "image_io.h"
+#include "instance.h"
+#include "integrator.h"
+#include "material.h"
+#include "memory_stats.h"
+#include "mesh.h"
+#include "obj_loader.h"
+#include "packet.h"
+#include "preview.h"
+#include "random_scene.h"
+#include "renderer.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphere_set.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// set by CMakeLists.txt
+#ifndef RAYTRACER_BUILD_TYPE
+#define RAYTRACER_BUILD_TYPE "unknown"
+#endif
+#ifndef RAYTRACER_NATIVE_BUILD
+#define RAYTRACER_NATIVE_BUILD 0
+#endif
+
+// keeps the compiler from optimizing a benchmarked result away
+template <typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct micro_result {
+    string name;
+    double ns_per_op;
+    uint64_t ops;
+};
+
+struct render_result {
+    string name;
+    int width, height, spp, threads;
+    uint64_t seed;
+    double seconds;
+    uint64_t rays;
+    vector<uint64_t> rays_per_bounce;     // [b] = rays traced at bounce b (0 = camera rays)
+    uint64_t image_hash;
+    double rmse = -1;           // against the --reference image, -1 without one
+    double max_error = -1;
+    uint64_t allocations;       // heap allocations during the render
+};
+
+struct sequence_result {
+    string name;
+    int frames, width, height, spp;
+    double seconds;
+    double refit_ms;            // per frame
+    double rebuild_ms;          // what building the bvh again would cost per frame
+    size_t refit_nodes;         // per frame
+    uint64_t image_hash;        // of the last frame
+};
+
+struct mesh_result {
+    string name;
+    size_t triangles;
+    size_t file_bytes;
+    int threads;
+    double load_ms;
+    double build_ms;
+    size_t memory_bytes;
+};
+
+struct instance_result {
+    string name;
+    size_t instances;
+    size_t prototypes;
+    size_t instanced_triangles;     // triangles the instances show
+    size_t geometry_bytes;          // the prototypes' buffers and hierarchies
+    size_t memory_bytes;            // the placements and the top level
+    size_t flattened_bytes;         // the instanced triangles as one mesh, estimated
+    double build_ms;
+};
+
+struct light_result {
+    string name;
+    int spp;
+    double nee_seconds, bsdf_seconds;
+    double nee_noise, bsdf_noise;   // rms of a pixel's error, from two seeds
+};
+
+struct denoise_result {
+    string name;
+    int width, height;
+    int low_spp, high_spp, reference_spp;
+    double low_seconds, high_seconds;
+    double denoise_ms;
+    double low_rmse, denoised_rmse, high_rmse;     // against the reference, as displayed (gamma 2, clamped)
+};
+
+struct preview_result {
+    string name;
+    int width, height, spp;
+    size_t tiles;
+    double camera_first_tile_ms, camera_first_pass_ms, camera_seconds;     // after a camera edit
+    size_t material_tiles;          // restarted by editing a small sphere's material
+    double material_first_tile_ms, material_seconds;
+    bool matches_full_render;       // the edited image converged to the one a fresh render gives
+};
+
+struct batch_result {
+    string name;
+    int jobs;
+    double cached_seconds, uncached_seconds;
+    size_t cached_loads, uncached_loads;
+    double cached_build_ms, uncached_build_ms;     // loading and building the scenes
+    double samples_per_sec;                         // with the cache
+};
+
+struct texture_result {
+    string name;
+    int image_size;                 // texels per side
+    size_t pyramid_bytes;
+    size_t small_capacity, large_capacity;
+    double small_seconds, large_seconds;
+    double small_hit_rate, large_hit_rate;
+    size_t small_peak, large_peak;
+    uint64_t small_misses, large_misses;
+    bool same_image;
+};
+
+struct bench_options {
+    bool quick = false;
+    string json;
+    string filter;
+    int threads = 0;
+    string save_images;     // directory the renders are written to as PFM
+    string reference;       // directory of PFM renders to measure the error against
+};
+
+static bool selected(const bench_options& opts, const string& name) {
+    return opts.filter.empty() || name.find(opts.filter) != string::npos;
+}
+
+// micro_result time_micro(const string& name, double min_seconds, const function<void(uint64_t)>& body)
+// - body(n) runs n operations; n doubles until a run takes min_seconds / 5 and
+//   the best of five such runs is reported
+static micro_result time_micro(const string& name, double min_seconds, const function<void(uint64_t)>& body) {
+    uint64_t n = 1024;
+    for (;;) {
+        auto start = chrono::steady_clock::now();
+        body(n);
+        double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (t >= min_seconds / 5 || n >= (1ull << 34)) break;
+        n *= 2;
+    }
+
+    double best = infinity;
+    for (int rep = 0 ; rep < 5 ; ++rep) {
+        auto start = chrono::steady_clock::now();
+        body(n);
+        best = fmin(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    return { name, best * 1e9 / n, n };
+}
+
+static vec3 random_direction() {
+    return unit_vector(vec3::random(-1, 1));
+}
+
+static void run_micro(const bench_options& opts, vector<micro_result>& results) {
+    const double min_seconds = opts.quick ? 0.05 : 0.5;
+    const size_t count = 1024;      // inputs cycle through a small, cache-resident set
+    seed_random(1);
+
+    vector<vec3> a(count), b(count);
+    for (size_t k = 0 ; k < count ; ++k) {
+        a[k] = vec3::random(-1, 1);
+        b[k] = vec3::random(-1, 1);
+    }
+
+    auto add = [&](const string& name, const function<void(uint64_t)>& body) {
+        if (!selected(opts, name)) return;
+        results.push_back(time_micro(name, min_seconds, body));
+        const micro_result& r = results.back();
+        fprintf(stderr, "  %-32s %10.2f ns/op\n", r.name.c_str(), r.ns_per_op);
+    };
+
+    add("vec3.dot", [&](uint64_t n) {
+        double sum = 0;
+        for (uint64_t k = 0 ; k < n ; ++k) sum += dot(a[k & (count - 1)], b[k & (count - 1)]);
+        keep(sum);
+    });
+    add("vec3.cross", [&](uint64_t n) {
+        vec3 sum;
+        for (uint64_t k = 0 ; k < n ; ++k) sum += cross(a[k & (count - 1)], b[k & (count - 1)]);
+        keep(sum);
+    });
+    add("vec3.unit_vector", [&](uint64_t n) {
+        vec3 sum;
+        for (uint64_t k = 0 ; k < n ; ++k) sum += unit_vector(a[k & (count - 1)]);
+        keep(sum);
+    });
+
+    camera cam(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 1.5, 0.1, 10);
+    add("camera.get_ray", [&](uint64_t n) {
+        for (uint64_t k = 0 ; k < n ; ++k) {
+            ray r = cam.get_ray(a[k & (count - 1)].x() * 0.5 + 0.5, a[k & (count - 1)].y() * 0.5 + 0.5);
+            keep(r);
+        }
+    });
+
+    // half the rays aim at the sphere, half away from it
+    sphere ball(point3(0, 0, 0), 1.0, 0);
+    vector<ray> sphere_rays(count);
+    for (size_t k = 0 ; k < count ; ++k) {
+        point3 origin = 5 * random_direction();
+        vec3 toward = unit_vector(point3(0, 0, 0) + 0.8 * random_in_unit_sphere() - origin);
+        sphere_rays[k] = ray(origin, (k & 1) ? toward : -toward);
+    }
+    add("sphere.hit", [&](uint64_t n) {
+        hit_record rec;
+        int hits = 0;
+        for (uint64_t k = 0 ; k < n ; ++k) hits += ball.hit(sphere_rays[k & (count - 1)], 0.001, infinity, rec);
+        keep(hits);
+    });
+
+    // camera rays into random_scene()
+    scene_desc desc = random_scene(11);
+    material_table materials;
+    hittable_list list = desc.build(materials);
+    bvh tree(list);
+    vector<ray> scene_rays(count);
+    for (size_t k = 0 ; k < count ; ++k)
+        scene_rays[k] = cam.get_ray(random_double(), random_double());
+    add("hittable_list.hit", [&](uint64_t n) {
+        hit_record rec;
+        int hits = 0;
+        for (uint64_t k = 0 ; k < n ; ++k) hits += list.hit(scene_rays[k & (count - 1)], 0.001, infinity, rec);
+        keep(hits);
+    });
+    add("bvh.hit", [&](uint64_t n) {
+        hit_record rec;
+        int hits = 0;
+        for (uint64_t k = 0 ; k < n ; ++k) hits += tree.hit(scene_rays[k & (count - 1)], 0.001, infinity, rec);
+        keep(hits);
+    });
+
+    // a ray coming down onto the top of a sphere
+    hit_record rec;
+    ray incoming(point3(0.3, 3, 0.2), vec3(-0.1, -1, 0.05));
+    ball.hit(incoming, 0.001, infinity, rec);
+    // through material::scatter, the dispatch the integrator uses
+    material diffuse = lambertian(color(0.5, 0.5, 0.5));
+    material shiny = metal(color(0.7, 0.6, 0.5), 0.2);
+    material glass = dielectric(1.5);
+    auto scatter_bench = [&](const material& m) {
+        return [&](uint64_t n) {
+            ray scattered;
+            color attenuation;
+            int scatters = 0;
+            for (uint64_t k = 0 ; k < n ; ++k) scatters += m.scatter(incoming, rec, attenuation, scattered);
+            keep(scatters);
+            keep(scattered);
+        };
+    };
+    add("lambertian.scatter", scatter_bench(diffuse));
+    add("metal.scatter", scatter_bench(shiny));
+    add("dielectric.scatter", scatter_bench(glass));
+}
+
+// uint64_t hash_framebuffer(const framebuffer& fb)
+// - FNV-1a over the raw sums
+static uint64_t hash_framebuffer(const framebuffer& fb) {
+    uint64_t h = 1469598103934665603ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(fb.pixels.data());
+    for (size_t k = 0 ; k < fb.pixels.size() * sizeof(color) ; ++k)
+        h = (h ^ bytes[k]) * 1099511628211ull;
+    return h;
+}
+
+// bool image_error(const framebuffer& fb, int spp, const string& path, double& rmse, double& max_error)
+// - root mean square and largest difference of the linear pixel values of fb
+//   and the PFM at path, over all channels
+static bool image_error(const framebuffer& fb, int spp, const string& path, double& rmse, double& max_error) {
+    int width, height;
+    vector<float> reference;
+    if (!read_pfm(path, width, height, reference) || width != fb.width || height != fb.height)
+        return false;
+    double sum = 0;
+    max_error = 0;
+    for (size_t k = 0 ; k < fb.pixels.size() ; ++k) {
+        for (int c = 0 ; c < 3 ; ++c) {
+            double d = fabs(static_cast<float>(fb.pixels[k][c] * fb.sample_scale(k, spp)) - reference[(3 * k) + c]);
+            sum += d * d;
+            max_error = fmax(max_error, d);
+        }
+    }
+    rmse = sqrt(sum / reference.size());
+    return true;
+}
+
+static void run_renders(const bench_options& opts, vector<render_result>& results) {
+    const int width = opts.quick ? 200 : 400;
+    const int height = static_cast<int>(width / 1.5);
+    const int spp = opts.quick ? 4 : 16;
+    const int max_depth = 50;
+    const int rr_depth = 3;
+
+    thread_rng() = pcg32();     // the generator state raytracer builds random_scene() from
+    scene_desc desc = random_scene(11);
+    material_table materials;
+    hittable_list list = desc.build(materials);
+    auto tree = make_shared<bvh>(list);
+    hittable_list packed_world = list;
+    auto packed = make_shared<sphere_set>();
+    packed->extract_spheres(packed_world);
+    packed_world.add(packed);
+    camera cam = desc.make_camera(1.5);
+    tile_renderer renderer(32, opts.threads);
+
+    // the same scene with the small spheres as instances of one unit sphere
+    thread_rng() = pcg32();
+    scene_desc instanced_desc = random_scene(11, false, true);
+    material_table instanced_materials;
+    auto instanced_tree = make_shared<bvh>(instanced_desc.build(instanced_materials));
+
+    struct config {
+        string name;
+        const hittable* world;
+        const material_table* materials;
+        int packet;
+    };
+    const config configs[] = {
+        { "render.bvh", tree.get(), &materials, 0 },
+        { "render.bvh.packet8", tree.get(), &materials, 8 },
+        { "render.sphere_set", &packed_world, &materials, 0 },
+        { "render.bvh.instanced", instanced_tree.get(), &instanced_materials, 0 },
+    };
+
+    for (const config& c : configs) {
+        for (uint64_t seed : { 0ull, 1ull }) {
+            string name = c.name + ".seed" + to_string(seed);
+            if (!selected(opts, name)) continue;
+
+            total_ray_count() = 0;
+            total_path_stats() = path_stats();
+            framebuffer fb(width, height);
+            packet_tracer tracer(*c.world, *c.materials, cam, width, height, max_depth, rr_depth, c.packet,
+                                 sample_pattern::random, seed);
+
+            uint64_t allocations_before = allocation_count();
+            auto start = chrono::steady_clock::now();
+            renderer.render_tiles(width, height, [&](const tile& t) {
+                if (c.packet > 0) {
+                    tracer.render_tile(t, fb, 0, spp);
+                    return;
+                }
+                for (int j = t.y0 ; j < t.y1 ; ++j) {
+                    for (int i = t.x0 ; i < t.x1 ; ++i) {
+                        pixel_sampler sampler(sample_pattern::random, seed, static_cast<uint64_t>(j) * width + i);
+                        for (int s = 0 ; s < spp ; ++s) {
+                            sampler.start_sample(s);
+                            ray r = primary_ray(cam, sampler, i, j, width, height);
+                            fb.at(i, j) += ray_color(r, *c.world, *c.materials, max_depth, rr_depth);
+                        }
+                    }
+                }
+                flush_render_stats();
+            });
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            render_result r;
+            r.name = name;
+            r.width = width;
+            r.height = height;
+            r.spp = spp;
+            r.threads = renderer.thread_count;
+            r.seed = seed;
+            r.seconds = seconds;
+            r.rays = total_ray_count();
+            r.image_hash = hash_framebuffer(fb);
+            r.allocations = allocation_count() - allocations_before;
+
+            if (!opts.save_images.empty() && !write_image(fb, spp, image_format::pfm, opts.save_images + "/" + name + ".pfm"))
+                cerr << "cannot write " << opts.save_images << "/" << name << ".pfm\n";
+            if (!opts.reference.empty() &&
+                !image_error(fb, spp, opts.reference + "/" + name + ".pfm", r.rmse, r.max_error))
+                cerr << "no reference for " << name << " in " << opts.reference << '\n';
+
+            // a path that traced d rays contributed one ray to each of bounces 0 .. d-1
+            const vector<uint64_t>& depths = total_path_stats().depth_counts;
+            uint64_t alive = total_path_stats().paths();
+            for (size_t d = 1 ; d < depths.size() && alive > 0 ; ++d) {
+                r.rays_per_bounce.push_back(alive);
+                alive -= depths[d];
+            }
+            results.push_back(r);
+
+            fprintf(stderr, "\r  %-32s %8.3f s %8.2f Mrays/s %8.2f Msamples/s  hash %016llx\n", name.c_str(),
+                    seconds, r.rays / seconds * 1e-6, double(width) * height * spp / seconds * 1e-6,
+                    static_cast<unsigned long long>(r.image_hash));
+            if (r.rmse >= 0)
+                fprintf(stderr, "  %-32s rmse %.3g, max error %.3g\n", "", r.rmse, r.max_error);
+        }
+    }
+}
+
+// render_result render_still(const bench_options& opts, const string& name, const hittable& world, const material_table& materials, const camera& cam, ...)
+// - one render of world at the size and sample count of the renders above,
+//   one ray at a time, sampling lights if given; the image is left in out if
+//   given
+static render_result render_still(const bench_options& opts, const string& name, const hittable& world,
+                                  const material_table& materials, const camera& cam, uint64_t seed = 0,
+                                  const light_list* lights = nullptr, framebuffer* out = nullptr) {
+    const int width = opts.quick ? 200 : 400;
+    const int height = static_cast<int>(width / 1.5);
+    const int spp = opts.quick ? 4 : 16;
+    tile_renderer renderer(32, opts.threads);
+    framebuffer fb(width, height);
+
+    total_ray_count() = 0;
+    uint64_t allocations_before = allocation_count();
+    auto start = chrono::steady_clock::now();
+    renderer.render_tiles(width, height, [&](const tile& t) {
+        for (int j = t.y0 ; j < t.y1 ; ++j) {
+            for (int i = t.x0 ; i < t.x1 ; ++i) {
+                pixel_sampler sampler(sample_pattern::random, seed, static_cast<uint64_t>(j) * width + i);
+                for (int s = 0 ; s < spp ; ++s) {
+                    sampler.start_sample(s);
+                    ray r = primary_ray(cam, sampler, i, j, width, height);
+                    fb.at(i, j) += ray_color(r, world, materials, 50, 3, lights);
+                }
+            }
+        }
+        flush_render_stats();
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    render_result r;
+    r.name = name;
+    r.width = width;
+    r.height = height;
+    r.spp = spp;
+    r.threads = renderer.thread_count;
+    r.seed = seed;
+    r.seconds = seconds;
+    r.rays = total_ray_count();
+    r.image_hash = hash_framebuffer(fb);
+    r.allocations = allocation_count() - allocations_before;
+    if (!opts.save_images.empty() && !write_image(fb, spp, image_format::pfm, opts.save_images + "/" + name + ".pfm"))
+        cerr << "cannot write " << opts.save_images << "/" << name << ".pfm\n";
+    fprintf(stderr, "\r  %-32s %8.3f s %8.2f Mrays/s %8.2f Msamples/s  hash %016llx\n", name.c_str(),
+            seconds, r.rays / seconds * 1e-6, double(width) * height * spp / seconds * 1e-6,
+            static_cast<unsigned long long>(r.image_hash));
+    if (out) out->pixels.swap(fb.pixels);
+    return r;
+}
+
+// bool write_torus_obj(const string& path, int rings, int segments)
+// - a torus of rings x segments quads with per-vertex normals, the faces
+//   written as quads so the loader has polygons to split
+static bool write_torus_obj(const string& path, int rings, int segments) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    const double major = 1.0, minor = 0.4;
+    for (int i = 0 ; i < rings ; ++i) {
+        for (int j = 0 ; j < segments ; ++j) {
+            double u = 2 * pi * i / rings, v = 2 * pi * j / segments;
+            double ring = major + (minor * cos(v));
+            fprintf(f, "v %.6f %.6f %.6f\nvn %.6f %.6f %.6f\n", ring * cos(u), minor * sin(v), ring * sin(u),
+                    cos(v) * cos(u), sin(v), cos(v) * sin(u));
+        }
+    }
+    for (int i = 0 ; i < rings ; ++i) {
+        for (int j = 0 ; j < segments ; ++j) {
+            int a = (i * segments) + j + 1;
+            int b = (((i + 1) % rings) * segments) + j + 1;
+            int c = (((i + 1) % rings) * segments) + ((j + 1) % segments) + 1;
+            int d = (i * segments) + ((j + 1) % segments) + 1;
+            fprintf(f, "f %d//%d %d//%d %d//%d %d//%d\n", a, a, d, d, c, c, b, b);
+        }
+    }
+    return fclose(f) == 0;
+}
+
+// void run_mesh(const bench_options& opts, vector<mesh_result>& meshes, vector<render_result>& renders)
+// - a 2 million triangle torus (80 thousand with --quick) through the OBJ
+//   loader and the mesh hierarchy, then rendered above a ground sphere
+static void run_mesh(const bench_options& opts, vector<mesh_result>& meshes, vector<render_result>& renders) {
+    const string name = "mesh.torus";
+    if (!selected(opts, name)) return;
+    const int rings = opts.quick ? 200 : 1000;
+    const char* tmp = getenv("TMPDIR");
+    const string path = string(tmp ? tmp : "/tmp") + "/raytracer_bench_torus.obj";
+    if (!write_torus_obj(path, rings, rings)) {
+        cerr << "cannot write " << path << '\n';
+        return;
+    }
+
+    mesh_buffers buffers;
+    obj_stats loaded;
+    string error;
+    bool ok = load_obj(path, buffers, error, opts.threads, &loaded);
+    remove(path.c_str());
+    if (!ok) {
+        cerr << error << '\n';
+        return;
+    }
+    auto geometry = make_shared<triangle_mesh>(move(buffers));
+
+    mesh_result m;
+    m.name = name;
+    m.triangles = geometry->stats.triangles;
+    m.file_bytes = loaded.file_bytes;
+    m.threads = loaded.threads;
+    m.load_ms = loaded.load_ms;
+    m.build_ms = geometry->stats.tree.build_ms;
+    m.memory_bytes = geometry->stats.memory_bytes;
+    meshes.push_back(m);
+    fprintf(stderr, "  %-32s %zu triangles, %.1f MiB read in %.1f ms (%d threads), hierarchy %.1f ms, %.1f MiB\n",
+            name.c_str(), m.triangles, m.file_bytes / 1048576.0, m.load_ms, m.threads, m.build_ms,
+            m.memory_bytes / 1048576.0);
+
+    const string render_name = "render.mesh.seed0";
+    if (!selected(opts, render_name)) return;
+    material_table materials;
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000.4, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+    world.add(make_shared<mesh>(geometry, materials.add(metal(color(0.8, 0.6, 0.4), 0.1))));
+    bvh tree(world);
+    camera cam(point3(0, 2.5, 4), point3(0, 0, 0), vec3(0, 1, 0), 35, 1.5, 0, 4.7);
+    renders.push_back(render_still(opts, render_name, tree, materials, cam));
+}
+
+// void run_forest(const bench_options& opts, vector<instance_result>& results, vector<render_result>& renders)
+// - a square forest of a million instances (100 thousand with --quick): nine
+//   in ten a 1024 triangle torus, the rest the unit sphere, each turned and
+//   scaled at random, then rendered from above one corner
+static void run_forest(const bench_options& opts, vector<instance_result>& results, vector<render_result>& renders) {
+    const string name = "instance.forest";
+    if (!selected(opts, name)) return;
+    const int side = opts.quick ? 316 : 1000;
+    const char* tmp = getenv("TMPDIR");
+    const string path = string(tmp ? tmp : "/tmp") + "/raytracer_bench_tree.obj";
+    mesh_buffers buffers;
+    string error;
+    bool ok = write_torus_obj(path, 32, 16) && load_obj(path, buffers, error, 1);
+    remove(path.c_str());
+    if (!ok) {
+        cerr << "cannot make " << path << " " << error << '\n';
+        return;
+    }
+    auto torus = make_shared<triangle_mesh>(move(buffers));
+
+    thread_rng() = pcg32();
+    material_table materials;
+    uint32_t ground = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+    vector<uint32_t> palette;
+    for (int k = 0 ; k < 6 ; ++k) palette.push_back(materials.add(lambertian(color::random(0.1, 0.9))));
+    palette.push_back(materials.add(metal(color(0.8, 0.7, 0.5), 0.2)));
+
+    auto set = make_shared<instance_set>();
+    uint32_t torus_prototype = set->add_prototype(make_shared<mesh>(torus, 0));
+    uint32_t sphere_prototype = set->add_prototype(make_shared<sphere>(point3(0, 0, 0), 1, 0));
+    set->placements.reserve(size_t(side) * side);
+    size_t instanced_triangles = 0;
+    for (int i = 0 ; i < side ; ++i) {
+        for (int j = 0 ; j < side ; ++j) {
+            bool is_torus = random_double() < 0.9;
+            double scale = random_double(0.15, 0.35);
+            affine xf = affine::translate(vec3(i + random_double(0.2, 0.8), is_torus ? 0.4 * scale : scale, j + random_double(0.2, 0.8))) *
+                        affine::rotate(vec3(random_double(-0.3, 0.3), 1, random_double(-0.3, 0.3)), random_double(0, 360)) *
+                        affine::scale(scale);
+            set->add(is_torus ? torus_prototype : sphere_prototype, xf, palette[static_cast<size_t>(random_double(0, palette.size()))]);
+            if (is_torus) instanced_triangles += torus->stats.triangles;
+        }
+    }
+    set->build();
+
+    instance_result r;
+    r.name = name;
+    r.instances = set->stats.instances;
+    r.prototypes = set->stats.prototypes;
+    r.instanced_triangles = instanced_triangles;
+    r.geometry_bytes = torus->stats.memory_bytes;
+    r.memory_bytes = set->stats.memory_bytes;
+    r.flattened_bytes = static_cast<size_t>(double(torus->stats.memory_bytes) / torus->stats.triangles * instanced_triangles);
+    r.build_ms = set->stats.tree.build_ms;
+    results.push_back(r);
+    fprintf(stderr, "  %-32s %zu instances of %zu prototypes, %.1f MiB (%.0f bytes each) + %.1f KiB geometry, top level %.1f ms;"
+                    " %zu triangles flattened would be ~%.0f MiB\n",
+            name.c_str(), r.instances, r.prototypes, r.memory_bytes / 1048576.0, double(r.memory_bytes) / r.instances,
+            r.geometry_bytes / 1024.0, r.build_ms, r.instanced_triangles, r.flattened_bytes / 1048576.0);
+
+    const string render_name = "render.forest.seed0";
+    if (!selected(opts, render_name)) return;
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+    world.add(set);
+    bvh tree(world);
+    camera cam(point3(-2, 3, -2), point3(side * 0.25, 0, side * 0.25), vec3(0, 1, 0), 40, 1.5, 0, 10);
+    renders.push_back(render_still(opts, render_name, tree, materials, cam));
+}
+
+// scene_desc cornell_scene()
+// - scenes/cornell.txt
+static scene_desc cornell_scene() {
+    scene_desc desc;
+    desc.cam = { point3(50, 45, 165), point3(50, 38, 0), vec3(0, 1, 0), 62, 0, 10 };
+    uint32_t white = desc.add_material(diffuse_material(color(0.75, 0.75, 0.75)));
+    uint32_t red = desc.add_material(diffuse_material(color(0.75, 0.25, 0.25)));
+    uint32_t blue = desc.add_material(diffuse_material(color(0.25, 0.25, 0.75)));
+    uint32_t lamp = desc.add_material(emissive_material(color(40, 40, 40)));
+    desc.add_sphere(point3(1e5 + 1, 40.8, 81.6), 1e5, red);
+    desc.add_sphere(point3(-1e5 + 99, 40.8, 81.6), 1e5, blue);
+    desc.add_sphere(point3(50, 40.8, 1e5), 1e5, white);
+    desc.add_sphere(point3(50, 40.8, -1e5 + 170), 1e5, white);
+    desc.add_sphere(point3(50, 1e5, 81.6), 1e5, white);
+    desc.add_sphere(point3(50, -1e5 + 81.6, 81.6), 1e5, white);
+    desc.add_sphere(point3(27, 16.5, 47), 16.5, desc.add_material(metal_material(color(0.999, 0.999, 0.999), 0)));
+    desc.add_sphere(point3(73, 16.5, 78), 16.5, desc.add_material(glass_material(1.5)));
+    desc.add_sphere(point3(50, 72, 81.6), 5, lamp);
+    return desc;
+}
+
+// void run_lights(const bench_options& opts, vector<light_result>& results, vector<render_result>& renders)
+// - scenes/cornell.txt, a room of huge spheres lit by one small lamp, rendered
+//   at two seeds with direct light sampling and two without; the difference
+//   of two renders is noise alone, and its rms over sqrt(2) is one render's
+// - noise falls as 1 / sqrt(spp), so (bsdf noise / nee noise)^2 is how many
+//   times the samples scattering alone needs to match direct light sampling
+static void run_lights(const bench_options& opts, vector<light_result>& results, vector<render_result>& renders) {
+    const string name = "lights.cornell";
+    if (!selected(opts, name)) return;
+
+    scene_desc desc = cornell_scene();
+    material_table materials;
+    hittable_list objects = desc.build(materials);
+    light_list lights;
+    desc.build_lights(lights);
+    bvh tree(objects);
+    camera cam = desc.make_camera(1.5);
+
+    // rms of the difference of two renders of spp samples, over sqrt(2)
+    auto noise = [](const framebuffer& a, const framebuffer& b, int spp) {
+        double sum = 0;
+        for (size_t k = 0 ; k < a.pixels.size() ; ++k) {
+            vec3 d = (a.pixels[k] - b.pixels[k]) / spp;
+            sum += d.length_squared();
+        }
+        return sqrt(sum / (3.0 * a.pixels.size()) / 2);
+    };
+
+    light_result r;
+    r.name = name;
+    framebuffer images[2] = { framebuffer(0, 0), framebuffer(0, 0) };
+    for (const light_list* sampled : { static_cast<const light_list*>(&lights), static_cast<const light_list*>(nullptr) }) {
+        double seconds = 0;
+        for (uint64_t seed = 0 ; seed < 2 ; ++seed) {
+            string render_name = string("render.cornell.") + (sampled ? "nee" : "bsdf") + ".seed" + to_string(seed);
+            renders.push_back(render_still(opts, render_name, tree, materials, cam, seed, sampled, &images[seed]));
+            seconds += renders.back().seconds / 2;
+        }
+        r.spp = renders.back().spp;
+        (sampled ? r.nee_seconds : r.bsdf_seconds) = seconds;
+        (sampled ? r.nee_noise : r.bsdf_noise) = noise(images[0], images[1], r.spp);
+    }
+    results.push_back(r);
+    double spp_ratio = (r.bsdf_noise / r.nee_noise) * (r.bsdf_noise / r.nee_noise);
+    fprintf(stderr, "  %-32s noise %.4f with direct light sampling, %.4f without: equal noise without takes %.1fx the"
+                    " samples, %.1fx the time\n",
+            name.c_str(), r.nee_noise, r.bsdf_noise, spp_ratio, spp_ratio * r.bsdf_seconds / r.nee_seconds);
+}
+
+// void run_denoise(const bench_options& opts, vector<denoise_result>& results)
+// - random_scene() and the cornell room at 8 spp, denoised, and at 50 spp as
+//   they are, against a reference of 256 spp (512 without --quick) from
+//   another seed; the error is of the displayed values, gamma corrected and
+//   clamped like the 8-bit images, which is what the noise is seen as
+static void run_denoise(const bench_options& opts, vector<denoise_result>& results) {
+    const int width = opts.quick ? 100 : 200;
+    const int height = static_cast<int>(width / 1.5);
+    const int low_spp = 8, high_spp = 50;
+    const int reference_spp = opts.quick ? 256 : 512;
+
+    for (const char* scene : { "random_scene", "cornell" }) {
+        const string name = string("denoise.") + scene;
+        if (!selected(opts, name)) continue;
+
+        thread_rng() = pcg32();
+        scene_desc desc = strcmp(scene, "cornell") == 0 ? cornell_scene() : random_scene(11);
+        material_table materials;
+        hittable_list objects = desc.build(materials);
+        light_list lights;
+        desc.build_lights(lights);
+        const light_list* sampled = lights.empty() ? nullptr : &lights;
+        bvh tree(objects);
+        camera cam = desc.make_camera(1.5);
+        tile_renderer renderer(32, opts.threads);
+
+        // spp samples per pixel from seed, with the first hits into features if given
+        auto render = [&](framebuffer& fb, int spp, uint64_t seed, feature_buffer* features) {
+            auto start = chrono::steady_clock::now();
+            renderer.render_tiles(width, height, [&](const tile& t) {
+                for (int j = t.y0 ; j < t.y1 ; ++j) {
+                    for (int i = t.x0 ; i < t.x1 ; ++i) {
+                        pixel_sampler sampler(sample_pattern::random, seed, static_cast<uint64_t>(j) * width + i);
+                        for (int s = 0 ; s < spp ; ++s) {
+                            sampler.start_sample(s);
+                            ray r = primary_ray(cam, sampler, i, j, width, height);
+                            path_features first_hit;
+                            color sample = ray_color(r, tree, materials, 50, 3, sampled, features ? &first_hit : nullptr);
+                            fb.at(i, j) += sample;
+                            if (features) features->add(i, j, first_hit, sample);
+                        }
+                    }
+                }
+                flush_render_stats();
+            });
+            return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        };
+
+        // rms difference of the displayed values of a (a_spp samples) and the reference
+        framebuffer reference(width, height);
+        render(reference, reference_spp, 1, nullptr);
+        auto display_rmse = [&](const framebuffer& a, int a_spp) {
+            double sum = 0;
+            for (size_t k = 0 ; k < a.pixels.size() ; ++k) {
+                for (int c = 0 ; c < 3 ; ++c) {
+                    double x = sqrt(clamp(a.pixels[k][c] / a_spp, 0.0, 1.0));
+                    double y = sqrt(clamp(reference.pixels[k][c] / reference_spp, 0.0, 1.0));
+                    sum += (x - y) * (x - y);
+                }
+            }
+            return sqrt(sum / (3.0 * a.pixels.size()));
+        };
+
+        denoise_result r;
+        r.name = name;
+        r.width = width;
+        r.height = height;
+        r.low_spp = low_spp;
+        r.high_spp = high_spp;
+        r.reference_spp = reference_spp;
+
+        framebuffer low(width, height), high(width, height), denoised(0, 0);
+        feature_buffer features(width, height);
+        r.low_seconds = render(low, low_spp, 0, &features);
+        r.high_seconds = render(high, high_spp, 0, nullptr);
+        denoise_settings settings;
+        settings.threads = opts.threads;
+        denoiser filter(settings);
+        filter.run(low, low_spp, features, low_spp, denoised);
+        r.denoise_ms = filter.stats.ms;
+        r.low_rmse = display_rmse(low, low_spp);
+        r.denoised_rmse = display_rmse(denoised, 1);
+        r.high_rmse = display_rmse(high, high_spp);
+        results.push_back(r);
+
+        if (!opts.save_images.empty()) {
+            write_image(low, low_spp, image_format::pfm, opts.save_images + "/" + name + ".noisy.pfm");
+            write_image(denoised, 1, image_format::pfm, opts.save_images + "/" + name + ".denoised.pfm");
+            write_image(high, high_spp, image_format::pfm, opts.save_images + "/" + name + ".high.pfm");
+            write_image(reference, reference_spp, image_format::pfm, opts.save_images + "/" + name + ".reference.pfm");
+        }
+        fprintf(stderr, "\r  %-32s rmse %d spp %.4f, denoised %.4f (%.3f s + %.1f ms), %d spp %.4f (%.3f s)\n",
+                name.c_str(), low_spp, r.low_rmse, r.denoised_rmse, r.low_seconds, r.denoise_ms, high_spp, r.high_rmse,
+                r.high_seconds);
+    }
+}
+
+// void run_preview(const bench_options& opts, vector<preview_result>& results)
+// - random_scene() in a preview session (preview.h), at the size and sample
+//   count of the renders above: how soon the first tiles and the first whole
+//   pass come after a camera edit, and how much of the image editing the
+//   material of one small sphere restarts and how long it then takes to
+//   converge again
+static void run_preview(const bench_options& opts, vector<preview_result>& results) {
+    const string name = "preview.random_scene";
+    if (!selected(opts, name)) return;
+    const int width = opts.quick ? 200 : 400;
+    const int height = static_cast<int>(width / 1.5);
+    const int spp = opts.quick ? 4 : 16;
+
+    thread_rng() = pcg32();
+    scene_desc desc = random_scene(11);
+    material_table materials;
+    hittable_list list = desc.build(materials);
+    light_list lights;
+    bvh tree(list);
+    camera cam = desc.make_camera(1.5);
+    tile_renderer renderer(32, opts.threads);
+    renderer.show_progress = false;
+
+    auto render_tile = [&](const tile& t, framebuffer& target, int first_sample, int end_sample) {
+        for (int j = t.y0 ; j < t.y1 ; ++j) {
+            for (int i = t.x0 ; i < t.x1 ; ++i) {
+                pixel_sampler sampler(sample_pattern::random, 0, static_cast<uint64_t>(j) * width + i);
+                for (int s = first_sample ; s < end_sample ; ++s) {
+                    sampler.start_sample(s);
+                    ray r = primary_ray(cam, sampler, i, j, width, height);
+                    target.at(i, j) += ray_color(r, tree, materials, 50, 3);
+                }
+            }
+        }
+        flush_render_stats();
+    };
+    preview_settings settings;
+    settings.samples_per_pixel = spp;
+    auto converge = [](preview_session& session) {
+        auto start = chrono::steady_clock::now();
+        while (!session.converged())
+            session.render_batch();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    framebuffer fb(width, height);
+    preview_session session(desc, materials, lights, cam, fb, renderer, render_tile, settings);
+    converge(session);
+
+    preview_result r;
+    r.name = name;
+    r.width = width;
+    r.height = height;
+    r.spp = spp;
+    r.tiles = session.tile_count();
+
+    scene_camera moved = desc.cam;
+    moved.lookfrom = point3(12, 2.5, 4);
+    string error;
+    session.edit_camera(moved, error);
+    r.camera_seconds = converge(session);
+    r.camera_first_tile_ms = session.stats.first_tile_ms;
+    r.camera_first_pass_ms = session.stats.first_pass_ms;
+
+    // the small sphere nearest the middle of the view
+    uint32_t id = 0;
+    double nearest = infinity;
+    for (const scene_sphere& sp : desc.spheres) {
+        double d = (point3(sp.center[0], sp.center[1], sp.center[2]) - desc.cam.lookat).length();
+        if (sp.radius < 0.5 && d < nearest) {
+            nearest = d;
+            id = sp.material;
+        }
+    }
+    scene_material m = desc.materials[id];
+    m.albedo[0] = 0.9;
+    m.albedo[1] = 0.3;
+    m.albedo[2] = 0.2;
+    session.edit_material(id, m, r.material_tiles, error);
+    r.material_seconds = converge(session);
+    r.material_first_tile_ms = session.stats.first_tile_ms;
+
+    framebuffer fresh(width, height);
+    preview_session full(desc, materials, lights, cam, fresh, renderer, render_tile, settings);
+    converge(full);
+    r.matches_full_render = hash_framebuffer(fresh) == hash_framebuffer(fb);
+    results.push_back(r);
+
+    fprintf(stderr, "\r  %-32s camera edit: first tile %.2f ms, first pass %.1f ms, %.3f s to %d spp; material edit:"
+                    " %zu of %zu tiles, %.3f s; %s\n",
+            name.c_str(), r.camera_first_tile_ms, r.camera_first_pass_ms, r.camera_seconds, spp, r.material_tiles,
+            r.tiles, r.material_seconds, r.matches_full_render ? "matches a full render" : "DIFFERS from a full render");
+}
+
+// void run_batch(const bench_options& opts, vector<batch_result>& results)
+// - small jobs alternating between two random scenes at different cameras, as
+//   raytracer --batch runs them, with a cache that holds both scenes and with
+//   one that holds a single scene and so loads and builds one for every job
+static void run_batch(const bench_options& opts, vector<batch_result>& results) {
+    const string name = "batch.random_scenes";
+    if (!selected(opts, name)) return;
+    const int job_count = opts.quick ? 12 : 48;
+
+    batch_settings settings;
+    settings.defaults.width = 96;
+    settings.defaults.aspect_ratio = 1.5;
+    settings.defaults.samples_per_pixel = 2;
+    settings.defaults.max_depth = 50;
+    settings.threads = opts.threads;
+    vector<batch_job> jobs;
+    for (int k = 0 ; k < job_count ; ++k) {
+        batch_job job = settings.defaults;
+        job.line = k + 1;
+        job.scene = k % 2 ? "random:22" : "random";
+        job.output = "/dev/null";
+        double angle = 2 * pi * k / job_count;
+        job.cam.lookfrom = point3(13 * cos(angle), 2, 13 * sin(angle));
+        job.camera_fields = batch_job::lookfrom;
+        jobs.push_back(job);
+    }
+
+    batch_result r;
+    r.name = name;
+    r.jobs = job_count;
+    for (int capacity : { 2, 1 }) {
+        settings.cache_scenes = capacity;
+        batch_runner runner(settings);
+        runner.log = nullptr;
+        runner.run(jobs);
+        (capacity == 2 ? r.cached_seconds : r.uncached_seconds) = runner.stats.seconds;
+        (capacity == 2 ? r.cached_loads : r.uncached_loads) = runner.cache.misses;
+        (capacity == 2 ? r.cached_build_ms : r.uncached_build_ms) = runner.cache.load_ms + runner.cache.build_ms;
+        if (capacity == 2) r.samples_per_sec = runner.stats.samples / runner.stats.seconds;
+    }
+    results.push_back(r);
+    fprintf(stderr, "\r  %-32s %d jobs: %.3f s, %.1f jobs/s, %zu scenes built in %.1f ms; a scene per job: %.3f s,"
+                    " %zu built in %.1f ms\n",
+            name.c_str(), r.jobs, r.cached_seconds, r.jobs / r.cached_seconds, r.cached_loads, r.cached_build_ms,
+            r.uncached_seconds, r.uncached_loads, r.uncached_build_ms);
+}
+
+// bool write_checker_ppm(const string& path, int size)
+// - a size x size binary PPM of 64 texel squares shaded across the image, so
+//   every level of its pyramid differs
+static bool write_checker_ppm(const string& path, int size) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "P6\n%d %d\n255\n", size, size);
+    vector<unsigned char> row(3 * size_t(size));
+    for (int y = 0 ; y < size ; ++y) {
+        for (int x = 0 ; x < size ; ++x) {
+            bool light = ((x / 64) + (y / 64)) % 2 == 0;
+            row[3 * size_t(x)] = static_cast<unsigned char>(light ? 255 * x / size : 30);
+            row[(3 * size_t(x)) + 1] = static_cast<unsigned char>(light ? 255 * y / size : 200);
+            row[(3 * size_t(x)) + 2] = 120;
+        }
+        fwrite(row.data(), 1, row.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+// void run_textures(const bench_options& opts, vector<texture_result>& results, vector<render_result>& renders)
+// - a 4096 x 4096 image (1024 with --quick) on the ground and on spheres from
+//   near to far, so lookups read every level of its pyramid, rendered with a
+//   1 MiB tile cache (256 KiB with --quick) and with one that holds the whole
+//   pyramid; both must give the same image, the small one by making dropped
+//   tiles again
+static void run_textures(const bench_options& opts, vector<texture_result>& results, vector<render_result>& renders) {
+    const string name = "textures.paged";
+    if (!selected(opts, name)) return;
+    const int size = opts.quick ? 1024 : 4096;
+    const char* tmp = getenv("TMPDIR");
+    const string path = string(tmp ? tmp : "/tmp") + "/raytracer_bench_checker.ppm";
+    if (!write_checker_ppm(path, size)) {
+        cerr << "cannot write " << path << '\n';
+        return;
+    }
+
+    scene_desc desc;
+    desc.cam = { point3(0, 1.5, 6), point3(0, 0.5, 0), vec3(0, 1, 0), 40, 0, 6 };
+    const uint32_t image = 1 + desc.add_texture(path);
+    scene_material ground = diffuse_material(color(0.9, 0.9, 0.9));
+    scene_material matte = diffuse_material(color(0.8, 0.8, 0.8));
+    scene_material shiny = metal_material(color(0.9, 0.9, 0.9), 0.05);
+    ground.texture = matte.texture = shiny.texture = image;
+    desc.add_sphere(point3(0, -1000, 0), 1000, desc.add_material(ground));
+    uint32_t materials_used[2] = { desc.add_material(matte), desc.add_material(shiny) };
+    for (int k = 0 ; k < 12 ; ++k) {
+        double z = 2 - (4.0 * k);
+        double radius = 0.2 + (0.05 * k);
+        desc.add_sphere(point3(k % 2 ? 1.5 : -1.5, radius, z), radius, materials_used[k % 2]);
+    }
+    desc.add_sphere(point3(0, 1, 0), 1, materials_used[0]);
+
+    texture_result r;
+    r.name = name;
+    r.image_size = size;
+    r.small_capacity = size_t(opts.quick ? 256 : 1024) << 10;
+    uint64_t hashes[2];
+    for (int pass = 0 ; pass < 2 ; ++pass) {
+        material_table materials;
+        // the second cache holds every tile of the pyramid, borders included
+        size_t capacity = pass == 0 ? r.small_capacity : size_t(size) * size * 3 * sizeof(float) * 2;
+        materials.textures = make_shared<texture_cache>(capacity);
+        hittable_list objects = desc.build(materials);
+        bvh tree(objects);
+        camera cam = desc.make_camera(1.5);
+        string render_name = string("render.textures.") + (pass == 0 ? "small_cache" : "large_cache");
+        renders.push_back(render_still(opts, render_name, tree, materials, cam));
+        texture_stats stats = materials.textures->stats();
+        hashes[pass] = renders.back().image_hash;
+        r.pyramid_bytes = stats.pyramid_bytes;
+        (pass == 0 ? r.small_seconds : r.large_seconds) = renders.back().seconds;
+        (pass == 0 ? r.small_hit_rate : r.large_hit_rate) = stats.hit_rate();
+        (pass == 0 ? r.small_peak : r.large_peak) = stats.peak_bytes;
+        (pass == 0 ? r.small_misses : r.large_misses) = stats.misses;
+        if (pass == 1) r.large_capacity = stats.capacity_bytes;
+    }
+    remove(path.c_str());
+    r.same_image = hashes[0] == hashes[1];
+    results.push_back(r);
+    fprintf(stderr, "  %-32s %d^2 image, pyramid %.1f MiB: %.0f KiB cache %.3f s, hit rate %.2f%% (%llu misses),"
+                    " peak %.0f KiB; whole pyramid %.3f s, %.2f%% (%llu misses), peak %.0f KiB; %s\n",
+            name.c_str(), r.image_size, r.pyramid_bytes / 1048576.0, r.small_capacity / 1024.0, r.small_seconds,
+            100 * r.small_hit_rate, static_cast<unsigned long long>(r.small_misses), r.small_peak / 1024.0,
+            r.large_seconds, 100 * r.large_hit_rate, static_cast<unsigned long long>(r.large_misses),
+            r.large_peak / 1024.0, r.same_image ? "same image" : "DIFFERENT images");
+}
+
+// void run_sequence(const bench_options& opts, vector<sequence_result>& results)
+// - a small 240 frame animation of random_scene() with bouncing spheres and an
+//   orbiting camera, rendered the way raytracer --frames does it: one scene and
+//   one bvh for the whole sequence, refit every frame
+static void run_sequence(const bench_options& opts, vector<sequence_result>& results) {
+    const string name = "sequence.refit";
+    if (!selected(opts, name)) return;
+    const int frames = opts.quick ? 48 : 240;
+    const int width = 96;
+    const int height = 64;
+    const int spp = 2;
+    const double fps = 24;
+    const double shutter = 0.5 / fps;
+
+    thread_rng() = pcg32();
+    scene_desc desc = random_scene(11, true);
+    desc.orbit_camera(360 / (frames / fps), fps, frames);
+    material_table materials;
+    hittable_list list = desc.build(materials);
+    bvh tree(list);
+    tile_renderer renderer(32, opts.threads);
+    framebuffer fb(width, height);
+
+    sequence_result r;
+    r.name = name;
+    r.frames = frames;
+    r.width = width;
+    r.height = height;
+    r.spp = spp;
+    r.refit_ms = 0;
+    r.refit_nodes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int frame = 0 ; frame < frames ; ++frame) {
+        double time0 = frame / fps;
+        tree.update(time0, time0 + shutter);
+        r.refit_ms += tree.stats.refit_ms;
+        r.refit_nodes += tree.stats.refit_nodes;
+        camera cam = desc.make_camera(1.5, time0, time0 + shutter);
+        fill(fb.pixels.begin(), fb.pixels.end(), color(0, 0, 0));
+        renderer.render_tiles(width, height, [&](const tile& t) {
+            for (int j = t.y0 ; j < t.y1 ; ++j) {
+                for (int i = t.x0 ; i < t.x1 ; ++i) {
+                    pixel_sampler sampler(sample_pattern::random, 0, static_cast<uint64_t>(j) * width + i);
+                    for (int s = 0 ; s < spp ; ++s) {
+                        sampler.start_sample(s);
+                        ray camera_ray = primary_ray(cam, sampler, i, j, width, height);
+                        fb.at(i, j) += ray_color(camera_ray, tree, materials, 50, 3);
+                    }
+                }
+            }
+            flush_render_stats();
+        });
+    }
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    r.image_hash = hash_framebuffer(fb);
+    r.refit_ms /= frames;
+    r.refit_nodes /= frames;
+
+    // the same frames' hierarchies built from scratch, for comparison
+    auto rebuild_start = chrono::steady_clock::now();
+    for (int frame = 0 ; frame < frames ; ++frame) {
+        double time0 = frame / fps;
+        list.update(time0, time0 + shutter);
+        bvh rebuilt(list);
+        keep(rebuilt.nodes.size());
+    }
+    r.rebuild_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - rebuild_start).count() / frames;
+    results.push_back(r);
+
+    fprintf(stderr, "\r  %-32s %8.3f s %8.2f frames/s  refit %.3f ms (%zu nodes), rebuild %.3f ms  hash %016llx\n",
+            name.c_str(), r.seconds, frames / r.seconds, r.refit_ms, r.refit_nodes, r.rebuild_ms,
+            static_cast<unsigned long long>(r.image_hash));
+}
+
+static void write_json(FILE* f, const vector<micro_result>& micro, const vector<render_result>& renders,
+                       const vector<mesh_result>& meshes, const vector<instance_result>& instances,
+                       const vector<light_result>& lights, const vector<denoise_result>& denoised,
+                       const vector<preview_result>& previews, const vector<batch_result>& batches,
+                       const vector<texture_result>& textures, const vector<sequence_result>& sequences) {
+    fprintf(f, "{\n  \"build\": {\"compiler\": \"%s\", \"type\": \"%s\", \"native\": %s, \"precision\": \"%s\"},\n",
+            __VERSION__, RAYTRACER_BUILD_TYPE, RAYTRACER_NATIVE_BUILD ? "true" : "false", precision_name());
+
+    fprintf(f, "  \"micro\": [\n");
+    for (size_t k = 0 ; k < micro.size() ; ++k) {
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.4f, \"ops\": %llu}%s\n", micro[k].name.c_str(),
+                micro[k].ns_per_op, static_cast<unsigned long long>(micro[k].ops), k + 1 < micro.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"render\": [\n");
+    for (size_t k = 0 ; k < renders.size() ; ++k) {
+        const render_result& r = renders[k];
+        fprintf(f, "    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, \"threads\": %d, "
+                   "\"seed\": %llu, \"seconds\": %.6f, \"rays\": %llu, \"rays_per_sec\": %.1f, "
+                   "\"samples_per_sec\": %.1f, \"image_hash\": \"%016llx\", \"allocations\": %llu, \"rays_per_bounce\": [",
+                r.name.c_str(), r.width, r.height, r.spp, r.threads, static_cast<unsigned long long>(r.seed),
+                r.seconds, static_cast<unsigned long long>(r.rays), r.rays / r.seconds,
+                double(r.width) * r.height * r.spp / r.seconds, static_cast<unsigned long long>(r.image_hash),
+                static_cast<unsigned long long>(r.allocations));
+        for (size_t b = 0 ; b < r.rays_per_bounce.size() ; ++b)
+            fprintf(f, "%s%llu", b ? ", " : "", static_cast<unsigned long long>(r.rays_per_bounce[b]));
+        fprintf(f, "]");
+        if (r.rmse >= 0)
+            fprintf(f, ", \"rmse\": %.6g, \"max_error\": %.6g", r.rmse, r.max_error);
+        fprintf(f, "}%s\n", k + 1 < renders.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"mesh\": [\n");
+    for (size_t k = 0 ; k < meshes.size() ; ++k) {
+        const mesh_result& m = meshes[k];
+        fprintf(f, "    {\"name\": \"%s\", \"triangles\": %zu, \"file_bytes\": %zu, \"threads\": %d, "
+                   "\"load_ms\": %.3f, \"build_ms\": %.3f, \"memory_bytes\": %zu}%s\n",
+                m.name.c_str(), m.triangles, m.file_bytes, m.threads, m.load_ms, m.build_ms, m.memory_bytes,
+                k + 1 < meshes.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"instances\": [\n");
+    for (size_t k = 0 ; k < instances.size() ; ++k) {
+        const instance_result& r = instances[k];
+        fprintf(f, "    {\"name\": \"%s\", \"instances\": %zu, \"prototypes\": %zu, \"instanced_triangles\": %zu, "
+                   "\"geometry_bytes\": %zu, \"memory_bytes\": %zu, \"flattened_bytes\": %zu, \"build_ms\": %.3f}%s\n",
+                r.name.c_str(), r.instances, r.prototypes, r.instanced_triangles, r.geometry_bytes, r.memory_bytes,
+                r.flattened_bytes, r.build_ms, k + 1 < instances.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"lights\": [\n");
+    for (size_t k = 0 ; k < lights.size() ; ++k) {
+        const light_result& r = lights[k];
+        double spp_ratio = (r.bsdf_noise / r.nee_noise) * (r.bsdf_noise / r.nee_noise);
+        fprintf(f, "    {\"name\": \"%s\", \"spp\": %d, \"nee_seconds\": %.6f, \"bsdf_seconds\": %.6f, "
+                   "\"nee_noise\": %.6g, \"bsdf_noise\": %.6g, \"equal_noise_spp_ratio\": %.3f, "
+                   "\"equal_noise_time_ratio\": %.3f}%s\n",
+                r.name.c_str(), r.spp, r.nee_seconds, r.bsdf_seconds, r.nee_noise, r.bsdf_noise, spp_ratio,
+                spp_ratio * r.bsdf_seconds / r.nee_seconds, k + 1 < lights.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"denoise\": [\n");
+    for (size_t k = 0 ; k < denoised.size() ; ++k) {
+        const denoise_result& r = denoised[k];
+        fprintf(f, "    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"low_spp\": %d, \"high_spp\": %d, "
+                   "\"reference_spp\": %d, \"low_seconds\": %.6f, \"high_seconds\": %.6f, \"denoise_ms\": %.3f, "
+                   "\"low_rmse\": %.6g, \"denoised_rmse\": %.6g, \"high_rmse\": %.6g}%s\n",
+                r.name.c_str(), r.width, r.height, r.low_spp, r.high_spp, r.reference_spp, r.low_seconds, r.high_seconds,
+                r.denoise_ms, r.low_rmse, r.denoised_rmse, r.high_rmse, k + 1 < denoised.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"preview\": [\n");
+    for (size_t k = 0 ; k < previews.size() ; ++k) {
+        const preview_result& r = previews[k];
+        fprintf(f, "    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, \"tiles\": %zu, "
+                   "\"camera_first_tile_ms\": %.3f, \"camera_first_pass_ms\": %.3f, \"camera_seconds\": %.6f, "
+                   "\"material_tiles\": %zu, \"material_first_tile_ms\": %.3f, \"material_seconds\": %.6f, "
+                   "\"matches_full_render\": %s}%s\n",
+                r.name.c_str(), r.width, r.height, r.spp, r.tiles, r.camera_first_tile_ms, r.camera_first_pass_ms,
+                r.camera_seconds, r.material_tiles, r.material_first_tile_ms, r.material_seconds,
+                r.matches_full_render ? "true" : "false", k + 1 < previews.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"batch\": [\n");
+    for (size_t k = 0 ; k < batches.size() ; ++k) {
+        const batch_result& r = batches[k];
+        fprintf(f, "    {\"name\": \"%s\", \"jobs\": %d, \"cached_seconds\": %.6f, \"uncached_seconds\": %.6f, "
+                   "\"cached_loads\": %zu, \"uncached_loads\": %zu, \"cached_build_ms\": %.3f, "
+                   "\"uncached_build_ms\": %.3f, \"samples_per_sec\": %.1f}%s\n",
+                r.name.c_str(), r.jobs, r.cached_seconds, r.uncached_seconds, r.cached_loads, r.uncached_loads,
+                r.cached_build_ms, r.uncached_build_ms, r.samples_per_sec, k + 1 < batches.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"textures\": [\n");
+    for (size_t k = 0 ; k < textures.size() ; ++k) {
+        const texture_result& r = textures[k];
+        fprintf(f, "    {\"name\": \"%s\", \"image_size\": %d, \"pyramid_bytes\": %zu, \"small_capacity\": %zu, "
+                   "\"large_capacity\": %zu, \"small_seconds\": %.6f, \"large_seconds\": %.6f, "
+                   "\"small_hit_rate\": %.6f, \"large_hit_rate\": %.6f, \"small_misses\": %llu, "
+                   "\"large_misses\": %llu, \"small_peak_bytes\": %zu, \"large_peak_bytes\": %zu, "
+                   "\"same_image\": %s}%s\n",
+                r.name.c_str(), r.image_size, r.pyramid_bytes, r.small_capacity, r.large_capacity, r.small_seconds,
+                r.large_seconds, r.small_hit_rate, r.large_hit_rate, static_cast<unsigned long long>(r.small_misses),
+                static_cast<unsigned long long>(r.large_misses), r.small_peak, r.large_peak,
+                r.same_image ? "true" : "false", k + 1 < textures.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"sequence\": [\n");
+    for (size_t k = 0 ; k < sequences.size() ; ++k) {
+        const sequence_result& r = sequences[k];
+        fprintf(f, "    {\"name\": \"%s\", \"frames\": %d, \"width\": %d, \"height\": %d, \"spp\": %d, "
+                   "\"seconds\": %.6f, \"frames_per_sec\": %.3f, \"refit_ms\": %.4f, \"refit_nodes\": %zu, "
+                   "\"rebuild_ms\": %.4f, \"image_hash\": \"%016llx\"}%s\n",
+                r.name.c_str(), r.frames, r.width, r.height, r.spp, r.seconds, r.frames / r.seconds, r.refit_ms,
+                r.refit_nodes, r.rebuild_ms, static_cast<unsigned long long>(r.image_hash),
+                k + 1 < sequences.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"memory\": {\"peak_rss_bytes\": %zu, \"allocations\": %llu}\n}\n",
+            peak_resident_memory_bytes(), static_cast<unsigned long long>(allocation_count().load()));
+}
+
+static void print_usage(const char* prog) {
+    cerr << "usage: " << prog << " [options]\n"
+         << "  --quick        shorter runs and smaller renders, for smoke testing\n"
+         << "  --filter S     only run benchmarks whose name contains S\n"
+         << "  --threads N    render threads, 0 = all cores (default 0)\n"
+         << "  --json FILE    write the results as JSON, - = stdout\n"
+         << "  --save-images DIR  write every render to DIR as PFM\n"
+         << "  --reference DIR    report each render's error against DIR/<name>.pfm\n";
+}
+
+int main(int argc, char** argv) {
+    bench_options opts;
+    for (int k = 1 ; k < argc ; ++k) {
+        const char* value = (k + 1 < argc) ? argv[k + 1] : nullptr;
+        if (strcmp(argv[k], "--quick") == 0) {
+            opts.quick = true;
+        } else if (strcmp(argv[k], "--json") == 0 && value) {
+            opts.json = value;
+            ++k;
+        } else if (strcmp(argv[k], "--filter") == 0 && value) {
+            opts.filter = value;
+            ++k;
+        } else if (strcmp(argv[k], "--save-images") == 0 && value) {
+            opts.save_images = value;
+            ++k;
+        } else if (strcmp(argv[k], "--reference") == 0 && value) {
+            opts.reference = value;
+            ++k;
+        } else if (strcmp(argv[k], "--threads") == 0 && value) {
+            opts.threads = atoi(value);
+            ++k;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    vector<micro_result> micro;
+    vector<render_result> renders;
+    vector<mesh_result> meshes;
+    vector<instance_result> instances;
+    vector<light_result> lights;
+    vector<denoise_result> denoised;
+    vector<preview_result> previews;
+    vector<batch_result> batches;
+    vector<texture_result> textures;
+    vector<sequence_result> sequences;
+    cerr << "precision: " << precision_name() << '\n';
+    cerr << "microbenchmarks\n";
+    run_micro(opts, micro);
+    cerr << "renders\n";
+    run_renders(opts, renders);
+    cerr << "meshes\n";
+    run_mesh(opts, meshes, renders);
+    cerr << "instances\n";
+    run_forest(opts, instances, renders);
+    cerr << "lights\n";
+    run_lights(opts, lights, renders);
+    cerr << "denoising\n";
+    run_denoise(opts, denoised);
+    cerr << "preview\n";
+    run_preview(opts, previews);
+    cerr << "batch\n";
+    run_batch(opts, batches);
+    cerr << "textures\n";
+    run_textures(opts, textures, renders);
+    cerr << "animation\n";
+    run_sequence(opts, sequences);
+
+    if (!opts.json.empty()) {
+        FILE* f = opts.json == "-" ? stdout : fopen(opts.json.c_str(), "w");
+        if (!f) {
+            cerr << "cannot write " << opts.json << '\n';
+            return 1;
+        }
+        write_json(f, micro, renders, meshes, instances, lights, denoised, previews, batches, textures, sequences);
+        if (f != stdout) fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,577 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+// struct bvh_stats
+// - summary of a built hierarchy, printed so speedups can be checked per scene size
+struct bvh_stats {
+    size_t primitives = 0;
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    int max_depth = 0;
+    double build_ms = 0;
+    size_t moving_primitives = 0;
+    size_t refit_nodes = 0;         // nodes whose box the last refit recomputed
+    double refit_ms = 0;            // time the last refit took
+};
+
+inline ostream& operator<<(ostream& out, const bvh_stats& s) {
+    return out << "bvh: " << s.primitives << " primitives, " << s.node_count << " nodes, "
+               << s.leaf_count << " leaves, depth " << s.max_depth << ", built in "
+               << s.build_ms << " ms";
+}
+
+// struct bvh_node
+// - one node of a flattened hierarchy, see bvh
+struct bvh_node {
+    aabb box;
+    int first;      // leaf: first primitive, interior: index of the right child
+    int count;      // leaf: number of primitives, interior: 0
+    int axis;       // interior: split axis, used to visit the nearer child first
+};
+
+// struct bvh_build_ref
+// - what the builder sees of a primitive: its box, the box's centroid and the
+//   primitive's index in the caller's array
+struct bvh_build_ref {
+    aabb box;
+    point3 centroid;
+    int index;
+};
+
+// struct bvh_float_node
+// - a bvh_node with its box in float, half the size in double builds, for the
+//   big hierarchies of meshes and instance sets; the box is rounded outwards,
+//   so it still encloses everything the original did
+// - count fits 16 bits because bvh_builder makes no leaf of more than
+//   bvh_builder::max_leaf_limit primitives
+struct bvh_float_node {
+    float lo[3], hi[3];
+    int32_t first;          // leaf: first primitive, interior: index of the right child
+    uint16_t count;         // leaf: number of primitives, interior: 0
+    uint16_t axis;
+
+    explicit bvh_float_node(const bvh_node& n)
+        : first(n.first), count(static_cast<uint16_t>(n.count)), axis(static_cast<uint16_t>(n.axis)) {
+        for (int a = 0 ; a < 3 ; a++) {
+            lo[a] = static_cast<float>(n.box.minimum[a]);
+            hi[a] = static_cast<float>(n.box.maximum[a]);
+            if (lo[a] > n.box.minimum[a]) lo[a] = nextafterf(lo[a], -numeric_limits<float>::infinity());
+            if (hi[a] < n.box.maximum[a]) hi[a] = nextafterf(hi[a], numeric_limits<float>::infinity());
+        }
+    }
+
+    aabb box() const { return aabb(point3(lo[0], lo[1], lo[2]), point3(hi[0], hi[1], hi[2])); }
+
+    // bool hit(const point3& orig, const vec3& inv_dir, real t_min, real t_max) const
+    // - the slab test of aabb::hit
+    bool hit(const point3& orig, const vec3& inv_dir, real t_min, real t_max) const {
+        for (int a = 0 ; a < 3 ; a++) {
+            real t0 = (lo[a] - orig[a]) * inv_dir[a];
+            real t1 = (hi[a] - orig[a]) * inv_dir[a];
+            if (inv_dir[a] < 0) swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min) return false;
+        }
+        return true;
+    }
+};
+
+// class bvh_builder
+// - the binned surface area heuristic (SAH) build shared by bvh, the per-mesh
+//   hierarchies of triangle_mesh and the top level of instance_set
+// - build() flattens the tree into nodes in depth-first order (a node's left
+//   child is the next node) and appends the primitives' indices to order in
+//   leaf order, so a leaf covers order[first, first + count)
+// - the last balanced_levels levels above the depth limit halve their runs
+//   instead of trying the SAH, so even a lopsided tree ends in leaves of at
+//   most max_leaf_limit primitives
+class bvh_builder {
+
+    public:
+        static constexpr int max_depth_limit = 60;     // keeps the traversal stack (64) from overflowing
+        static constexpr int balanced_levels = 16;
+        static constexpr int max_leaf_limit = 1 << 15; // 2^31 primitives halved balanced_levels times
+
+    public:
+        // CONSTRUCTORS
+        explicit bvh_builder(int max_leaf = 4) : max_leaf_size(clamp(max_leaf, 1, max_leaf_limit)) {}
+
+        // void build(vector<bvh_build_ref>& refs, vector<bvh_node>& out_nodes, vector<int>& out_order, bvh_stats& out_stats)
+        // - refs is reordered; an empty refs gives no nodes
+        void build(vector<bvh_build_ref>& refs, vector<bvh_node>& out_nodes, vector<int>& out_order, bvh_stats& out_stats) {
+            nodes = &out_nodes;
+            order = &out_order;
+            stats = &out_stats;
+            if (refs.empty()) return;
+            nodes->reserve(nodes->size() + (2 * refs.size()));
+            order->reserve(order->size() + refs.size());
+            build(refs, 0, static_cast<int>(refs.size()), 1);
+        }
+
+    private:
+        struct bin {
+            aabb box;
+            int count = 0;
+        };
+
+        static const int bin_count = 16;
+
+        int max_leaf_size;
+        vector<bvh_node>* nodes = nullptr;
+        vector<int>* order = nullptr;
+        bvh_stats* stats = nullptr;
+
+        // int build(vector<bvh_build_ref>& refs, int first, int count, int depth)
+        // - builds the subtree over refs[first, first + count) and returns its node index
+        // - tries bin_count candidate planes on every axis and keeps the split with the
+        //   lowest SAH cost (traversal = 1, intersection = 1 per primitive); makes a
+        //   leaf when no split beats intersecting everything
+        int build(vector<bvh_build_ref>& refs, int first, int count, int depth) {
+            int index = static_cast<int>(nodes->size());
+            nodes->push_back(bvh_node());
+            stats->max_depth = max(stats->max_depth, depth);
+
+            aabb box, centroid_box;
+            for (int k = first ; k < first + count ; ++k) {
+                box.grow(refs[k].box);
+                centroid_box.grow(refs[k].centroid);
+            }
+            (*nodes)[index].box = box;
+
+            int best_axis = -1;
+            int best_split = 0;
+            double best_cost = infinity;
+
+            if (count > 1) {
+                // one pass over the run fills the bins of all three axes
+                bin bins[3][bin_count];
+                double lo[3], scale[3];
+                for (int axis = 0 ; axis < 3 ; ++axis) {
+                    lo[axis] = centroid_box.minimum[axis];
+                    double hi = centroid_box.maximum[axis];
+                    scale[axis] = hi > lo[axis] ? bin_count / (hi - lo[axis]) : 0;
+                }
+                for (int k = first ; k < first + count ; ++k) {
+                    for (int axis = 0 ; axis < 3 ; ++axis) {
+                        if (scale[axis] == 0) continue;
+                        int b = min(bin_count - 1, static_cast<int>((refs[k].centroid[axis] - lo[axis]) * scale[axis]));
+                        bins[axis][b].count++;
+                        bins[axis][b].box.grow(refs[k].box);
+                    }
+                }
+
+                for (int axis = 0 ; axis < 3 ; ++axis) {
+                    if (scale[axis] == 0) continue;
+
+                    // sweep from the right to get the area/count of every right side
+                    double right_area[bin_count];
+                    int right_count[bin_count];
+                    aabb acc;
+                    int acc_count = 0;
+                    for (int b = bin_count - 1 ; b > 0 ; --b) {
+                        acc.grow(bins[axis][b].box);
+                        acc_count += bins[axis][b].count;
+                        right_area[b] = acc.surface_area();
+                        right_count[b] = acc_count;
+                    }
+
+                    acc = aabb();
+                    acc_count = 0;
+                    for (int b = 0 ; b < bin_count - 1 ; ++b) {
+                        acc.grow(bins[axis][b].box);
+                        acc_count += bins[axis][b].count;
+                        if (acc_count == 0 || right_count[b + 1] == 0) continue;
+                        double cost = (acc.surface_area() * acc_count)
+                                    + (right_area[b + 1] * right_count[b + 1]);
+                        if (cost < best_cost) {
+                            best_cost = cost;
+                            best_axis = axis;
+                            best_split = b;
+                        }
+                    }
+                }
+            }
+
+            double leaf_cost = count;
+            double split_cost = 1 + (best_cost / fmax(box.surface_area(), 1e-12));
+
+            if (count <= 1 || depth >= max_depth_limit
+                || (count <= max_leaf_size && leaf_cost <= split_cost)) {
+                make_leaf(refs, index, first, count);
+                return index;
+            }
+
+            int mid;
+            if (depth >= max_depth_limit - balanced_levels) {
+                // close to the depth limit: an object median split, so what is
+                // left at the limit is at most count / 2^balanced_levels
+                best_axis = centroid_box.longest_axis();
+                mid = first + (count / 2);
+                nth_element(refs.begin() + first, refs.begin() + mid, refs.begin() + first + count,
+                    [&](const bvh_build_ref& a, const bvh_build_ref& b) {
+                        return a.centroid[best_axis] < b.centroid[best_axis];
+                    });
+            } else if (best_axis >= 0) {
+                double lo = centroid_box.minimum[best_axis];
+                double scale = bin_count / (centroid_box.maximum[best_axis] - lo);
+                auto it = partition(refs.begin() + first, refs.begin() + first + count,
+                    [&](const bvh_build_ref& ref) {
+                        int b = min(bin_count - 1, static_cast<int>((ref.centroid[best_axis] - lo) * scale));
+                        return b <= best_split;
+                    });
+                mid = static_cast<int>(it - refs.begin());
+            } else {
+                // every centroid coincides: no plane separates them, split the run in half
+                best_axis = box.longest_axis();
+                mid = first + (count / 2);
+            }
+
+            (*nodes)[index].axis = best_axis;
+            (*nodes)[index].count = 0;
+            build(refs, first, mid - first, depth + 1);
+            int right = build(refs, mid, first + count - mid, depth + 1);
+            (*nodes)[index].first = right;
+            return index;
+        }
+
+        void make_leaf(vector<bvh_build_ref>& refs, int index, int first, int count) {
+            (*nodes)[index].first = static_cast<int>(order->size());
+            (*nodes)[index].count = count;
+            (*nodes)[index].axis = 0;
+            for (int k = first ; k < first + count ; ++k)
+                order->push_back(refs[k].index);
+            stats->leaf_count++;
+        }
+
+};
+
+static_assert(bvh_builder::max_leaf_limit <= numeric_limits<uint16_t>::max(), "bvh_float_node::count is 16 bits");
+
+// class bvh
+// - bounding volume hierarchy over the objects of a hittable_list, built by
+//   bvh_builder
+// - the tree is flattened into one array in depth-first order: a node's left
+//   child is the next node, the right child is stored by index; leaves point at
+//   a run of the reordered primitives
+// - objects without a bounding box are kept aside and tested linearly
+// - animated primitives are moved by update(), which refits the tree instead of
+//   rebuilding it: only the leaves holding primitives whose box changed, and
+//   their ancestors, get new boxes; the topology stays the one built for the
+//   first frame, which is fine for objects that stay near where they started
+//   and slowly costs traversal speed for ones that travel far
+class bvh : public hittable {
+
+    public:
+        typedef bvh_node node;
+
+        // MEMBERS
+        vector<node> nodes;
+        vector<shared_ptr<hittable>> primitives;
+        vector<shared_ptr<hittable>> unbounded;
+        bvh_stats stats;
+
+    public:
+        // CONSTRUCTORS
+        bvh(const hittable_list& list, int max_leaf = 4)
+            : bvh(list.objects, max_leaf) {}
+
+        bvh(const vector<shared_ptr<hittable>>& objects, int max_leaf = 4) {
+            auto start = chrono::steady_clock::now();
+
+            vector<bvh_build_ref> refs;
+            refs.reserve(objects.size());
+            for (size_t k = 0 ; k < objects.size() ; ++k) {
+                aabb box;
+                if (objects[k]->bounding_box(box))
+                    refs.push_back({ box, box.centroid(), static_cast<int>(k) });
+                else
+                    unbounded.push_back(objects[k]);
+            }
+
+            vector<int> order;
+            bvh_builder(max_leaf).build(refs, nodes, order, stats);
+            primitives.reserve(order.size());
+            for (int index : order)
+                primitives.push_back(objects[index]);
+            for (int n = 0 ; n < static_cast<int>(nodes.size()) ; ++n) {
+                for (int k = nodes[n].first ; nodes[n].count > 0 && k < nodes[n].first + nodes[n].count ; ++k)
+                    if (primitives[k]->animated()) moving.push_back({ k, n });
+            }
+
+            if (!moving.empty()) {
+                parents.assign(nodes.size(), -1);
+                for (int k = 0 ; k < static_cast<int>(nodes.size()) ; ++k) {
+                    if (nodes[k].count > 0) continue;
+                    parents[k + 1] = k;
+                    parents[nodes[k].first] = k;
+                }
+                refit_marks.assign(nodes.size(), 0);
+            }
+
+            auto end = chrono::steady_clock::now();
+            stats.primitives = primitives.size();
+            stats.moving_primitives = moving.size();
+            stats.node_count = nodes.size();
+            stats.build_ms = chrono::duration<double, milli>(end - start).count();
+        }
+
+        // bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
+        // - iterative front-to-back traversal; t_max shrinks with every hit so boxes
+        //   behind the closest hit so far are skipped, and the record returned is
+        //   the closest one exactly as a linear hittable_list::hit would find
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            bool hit_anything = false;
+
+            for (const auto& object : unbounded) {
+                if (object->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+
+            if (nodes.empty()) return hit_anything;
+
+            const point3 orig = r.origin();
+            const vec3 dir = r.direction();
+            const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+            const bool dir_negative[3] = { dir.x() < 0, dir.y() < 0, dir.z() < 0 };
+
+            int stack[64];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const node& n = nodes[current];
+                profile_count(&profile_counters::box_tests);
+                if (n.box.hit(orig, inv_dir, t_min, t_max)) {
+                    if (n.count > 0) {
+                        for (int k = n.first ; k < n.first + n.count ; ++k) {
+                            if (primitives[k]->hit(r, t_min, t_max, rec)) {
+                                hit_anything = true;
+                                t_max = rec.t;
+                            }
+                        }
+                    } else if (dir_negative[n.axis]) {
+                        stack[stack_size++] = current + 1;
+                        current = n.first;
+                        continue;
+                    } else {
+                        stack[stack_size++] = n.first;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+
+            return hit_anything;
+        }
+
+        // bool occluded(const ray& r, real t_min, real t_max) const override
+        // - the traversal of hit() without the ordering: the first primitive that
+        //   occludes r ends it
+        bool occluded(const ray& r, real t_min, real t_max) const override {
+            for (const auto& object : unbounded)
+                if (object->occluded(r, t_min, t_max)) return true;
+            if (nodes.empty()) return false;
+
+            const point3 orig = r.origin();
+            const vec3 dir = r.direction();
+            const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+
+            int stack[64];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const node& n = nodes[current];
+                profile_count(&profile_counters::box_tests);
+                if (n.box.hit(orig, inv_dir, t_min, t_max)) {
+                    if (n.count > 0) {
+                        for (int k = n.first ; k < n.first + n.count ; ++k)
+                            if (primitives[k]->occluded(r, t_min, t_max)) return true;
+                    } else {
+                        stack[stack_size++] = n.first;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            return false;
+        }
+
+        // void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override
+        // - walks the tree once for the whole packet: every node's box is tested against
+        //   all the rays at once (one lane per ray) and the node is entered if any ray
+        //   hits it; leaf primitives get the whole packet, with an empty interval for
+        //   the rays that didn't reach the leaf
+        // - children are visited in the order of the first ray's direction, which the
+        //   other rays of a coherent packet share
+        // - p must be padded (ray_packet::pad)
+        void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override {
+            for (const auto& object : unbounded)
+                object->hit_packet(p, t_min, t_max, recs, hits);
+
+            if (nodes.empty() || p.size == 0) return;
+
+            switch (p.width()) {
+                case 4: traverse_packet<4>(p, t_min, t_max, recs, hits); break;
+                case 8: traverse_packet<8>(p, t_min, t_max, recs, hits); break;
+                default: traverse_packet<16>(p, t_min, t_max, recs, hits); break;
+            }
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            if (!unbounded.empty() || nodes.empty()) return false;
+            output_box = nodes[0].box;
+            return true;
+        }
+
+        bool animated() const override {
+            if (!moving.empty()) return true;
+            for (const auto& object : unbounded)
+                if (object->animated()) return true;
+            return false;
+        }
+
+        // bool update(double time0, double time1) override
+        // - moves the animated primitives to the new shutter interval and refits:
+        //   every node above a primitive whose box changed is marked once, and the
+        //   marked nodes are recomputed children first, which in the depth-first
+        //   layout is simply descending index order
+        bool update(double time0, double time1) override {
+            auto start = chrono::steady_clock::now();
+            bool changed = false;
+            for (const auto& object : unbounded)
+                changed |= object->update(time0, time1);
+
+            refit_order.clear();
+            for (const moving_ref& m : moving) {
+                if (!primitives[m.primitive]->update(time0, time1)) continue;
+                for (int n = m.leaf ; n >= 0 && !refit_marks[n] ; n = parents[n]) {
+                    refit_marks[n] = 1;
+                    refit_order.push_back(n);
+                }
+            }
+            sort(refit_order.begin(), refit_order.end(), greater<int>());
+            for (int n : refit_order) {
+                node& nd = nodes[n];
+                aabb box;
+                if (nd.count > 0) {
+                    aabb primitive_box;
+                    for (int k = nd.first ; k < nd.first + nd.count ; ++k)
+                        if (primitives[k]->bounding_box(primitive_box)) box.grow(primitive_box);
+                } else {
+                    box = nodes[n + 1].box;
+                    box.grow(nodes[nd.first].box);
+                }
+                nd.box = box;
+                refit_marks[n] = 0;
+            }
+
+            stats.refit_nodes = refit_order.size();
+            stats.refit_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            return changed || !refit_order.empty();
+        }
+
+    private:
+        // an animated primitive and the leaf it sits in
+        struct moving_ref {
+            int primitive;
+            int leaf;
+        };
+
+        vector<moving_ref> moving;
+        vector<int> parents;            // only kept when something moves
+        vector<char> refit_marks;
+        vector<int> refit_order;
+
+        // template <int lanes> void traverse_packet(...) const
+        // - hit_packet for a fixed lane count, so the compiler can vectorize the
+        //   per-lane loops; lanes past p.size get an empty interval
+        template <int lanes>
+        void traverse_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const {
+            const int n_rays = p.size;
+            real inv_x[lanes], inv_y[lanes], inv_z[lanes];
+            real t_far_max[lanes];
+            for (int k = 0 ; k < lanes ; ++k) {
+                inv_x[k] = 1 / p.dx[k];
+                inv_y[k] = 1 / p.dy[k];
+                inv_z[k] = 1 / p.dz[k];
+                t_far_max[k] = k < n_rays ? t_max[k] : -infinity;
+            }
+            const bool dir_negative[3] = { p.dx[0] < 0, p.dy[0] < 0, p.dz[0] < 0 };
+
+            int stack[64];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const node& n = nodes[current];
+                const real min_x = n.box.minimum.x(), min_y = n.box.minimum.y(), min_z = n.box.minimum.z();
+                const real max_x = n.box.maximum.x(), max_y = n.box.maximum.y(), max_z = n.box.maximum.z();
+
+                bool lane_hit[lanes];
+                int any_hit = 0;
+                for (int k = 0 ; k < lanes ; ++k) {
+                    real tx0 = (min_x - p.ox[k]) * inv_x[k], tx1 = (max_x - p.ox[k]) * inv_x[k];
+                    real ty0 = (min_y - p.oy[k]) * inv_y[k], ty1 = (max_y - p.oy[k]) * inv_y[k];
+                    real tz0 = (min_z - p.oz[k]) * inv_z[k], tz1 = (max_z - p.oz[k]) * inv_z[k];
+                    real t_near = max(max(t_min, min(tx0, tx1)), max(min(ty0, ty1), min(tz0, tz1)));
+                    real t_far = min(min(t_far_max[k], max(tx0, tx1)), min(max(ty0, ty1), max(tz0, tz1)));
+                    lane_hit[k] = t_near <= t_far;
+                    any_hit |= lane_hit[k];
+                }
+
+                if (any_hit) {
+                    if (n.count > 0) {
+                        // lanes that missed the box get an empty interval for the leaf
+                        real leaf_t[ray_packet::max_size];
+                        for (int k = 0 ; k < lanes ; ++k)
+                            leaf_t[k] = lane_hit[k] ? t_far_max[k] : -infinity;
+                        for (int j = n.first ; j < n.first + n.count ; ++j)
+                            primitives[j]->hit_packet(p, t_min, leaf_t, recs, hits);
+                        for (int k = 0 ; k < lanes ; ++k)
+                            t_far_max[k] = lane_hit[k] ? leaf_t[k] : t_far_max[k];
+                    } else if (dir_negative[n.axis]) {
+                        stack[stack_size++] = current + 1;
+                        current = n.first;
+                        continue;
+                    } else {
+                        stack[stack_size++] = n.first;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+
+            for (int k = 0 ; k < n_rays ; ++k)
+                t_max[k] = t_far_max[k];
+        }
+
+};
+
+#endif
@@ -14,6 +14,8 @@ class camera {
         vec3 vertical;
         vec3 u, v, w;
         double lens_radius;
+        double time0, time1;    // shutter open/close
+        double viewport_h;      // height of the view one unit in front of the camera
 
     public:
         camera(
@@ -23,7 +25,9 @@ class camera {
             double vfov,    // vertical field of view (deg.)
             double aspect_ratio,
             double aperture,
-            double focus_dist
+            double focus_dist,
+            double shutter_open = 0,
+            double shutter_close = 0
         ) {
             auto theta = degrees_to_radians(vfov);
             auto h = tan(theta / 2);
@@ -40,13 +44,45 @@ class camera {
             lower_left_corner = origin - (horizontal / 2) - (vertical / 2) - (focus_dist * w);
 
             lens_radius = aperture / 2;
+            time0 = shutter_open;
+            time1 = shutter_close;
+            viewport_h = viewport_height;
         }
 
+        // double pixel_spread(int image_height) const
+        // - the angle one pixel of an image_height tall image covers, near
+        //   enough for the ray cones of camera rays (texture.h)
+        double pixel_spread(int image_height) const { return viewport_h / image_height; }
+
+        // bool shutter_is_open() const
+        // - true if the rays are spread over a time interval (motion blur), false
+        //   if they are all cast at time0
+        bool shutter_is_open() const { return time1 > time0; }
+
         ray get_ray(double s, double t) const {
             vec3 rd = lens_radius * random_in_unit_disk();
             vec3 offset = (u * rd.x()) + (v * rd.y());
+            double time = shutter_is_open() ? random_double(time0, time1) : time0;
+
+            return ray(origin + offset, lower_left_corner + (s * horizontal) + (t * vertical) - origin - offset, time);
+        }
+
+        // ray get_ray(double s, double t, double lens_x, double lens_y) const
+        // - same as get_ray(s, t) but with the lens position supplied by a sampler
+        //   ([0, 1)^2, mapped onto the aperture) instead of drawn at random
+        ray get_ray(double s, double t, double lens_x, double lens_y) const {
+            vec3 rd = lens_radius * square_to_unit_disk(lens_x, lens_y);
+            vec3 offset = (u * rd.x()) + (v * rd.y());
+
+            return ray(origin + offset, lower_left_corner + (s * horizontal) + (t * vertical) - origin - offset, time0);
+        }
 
-            return ray(origin + offset, lower_left_corner + (s * horizontal) + (t * vertical) - origin - offset);
+        // ray get_ray(double s, double t, double lens_x, double lens_y, double time_sample) const
+        // - the ray cast at time0 + time_sample * (time1 - time0), time_sample in [0, 1)
+        ray get_ray(double s, double t, double lens_x, double lens_y, double time_sample) const {
+            ray r = get_ray(s, t, lens_x, lens_y);
+            r.tm = time0 + (time_sample * (time1 - time0));
+            return r;
         }
 
 };
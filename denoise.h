@@ -0,0 +1,348 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "rtweekend.h"
+
+#include "image_io.h"
+#include "integrator.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// DENOISING
+// - next to the colors the renderer can keep what each pixel's camera rays hit
+//   first (path_features): the surface's albedo, normal and distance, the
+//   auxiliary or AOV buffers, plus the first two moments of the luminance
+// - the denoiser is the edge-avoiding a-trous wavelet filter of Dammertz et al.
+//   (HPG 2010) with the variance guided luminance weight of SVGF (Schied et al.,
+//   HPG 2017): passes of a 5x5 B3 spline kernel whose taps are 1, 2, 4, ...
+//   pixels apart, so the default three passes of 25 taps reach 14 pixels out
+// - a tap counts less the more the two normals differ, the further apart the two
+//   depths are and the more the two luminances differ, measured in standard
+//   deviations of the center's noise; edges of the geometry stop the blur, and
+//   so does detail the noise cannot explain
+// - it filters irradiance, the color divided by the albedo, and multiplies the
+//   albedo back in at the end, so the colors of neighbouring surfaces do not
+//   bleed into each other
+// - every buffer is planar floats, one plane per channel: for one tap the loop
+//   over a row's pixels is branch free arithmetic on consecutive floats, which
+//   the compiler vectorizes; rows are split over threads
+
+// float luma(float r, float g, float b)
+inline float luma(float r, float g, float b) {
+    return (0.2126f * r) + (0.7152f * g) + (0.0722f * b);
+}
+
+// float demodulate(float value, float albedo)
+// - value divided by albedo, or value itself where the albedo is (nearly) black
+inline float demodulate(float value, float albedo) {
+    return albedo > 1e-3f ? value / albedo : value;
+}
+
+inline float remodulate(float value, float albedo) {
+    return albedo > 1e-3f ? value * albedo : value;
+}
+
+// class feature_buffer
+// - per pixel sums over the samples of the auxiliary buffers, like the sums of
+//   a framebuffer; pixels only ever receive samples from the tile they are in,
+//   so workers need no locking
+class feature_buffer {
+
+    public:
+        // MEMBERS
+        int width;
+        int height;
+        vector<float> albedo[3];
+        vector<float> normal[3];
+        vector<float> depth;
+        vector<float> luminance;        // of the samples' demodulated colors
+        vector<float> luminance_sq;
+
+    public:
+        // CONSTRUCTORS
+        feature_buffer(int w, int h) : width(w), height(h) {
+            size_t n = static_cast<size_t>(w) * h;
+            for (int c = 0 ; c < 3 ; ++c) {
+                albedo[c].assign(n, 0);
+                normal[c].assign(n, 0);
+            }
+            depth.assign(n, 0);
+            luminance.assign(n, 0);
+            luminance_sq.assign(n, 0);
+        }
+
+        // void add(int i, int j, const path_features& f, const color& sample)
+        // - one sample of pixel (i, j): its first hit f and the color it brought back
+        void add(int i, int j, const path_features& f, const color& sample) {
+            size_t k = static_cast<size_t>(j) * width + i;
+            float d[3];
+            for (int c = 0 ; c < 3 ; ++c) {
+                albedo[c][k] += static_cast<float>(f.albedo[c]);
+                normal[c][k] += static_cast<float>(f.normal[c]);
+                d[c] = demodulate(static_cast<float>(sample[c]), static_cast<float>(f.albedo[c]));
+            }
+            depth[k] += static_cast<float>(f.depth);
+            float l = luma(d[0], d[1], d[2]);
+            luminance[k] += l;
+            luminance_sq[k] += l * l;
+        }
+
+        // bool write(const string& prefix, int samples_per_pixel) const
+        // - the averaged albedo, normals and depth as prefix_albedo.pfm,
+        //   prefix_normal.pfm and prefix_depth.pfm (depth in all three channels)
+        bool write(const string& prefix, int samples_per_pixel) const {
+            framebuffer a(width, height), n(width, height), z(width, height);
+            for (size_t k = 0 ; k < a.pixels.size() ; ++k) {
+                a.pixels[k] = color(albedo[0][k], albedo[1][k], albedo[2][k]);
+                n.pixels[k] = vec3(normal[0][k], normal[1][k], normal[2][k]);
+                z.pixels[k] = vec3(depth[k], depth[k], depth[k]);
+            }
+            return write_image(a, samples_per_pixel, image_format::pfm, prefix + "_albedo.pfm") &&
+                   write_image(n, samples_per_pixel, image_format::pfm, prefix + "_normal.pfm") &&
+                   write_image(z, samples_per_pixel, image_format::pfm, prefix + "_depth.pfm");
+        }
+
+};
+
+// struct denoise_settings
+struct denoise_settings {
+    int passes = 3;                 // 1 to 12
+    float sigma_luminance = 4;      // standard deviations of the noise
+    float sigma_depth = 0.02f;      // depth difference, relative to the depth, per pixel between the taps
+    int threads = 0;                // 0 = one per hardware thread
+};
+
+// struct denoise_stats
+struct denoise_stats {
+    double ms = 0;
+    int threads = 0;
+};
+
+inline ostream& operator<<(ostream& out, const denoise_stats& s) {
+    return out << "denoise: " << s.ms << " ms on " << s.threads << " threads";
+}
+
+// class denoiser
+class denoiser {
+
+    public:
+        // MEMBERS
+        denoise_settings settings;
+        denoise_stats stats;
+
+    public:
+        // CONSTRUCTORS
+        denoiser(const denoise_settings& s = denoise_settings()) : settings(s) {}
+
+        // void run(const framebuffer& fb, int samples_per_pixel, const feature_buffer& features, int feature_samples, framebuffer& out)
+        // - fb's image, denoised, into out as averages (write it with one sample
+        //   per pixel); features holds feature_samples samples per pixel, which
+        //   may be fewer than fb's if the render was resumed
+        void run(const framebuffer& fb, int samples_per_pixel, const feature_buffer& features, int feature_samples,
+                 framebuffer& out) {
+            auto start = chrono::steady_clock::now();
+            width = fb.width;
+            height = fb.height;
+            const size_t n = static_cast<size_t>(width) * height;
+            stats.threads = settings.threads > 0 ? settings.threads : max(1, static_cast<int>(thread::hardware_concurrency()));
+            for (int c = 0 ; c < 3 ; ++c) {
+                albedo[c].resize(n);
+                normal[c].resize(n);
+                irradiance[c].resize(n);
+                next_irradiance[c].resize(n);
+            }
+            depth.resize(n);
+            depth_scale.resize(n);
+            variance.resize(n);
+            next_variance.resize(n);
+            lum.resize(n);
+            lum_scale.resize(n);
+
+            const float feature_scale = 1.0f / max(feature_samples, 1);
+            parallel_rows([&](int y) {
+                for (size_t k = static_cast<size_t>(y) * width ; k < static_cast<size_t>(y + 1) * width ; ++k) {
+                    float scale = static_cast<float>(fb.sample_scale(k, samples_per_pixel));
+                    float length_sq = 0;
+                    for (int c = 0 ; c < 3 ; ++c) {
+                        albedo[c][k] = features.albedo[c][k] * feature_scale;
+                        normal[c][k] = features.normal[c][k] * feature_scale;
+                        length_sq += normal[c][k] * normal[c][k];
+                        irradiance[c][k] = demodulate(static_cast<float>(fb.pixels[k][c]) * scale, albedo[c][k]);
+                    }
+                    // a pixel's normals average shorter across an edge; misses have none
+                    float inv_length = length_sq > 1e-6f ? 1 / sqrt(length_sq) : 0;
+                    for (int c = 0 ; c < 3 ; ++c) normal[c][k] *= inv_length;
+                    depth[k] = features.depth[k] * feature_scale;
+                    depth_scale[k] = 1 / ((settings.sigma_depth * depth[k]) + 1e-6f);
+                    float mean = features.luminance[k] * feature_scale;
+                    float mean_sq = features.luminance_sq[k] * feature_scale;
+                    variance[k] = max(0.0f, mean_sq - (mean * mean)) * feature_scale;   // of the mean
+                }
+            });
+
+            // a pass whose taps are further apart than the image is wide or tall
+            // only weighs each pixel with itself
+            for (int pass = 0 ; pass < settings.passes && (1 << pass) < max(width, height) ; ++pass) {
+                parallel_rows([&](int y) { prepare_row(y); });
+                parallel_rows([&](int y) { filter_row(y, 1 << pass); });
+                for (int c = 0 ; c < 3 ; ++c) irradiance[c].swap(next_irradiance[c]);
+                variance.swap(next_variance);
+            }
+
+            out = framebuffer(width, height);
+            for (size_t k = 0 ; k < n ; ++k)
+                out.pixels[k] = color(remodulate(irradiance[0][k], albedo[0][k]), remodulate(irradiance[1][k], albedo[1][k]),
+                                      remodulate(irradiance[2][k], albedo[2][k]));
+            stats.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        int width = 0;
+        int height = 0;
+        vector<float> albedo[3];
+        vector<float> normal[3];
+        vector<float> irradiance[3];
+        vector<float> next_irradiance[3];
+        vector<float> depth;
+        vector<float> depth_scale;      // 1 / (sigma_depth * depth)
+        vector<float> variance;         // of each pixel's mean luminance
+        vector<float> next_variance;
+        vector<float> lum;              // this pass's luminance of the irradiance
+        vector<float> lum_scale;        // 1 / (sigma_luminance * standard deviation)
+
+        // void parallel_rows(const function<void(int)>& row) const
+        // - row(y) for every row, in bands of consecutive rows, one per thread
+        void parallel_rows(const function<void(int)>& row) const {
+            int threads = min(stats.threads, height);
+            auto band = [&](int t) {
+                for (int y = height * t / threads ; y < height * (t + 1) / threads ; ++y) row(y);
+            };
+            vector<thread> pool;
+            for (int t = 1 ; t < threads ; ++t) pool.emplace_back(band, t);
+            band(0);
+            for (thread& th : pool) th.join();
+        }
+
+        // exp(-x) for x >= 0 as (1 - x / 16)^16: no call, so it vectorizes
+        static float exp_neg(float x) {
+            float y = max(0.0f, 1 - (x * (1.0f / 16)));
+            y *= y;
+            y *= y;
+            y *= y;
+            return y * y;
+        }
+
+        // void prepare_row(int y)
+        // - the luminance of row y and the inverse of its luminance weight's
+        //   width, from the variance blurred by a 3x3 gaussian first as a
+        //   pixel's own estimate from a few samples is noisy itself
+        void prepare_row(int y) {
+            static const float gauss[3] = { 0.25f, 0.5f, 0.25f };
+            for (int x = 0 ; x < width ; ++x) {
+                size_t k = (static_cast<size_t>(y) * width) + x;
+                lum[k] = luma(irradiance[0][k], irradiance[1][k], irradiance[2][k]);
+                float sum = 0, weight = 0;
+                for (int dy = -1 ; dy <= 1 ; ++dy) {
+                    int qy = y + dy;
+                    if (qy < 0 || qy >= height) continue;
+                    for (int dx = -1 ; dx <= 1 ; ++dx) {
+                        int qx = x + dx;
+                        if (qx < 0 || qx >= width) continue;
+                        float w = gauss[dy + 1] * gauss[dx + 1];
+                        sum += w * variance[(static_cast<size_t>(qy) * width) + qx];
+                        weight += w;
+                    }
+                }
+                lum_scale[k] = 1 / ((settings.sigma_luminance * sqrt(sum / weight)) + 1e-6f);
+            }
+        }
+
+        // void filter_row(int y, int step)
+        // - one a-trous pass over row y with taps step pixels apart; the
+        //   variance goes through the same filter with squared weights
+        void filter_row(int y, int step) {
+            static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+            static thread_local vector<float> sums;
+            sums.assign(5 * static_cast<size_t>(width), 0);
+            float* sum_w = sums.data();
+            float* sum_r = sum_w + width;
+            float* sum_g = sum_r + width;
+            float* sum_b = sum_g + width;
+            float* sum_v = sum_b + width;
+            const size_t row = static_cast<size_t>(y) * width;
+            const float* nx = normal[0].data();
+            const float* ny = normal[1].data();
+            const float* nz = normal[2].data();
+            const float* r = irradiance[0].data();
+            const float* g = irradiance[1].data();
+            const float* b = irradiance[2].data();
+            const float* v = variance.data();
+            const float* l = lum.data();
+            const float* ls = lum_scale.data();
+            const float* z = depth.data();
+            const float* zs = depth_scale.data();
+            const float inv_step = 1.0f / step;
+
+            // the center tap always counts, even for a pixel without a normal
+            const float center = kernel[2] * kernel[2];
+            for (int x = 0 ; x < width ; ++x) {
+                size_t p = row + x;
+                sum_w[x] = center;
+                sum_r[x] = center * r[p];
+                sum_g[x] = center * g[p];
+                sum_b[x] = center * b[p];
+                sum_v[x] = center * center * v[p];
+            }
+
+            for (int ky = -2 ; ky <= 2 ; ++ky) {
+                int qy = y + (ky * step);
+                if (qy < 0 || qy >= height) continue;
+                for (int kx = -2 ; kx <= 2 ; ++kx) {
+                    if (kx == 0 && ky == 0) continue;
+                    const int dx = kx * step;
+                    const int first = max(0, -dx), last = min(width, width - dx);
+                    const float h = kernel[ky + 2] * kernel[kx + 2];
+                    // the depth of a slanted surface changes with the distance between the pixels
+                    const float depth_tolerance = inv_step / (abs(kx) + abs(ky));
+                    const size_t q_row = (static_cast<size_t>(qy) * width) + dx;
+                    for (int x = first ; x < last ; ++x) {
+                        const size_t p = row + x, q = q_row + x;
+                        // the cosine of the normals to the 4th power: SVGF's 128th kept
+                        // the coverage noise of edges, which a soft stop averages away
+                        float w_normal = max(0.0f, (nx[p] * nx[q]) + (ny[p] * ny[q]) + (nz[p] * nz[q]));
+                        w_normal *= w_normal;
+                        w_normal *= w_normal;
+                        float w_depth = exp_neg(fabs(z[p] - z[q]) * zs[p] * depth_tolerance);
+                        float w_lum = exp_neg(fabs(l[p] - l[q]) * ls[p]);
+                        float w = h * w_normal * w_depth * w_lum;
+                        sum_w[x] += w;
+                        sum_r[x] += w * r[q];
+                        sum_g[x] += w * g[q];
+                        sum_b[x] += w * b[q];
+                        sum_v[x] += w * w * v[q];
+                    }
+                }
+            }
+
+            for (int x = 0 ; x < width ; ++x) {
+                size_t p = row + x;
+                float inv = 1 / sum_w[x];
+                next_irradiance[0][p] = sum_r[x] * inv;
+                next_irradiance[1][p] = sum_g[x] * inv;
+                next_irradiance[2][p] = sum_b[x] * inv;
+                next_variance[p] = sum_v[x] * inv * inv;
+            }
+        }
+
+};
+
+#endif
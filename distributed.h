@@ -0,0 +1,361 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+
+#include "integrator.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+// DISTRIBUTED RENDERING
+// - a coordinator hands tiles to worker processes and assembles the image from
+//   the pixel sums they send back
+// - workers are forked once the scene is built, so each has it loaded exactly
+//   once, and talk to the coordinator over a socketpair; the messages are plain
+//   structs over a stream socket, so nothing but the setup ties them to one host
+// - every sample seeds its own RNG from (seed, pixel, sample) and a tile's sums
+//   start from zero in whichever process renders it, so the assembled image is
+//   bit for bit the single-process one
+// - a worker that dies, stops answering the socket or sits on a tile far longer
+//   than tiles usually take (stopped, swapping, wedged) is killed and loses its
+//   tiles to the others; when every worker is gone the coordinator renders the
+//   rest itself
+
+// struct tile_job
+// - coordinator -> worker: render samples [first_sample, end_sample) of a tile;
+//   id < 0 tells the worker to exit
+struct tile_job {
+    int32_t id;
+    int32_t x0, y0, x1, y1;
+    int32_t first_sample, end_sample;
+};
+
+// struct tile_result
+// - worker -> coordinator: followed by depth_bins uint64_t path depth counts and
+//   then (x1 - x0) * (y1 - y0) pixels of 3 reals each, rows bottom to top like
+//   the framebuffer; the sums go over the wire unrounded, in the build's precision
+struct tile_result {
+    int32_t id;
+    int32_t depth_bins;
+    uint64_t rays;
+    uint64_t escaped, absorbed, roulette, truncated;
+};
+
+// bool send_all(int fd, const void* data, size_t n) / bool recv_all(int fd, void* data, size_t n)
+// - the whole buffer or false; a closed peer is an error, never a signal
+inline bool send_all(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        p += sent;
+        n -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t n) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t got = recv(fd, p, n, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        n -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// class render_coordinator
+// - render() forks the workers on first use and keeps them for later calls;
+//   the destructor tells them to exit and reaps them
+// - in_flight tiles are queued per worker so it never waits for its next job
+// - a worker's oldest tile is overdue once it has taken stall_factor times the
+//   median tile time so far, and never less than min_stall_seconds; until a
+//   first tile comes back there is no median and nothing is overdue
+// - fail_after > 0 makes worker 0 exit abruptly before sending its fail_after-th
+//   tile, to exercise the reassignment (testing only)
+class render_coordinator {
+
+    public:
+        // MEMBERS
+        int workers_started = 0;
+        int workers_lost = 0;
+        int tiles_reassigned = 0;
+        int tiles_local = 0;           // rendered by the coordinator after losing every worker
+
+    public:
+        // CONSTRUCTORS
+        render_coordinator(int worker_count, int tiles_in_flight = 2, int fail_after = 0)
+            : requested(worker_count), in_flight(max(1, tiles_in_flight)), fail_after_tiles(fail_after) {}
+
+        ~render_coordinator() {
+            tile_job stop = { -1, 0, 0, 0, 0, 0, 0 };
+            for (worker& w : workers) {
+                if (w.fd < 0) continue;
+                send_all(w.fd, &stop, sizeof(stop));
+                close(w.fd);
+            }
+            for (worker& w : workers)
+                waitpid(w.pid, nullptr, 0);
+        }
+
+        // bool render(framebuffer& fb, const vector<tile>& tiles, int first_sample, int end_sample, const render_function& render_tile)
+        // - renders samples [first_sample, end_sample) of every tile into fb, which
+        //   must be zero over the tiles; render_tile(t, fb, first, end) adds the
+        //   samples of one tile to fb and is what both the workers and, as the
+        //   fallback, the coordinator run
+        // - returns false if the workers could not be started
+        typedef function<void(const tile&, framebuffer&, int, int)> render_function;
+
+        bool render(framebuffer& fb, const vector<tile>& tiles, int first_sample, int end_sample,
+                    const render_function& render_tile) {
+            if (workers.empty() && !start_workers(fb, render_tile))
+                return false;
+
+            deque<int> pending;
+            for (size_t k = 0 ; k < tiles.size() ; ++k)
+                pending.push_back(static_cast<int>(k));
+            int remaining = static_cast<int>(tiles.size());
+
+            vector<pollfd> fds;
+            vector<size_t> owners;
+            vector<double> tile_seconds;
+            while (remaining > 0) {
+                for (size_t w = 0 ; w < workers.size() ; ++w)
+                    fill_worker(w, tiles, pending, first_sample, end_sample);
+
+                fds.clear();
+                owners.clear();
+                for (size_t w = 0 ; w < workers.size() ; ++w) {
+                    if (workers[w].fd < 0 || workers[w].jobs.empty()) continue;
+                    fds.push_back({ workers[w].fd, POLLIN, 0 });
+                    owners.push_back(w);
+                }
+
+                if (fds.empty()) {
+                    // no worker left to wait for: the coordinator finishes the job
+                    while (!pending.empty()) {
+                        render_tile(tiles[pending.front()], fb, first_sample, end_sample);
+                        pending.pop_front();
+                        tiles_local++;
+                        remaining--;
+                    }
+                    break;
+                }
+
+                double deadline = stall_seconds(tile_seconds);
+                int timeout_ms = -1;
+                if (deadline > 0) {
+                    double wait = deadline;
+                    for (size_t w : owners)
+                        wait = min(wait, deadline - seconds_since(workers[w].started));
+                    timeout_ms = static_cast<int>(ceil(max(wait, 0.0) * 1000));
+                }
+                if (poll(fds.data(), fds.size(), timeout_ms) < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                for (size_t k = 0 ; k < fds.size() ; ++k) {
+                    size_t w = owners[k];
+                    if (fds[k].revents == 0) {
+                        if (deadline > 0 && seconds_since(workers[w].started) >= deadline) {
+                            cerr << "\nworker " << workers[w].pid << " overdue on tile " << workers[w].jobs.front();
+                            lose_worker(workers[w], pending);
+                        }
+                        continue;
+                    }
+                    if (!receive_tile(workers[w], tiles, fb)) {
+                        lose_worker(workers[w], pending);
+                        continue;
+                    }
+                    // the next queued tile starts once this one is back
+                    tile_seconds.push_back(seconds_since(workers[w].started));
+                    workers[w].started = chrono::steady_clock::now();
+                    remaining--;
+                    cerr << "\rTiles remaining: " << remaining << ' ' << flush;      // Progress Indicator
+                }
+            }
+            return true;
+        }
+
+    private:
+        typedef chrono::steady_clock::time_point time_point;
+
+        struct worker {
+            pid_t pid;
+            int fd;
+            deque<int> jobs;        // tiles sent and not yet returned, in order
+            time_point started;     // when the worker got to jobs.front()
+        };
+
+        static constexpr double stall_factor = 10;
+        static constexpr double min_stall_seconds = 2;
+
+        int requested;
+        int in_flight;
+        int fail_after_tiles;
+        vector<worker> workers;
+
+        bool start_workers(framebuffer& fb, const render_function& render_tile) {
+            cerr.flush();
+            fflush(stdout);
+            for (int k = 0 ; k < requested ; ++k) {
+                int pair[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+                    break;
+                pid_t pid = fork();
+                if (pid < 0) {
+                    close(pair[0]);
+                    close(pair[1]);
+                    break;
+                }
+                if (pid == 0) {
+                    // the child keeps only its own end of its own socket
+                    close(pair[0]);
+                    for (worker& w : workers)
+                        close(w.fd);
+                    worker_loop(pair[1], fb, render_tile, k == 0 ? fail_after_tiles : 0);
+                }
+                close(pair[1]);
+                workers.push_back({ pid, pair[0], {}, time_point() });
+            }
+            workers_started = static_cast<int>(workers.size());
+            return !workers.empty();
+        }
+
+        // [[noreturn]] static void worker_loop(int fd, framebuffer& fb, const render_function& render_tile, int fail_after)
+        // - the worker process: renders jobs until told to stop or the coordinator
+        //   goes away, then exits without running the rest of main()
+        [[noreturn]] static void worker_loop(int fd, framebuffer& fb, const render_function& render_tile, int fail_after) {
+            signal(SIGINT, SIG_IGN);    // the coordinator decides when the workers stop
+            vector<real> pixels;
+            tile_job job;
+            int done = 0;
+            while (recv_all(fd, &job, sizeof(job)) && job.id >= 0) {
+                tile t = { job.x0, job.y0, job.x1, job.y1 };
+                for (int j = t.y0 ; j < t.y1 ; ++j)
+                    for (int i = t.x0 ; i < t.x1 ; ++i)
+                        fb.at(i, j) = color(0, 0, 0);
+                render_tile(t, fb, job.first_sample, job.end_sample);
+                flush_render_stats();
+                if (fail_after > 0 && ++done >= fail_after)
+                    _exit(3);
+
+                pixels.clear();
+                for (int j = t.y0 ; j < t.y1 ; ++j)
+                    for (int i = t.x0 ; i < t.x1 ; ++i)
+                        for (int c = 0 ; c < 3 ; ++c)
+                            pixels.push_back(fb.at(i, j)[c]);
+
+                path_stats& stats = total_path_stats();
+                tile_result r = { job.id, static_cast<int32_t>(stats.depth_counts.size()), total_ray_count(),
+                                  stats.escaped, stats.absorbed, stats.roulette, stats.truncated };
+                bool ok = send_all(fd, &r, sizeof(r)) &&
+                          send_all(fd, stats.depth_counts.data(), stats.depth_counts.size() * sizeof(uint64_t)) &&
+                          send_all(fd, pixels.data(), pixels.size() * sizeof(real));
+                if (!ok) break;
+                stats.clear();
+                total_ray_count() = 0;
+            }
+            close(fd);
+            _exit(0);
+        }
+
+        void fill_worker(size_t w, const vector<tile>& tiles, deque<int>& pending, int first_sample, int end_sample) {
+            worker& wk = workers[w];
+            while (wk.fd >= 0 && static_cast<int>(wk.jobs.size()) < in_flight && !pending.empty()) {
+                int id = pending.front();
+                const tile& t = tiles[id];
+                tile_job job = { id, t.x0, t.y0, t.x1, t.y1, first_sample, end_sample };
+                if (!send_all(wk.fd, &job, sizeof(job))) {
+                    lose_worker(wk, pending);
+                    return;
+                }
+                pending.pop_front();
+                if (wk.jobs.empty())
+                    wk.started = chrono::steady_clock::now();
+                wk.jobs.push_back(id);
+            }
+        }
+
+        // bool receive_tile(worker& w, const vector<tile>& tiles, framebuffer& fb)
+        // - reads one result into fb and the render totals; false if the worker is
+        //   gone or sent something that is not the tile it was asked for
+        bool receive_tile(worker& w, const vector<tile>& tiles, framebuffer& fb) {
+            tile_result r;
+            if (!recv_all(w.fd, &r, sizeof(r)) || w.jobs.empty() || r.id != w.jobs.front() ||
+                r.depth_bins < 0 || r.depth_bins > 1 << 16)
+                return false;
+
+            path_stats stats;
+            stats.depth_counts.resize(r.depth_bins);
+            const tile& t = tiles[r.id];
+            vector<real> pixels(static_cast<size_t>(t.x1 - t.x0) * (t.y1 - t.y0) * 3);
+            if (!recv_all(w.fd, stats.depth_counts.data(), stats.depth_counts.size() * sizeof(uint64_t)) ||
+                !recv_all(w.fd, pixels.data(), pixels.size() * sizeof(real)))
+                return false;
+
+            size_t k = 0;
+            for (int j = t.y0 ; j < t.y1 ; ++j) {
+                for (int i = t.x0 ; i < t.x1 ; ++i, k += 3)
+                    fb.at(i, j) = color(pixels[k], pixels[k + 1], pixels[k + 2]);
+            }
+            stats.escaped = r.escaped;
+            stats.absorbed = r.absorbed;
+            stats.roulette = r.roulette;
+            stats.truncated = r.truncated;
+            total_path_stats().merge(stats);
+            total_ray_count() += r.rays;
+            w.jobs.pop_front();
+            return true;
+        }
+
+        static double seconds_since(time_point t) {
+            return chrono::duration<double>(chrono::steady_clock::now() - t).count();
+        }
+
+        // static double stall_seconds(vector<double>& tile_seconds)
+        // - how long a worker may sit on one tile, or 0 while no tile has come back
+        static double stall_seconds(vector<double>& tile_seconds) {
+            if (tile_seconds.empty()) return 0;
+            auto middle = tile_seconds.begin() + tile_seconds.size() / 2;
+            nth_element(tile_seconds.begin(), middle, tile_seconds.end());
+            return max(min_stall_seconds, stall_factor * *middle);
+        }
+
+        // void lose_worker(worker& w, deque<int>& pending)
+        // - closes a failed worker and puts its unfinished tiles first in line
+        void lose_worker(worker& w, deque<int>& pending) {
+            close(w.fd);
+            w.fd = -1;
+            kill(w.pid, SIGKILL);
+            workers_lost++;
+            tiles_reassigned += static_cast<int>(w.jobs.size());
+            for (auto it = w.jobs.rbegin() ; it != w.jobs.rend() ; ++it)
+                pending.push_front(*it);
+            w.jobs.clear();
+            cerr << "\nworker " << w.pid << " lost, " << workers_started - workers_lost << " left\n";
+        }
+
+};
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include "rtweekend.h"
+
+#include "renderer.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// FILM
+// - a film reconstructs the image from samples at arbitrary positions: each
+//   sample is added, weighted by a reconstruction filter, to every pixel whose
+//   centre is within the filter's radius of it, and a pixel is its weighted
+//   sum over its sum of weights (Pharr, Jakob and Humphreys, "Physically
+//   Based Rendering", 3rd ed., 7.8), so it gives an image at any sample count
+//   and pixels may have different ones, as adaptive sampling leaves them
+// - the sums are floats, four per pixel (rgb and weight)
+// - a sample reaches the pixels of neighbouring tiles, which other threads
+//   may be rendering at the same time: a tile's samples are splatted into a
+//   film_tile of the thread's own and merged into the film when the tile is
+//   done, with a plain load and store for the pixels only that tile reaches
+//   and a compare-and-swap loop for the ones near its edges, so the atomics
+//   cost one per border pixel per tile, not one per sample, and no locks
+//   are taken; the box filter of the default radius reaches no other tile
+// - the order tiles are merged in varies, so with several threads and a
+//   wider filter the last bits of the border pixels can differ between runs
+// - film::add_sample() splats a sample straight into the film from any
+//   thread, always through compare-and-swap, for renderers that do not work
+//   tile by tile (adaptive.h)
+// - positions are in pixels from the bottom left corner of the image: pixel
+//   (i, j) covers [i, i + 1) x [j, j + 1) and its centre is (i + 0.5, j + 0.5)
+
+enum class filter_type { box, tent, gaussian, mitchell };
+
+inline bool parse_filter(const char* name, filter_type& f) {
+    if (strcmp(name, "box") == 0) { f = filter_type::box; return true; }
+    if (strcmp(name, "tent") == 0) { f = filter_type::tent; return true; }
+    if (strcmp(name, "gaussian") == 0) { f = filter_type::gaussian; return true; }
+    if (strcmp(name, "mitchell") == 0) { f = filter_type::mitchell; return true; }
+    return false;
+}
+
+// class pixel_filter
+// - a separable filter: the weight of a sample (dx, dy) from a pixel centre
+//   is weight(dx) * weight(dy), zero from radius on
+// - box: 1; tent: falls linearly to 0 at the radius; gaussian: standard
+//   deviation 0.5 pixel, less its value at the radius so it reaches 0 there;
+//   mitchell: the Mitchell-Netravali cubic with B = C = 1/3 stretched over
+//   the radius, slightly negative towards it, which keeps edges sharper
+class pixel_filter {
+
+    public:
+        // MEMBERS
+        static constexpr double max_radius = 4;
+
+        filter_type type;
+        double radius;
+
+    public:
+        // CONSTRUCTORS
+        // - radius 0 takes the filter's usual one: 0.5 for box, 1 for tent,
+        //   1.5 for gaussian, 2 for mitchell
+        explicit pixel_filter(filter_type t = filter_type::box, double r = 0) : type(t), radius(r) {
+            if (radius <= 0)
+                radius = t == filter_type::box ? 0.5 : (t == filter_type::tent ? 1 : (t == filter_type::gaussian ? 1.5 : 2));
+            gaussian_edge = exp(-2 * radius * radius);
+        }
+
+        double weight(double d) const {
+            d = fabs(d);
+            if (d >= radius) return 0;
+            switch (type) {
+                case filter_type::box: return 1;
+                case filter_type::tent: return radius - d;
+                case filter_type::gaussian: return fmax(exp(-2 * d * d) - gaussian_edge, 0.0);
+                default: {
+                    const double b = 1.0 / 3, c = 1.0 / 3;
+                    double x = 2 * d / radius;
+                    if (x < 1)
+                        return (((12 - (9 * b) - (6 * c)) * x * x * x) + ((-18 + (12 * b) + (6 * c)) * x * x) + (6 - (2 * b))) / 6;
+                    return (((-b - (6 * c)) * x * x * x) + (((6 * b) + (30 * c)) * x * x) + (((-12 * b) - (48 * c)) * x) +
+                            ((8 * b) + (24 * c))) / 6;
+                }
+            }
+        }
+
+        // int reach() const
+        // - how many pixels beyond its own on each side a sample can reach
+        int reach() const { return static_cast<int>(ceil(radius - 0.5)); }
+
+    private:
+        double gaussian_edge;       // the gaussian's value at the radius
+
+};
+
+class film;
+
+// class film_tile
+// - the samples of one tile, splatted into a buffer of the thread's own that
+//   covers the tile and the pixels around it its samples reach, until
+//   film::merge() adds them to the film
+// - a thread has one buffer: finish one film_tile before starting the next
+class film_tile {
+
+    public:
+        // MEMBERS
+        tile bounds;                // the pixels the samples reach, clipped to the image
+        const tile source;          // the tile the samples are taken in
+
+    public:
+        // CONSTRUCTORS
+        film_tile(const film& f, const tile& t);
+
+        // void add_sample(double x, double y, const color& c)
+        // - sample c taken at (x, y), which must lie in the source tile
+        void add_sample(double x, double y, const color& c);
+
+    private:
+        friend class film;
+
+        const pixel_filter& filter;
+        int reach;
+        vector<float>& sums;        // r, g, b, weight per pixel of bounds
+
+        static vector<float>& thread_buffer() {
+            static thread_local vector<float> buffer;
+            return buffer;
+        }
+
+};
+
+// class film
+class film {
+
+    public:
+        // MEMBERS
+        int width;
+        int height;
+        pixel_filter filter;
+
+    public:
+        // CONSTRUCTORS
+        film(int w, int h, const pixel_filter& f)
+            : width(w), height(h), filter(f), sums(new atomic<float>[4 * static_cast<size_t>(w) * h]) {
+            clear();
+        }
+
+        void clear() {
+            for (size_t k = 0 ; k < 4 * static_cast<size_t>(width) * height ; ++k)
+                sums[k].store(0, memory_order_relaxed);
+        }
+
+        // void merge(const film_tile& staged)
+        // - adds staged's samples to the film: a pixel only the samples of
+        //   staged's tile reach (the image's edges counting as the tile's) with
+        //   a plain load and store, any other with a compare-and-swap loop
+        void merge(const film_tile& staged) {
+            const tile& b = staged.bounds;
+            const tile& t = staged.source;
+            const int reach = staged.reach;
+            const int row = b.x1 - b.x0;
+            for (int q = b.y0 ; q < b.y1 ; ++q) {
+                bool row_owned = (q - reach >= t.y0 || t.y0 == 0) && (q + reach < t.y1 || t.y1 == height);
+                for (int p = b.x0 ; p < b.x1 ; ++p) {
+                    const float* add = &staged.sums[4 * ((static_cast<size_t>(q - b.y0) * row) + (p - b.x0))];
+                    if (add[3] == 0) continue;
+                    bool owned = row_owned && (p - reach >= t.x0 || t.x0 == 0) && (p + reach < t.x1 || t.x1 == width);
+                    atomic<float>* s = &sums[4 * ((static_cast<size_t>(q) * width) + p)];
+                    for (int k = 0 ; k < 4 ; ++k) {
+                        if (owned)
+                            s[k].store(s[k].load(memory_order_relaxed) + add[k], memory_order_relaxed);
+                        else
+                            shared_add(s[k], add[k]);
+                    }
+                }
+            }
+        }
+
+        // void add_sample(double x, double y, const color& c)
+        // - splats sample c taken at (x, y) straight into the film, from any thread
+        void add_sample(double x, double y, const color& c) {
+            const int reach = filter.reach();
+            const int i = static_cast<int>(floor(x)), j = static_cast<int>(floor(y));
+            const int x0 = max(i - reach, 0), x1 = min(i + reach, width - 1);
+            const int y0 = max(j - reach, 0), y1 = min(j + reach, height - 1);
+            float wx[max_span], wy[max_span];
+            for (int p = x0 ; p <= x1 ; ++p) wx[p - x0] = static_cast<float>(filter.weight(p + 0.5 - x));
+            for (int q = y0 ; q <= y1 ; ++q) wy[q - y0] = static_cast<float>(filter.weight(q + 0.5 - y));
+            for (int q = y0 ; q <= y1 ; ++q) {
+                for (int p = x0 ; p <= x1 ; ++p) {
+                    float w = wx[p - x0] * wy[q - y0];
+                    if (w == 0) continue;
+                    atomic<float>* s = &sums[4 * ((static_cast<size_t>(q) * width) + p)];
+                    shared_add(s[0], w * static_cast<float>(c.x()));
+                    shared_add(s[1], w * static_cast<float>(c.y()));
+                    shared_add(s[2], w * static_cast<float>(c.z()));
+                    shared_add(s[3], w);
+                }
+            }
+        }
+
+        // void resolve(framebuffer& out) const
+        // - the image so far into out, as averages (write it with one sample per
+        //   pixel); pixels no sample has reached are black
+        // - call it while no thread is adding samples
+        void resolve(framebuffer& out) const {
+            out.sample_counts.clear();
+            for (size_t k = 0 ; k < out.pixels.size() ; ++k) {
+                const atomic<float>* s = &sums[4 * k];
+                float w = s[3].load(memory_order_relaxed);
+                out.pixels[k] = w > 0 ? color(s[0].load(memory_order_relaxed) / w, s[1].load(memory_order_relaxed) / w,
+                                              s[2].load(memory_order_relaxed) / w)
+                                      : color(0, 0, 0);
+            }
+        }
+
+    private:
+        friend class film_tile;
+
+        static const int max_span = 2 * static_cast<int>(pixel_filter::max_radius) + 1;
+
+        unique_ptr<atomic<float>[]> sums;      // r, g, b, weight per pixel, rows bottom to top
+
+        static void shared_add(atomic<float>& sum, float v) {
+            float old = sum.load(memory_order_relaxed);
+            while (!sum.compare_exchange_weak(old, old + v, memory_order_relaxed)) {}
+        }
+
+};
+
+inline film_tile::film_tile(const film& f, const tile& t)
+    : source(t), filter(f.filter), reach(f.filter.reach()), sums(thread_buffer()) {
+    bounds = { max(t.x0 - reach, 0), max(t.y0 - reach, 0), min(t.x1 + reach, f.width), min(t.y1 + reach, f.height) };
+    sums.assign(4 * static_cast<size_t>(bounds.x1 - bounds.x0) * (bounds.y1 - bounds.y0), 0.0f);
+}
+
+inline void film_tile::add_sample(double x, double y, const color& c) {
+    const int i = static_cast<int>(floor(x)), j = static_cast<int>(floor(y));
+    const int x0 = max(i - reach, bounds.x0), x1 = min(i + reach, bounds.x1 - 1);
+    const int y0 = max(j - reach, bounds.y0), y1 = min(j + reach, bounds.y1 - 1);
+    float wx[film::max_span], wy[film::max_span];
+    for (int p = x0 ; p <= x1 ; ++p) wx[p - x0] = static_cast<float>(filter.weight(p + 0.5 - x));
+    for (int q = y0 ; q <= y1 ; ++q) wy[q - y0] = static_cast<float>(filter.weight(q + 0.5 - y));
+    const float rgb[3] = { static_cast<float>(c.x()), static_cast<float>(c.y()), static_cast<float>(c.z()) };
+    const int row = bounds.x1 - bounds.x0;
+    for (int q = y0 ; q <= y1 ; ++q) {
+        float* s = &sums[4 * ((static_cast<size_t>(q - bounds.y0) * row) + (x0 - bounds.x0))];
+        for (int p = x0 ; p <= x1 ; ++p, s += 4) {
+            float w = wx[p - x0] * wy[q - y0];
+            s[0] += w * rgb[0];
+            s[1] += w * rgb[1];
+            s[2] += w * rgb[2];
+            s[3] += w;
+        }
+    }
+}
+
+#endif
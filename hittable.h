@@ -4,16 +4,35 @@
 #define HITTABLE_H
 
 #include "rtweekend.h"
-
-class material;
+#include "aabb.h"
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    uint32_t material_id;   // index into the scene's material_table
+    real t;
+    real p_error = 0;       // bound on the distance of p from the true surface (float builds)
+    real u = 0, v = 0;      // texture coordinates of p, see texture_uv()
+    real uv_extent = 0;     // distance on the surface one unit of u or v spans around p, 0 without coordinates
+    vec3 sphere_dir;        // for a sphere, p less the centre in the sphere's own space; else zero
     bool front_face;
 
+    // void texture_uv(real& tu, real& tv) const
+    // - the texture coordinates of p: u and v as the object set them or, on a
+    //   sphere, worked out from sphere_dir: u goes once around the y axis
+    //   starting at -x and v from the bottom pole to the top
+    void texture_uv(real& tu, real& tv) const {
+        real r2 = sphere_dir.length_squared();
+        if (r2 == 0) {
+            tu = u;
+            tv = v;
+            return;
+        }
+        real y = -sphere_dir.y() / sqrt(r2);
+        tu = static_cast<real>((atan2(-sphere_dir.z(), sphere_dir.x()) + pi) / (2 * pi));
+        tv = static_cast<real>(acos(fmax(real(-1), fmin(y, real(1)))) / pi);
+    }
+
     // set_face_normal(const ray& r, const vec3& outward_normal)
     // - takes in a ray and the outward_normal and determines whether
     //   the ray is front-facing (against the normal)
@@ -27,7 +46,50 @@ struct hit_record {
 class hittable {
 
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+
+        // virtual bool bounding_box(aabb& output_box) const
+        // - stores a box enclosing the whole object in output_box; returns false
+        //   for objects that can't be bounded (e.g. infinite planes)
+        virtual bool bounding_box(aabb& output_box) const = 0;
+
+        // virtual void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const
+        // - closest hit for every ray of a packet; lane k is tested in [t_min, t_max[k]],
+        //   and on a hit recs[k] is filled, hits[k] set and t_max[k] narrowed
+        // - hits[] is only ever set, never cleared, so one packet can be run against
+        //   several objects; the default just loops over the rays
+        // - the packet is padded (ray_packet::pad) and t_max has max_size entries,
+        //   -infinity past p.size, so overrides may run the full lane width
+        virtual void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const {
+            for (int k = 0 ; k < p.size ; ++k) {
+                if (hit(p.get(k), t_min, t_max[k], recs[k])) {
+                    hits[k] = true;
+                    t_max[k] = recs[k].t;
+                }
+            }
+        }
+
+        // virtual bool occluded(const ray& r, real t_min, real t_max) const
+        // - whether anything at all is hit in [t_min, t_max], for shadow rays:
+        //   overrides stop at the first hit instead of looking for the closest
+        //   and fill in no hit_record; the default asks hit()
+        virtual bool occluded(const ray& r, real t_min, real t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // virtual bool animated() const
+        // - true for objects that move over time, or that contain ones that do
+        virtual bool animated() const { return false; }
+
+        // virtual bool update(double time0, double time1)
+        // - moves the object to the shutter interval [time0, time1] of the next
+        //   frame: rays cast in it see the object where it is at their time(), and
+        //   the bounding box covers the whole interval
+        // - returns true if the bounding box changed; static objects never change
+        virtual bool update(double /*time0*/, double /*time1*/) { return false; }
+
+        virtual ~hittable() {}
 
 };
 
@@ -24,9 +24,9 @@ class hittable_list : public hittable {
         void clear() { objects.clear(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-        // virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+        // virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
         // - 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
             hit_record temp_rec;
             bool hit_anything = false;
             auto closest_so_far = t_max;
@@ -42,6 +42,42 @@ class hittable_list : public hittable {
             return hit_anything;
         }
 
+        virtual void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override {
+            for (const auto& object : objects)
+                object->hit_packet(p, t_min, t_max, recs, hits);
+        }
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override {
+            for (const auto& object : objects)
+                if (object->occluded(r, t_min, t_max)) return true;
+            return false;
+        }
+
+        virtual bool animated() const override {
+            for (const auto& object : objects)
+                if (object->animated()) return true;
+            return false;
+        }
+
+        virtual bool update(double time0, double time1) override {
+            bool changed = false;
+            for (const auto& object : objects)
+                changed |= object->update(time0, time1);
+            return changed;
+        }
+
+        virtual bool bounding_box(aabb& output_box) const override {
+            if (objects.empty()) return false;
+
+            aabb temp_box;
+            output_box = aabb();
+            for (const auto& object : objects) {
+                if (!object->bounding_box(temp_box)) return false;
+                output_box.grow(temp_box);
+            }
+            return true;
+        }
+
 };
 
 #endif
\ No newline at end of file
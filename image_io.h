@@ -0,0 +1,313 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "rtweekend.h"
+
+#include "renderer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// IMAGE OUTPUT
+// - the finished framebuffer holds per-pixel sums of samples; every format is
+//   encoded into one in-memory buffer and written with a single call
+// - ppm: binary P6, ppm_ascii: the original P3 text, png: 8-bit RGB (stored
+//   deflate, no compression), pfm: linear 32-bit float RGB for HDR tools
+enum class image_format { ppm, ppm_ascii, png, pfm };
+
+inline bool parse_image_format(const char* name, image_format& f) {
+    if (strcmp(name, "ppm") == 0) { f = image_format::ppm; return true; }
+    if (strcmp(name, "p3") == 0) { f = image_format::ppm_ascii; return true; }
+    if (strcmp(name, "png") == 0) { f = image_format::png; return true; }
+    if (strcmp(name, "pfm") == 0) { f = image_format::pfm; return true; }
+    return false;
+}
+
+// image_format format_from_path(const string& path, image_format fallback)
+// - picks the format from the file extension; fallback for stdout or an unknown one
+inline image_format format_from_path(const string& path, image_format fallback) {
+    size_t dot = path.rfind('.');
+    if (dot == string::npos) return fallback;
+    image_format f = fallback;
+    parse_image_format(path.c_str() + dot + 1, f);
+    return f;
+}
+
+// string frame_path(const string& pattern, int frame)
+// - the file name of one frame of a sequence: the first run of '#' in pattern
+//   replaced by the frame number, zero padded to its length, or "_NNNN" put in
+//   front of the extension if pattern has no '#'
+inline string frame_path(const string& pattern, int frame) {
+    string number = to_string(frame);
+    size_t first = pattern.find('#');
+    if (first == string::npos) {
+        size_t slash = pattern.rfind('/');
+        size_t dot = pattern.rfind('.');
+        if (dot == string::npos || (slash != string::npos && dot < slash)) dot = pattern.size();
+        return pattern.substr(0, dot) + "_" + string(number.size() < 4 ? 4 - number.size() : 0, '0') + number +
+               pattern.substr(dot);
+    }
+    size_t last = pattern.find_first_not_of('#', first);
+    if (last == string::npos) last = pattern.size();
+    size_t width = last - first;
+    if (number.size() < width) number.insert(0, width - number.size(), '0');
+    return pattern.substr(0, first) + number + pattern.substr(last);
+}
+
+// const double* row_doubles(const color* pixels, int n, vector<double>& scratch)
+// - the n pixels from pixels on as 3 * n consecutive doubles: the framebuffer's
+//   own memory when color is three packed doubles, otherwise a copy in scratch
+inline const double* row_doubles(const color* pixels, int n, vector<double>& scratch) {
+    if constexpr (is_same<real, double>::value && vec3_lanes == 3) {
+        return reinterpret_cast<const double*>(pixels);
+    } else {
+        scratch.resize(static_cast<size_t>(n) * 3);
+        for (int k = 0 ; k < n ; ++k)
+            for (int c = 0 ; c < 3 ; ++c)
+                scratch[(static_cast<size_t>(k) * 3) + c] = pixels[k][c];
+        return scratch.data();
+    }
+}
+
+// void quantize_rgb8(const framebuffer& fb, int samples_per_pixel, vector<uint8_t>& out)
+// - averages, gamma corrects (gamma 2), clamps and quantizes the whole image in
+//   one pass, rows top to bottom as every 8-bit format stores them
+// - works on each row as a flat array of doubles, two at a time with SSE2;
+//   the scalar loop gives the same bytes as write_color()
+inline void quantize_rgb8(const framebuffer& fb, int samples_per_pixel, vector<uint8_t>& out) {
+    const size_t row_values = static_cast<size_t>(fb.width) * 3;
+    const double scale = 1.0 / samples_per_pixel;
+    out.resize(row_values * fb.height);
+    vector<double> scratch;
+
+    for (int y = 0 ; y < fb.height ; ++y) {
+        // PPM rows go top to bottom, the framebuffer's j runs bottom to top
+        const double* src = row_doubles(&fb.at(0, fb.height - 1 - y), fb.width, scratch);
+        uint8_t* dst = out.data() + (row_values * y);
+        size_t k = 0;
+        if (!fb.sample_counts.empty()) {
+            // adaptive sampling: every pixel has its own sample count
+            const size_t row_start = static_cast<size_t>(fb.height - 1 - y) * fb.width;
+            for ( ; k < row_values ; ++k) {
+                double v = sqrt(fmax(src[k] * fb.sample_scale(row_start + (k / 3), samples_per_pixel), 0.0));
+                dst[k] = static_cast<uint8_t>(256 * fmin(v, 0.999));
+            }
+            continue;
+        }
+#if defined(__SSE2__)
+        const __m128d vscale = _mm_set1_pd(scale);
+        const __m128d vzero = _mm_setzero_pd();
+        const __m128d vmax = _mm_set1_pd(0.999);
+        const __m128d v256 = _mm_set1_pd(256.0);
+        for ( ; k + 2 <= row_values ; k += 2) {
+            __m128d v = _mm_max_pd(_mm_mul_pd(_mm_loadu_pd(src + k), vscale), vzero);
+            v = _mm_mul_pd(_mm_min_pd(_mm_sqrt_pd(v), vmax), v256);
+            __m128i q = _mm_cvttpd_epi32(v);
+            dst[k] = static_cast<uint8_t>(_mm_cvtsi128_si32(q));
+            dst[k + 1] = static_cast<uint8_t>(_mm_cvtsi128_si32(_mm_srli_si128(q, 4)));
+        }
+#endif
+        for ( ; k < row_values ; ++k) {
+            double v = sqrt(fmax(src[k] * scale, 0.0));
+            dst[k] = static_cast<uint8_t>(256 * fmin(v, 0.999));
+        }
+    }
+}
+
+// PNG HELPERS
+inline uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t n) {
+    static const vector<uint32_t> table = [] {
+        vector<uint32_t> t(256);
+        for (uint32_t i = 0 ; i < 256 ; ++i) {
+            uint32_t c = i;
+            for (int bit = 0 ; bit < 8 ; ++bit)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0 ; i < n ; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline void append_be32(string& out, uint32_t v) {
+    const char bytes[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) };
+    out.append(bytes, 4);
+}
+
+inline void append_png_chunk(string& out, const char* type, const string& data) {
+    append_be32(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.append(type, 4);
+    out += data;
+    append_be32(out, crc32_update(0, reinterpret_cast<const uint8_t*>(out.data() + start), out.size() - start));
+}
+
+// string zlib_stored(const vector<uint8_t>& raw)
+// - wraps raw in a zlib stream of uncompressed (stored) deflate blocks
+inline string zlib_stored(const vector<uint8_t>& raw) {
+    const size_t max_block = 65535;
+    string z;
+    z.reserve(raw.size() + (raw.size() / max_block + 1) * 5 + 6);
+    z += char(0x78);
+    z += char(0x01);
+
+    uint32_t a = 1, b = 0;
+    size_t pos = 0;
+    do {
+        size_t n = min(max_block, raw.size() - pos);
+        bool last = pos + n == raw.size();
+        z += char(last ? 1 : 0);
+        z += char(n & 0xff);
+        z += char(n >> 8);
+        z += char(~n & 0xff);
+        z += char((~n >> 8) & 0xff);
+        z.append(reinterpret_cast<const char*>(raw.data() + pos), n);
+
+        // adler32, reduced often enough that the sums cannot overflow
+        for (size_t i = 0 ; i < n ; i += 5552) {
+            size_t end = min(n, i + 5552);
+            for (size_t j = i ; j < end ; ++j) {
+                a += raw[pos + j];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        pos += n;
+    } while (pos < raw.size());
+
+    append_be32(z, (b << 16) | a);
+    return z;
+}
+
+// void encode_rgb8(int width, int height, const vector<uint8_t>& rgb, image_format format, string& out)
+// - encodes 8-bit RGB rows (top to bottom) into out; pfm gets the bytes / 255
+inline void encode_rgb8(int width, int height, const vector<uint8_t>& rgb, image_format format, string& out) {
+    out.clear();
+    const size_t row_bytes = static_cast<size_t>(width) * 3;
+
+    if (format == image_format::pfm) {
+        out = "PF\n" + to_string(width) + ' ' + to_string(height) + "\n-1.0\n";
+        size_t header = out.size();
+        out.resize(header + (rgb.size() * sizeof(float)));
+        float* dst = reinterpret_cast<float*>(&out[header]);
+        for (int y = 0 ; y < height ; ++y)
+            for (size_t k = 0 ; k < row_bytes ; ++k)
+                dst[(row_bytes * y) + k] = rgb[(row_bytes * (height - 1 - y)) + k] * (1.0f / 255);
+    } else if (format == image_format::ppm) {
+        out = "P6\n" + to_string(width) + ' ' + to_string(height) + "\n255\n";
+        out.append(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    } else if (format == image_format::ppm_ascii) {
+        out = "P3\n" + to_string(width) + ' ' + to_string(height) + "\n255\n";
+        out.reserve(out.size() + (rgb.size() * 4));
+        char line[16];
+        for (size_t k = 0 ; k < rgb.size() ; k += 3) {
+            int n = snprintf(line, sizeof(line), "%d %d %d\n", rgb[k], rgb[k + 1], rgb[k + 2]);
+            out.append(line, n);
+        }
+    } else {
+        // every scanline gets filter type 0 (none)
+        vector<uint8_t> raw((row_bytes + 1) * height);
+        for (int y = 0 ; y < height ; ++y) {
+            raw[(row_bytes + 1) * y] = 0;
+            memcpy(&raw[((row_bytes + 1) * y) + 1], &rgb[row_bytes * y], row_bytes);
+        }
+
+        string ihdr;
+        append_be32(ihdr, width);
+        append_be32(ihdr, height);
+        ihdr += char(8);    // bit depth
+        ihdr += char(2);    // truecolor RGB
+        ihdr.append(3, char(0));
+
+        out.assign("\x89PNG\r\n\x1a\n", 8);
+        append_png_chunk(out, "IHDR", ihdr);
+        append_png_chunk(out, "IDAT", zlib_stored(raw));
+        append_png_chunk(out, "IEND", string());
+    }
+}
+
+// void encode_image(const framebuffer& fb, int samples_per_pixel, image_format format, string& out)
+// - encodes the whole image into out
+inline void encode_image(const framebuffer& fb, int samples_per_pixel, image_format format, string& out) {
+    out.clear();
+    const size_t row_bytes = static_cast<size_t>(fb.width) * 3;
+
+    if (format == image_format::pfm) {
+        // PFM stores rows bottom to top, the framebuffer's own order
+        out = "PF\n" + to_string(fb.width) + ' ' + to_string(fb.height) + "\n-1.0\n";
+        size_t header = out.size();
+        out.resize(header + (row_bytes * fb.height * sizeof(float)));
+        float* dst = reinterpret_cast<float*>(&out[header]);
+        for (size_t k = 0 ; k < fb.pixels.size() ; ++k) {
+            const double scale = fb.sample_scale(k, samples_per_pixel);
+            for (int c = 0 ; c < 3 ; ++c)
+                dst[(3 * k) + c] = static_cast<float>(fb.pixels[k][c] * scale);
+        }
+        return;
+    }
+
+    vector<uint8_t> rgb;
+    quantize_rgb8(fb, samples_per_pixel, rgb);
+    encode_rgb8(fb.width, fb.height, rgb, format, out);
+}
+
+// bool write_encoded(const string& data, const string& path)
+// - writes an encoded image to path ("-" for stdout); false if the file cannot be written
+inline bool write_encoded(const string& data, const string& path) {
+    bool to_stdout = path.empty() || path == "-";
+    FILE* f = to_stdout ? stdout : fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (to_stdout) ok = (fflush(f) == 0) && ok;
+    else ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+// bool write_image(const framebuffer& fb, int samples_per_pixel, image_format format, const string& path)
+// - encodes fb and writes it to path ("-" for stdout)
+inline bool write_image(const framebuffer& fb, int samples_per_pixel, image_format format, const string& path) {
+    string data;
+    encode_image(fb, samples_per_pixel, format, data);
+    return write_encoded(data, path);
+}
+
+// bool write_rgb8(int width, int height, const vector<uint8_t>& rgb, image_format format, const string& path)
+// - encodes 8-bit RGB rows (top to bottom) and writes them to path
+inline bool write_rgb8(int width, int height, const vector<uint8_t>& rgb, image_format format, const string& path) {
+    string data;
+    encode_rgb8(width, height, rgb, format, data);
+    return write_encoded(data, path);
+}
+
+// bool read_pfm(const string& path, int& width, int& height, vector<float>& rgb)
+// - reads a color PFM as written by encode_image (little endian, rows bottom to
+//   top) into width * height * 3 floats; false for anything else
+inline bool read_pfm(const string& path, int& width, int& height, vector<float>& rgb) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    float scale = 0;
+    bool ok = fscanf(f, "PF %d %d %f", &width, &height, &scale) == 3 && fgetc(f) == '\n' &&
+              width > 0 && height > 0 && scale < 0;
+    if (ok) {
+        rgb.resize(static_cast<size_t>(width) * height * 3);
+        ok = fread(rgb.data(), sizeof(float), rgb.size(), f) == rgb.size();
+    }
+    fclose(f);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "affine.h"
+#include "hittable.h"
+#include "profile.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// INSTANCES
+// - shared geometry (a sphere, a mesh, a whole bvh of objects) placed in the
+//   world by an affine map and optionally given another material
+// - a ray is taken into the geometry's own space instead of the geometry into
+//   the world: the direction is transformed but not normalized, so a hit's t
+//   is the same in both spaces and t_min / t_max need no conversion
+// - the hit is brought back out: the point by the map, the normal by its
+//   inverse transpose; front_face does not change, since the map
+//   keeps the sign of dot(direction, normal)
+
+static constexpr uint32_t keep_material = UINT32_MAX;     // an instance without a material of its own
+
+// ray local_ray(const affine& xf, const ray& r)
+// - r in the space of geometry placed by xf
+inline ray local_ray(const affine& xf, const ray& r) {
+    return ray(xf.inverse_point(r.origin()), xf.inverse_vector(r.direction()), r.time());
+}
+
+// bool hit_instance(const hittable& geometry, const affine& xf, uint32_t material, const ray& r, real t_min, real t_max, hit_record& rec)
+// - r against geometry placed by xf, in world space; material replaces the
+//   geometry's unless it is keep_material
+inline bool hit_instance(const hittable& geometry, const affine& xf, uint32_t material, const ray& r,
+                         real t_min, real t_max, hit_record& rec) {
+    if (!geometry.hit(local_ray(xf, r), t_min, t_max, rec)) return false;
+
+    const point3 p = rec.p;
+    rec.p = xf.point(p);
+#ifdef RAYTRACER_FLOAT
+    // the geometry's own error, stretched by the map, and the rounding of the map
+    real extent = (xf.max_scale() * fmax(fabs(p.x()), fmax(fabs(p.y()), fabs(p.z())))) +
+                  fmax(fabs(rec.p.x()), fmax(fabs(rec.p.y()), fabs(rec.p.z())));
+    rec.p_error = (rec.p_error * xf.max_scale()) + (4 * numeric_limits<real>::epsilon() * extent);
+#endif
+    rec.normal = unit_vector(xf.normal(rec.normal));
+    rec.uv_extent *= xf.max_scale();
+    if (material != keep_material) rec.material_id = material;
+    return true;
+}
+
+// class instance
+// - one placement of shared geometry, for a handful of them in a
+//   hittable_list; many placements belong in an instance_set
+class instance : public hittable {
+
+    public:
+        // MEMBERS
+        shared_ptr<const hittable> geometry;
+        affine xf;
+        uint32_t material;
+
+    public:
+        // CONSTRUCTORS
+        instance(shared_ptr<const hittable> g, const affine& t, uint32_t m = keep_material)
+            : geometry(move(g)), xf(t), material(m) {}
+
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            return hit_instance(*geometry, xf, material, r, t_min, t_max, rec);
+        }
+
+        bool occluded(const ray& r, real t_min, real t_max) const override {
+            return geometry->occluded(local_ray(xf, r), t_min, t_max);
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            aabb local;
+            if (!geometry->bounding_box(local)) return false;
+            output_box = xf.box(local);
+            return true;
+        }
+
+};
+
+// struct instance_stats
+struct instance_stats {
+    size_t prototypes = 0;
+    size_t instances = 0;
+    size_t memory_bytes = 0;        // placements and top level hierarchy, not the prototypes
+    bvh_stats tree;
+};
+
+inline ostream& operator<<(ostream& out, const instance_stats& s) {
+    return out << "instances: " << s.instances << " of " << s.prototypes << " prototypes, "
+               << s.memory_bytes / (1024 * 1024) << " MiB, " << s.tree;
+}
+
+// class instance_set
+// - two level acceleration: every prototype keeps its own hierarchy (a
+//   triangle_mesh's, or a bvh over a sub-scene) and the set builds one more
+//   over the placements' boxes, so traversal goes down the top level, into a
+//   placement's space and down its prototype's
+// - a placement is an affine map, a prototype index and a material: about a
+//   hundred bytes with its share of the top level, however big the prototype,
+//   so memory follows the unique geometry and not the number of instances
+// - the placements are reordered into the top level's leaf order, like a
+//   mesh's triangles; prototypes must have a bounding box
+class instance_set : public hittable {
+
+    public:
+        struct placement {
+            affine xf;
+            uint32_t prototype;
+            uint32_t material;
+        };
+
+        // MEMBERS
+        vector<shared_ptr<const hittable>> prototypes;
+        vector<placement> placements;
+        vector<bvh_float_node> nodes;
+        instance_stats stats;
+
+    public:
+        // uint32_t add_prototype(shared_ptr<const hittable> geometry)
+        // - the index to place geometry by
+        uint32_t add_prototype(shared_ptr<const hittable> geometry) {
+            prototypes.push_back(move(geometry));
+            return static_cast<uint32_t>(prototypes.size() - 1);
+        }
+
+        // void add(uint32_t prototype, const affine& xf, uint32_t material = keep_material)
+        // - places a prototype; build() must run before the set is traced
+        void add(uint32_t prototype, const affine& xf, uint32_t material = keep_material) {
+            placements.push_back({ xf, prototype, material });
+        }
+
+        // void build(int max_leaf = 4)
+        // - builds the top level over the placements added so far
+        void build(int max_leaf = 4) {
+            auto start = chrono::steady_clock::now();
+            vector<aabb> prototype_boxes(prototypes.size());
+            vector<bool> bounded(prototypes.size());
+            for (size_t k = 0 ; k < prototypes.size() ; ++k)
+                bounded[k] = prototypes[k]->bounding_box(prototype_boxes[k]);
+
+            vector<bvh_build_ref> refs;
+            refs.reserve(placements.size());
+            for (size_t k = 0 ; k < placements.size() ; ++k) {
+                const placement& p = placements[k];
+                if (p.prototype >= prototypes.size() || !bounded[p.prototype]) continue;
+                aabb box = p.xf.box(prototype_boxes[p.prototype]);
+                refs.push_back({ box, box.centroid(), static_cast<int>(k) });
+            }
+
+            vector<bvh_node> built;
+            vector<int> order;
+            stats.tree = bvh_stats();
+            bvh_builder(max_leaf).build(refs, built, order, stats.tree);
+            vector<bvh_build_ref>().swap(refs);
+            nodes.clear();
+            nodes.reserve(built.size());
+            for (const bvh_node& n : built) nodes.emplace_back(n);
+            nodes.shrink_to_fit();
+
+            vector<placement> sorted;
+            sorted.reserve(order.size());
+            for (int index : order) sorted.push_back(placements[index]);
+            placements.swap(sorted);
+
+            stats.prototypes = prototypes.size();
+            stats.instances = placements.size();
+            stats.tree.primitives = placements.size();
+            stats.tree.node_count = nodes.size();
+            stats.tree.build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            stats.memory_bytes = (placements.capacity() * sizeof(placement)) + (nodes.capacity() * sizeof(bvh_float_node)) +
+                                 (prototypes.capacity() * sizeof(shared_ptr<const hittable>));
+        }
+
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            if (nodes.empty()) return false;
+
+            const vec3 dir = r.direction();
+            const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+            const bool dir_negative[3] = { dir.x() < 0, dir.y() < 0, dir.z() < 0 };
+
+            bool hit_anything = false;
+            int stack[64];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const bvh_float_node& n = nodes[current];
+                profile_count(&profile_counters::box_tests);
+                if (n.hit(r.origin(), inv_dir, t_min, t_max)) {
+                    if (n.count > 0) {
+                        for (int k = n.first ; k < n.first + n.count ; ++k) {
+                            const placement& p = placements[k];
+                            if (hit_instance(*prototypes[p.prototype], p.xf, p.material, r, t_min, t_max, rec)) {
+                                hit_anything = true;
+                                t_max = rec.t;
+                            }
+                        }
+                    } else if (dir_negative[n.axis]) {
+                        stack[stack_size++] = current + 1;
+                        current = n.first;
+                        continue;
+                    } else {
+                        stack[stack_size++] = n.first;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+
+        bool occluded(const ray& r, real t_min, real t_max) const override {
+            if (nodes.empty()) return false;
+
+            const vec3 dir = r.direction();
+            const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+
+            int stack[64];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const bvh_float_node& n = nodes[current];
+                profile_count(&profile_counters::box_tests);
+                if (n.hit(r.origin(), inv_dir, t_min, t_max)) {
+                    if (n.count > 0) {
+                        for (int k = n.first ; k < n.first + n.count ; ++k) {
+                            const placement& p = placements[k];
+                            if (prototypes[p.prototype]->occluded(local_ray(p.xf, r), t_min, t_max)) return true;
+                        }
+                    } else {
+                        stack[stack_size++] = n.first;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            return false;
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            if (nodes.empty()) return false;
+            output_box = nodes[0].box();
+            return true;
+        }
+
+};
+
+#endif
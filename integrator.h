@@ -0,0 +1,404 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "light.h"
+#include "material.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+using namespace std;
+
+// RAY COUNTING
+// - every traced ray bumps a thread-local counter; workers flush it into the
+//   global total once per pixel or tile so the hot path never touches an atomic
+inline uint64_t& thread_ray_count() {
+    thread_local uint64_t count = 0;
+    return count;
+}
+
+inline atomic<uint64_t>& total_ray_count() {
+    static atomic<uint64_t> count(0);
+    return count;
+}
+
+// struct path_stats
+// - how the paths of a render ended and how many rays each one traced
+// - depth_counts[d] is the number of paths that traced exactly d rays
+struct path_stats {
+    vector<uint64_t> depth_counts;
+    uint64_t escaped = 0;       // left the scene and picked up the sky
+    uint64_t absorbed = 0;      // the material did not scatter
+    uint64_t roulette = 0;      // killed by Russian roulette
+    uint64_t truncated = 0;     // reached max_depth
+
+    uint64_t paths() const { return escaped + absorbed + roulette + truncated; }
+
+    void record(int depth) {
+        if (depth >= static_cast<int>(depth_counts.size()))
+            depth_counts.resize(depth + 1, 0);
+        depth_counts[depth]++;
+    }
+
+    // void clear()
+    // - zeroes the counts but keeps depth_counts' memory, so the per-thread stats
+    //   flushed after every pixel do not go back to the heap each time
+    void clear() {
+        fill(depth_counts.begin(), depth_counts.end(), 0);
+        escaped = absorbed = roulette = truncated = 0;
+    }
+
+    void merge(path_stats& other) {
+        if (other.depth_counts.size() > depth_counts.size())
+            depth_counts.resize(other.depth_counts.size(), 0);
+        for (size_t d = 0 ; d < other.depth_counts.size() ; ++d)
+            depth_counts[d] += other.depth_counts[d];
+        escaped += other.escaped;
+        absorbed += other.absorbed;
+        roulette += other.roulette;
+        truncated += other.truncated;
+    }
+
+    double mean_depth() const {
+        uint64_t n = 0, sum = 0;
+        for (size_t d = 0 ; d < depth_counts.size() ; ++d) {
+            n += depth_counts[d];
+            sum += d * depth_counts[d];
+        }
+        return n ? double(sum) / n : 0.0;
+    }
+
+    // void print_histogram(ostream& out) const
+    // - one line per depth with the share of paths that ended there and the
+    //   cumulative share, i.e. what fraction of paths a given max_depth keeps whole
+    void print_histogram(ostream& out) const {
+        const double n = static_cast<double>(paths());
+        if (n == 0) return;
+        uint64_t cumulative = 0;
+        out << "depth      paths        %   cumul. %\n";
+        for (size_t d = 0 ; d < depth_counts.size() ; ++d) {
+            if (depth_counts[d] == 0) continue;
+            cumulative += depth_counts[d];
+            char line[80];
+            snprintf(line, sizeof(line), "%5zu %10llu %8.3f %10.3f\n", d,
+                     static_cast<unsigned long long>(depth_counts[d]),
+                     100.0 * depth_counts[d] / n, 100.0 * cumulative / n);
+            out << line;
+        }
+    }
+};
+
+inline ostream& operator<<(ostream& out, const path_stats& s) {
+    const double n = s.paths() ? static_cast<double>(s.paths()) : 1.0;
+    return out << "paths: " << s.paths() << ", mean depth " << s.mean_depth()
+               << ", escaped " << 100.0 * s.escaped / n << "%, absorbed " << 100.0 * s.absorbed / n
+               << "%, roulette " << 100.0 * s.roulette / n << "%, max depth " << 100.0 * s.truncated / n << '%';
+}
+
+inline path_stats& thread_path_stats() {
+    thread_local path_stats stats;
+    return stats;
+}
+
+inline path_stats& total_path_stats() {
+    static path_stats stats;
+    return stats;
+}
+
+// void flush_render_stats()
+// - adds the thread's ray count and path stats to the totals and resets them
+inline void flush_render_stats() {
+    static mutex stats_mutex;
+    total_ray_count() += thread_ray_count();
+    thread_ray_count() = 0;
+
+    path_stats& local = thread_path_stats();
+    lock_guard<mutex> lock(stats_mutex);
+    total_path_stats().merge(local);
+    local.clear();
+}
+
+// MATERIAL TRACKING
+// - a thread that points thread_material_mask() at a bitset gets the bit of
+//   every material its paths hit set in it; the preview server (preview.h)
+//   keeps one per tile, so editing a material restarts only the tiles whose
+//   samples saw it. Null, the default, costs a test per bounce
+inline uint64_t*& thread_material_mask() {
+    thread_local uint64_t* mask = nullptr;
+    return mask;
+}
+
+// bool survives_roulette(color& throughput, int depth, int rr_depth)
+// - Russian roulette: from bounce rr_depth on, a path carries on with probability
+//   equal to its brightest throughput channel (at most 0.95) and the survivors
+//   are reweighted by 1 / p, so the estimate stays unbiased while dim paths stop
+//   early; rr_depth = 0 disables it
+inline bool survives_roulette(color& throughput, int depth, int rr_depth) {
+    if (rr_depth <= 0 || depth < rr_depth)
+        return true;
+    double p = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+    if (random_double() >= p)
+        return false;
+    throughput /= p;
+    return true;
+}
+
+// SELF-INTERSECTION
+// - ray_t_min is where every ray's search interval starts; 0.001 is the book's
+//   epsilon and in double it is all the protection there is
+// - float cannot rely on a fixed epsilon: the scattered rays start off the
+//   surface by the hit's error bound (offset_ray_origin) and the sphere roots
+//   avoid cancellation (sphere::hit), so no epsilon is needed and contact
+//   shadows closer than 0.001 are kept
+#ifdef RAYTRACER_FLOAT
+const real ray_t_min = 0;
+#else
+const real ray_t_min = 0.001;
+#endif
+
+// ray spawn_ray(const hit_record& rec, const ray& scattered)
+// - scattered with its origin moved off the surface it leaves
+inline ray spawn_ray(const hit_record& rec, const ray& scattered) {
+    return ray(offset_ray_origin(scattered.origin(), rec.p_error, rec.normal, scattered.direction()), scattered.direction(),
+               scattered.time());
+}
+
+// color sky_color(const ray& r)
+// - the background: a vertical white to blue gradient
+inline color sky_color(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direction());
+    auto t = 0.5 * (unit_direction.y() + 1.0);
+
+    // linear interpolation
+    // blendedValue = (1 - t) * startValue + (t * endValue)
+    return (1.0 - t) * color(1.0, 1.0, 1.0) + (t * color(0.5, 0.7, 1.0));
+}
+
+// ray primary_ray(const camera& cam, const pixel_sampler& sampler, int i, int j, int image_width, int image_height, double& film_x, double& film_y)
+// - the camera ray of the sampler's current sample through pixel (i, j), at a
+//   time inside the shutter interval if the camera's shutter is open
+// - its cone starts at the lens with the angle of one pixel
+// - film_x and film_y receive where in the pixel the sample is, in pixels
+//   from the image's bottom left corner (film.h)
+inline ray primary_ray(const camera& cam, const pixel_sampler& sampler, int i, int j, int image_width, int image_height,
+                       double& film_x, double& film_y) {
+    double px, py, lx, ly;
+    sampler.pixel_offset(px, py);
+    sampler.lens_offset(lx, ly);
+    film_x = i + px;
+    film_y = j + py;
+    auto u = film_x / (image_width - 1);
+    auto v = film_y / (image_height - 1);
+    ray r = cam.shutter_is_open() ? cam.get_ray(u, v, lx, ly, sampler.time_offset()) : cam.get_ray(u, v, lx, ly);
+    r.cone_spread = static_cast<real>(cam.pixel_spread(image_height));
+    return r;
+}
+
+inline ray primary_ray(const camera& cam, const pixel_sampler& sampler, int i, int j, int image_width, int image_height) {
+    double film_x, film_y;
+    return primary_ray(cam, sampler, i, j, image_width, image_height, film_x, film_y);
+}
+
+// TEXTURE LOOKUPS
+// - a textured lambertian or metal multiplies its albedo by its texture at the
+//   hit (texture.h); how blurred a lookup is comes from the ray cone: a cone
+//   as wide as several texels reads a coarser level of the mip pyramid
+// - a camera ray's cone has the angle of a pixel; bounces off glass and
+//   mirrors keep the angle they came with, metal's fuzz widens it, and diffuse
+//   bounces, whose rays scatter over the hemisphere, go on with at least
+//   diffuse_cone_spread (Akenine-Moller et al., "Texture Level of Detail
+//   Strategies for Real-Time Ray Tracing", Ray Tracing Gems ch. 20, without
+//   the curvature term)
+// - untextured scenes (no texture_cache in the material table) skip all of
+//   it, and textures draw no random numbers, so paths are the same either way
+const real diffuse_cone_spread = real(0.1);
+
+// real cone_width_at(const ray& r, const hit_record& rec)
+// - the width of r's cone where it hit rec
+inline real cone_width_at(const ray& r, const hit_record& rec) {
+    return r.cone_width + (r.cone_spread * rec.t * r.direction().length());
+}
+
+// color texture_tint(const material& surface, const material_table& materials, const ray& r, const hit_record& rec)
+// - what surface's albedo is multiplied by at rec; only for textured surfaces
+inline color texture_tint(const material& surface, const material_table& materials, const ray& r, const hit_record& rec) {
+    real footprint = rec.uv_extent > 0 ? cone_width_at(r, rec) / rec.uv_extent : 0;
+    real u, v;
+    rec.texture_uv(u, v);
+    return materials.textures->lookup(surface.texture(), u, v, footprint);
+}
+
+// DIRECT LIGHTING
+// - with a light_list, every diffuse hit also sends a shadow ray to a point
+//   sampled on a light (next event estimation) and the path still scatters as
+//   before; a scattered ray that then hits a light found the same light a
+//   second way, so both estimates are weighted by multiple importance sampling
+//   (Veach's power heuristic) and their weights sum to one
+// - metal and glass scatter (nearly) specularly and sample no lights: the
+//   light they reflect is only found by their scattered rays, at full weight
+// - without a light_list emitters are only found by scattered rays and paths
+//   use exactly the random numbers they did before lights existed
+
+// real power_heuristic(real pdf, real other_pdf)
+inline real power_heuristic(real pdf, real other_pdf) {
+    real a = pdf * pdf;
+    real b = other_pdf * other_pdf;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+// color direct_light(const ray& r_in, const hit_record& rec, const color& albedo, const hittable& world, const light_list& lights)
+// - light from one sampled light reaching the diffuse hit rec, of the given
+//   albedo, weighted against finding it by scattering
+inline color direct_light(const ray& r_in, const hit_record& rec, const color& albedo, const hittable& world,
+                          const light_list& lights) {
+    light_sample ls;
+    if (!lights.sample(rec.p, ls)) return color(0, 0, 0);
+    real cosine = dot(rec.normal, ls.direction);
+    if (cosine <= 0 || ls.pdf <= 0) return color(0, 0, 0);
+
+    thread_ray_count()++;
+    profile_count(&profile_counters::shadow_rays);
+    ray shadow = spawn_ray(rec, ray(rec.p, ls.direction, r_in.time()));
+    if (world.occluded(shadow, ray_t_min, lights.shadow_distance(ls.light, shadow))) return color(0, 0, 0);
+
+    real scatter_pdf = cosine / pi;
+    real weight = power_heuristic(ls.pdf, scatter_pdf);
+    return (weight * cosine / (pi * ls.pdf)) * (albedo * ls.emission);
+}
+
+// bool shade_hit(const ray& current, const hit_record& rec, const hittable& world, const material_table& materials,
+//                const light_list* lights, int depth, int rr_depth, color& throughput, real& scatter_pdf, color& radiance, ray& next)
+// - one bounce of a path whose ray current hit rec: adds the light the
+//   surface gives off and, at diffuse surfaces, the directly sampled light to
+//   radiance, then scatters into next; false when the path ends here
+// - scatter_pdf is the density of the direction current was scattered in, 0
+//   for camera rays and after specular bounces; it is updated for next
+// - shared by ray_color and packet_tracer, so both end paths by the same
+//   rules in the same order and draw the same random numbers
+inline bool shade_hit(const ray& current, const hit_record& rec, const hittable& world, const material_table& materials,
+                      const light_list* lights, int depth, int rr_depth, color& throughput, real& scatter_pdf,
+                      color& radiance, ray& next) {
+    path_stats& stats = thread_path_stats();
+    const material& surface = materials[rec.material_id];
+    if (uint64_t* mask = thread_material_mask())
+        mask[rec.material_id >> 6] |= uint64_t(1) << (rec.material_id & 63);
+    profile_material(surface.type());
+
+    if (surface.type() == material_type::emissive) {
+        real weight = 1;
+        if (lights && scatter_pdf > 0)
+            weight = power_heuristic(scatter_pdf, lights->pdf(current.origin(), rec));
+        radiance += weight * (throughput * surface.emitted(rec));
+        stats.absorbed++;
+        stats.record(depth);
+        return false;
+    }
+
+    const bool textured = surface.texture() != no_texture && materials.textures;
+    color tint = textured ? texture_tint(surface, materials, current, rec) : color(1, 1, 1);
+    if (lights && surface.diffuse()) {
+        const color& albedo = surface.get<lambertian>()->albedo;
+        radiance += throughput * direct_light(current, rec, textured ? albedo * tint : albedo, world, *lights);
+    }
+
+    ray scattered;
+    color attenuation;
+    if (!surface.scatter(current, rec, attenuation, scattered)) {
+        stats.absorbed++;
+        stats.record(depth);
+        return false;
+    }
+
+    throughput = throughput * (textured ? attenuation * tint : attenuation);
+    if (!survives_roulette(throughput, depth, rr_depth)) {
+        stats.roulette++;
+        stats.record(depth);
+        return false;
+    }
+    if (lights)
+        scatter_pdf = surface.diffuse() ? fmax(dot(rec.normal, unit_vector(scattered.direction())), real(0)) / pi : 0;
+    next = spawn_ray(rec, scattered);
+    if (materials.textures) {
+        next.cone_width = cone_width_at(current, rec);
+        next.cone_spread = current.cone_spread;
+        if (surface.diffuse())
+            next.cone_spread = fmax(next.cone_spread, diffuse_cone_spread);
+        else if (surface.type() == material_type::metal)
+            next.cone_spread += surface.get<metal>()->fuzz;
+    }
+    return true;
+}
+
+// struct path_features
+// - what a camera ray sees first, for the denoiser (denoise.h): the albedo of
+//   the surface, its normal (hit_record::normal) and its distance along the
+//   path; a ray that escapes has the sky as albedo, no normal and depth 0
+// - metal and glass are looked through to what they reflect or refract, tinted
+//   by them, so the denoiser keeps the edges of reflections instead of
+//   blurring them over the smooth surface of a mirror
+struct path_features {
+    color albedo;
+    vec3 normal;
+    real depth;
+};
+
+// color ray_color(const ray& r, const hittable& world, const material_table& materials, int max_depth, int rr_depth, const light_list* lights, path_features* features)
+// - traces a path from r: a loop that carries the product of the attenuations
+//   (the throughput) instead of recursing once per bounce
+// - a path ends when it escapes to the sky, is absorbed or hits a light, loses
+//   at Russian roulette (from bounce rr_depth on) or has traced max_depth rays
+// - lights, if given and not empty, turns on direct light sampling; features,
+//   if given, receives the path's first hit
+inline color ray_color(const ray& r, const hittable& world, const material_table& materials, int max_depth, int rr_depth = 0,
+                       const light_list* lights = nullptr, path_features* features = nullptr) {
+    path_stats& stats = thread_path_stats();
+    if (lights && lights->empty()) lights = nullptr;
+    color throughput(1, 1, 1);
+    color radiance(0, 0, 0);
+    real scatter_pdf = 0;
+    ray current = r;
+    real travelled = 0;
+
+    for (int depth = 1 ; depth <= max_depth ; ++depth) {
+        hit_record rec;
+        thread_ray_count()++;
+        profile_count(&profile_counters::rays);
+
+        if (!world.hit(current, ray_t_min, infinity, rec)) {
+            if (features) *features = { throughput * sky_color(current), vec3(0, 0, 0), 0 };
+            stats.escaped++;
+            stats.record(depth);
+            return radiance + (throughput * sky_color(current));
+        }
+        if (features) {
+            const material& surface = materials[rec.material_id];
+            travelled += rec.t * current.direction().length();
+            color albedo = surface.albedo();
+            if (surface.texture() != no_texture && materials.textures)
+                albedo = albedo * texture_tint(surface, materials, current, rec);
+            *features = { throughput * albedo, rec.normal, travelled };
+            if (surface.type() != material_type::metal && surface.type() != material_type::dielectric) features = nullptr;
+        }
+
+        ray next;
+        if (!shade_hit(current, rec, world, materials, lights, depth, rr_depth, throughput, scatter_pdf, radiance, next))
+            return radiance;
+        current = next;
+    }
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    stats.truncated++;
+    stats.record(max_depth);
+    return radiance;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+// LIGHTS
+// - the emissive spheres of a scene in a list that can be sampled directly:
+//   from a point outside a sphere the directions that reach it form a cone,
+//   and sample() picks a light (in proportion to its power) and a direction
+//   in its cone uniformly
+// - pdf() is the density sample() has for the direction towards a hit on a
+//   light, which multiple importance sampling needs when a scattered ray finds
+//   the light by chance; hits are matched to their light by material and
+//   position
+// - emitters that are not spheres in the list (emissive meshes, instances)
+//   still light the scene, found by scattered rays alone
+
+// struct sphere_light
+struct sphere_light {
+    point3 center;
+    real radius;
+    uint32_t material_id;
+    color emission;
+};
+
+// struct light_sample
+// - a direction towards a light, the light's emission and its solid angle
+//   density for the direction
+struct light_sample {
+    vec3 direction;         // unit length
+    uint32_t light;         // index in the list, for shadow_distance()
+    color emission;
+    real pdf;
+};
+
+// class light_list
+class light_list {
+
+    public:
+        // MEMBERS
+        vector<sphere_light> lights;
+
+    public:
+        // void add(const point3& center, real radius, uint32_t material_id, const color& emission)
+        void add(const point3& center, real radius, uint32_t material_id, const color& emission) {
+            lights.push_back({ center, fabs(radius), material_id, emission });
+            cdf.clear();
+        }
+
+        bool empty() const { return lights.empty(); }
+        size_t size() const { return lights.size(); }
+
+        // void prepare()
+        // - the selection probabilities, by emitted power (luminance times the
+        //   sphere's cross section); must run after the last add()
+        void prepare() {
+            cdf.assign(lights.size(), 0);
+            by_material.resize(lights.size());
+            double total = 0;
+            for (size_t k = 0 ; k < lights.size() ; ++k) {
+                const sphere_light& l = lights[k];
+                double luminance = (0.2126 * l.emission.x()) + (0.7152 * l.emission.y()) + (0.0722 * l.emission.z());
+                total += fmax(luminance, 0.0) * l.radius * l.radius;
+                cdf[k] = total;
+                by_material[k] = static_cast<uint32_t>(k);
+            }
+            for (size_t k = 0 ; k < lights.size() ; ++k)
+                cdf[k] = total > 0 ? cdf[k] / total : double(k + 1) / lights.size();
+            sort(by_material.begin(), by_material.end(), [&](uint32_t a, uint32_t b) {
+                return lights[a].material_id < lights[b].material_id;
+            });
+        }
+
+        // bool sample(const point3& p, light_sample& out) const
+        // - a light and a direction from p towards it; false if p is inside the
+        //   chosen light
+        bool sample(const point3& p, light_sample& out) const {
+            double u = random_double();
+            size_t k = min(static_cast<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), lights.size() - 1);
+            const sphere_light& l = lights[k];
+
+            vec3 w = l.center - p;
+            real d2 = w.length_squared();
+            real r2 = l.radius * l.radius;
+            if (d2 <= r2) return false;
+            real cos_max = sqrt(1 - (r2 / d2));
+            real one_minus_cos = (r2 / d2) / (1 + cos_max);     // 1 - cos_max without the cancellation
+
+            real z = 1 - (random_double() * one_minus_cos);
+            real phi = 2 * pi * random_double();
+            real s = sqrt(fmax(real(0), 1 - (z * z)));
+            vec3 a, b;
+            vec3 axis = w / sqrt(d2);
+            basis(axis, a, b);
+            out.direction = unit_vector((s * cos(phi) * a) + (s * sin(phi) * b) + (z * axis));
+            out.light = static_cast<uint32_t>(k);
+            out.emission = l.emission;
+            out.pdf = static_cast<real>(probability(k) / (2 * pi * one_minus_cos));
+            return true;
+        }
+
+        // real shadow_distance(uint32_t light, const ray& shadow) const
+        // - how far shadow, a ray with a unit direction from sample(), can go
+        //   before it reaches the light, a little short so the light does not
+        //   shadow itself; taken from the ray's own origin, which in float has
+        //   moved off the surface, since towards the silhouette that changes
+        //   where the ray enters the light a lot
+        // - there the root is ill conditioned (rounding moves it by about
+        //   eps * radius * distance / sqrt(disc)), but the light is never nearer
+        //   than the distance to its center less its radius
+        real shadow_distance(uint32_t light, const ray& shadow) const {
+            const sphere_light& l = lights[light];
+            vec3 w = l.center - shadow.origin();
+            real d = w.length();
+            real proj = dot(w, shadow.direction());
+            real disc = (l.radius * l.radius) - (w - (proj * shadow.direction())).length_squared();
+            real sqrt_disc = sqrt(fmax(disc, real(0)));
+            real slack = (real(1e-3) * l.radius) +
+                         (16 * numeric_limits<real>::epsilon() * l.radius * d) / fmax(sqrt_disc, numeric_limits<real>::min());
+            return fmax(d - l.radius, proj - sqrt_disc - slack) * (1 - real(1e-4));
+        }
+
+        // real pdf(const point3& origin, const hit_record& rec) const
+        // - the density of sample(origin) for the direction from origin to the
+        //   light hit at rec; 0 if rec is on no light of the list or origin is
+        //   inside it
+        real pdf(const point3& origin, const hit_record& rec) const {
+            auto it = lower_bound(by_material.begin(), by_material.end(), rec.material_id,
+                                  [&](uint32_t index, uint32_t m) { return lights[index].material_id < m; });
+            for ( ; it != by_material.end() && lights[*it].material_id == rec.material_id ; ++it) {
+                const sphere_light& l = lights[*it];
+                real off_surface = fabs((rec.p - l.center).length() - l.radius);
+                if (off_surface > (1e-3 * l.radius) + rec.p_error) continue;
+                real d2 = (l.center - origin).length_squared();
+                real r2 = l.radius * l.radius;
+                if (d2 <= r2) return 0;
+                real one_minus_cos = (r2 / d2) / (1 + sqrt(1 - (r2 / d2)));
+                return static_cast<real>(probability(*it) / (2 * pi * one_minus_cos));
+            }
+            return 0;
+        }
+
+    private:
+        vector<double> cdf;                 // cumulative selection probability
+        vector<uint32_t> by_material;       // light indices sorted by material
+
+        double probability(size_t k) const {
+            return cdf[k] - (k > 0 ? cdf[k - 1] : 0.0);
+        }
+
+        // two unit vectors that make an orthonormal basis with n (Duff et al.,
+        // "Building an Orthonormal Basis, Revisited", JCGT 2017)
+        static void basis(const vec3& n, vec3& a, vec3& b) {
+            real sign = n.z() >= 0 ? 1 : -1;
+            real c = -1 / (sign + n.z());
+            real d = n.x() * n.y() * c;
+            a = vec3(1 + (sign * n.x() * n.x() * c), sign * d, -sign * n.x());
+            b = vec3(d, sign + (n.y() * n.y() * c), -n.y());
+        }
+
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// class mapped_file
+// - a read-only memory mapping of a whole file, unmapped on destruction
+class mapped_file {
+
+    public:
+        const char* data = nullptr;
+        size_t size = 0;
+
+    public:
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        explicit mapped_file(const string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            map(fd);
+            close(fd);
+        }
+
+        // explicit mapped_file(int fd)
+        // - maps the whole of a file already open for reading; fd may be closed
+        //   afterwards, the mapping stays
+        explicit mapped_file(int fd) { map(fd); }
+
+        ~mapped_file() {
+            if (data) munmap(const_cast<char*>(data), size);
+        }
+
+        bool ok() const { return data != nullptr; }
+
+    private:
+        void map(int fd) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    data = static_cast<const char*>(p);
+                    size = static_cast<size_t>(st.st_size);
+                    madvise(p, size, MADV_SEQUENTIAL);
+                }
+            }
+        }
+
+};
+
+#endif
@@ -4,88 +4,97 @@
 #define MATERIAL_H
 
 #include "hittable.h"
+#include "material_type.h"
+#include "profile.h"
+#include "texture.h"
 
-struct hit_record;
-
-class material {
+#include <cstdint>
+#include <memory>
+#include <variant>
+#include <vector>
 
-    public:
-        virtual bool scatter (const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+struct hit_record;
 
-};
+// the concrete materials are plain values; class material below wraps one of
+// them, and hit records refer to materials by their index in a material_table
+// - lambertian and metal may name an image of the table's texture_cache: the
+//   integrator multiplies their albedo by it at the hit (integrator.h)
 
-class lambertian : public material {
+class lambertian {
 
     public:
         color albedo;
+        uint32_t texture = no_texture;
 
     public:
-        lambertian(const color& a) : albedo(a) {}
+        lambertian(const color& a, uint32_t t = no_texture) : albedo(a), texture(t) {}
 
         // lambertian materials scatter randomly (matte)
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero())
                 scatter_direction = rec.normal;
 
-            scattered = ray(rec.p, scatter_direction);
+            scattered = ray(rec.p, scatter_direction, r_in.time());
             attenuation = albedo;
             return true;
         }
 
 };
 
-class metal : public material {
+class metal {
 
     public:
         color albedo;
-        double fuzz;
-    
+        real fuzz;
+        uint32_t texture = no_texture;
+
     public:
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(const color& a, real f, uint32_t t = no_texture) : albedo(a), fuzz(f < 1 ? f : 1), texture(t) {}
 
         // metals scatter in a certain direction
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p , reflected + (fuzz * random_in_unit_sphere()));
+            scattered = ray(rec.p , reflected + (fuzz * random_in_unit_sphere()), r_in.time());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
 };
 
-class dielectric : public material {
+class dielectric {
 
     public:
-        double ir;  // Index of Refraction
+        real ir;  // Index of Refraction
 
     public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+        dielectric(real index_of_refraction) : ir(index_of_refraction) {}
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
             attenuation = color(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+            real refraction_ratio = rec.front_face ? (1 / ir) : ir;
 
             vec3 unit_direction = unit_vector(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - (cos_theta * cos_theta));
+            real cos_theta = fmin(dot(-unit_direction, rec.normal), real(1));
+            real sin_theta = sqrt(1 - (cos_theta * cos_theta));
             
             bool cannot_refract = refraction_ratio * sin_theta > 1.0;
             vec3 direction;
+            if (cannot_refract) profile_count(&profile_counters::total_internal);
 
             if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
                 direction = reflect(unit_direction, rec.normal);
             else
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-            scattered = ray(rec.p, direction);
+            scattered = ray(rec.p, direction, r_in.time());
             return true;
         }
 
     private:
-        static double reflectance(double cosine, double ref_idx) {
+        static real reflectance(real cosine, real ref_idx) {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1 - ref_idx) / (1 + ref_idx);
             r0 = r0 * r0;
@@ -94,4 +103,116 @@ class dielectric : public material {
 
 };
 
-#endif
\ No newline at end of file
+// class diffuse_light
+// - an emitter: gives off emit, the same in every direction, from its front
+//   side and reflects nothing
+class diffuse_light {
+
+    public:
+        color emit;
+
+    public:
+        diffuse_light(const color& c) : emit(c) {}
+
+        bool scatter(const ray& /*r_in*/, const hit_record& /*rec*/, color& /*attenuation*/, ray& /*scattered*/) const {
+            return false;
+        }
+
+        color emitted(const hit_record& rec) const {
+            return rec.front_face ? emit : color(0, 0, 0);
+        }
+
+};
+
+// class material
+// - a tagged variant of the concrete materials; scatter() switches on the tag
+//   and calls the concrete scatter directly, so there is no virtual call and the
+//   compiler can inline all four
+class material {
+
+    public:
+        material(const lambertian& m) : value(m) {}
+        material(const metal& m) : value(m) {}
+        material(const dielectric& m) : value(m) {}
+        material(const diffuse_light& m) : value(m) {}
+
+        material_type type() const { return static_cast<material_type>(value.index()); }
+
+        template <typename T> const T* get() const { return get_if<T>(&value); }
+
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+            switch (type()) {
+                case material_type::metal: return get_if<metal>(&value)->scatter(r_in, rec, attenuation, scattered);
+                case material_type::dielectric: return get_if<dielectric>(&value)->scatter(r_in, rec, attenuation, scattered);
+                case material_type::emissive: return false;
+                default: return get_if<lambertian>(&value)->scatter(r_in, rec, attenuation, scattered);
+            }
+        }
+
+        // color emitted(const hit_record& rec) const
+        // - the light the surface gives off towards the ray that hit it
+        color emitted(const hit_record& rec) const {
+            if (type() != material_type::emissive) return color(0, 0, 0);
+            return get_if<diffuse_light>(&value)->emitted(rec);
+        }
+
+        // color albedo() const
+        // - the surface's own color, for the denoiser's albedo buffer: glass is
+        //   white and a light is its emission, clipped to one; a textured
+        //   surface's is still to be multiplied by its texture()
+        color albedo() const {
+            switch (type()) {
+                case material_type::metal: return get_if<metal>(&value)->albedo;
+                case material_type::dielectric: return color(1, 1, 1);
+                case material_type::emissive: {
+                    color e = get_if<diffuse_light>(&value)->emit;
+                    return color(fmin(e.x(), real(1)), fmin(e.y(), real(1)), fmin(e.z(), real(1)));
+                }
+                default: return get_if<lambertian>(&value)->albedo;
+            }
+        }
+
+        // uint32_t texture() const
+        // - the texture_cache image the albedo is multiplied by, no_texture if none
+        uint32_t texture() const {
+            switch (type()) {
+                case material_type::lambertian: return get_if<lambertian>(&value)->texture;
+                case material_type::metal: return get_if<metal>(&value)->texture;
+                default: return no_texture;
+            }
+        }
+
+        // bool diffuse() const
+        // - lambertian: the one material whose scattering has a density that
+        //   can be evaluated for any direction (cos / pi), so the only one direct
+        //   light sampling is combined with; metal and glass count as specular
+        bool diffuse() const { return type() == material_type::lambertian; }
+
+    private:
+        // alternatives in material_type order
+        variant<lambertian, metal, dielectric, diffuse_light> value;
+
+};
+
+// class material_table
+// - every material of a scene in one contiguous array; objects and hit records
+//   hold a material's index instead of a (reference counted) pointer to it
+class material_table {
+
+    public:
+        // MEMBERS
+        vector<material> materials;
+        shared_ptr<texture_cache> textures;     // the images textured materials name; null if none do
+
+    public:
+        uint32_t add(const material& m) {
+            materials.push_back(m);
+            return static_cast<uint32_t>(materials.size() - 1);
+        }
+
+        const material& operator[](uint32_t id) const { return materials[id]; }
+        size_t size() const { return materials.size(); }
+
+};
+
+#endif
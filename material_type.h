@@ -0,0 +1,14 @@
+#ifndef MATERIAL_TYPE_H
+#define MATERIAL_TYPE_H
+
+#include <cstdint>
+
+// enum class material_type
+// - the kinds of material, in the order of material's variant (material.h);
+//   also the tag of a scene file's material records (scene.h)
+enum class material_type : uint32_t { lambertian = 0, metal = 1, dielectric = 2, emissive = 3 };
+
+// how many material_types there are: emissive must stay the last
+const int material_type_count = static_cast<int>(material_type::emissive) + 1;
+
+#endif
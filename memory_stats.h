@@ -0,0 +1,60 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+using namespace std;
+
+// MEMORY STATISTICS
+// - replaces the global operator new / delete with versions that count the
+//   allocations and the bytes asked for, so a run can report how many trips to
+//   the heap building the scene and rendering took
+// - replacement operators must be defined exactly once in a program: include
+//   this header only from the file with main()
+
+inline atomic<uint64_t>& allocation_count() {
+    static atomic<uint64_t> count(0);
+    return count;
+}
+
+inline atomic<uint64_t>& allocated_bytes() {
+    static atomic<uint64_t> bytes(0);
+    return bytes;
+}
+
+inline void* counted_alloc(size_t n, size_t align) {
+    allocation_count().fetch_add(1, memory_order_relaxed);
+    allocated_bytes().fetch_add(n, memory_order_relaxed);
+    if (n == 0) n = 1;
+    void* p = align > alignof(max_align_t) ? aligned_alloc(align, (n + align - 1) / align * align) : malloc(n);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t n) { return counted_alloc(n, 0); }
+void* operator new[](size_t n) { return counted_alloc(n, 0); }
+void* operator new(size_t n, align_val_t a) { return counted_alloc(n, static_cast<size_t>(a)); }
+void* operator new[](size_t n, align_val_t a) { return counted_alloc(n, static_cast<size_t>(a)); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, align_val_t) noexcept { free(p); }
+void operator delete[](void* p, align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { free(p); }
+
+// size_t peak_resident_memory_bytes()
+// - the most the process has had resident so far (getrusage, kilobytes on Linux)
+inline size_t peak_resident_memory_bytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "profile.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// struct mesh_buffers
+// - a triangle mesh as shared indexed buffers, the way the OBJ loader produces
+//   it: one array of positions, one of normals and one of texture
+//   coordinates, and per triangle three position indices and, if the mesh
+//   has normals or texture coordinates, three indices into those
+// - positions, normals and texture coordinates are stored as float whatever
+//   the build's precision; that is all the precision model files carry and
+//   halves the memory
+struct mesh_buffers {
+    static constexpr uint32_t no_normal = UINT32_MAX;   // a corner without a normal
+    static constexpr uint32_t no_uv = UINT32_MAX;       // a corner without texture coordinates
+
+    vector<float> positions;            // x, y, z per vertex
+    vector<float> normals;              // x, y, z per normal
+    vector<float> uvs;                  // u, v per texture coordinate
+    vector<uint32_t> indices;           // 3 per triangle, into positions
+    vector<uint32_t> normal_indices;    // 3 per triangle, into normals; empty if no corner has one
+    vector<uint32_t> uv_indices;        // 3 per triangle, into uvs; empty if no corner has one
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    size_t memory_bytes() const {
+        return (positions.capacity() + normals.capacity() + uvs.capacity()) * sizeof(float) +
+               (indices.capacity() + normal_indices.capacity() + uv_indices.capacity()) * sizeof(uint32_t);
+    }
+
+    point3 position(uint32_t v) const {
+        return point3(positions[3 * size_t(v)], positions[3 * size_t(v) + 1], positions[3 * size_t(v) + 2]);
+    }
+
+    vec3 normal(uint32_t n) const {
+        return vec3(normals[3 * size_t(n)], normals[3 * size_t(n) + 1], normals[3 * size_t(n) + 2]);
+    }
+};
+
+// struct mesh_stats
+struct mesh_stats {
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t memory_bytes = 0;        // buffers and hierarchy
+    bvh_stats tree;
+};
+
+inline ostream& operator<<(ostream& out, const mesh_stats& s) {
+    return out << "mesh: " << s.triangles << " triangles, " << s.vertices << " vertices, "
+               << s.memory_bytes / (1024 * 1024) << " MiB, " << s.tree;
+}
+
+// struct triangle_ray
+// - the per-ray part of the watertight ray/triangle test (Woop, Benthin and
+//   Wald, "Watertight Ray/Triangle Intersection", JCGT 2013): the ray's
+//   dominant axis becomes z and a shear turns it into the +z axis, after which
+//   a triangle is hit if the origin is inside its 2D projection
+// - the edge functions are evaluated on the same sheared coordinates for both
+//   triangles sharing an edge, so a ray through the edge hits one of them and
+//   never slips through the crack between them
+struct triangle_ray {
+    point3 org;
+    int kx, ky, kz;
+    real sx, sy, sz;
+
+    explicit triangle_ray(const ray& r) : org(r.origin()) {
+        const vec3 d = r.direction();
+        kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (d[kz] < 0) swap(kx, ky);   // keeps the triangles' winding
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1 / d[kz];
+    }
+};
+
+// class triangle_mesh
+// - the geometry of a mesh and its own bounding volume hierarchy, built once
+//   and shared by every object that shows it
+// - the hierarchy is built over the triangles by bvh_builder and the index
+//   buffers are then reordered so every leaf is a run of consecutive
+//   triangles: no per-triangle objects and no indirection
+// - leaves are intersected a few triangles at a time, one lane per triangle,
+//   in loops the compiler can vectorize
+class triangle_mesh {
+
+    public:
+        // MEMBERS
+        mesh_buffers buffers;
+        vector<bvh_float_node> nodes;
+        mesh_stats stats;
+
+    public:
+        // CONSTRUCTORS
+        explicit triangle_mesh(mesh_buffers&& b, int max_leaf = 4) : buffers(move(b)) {
+            auto start = chrono::steady_clock::now();
+            const size_t n = buffers.triangle_count();
+
+            vector<bvh_build_ref> refs(n);
+            for (size_t k = 0 ; k < n ; ++k) {
+                aabb box;
+                for (int c = 0 ; c < 3 ; c++)
+                    box.grow(buffers.position(buffers.indices[(3 * k) + c]));
+                refs[k] = { box, box.centroid(), static_cast<int>(k) };
+            }
+            vector<bvh_node> built;
+            vector<int> order;
+            bvh_builder(max_leaf).build(refs, built, order, stats.tree);
+            vector<bvh_build_ref>().swap(refs);
+            nodes.reserve(built.size());
+            for (const bvh_node& n : built) nodes.emplace_back(n);
+            vector<bvh_node>().swap(built);
+
+            // triangles in leaf order
+            vector<uint32_t> sorted(buffers.indices.size());
+            for (size_t k = 0 ; k < order.size() ; ++k)
+                for (int c = 0 ; c < 3 ; c++) sorted[(3 * k) + c] = buffers.indices[(3 * size_t(order[k])) + c];
+            buffers.indices.swap(sorted);
+            if (!buffers.normal_indices.empty()) {
+                for (size_t k = 0 ; k < order.size() ; ++k)
+                    for (int c = 0 ; c < 3 ; c++) sorted[(3 * k) + c] = buffers.normal_indices[(3 * size_t(order[k])) + c];
+                buffers.normal_indices.swap(sorted);
+            }
+            if (!buffers.uv_indices.empty()) {
+                for (size_t k = 0 ; k < order.size() ; ++k)
+                    for (int c = 0 ; c < 3 ; c++) sorted[(3 * k) + c] = buffers.uv_indices[(3 * size_t(order[k])) + c];
+                buffers.uv_indices.swap(sorted);
+            }
+
+            stats.vertices = buffers.vertex_count();
+            stats.triangles = n;
+            stats.tree.primitives = n;
+            stats.tree.node_count = nodes.size();
+            stats.tree.build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            stats.memory_bytes = buffers.memory_bytes() + (nodes.capacity() * sizeof(bvh_float_node));
+        }
+
+        bool bounding_box(aabb& output_box) const {
+            if (nodes.empty()) return false;
+            output_box = nodes[0].box();
+            return true;
+        }
+
+        // bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+        // - closest triangle hit in [t_min, t_max]; fills everything but the material
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+            int best = -1;
+            real best_b[3] = { 0, 0, 0 };
+            if (!traverse<false>(r, t_min, t_max, best, best_b)) return false;
+            fill_record(r, best, best_b, t_max, rec);
+            return true;
+        }
+
+        // bool occluded(const ray& r, real t_min, real t_max) const
+        // - whether any triangle is hit in [t_min, t_max]
+        bool occluded(const ray& r, real t_min, real t_max) const {
+            int best = -1;
+            real best_b[3];
+            return traverse<true>(r, t_min, t_max, best, best_b);
+        }
+
+    private:
+        static const int leaf_lanes = 4;
+
+        // template <bool any_hit> bool traverse(const ray& r, real t_min, real& t_max, int& best, real* best_b) const
+        // - walks the hierarchy nearer child first; leaves narrow t_max to the
+        //   closest hit so far, and with any_hit the first leaf with a hit ends it
+        template <bool any_hit>
+        bool traverse(const ray& r, real t_min, real& t_max, int& best, real* best_b) const {
+            if (nodes.empty()) return false;
+
+            const triangle_ray tr(r);
+            const vec3 dir = r.direction();
+            const vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+            const bool dir_negative[3] = { dir.x() < 0, dir.y() < 0, dir.z() < 0 };
+
+            int stack[64];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const bvh_float_node& n = nodes[current];
+                profile_count(&profile_counters::box_tests);
+                if (n.hit(tr.org, inv_dir, t_min, t_max)) {
+                    if (n.count > 0) {
+                        for (int first = n.first ; first < n.first + n.count ; first += leaf_lanes)
+                            hit_triangles(tr, first, min(leaf_lanes, n.first + n.count - first), t_min, t_max, best, best_b);
+                        if (any_hit && best >= 0) return true;
+                    } else if (dir_negative[n.axis]) {
+                        stack[stack_size++] = current + 1;
+                        current = n.first;
+                        continue;
+                    } else {
+                        stack[stack_size++] = n.first;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            return best >= 0;
+        }
+
+        // void hit_triangles(const triangle_ray& tr, int first, int count, real t_min, real& t_max, int& best, real* best_b) const
+        // - tests triangles [first, first + count), count <= leaf_lanes, one lane
+        //   each; on a closer hit narrows t_max and records the triangle and its
+        //   barycentric coordinates
+        void hit_triangles(const triangle_ray& tr, int first, int count, real t_min, real& t_max, int& best, real* best_b) const {
+            profile_count(&profile_counters::primitive_tests, count);
+            real u[leaf_lanes], v[leaf_lanes], w[leaf_lanes], t[leaf_lanes];
+            bool ok[leaf_lanes];
+
+            for (int k = 0 ; k < leaf_lanes ; ++k) {
+                // lanes past count repeat the last triangle and are masked off below
+                const uint32_t* tri = &buffers.indices[3 * size_t(first + min(k, count - 1))];
+                real ax, ay, az, bx, by, bz, cx, cy, cz;
+                shear(tr, tri[0], ax, ay, az);
+                shear(tr, tri[1], bx, by, bz);
+                shear(tr, tri[2], cx, cy, cz);
+
+                u[k] = (cx * by) - (cy * bx);
+                v[k] = (ax * cy) - (ay * cx);
+                w[k] = (bx * ay) - (by * ax);
+#ifdef RAYTRACER_FLOAT
+                // an edge function of exactly zero may be rounding; redo it in double
+                if (u[k] == 0 || v[k] == 0 || w[k] == 0) {
+                    u[k] = static_cast<real>((double(cx) * by) - (double(cy) * bx));
+                    v[k] = static_cast<real>((double(ax) * cy) - (double(ay) * cx));
+                    w[k] = static_cast<real>((double(bx) * ay) - (double(by) * ax));
+                }
+#endif
+                real det = u[k] + v[k] + w[k];
+                real inside = (u[k] < 0 || v[k] < 0 || w[k] < 0) && (u[k] > 0 || v[k] > 0 || w[k] > 0) ? 0 : 1;
+                t[k] = ((u[k] * tr.sz * az) + (v[k] * tr.sz * bz) + (w[k] * tr.sz * cz)) / det;
+                u[k] /= det;
+                v[k] /= det;
+                w[k] /= det;
+                ok[k] = k < count && inside != 0 && det != 0 && t[k] >= t_min && t[k] <= t_max;
+            }
+
+            for (int k = 0 ; k < count ; ++k) {
+                if (!ok[k] || !(t[k] <= t_max)) continue;
+                t_max = t[k];
+                best = first + k;
+                best_b[0] = u[k];
+                best_b[1] = v[k];
+                best_b[2] = w[k];
+            }
+        }
+
+        // the vertex relative to the ray origin in the ray's sheared space; z is
+        // left unscaled, hit_triangles multiplies it by sz
+        void shear(const triangle_ray& tr, uint32_t vertex, real& x, real& y, real& z) const {
+            const float* p = &buffers.positions[3 * size_t(vertex)];
+            real px = p[tr.kx] - tr.org[tr.kx];
+            real py = p[tr.ky] - tr.org[tr.ky];
+            z = p[tr.kz] - tr.org[tr.kz];
+            x = px - (tr.sx * z);
+            y = py - (tr.sy * z);
+        }
+
+        void fill_record(const ray& r, int triangle, const real* b, real t, hit_record& rec) const {
+            const uint32_t* tri = &buffers.indices[3 * size_t(triangle)];
+            point3 p0 = buffers.position(tri[0]), p1 = buffers.position(tri[1]), p2 = buffers.position(tri[2]);
+            rec.t = t;
+#ifdef RAYTRACER_FLOAT
+            // the barycentric point is on the triangle up to a few ulps of its
+            // vertices, r.at(t) only up to the error of t
+            rec.p = (b[0] * p0) + (b[1] * p1) + (b[2] * p2);
+            vec3 extent = (fabs(b[0]) * vec3(fabs(p0.x()), fabs(p0.y()), fabs(p0.z()))) +
+                          (fabs(b[1]) * vec3(fabs(p1.x()), fabs(p1.y()), fabs(p1.z()))) +
+                          (fabs(b[2]) * vec3(fabs(p2.x()), fabs(p2.y()), fabs(p2.z())));
+            rec.p_error = 8 * numeric_limits<real>::epsilon() * fmax(extent.x(), fmax(extent.y(), extent.z()));
+#else
+            rec.p = r.at(t);
+            rec.p_error = 0;
+#endif
+            rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+
+            // interpolated shading normal, turned to the side the geometric one faces
+            if (!buffers.normal_indices.empty()) {
+                const uint32_t* nrm = &buffers.normal_indices[3 * size_t(triangle)];
+                if (nrm[0] != mesh_buffers::no_normal && nrm[1] != mesh_buffers::no_normal &&
+                    nrm[2] != mesh_buffers::no_normal) {
+                    vec3 shading = (b[0] * buffers.normal(nrm[0])) + (b[1] * buffers.normal(nrm[1])) +
+                                   (b[2] * buffers.normal(nrm[2]));
+                    if (shading.length_squared() > 0) {
+                        shading = unit_vector(shading);
+                        rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+                    }
+                }
+            }
+
+            // interpolated texture coordinates; a unit of them spans the square
+            // root of the ratio of the triangle's area to its area in u and v
+            rec.u = rec.v = rec.uv_extent = 0;
+            rec.sphere_dir = vec3(0, 0, 0);
+            if (!buffers.uv_indices.empty()) {
+                const uint32_t* tex = &buffers.uv_indices[3 * size_t(triangle)];
+                if (tex[0] != mesh_buffers::no_uv && tex[1] != mesh_buffers::no_uv && tex[2] != mesh_buffers::no_uv) {
+                    const float* t0 = &buffers.uvs[2 * size_t(tex[0])];
+                    const float* t1 = &buffers.uvs[2 * size_t(tex[1])];
+                    const float* t2 = &buffers.uvs[2 * size_t(tex[2])];
+                    rec.u = (b[0] * t0[0]) + (b[1] * t1[0]) + (b[2] * t2[0]);
+                    rec.v = (b[0] * t0[1]) + (b[1] * t1[1]) + (b[2] * t2[1]);
+                    real uv_area = fabs(((t1[0] - t0[0]) * (t2[1] - t0[1])) - ((t2[0] - t0[0]) * (t1[1] - t0[1])));
+                    real area = cross(p1 - p0, p2 - p0).length();
+                    rec.uv_extent = uv_area > 0 ? sqrt(area / uv_area) : 0;
+                }
+            }
+        }
+
+};
+
+// class mesh
+// - a triangle_mesh placed in the scene with a material; the geometry is
+//   shared, so the same model can be in a scene several times at the cost of
+//   one copy
+class mesh : public hittable {
+
+    public:
+        // MEMBERS
+        shared_ptr<const triangle_mesh> geometry;
+        uint32_t material_id;
+
+    public:
+        // CONSTRUCTORS
+        mesh(shared_ptr<const triangle_mesh> g, uint32_t m) : geometry(move(g)), material_id(m) {}
+
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            if (!geometry->hit(r, t_min, t_max, rec)) return false;
+            rec.material_id = material_id;
+            return true;
+        }
+
+        bool occluded(const ray& r, real t_min, real t_max) const override {
+            return geometry->occluded(r, t_min, t_max);
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            return geometry->bounding_box(output_box);
+        }
+
+};
+
+#endif
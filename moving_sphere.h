@@ -0,0 +1,87 @@
+#ifndef MOVING_SPHERE_H
+#define MOVING_SPHERE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "sphere.h"
+
+// struct sphere_motion
+// - where a sphere's center is at time t (seconds): period == 0 moves it in a
+//   straight line, center + t * offset; period > 0 swings it out to center +
+//   offset and back once every period seconds, easing in and out at both ends
+struct sphere_motion {
+    point3 center;
+    vec3 offset;
+    double period = 0;
+
+    point3 at(double t) const {
+        if (period <= 0) return center + (t * offset);
+        return center + ((0.5 * (1 - cos(2 * pi * t / period))) * offset);
+    }
+};
+
+// class moving_sphere
+// - a sphere following a sphere_motion; update() samples the motion at the
+//   frame's shutter open and close and a ray at time t sees the sphere at the
+//   linear interpolation of the two, so the blur is a straight streak even
+//   where the path curves (one segment per frame, as in most production
+//   renderers)
+// - the bounding box is the union of the boxes at both ends, which encloses
+//   the whole segment
+class moving_sphere : public hittable {
+
+    public:
+        // MEMBERS
+        sphere shape;               // radius and material; its center is unused
+        sphere_motion motion;
+        point3 center0, center1;    // center at time0 and time1
+        real time0 = 0, time1 = 0;
+
+    public:
+        // CONSTRUCTORS
+        moving_sphere(const sphere_motion& path, real radius, uint32_t material)
+            : shape(path.center, radius, material), motion(path) {
+            center0 = center1 = motion.at(0);
+        }
+
+        // point3 center(real time) const
+        point3 center(real time) const {
+            if (time1 <= time0) return center0;
+            return center0 + (((time - time0) / (time1 - time0)) * (center1 - center0));
+        }
+
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            return shape.hit_at(center(r.time()), r, t_min, t_max, rec);
+        }
+
+        // the sphere's packet kernel assumes a fixed center: one ray at a time instead
+        void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override {
+            hittable::hit_packet(p, t_min, t_max, recs, hits);
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            vec3 r(fabs(shape.radius), fabs(shape.radius), fabs(shape.radius));
+            output_box = aabb(center0 - r, center0 + r);
+            output_box.grow(aabb(center1 - r, center1 + r));
+            return true;
+        }
+
+        bool animated() const override { return true; }
+
+        bool update(double shutter_open, double shutter_close) override {
+            point3 c0 = motion.at(shutter_open);
+            point3 c1 = motion.at(shutter_close);
+            bool moved = false;
+            for (int a = 0 ; a < 3 ; a++)
+                moved |= c0[a] != center0[a] || c1[a] != center1[a];
+            center0 = c0;
+            center1 = c1;
+            time0 = static_cast<real>(shutter_open);
+            time1 = static_cast<real>(shutter_close);
+            return moved;
+        }
+
+};
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "mapped_file.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// OBJ FILES
+// - reads the geometry of Wavefront OBJ files: "v" positions, "vn" normals, "vt"
+//   texture coordinates (u and v; a third is ignored) and "f" faces, whose
+//   polygons are split into triangle fans; groups, smoothing and materials
+//   are skipped
+// - face indices may be absolute (1 based) or relative (negative)
+// - the file is mapped and parsed by several threads, each over a run of whole
+//   lines: a first pass counts the vertices, normals and texture coordinates
+//   in every run, so the second knows where they go in the shared arrays and
+//   can resolve relative indices on its own
+
+// struct obj_stats
+struct obj_stats {
+    size_t file_bytes = 0;
+    size_t faces = 0;
+    int threads = 0;
+    double load_ms = 0;
+};
+
+inline ostream& operator<<(ostream& out, const obj_stats& s) {
+    return out << "obj: " << s.file_bytes / 1024 << " KiB, " << s.faces << " faces, loaded in " << s.load_ms
+               << " ms by " << s.threads << " threads";
+}
+
+// class obj_chunk
+// - one thread's run of lines [begin, end) and what it parsed from it
+class obj_chunk {
+
+    public:
+        // MEMBERS
+        const char* begin;
+        const char* end;
+        size_t lines = 0;
+        size_t vertices = 0;            // "v" lines
+        size_t normals = 0;             // "vn" lines
+        size_t uvs = 0;                 // "vt" lines
+        size_t first_line = 0;          // of the file, for error messages
+        size_t first_vertex = 0;        // index in the file of the run's first vertex
+        size_t first_normal = 0;
+        size_t first_uv = 0;
+        size_t faces = 0;
+        vector<uint32_t> indices;
+        vector<uint32_t> normal_indices;
+        vector<uint32_t> uv_indices;
+        bool any_normal = false;
+        bool any_uv = false;
+        string error;
+
+    public:
+        // CONSTRUCTORS
+        obj_chunk(const char* b, const char* e) : begin(b), end(e) {}
+
+        // void count()
+        // - first pass: lines, vertices, normals and texture coordinates
+        void count() {
+            for (const char* p = begin ; p < end ; p = next_line(p)) {
+                lines++;
+                p = skip_spaces(p);
+                if (p + 1 < end && p[0] == 'v') {
+                    if (p[1] == ' ' || p[1] == '\t') vertices++;
+                    else if (p[1] == 'n' && p + 2 < end && (p[2] == ' ' || p[2] == '\t')) normals++;
+                    else if (p[1] == 't' && p + 2 < end && (p[2] == ' ' || p[2] == '\t')) uvs++;
+                }
+            }
+        }
+
+        // void parse(mesh_buffers& out, size_t total_vertices, size_t total_normals, size_t total_uvs)
+        // - second pass: writes the run's vertices, normals and texture
+        //   coordinates straight into out, whose arrays are already sized for
+        //   the whole file, and collects the triangles
+        void parse(mesh_buffers& out, size_t total_vertices, size_t total_normals, size_t total_uvs) {
+            size_t vertex = first_vertex;
+            size_t normal = first_normal;
+            size_t uv = first_uv;
+            size_t line = first_line;
+            vector<int64_t> corner_v, corner_n, corner_t;
+
+            for (const char* p = begin ; p < end ; p = next_line(p)) {
+                line++;
+                const char* q = skip_spaces(p);
+                if (q + 1 >= end) continue;
+                if (q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+                    if (!floats(q + 2, &out.positions[3 * vertex])) return fail(line, "bad vertex");
+                    vertex++;
+                } else if (q[0] == 'v' && q[1] == 'n' && q + 2 < end && (q[2] == ' ' || q[2] == '\t')) {
+                    if (!floats(q + 3, &out.normals[3 * normal])) return fail(line, "bad normal");
+                    normal++;
+                } else if (q[0] == 'v' && q[1] == 't' && q + 2 < end && (q[2] == ' ' || q[2] == '\t')) {
+                    if (!floats(q + 3, &out.uvs[2 * uv], 2)) return fail(line, "bad texture coordinate");
+                    uv++;
+                } else if (q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+                    corner_v.clear();
+                    corner_n.clear();
+                    corner_t.clear();
+                    if (!face(q + 2, vertex, normal, uv, corner_v, corner_n, corner_t)) return fail(line, "bad face");
+                    if (corner_v.size() < 3) return fail(line, "face with fewer than 3 vertices");
+                    for (size_t c = 0 ; c < corner_v.size() ; ++c) {
+                        if (corner_v[c] < 0 || corner_v[c] >= static_cast<int64_t>(total_vertices))
+                            return fail(line, "face refers to a vertex that does not exist");
+                        if (corner_n[c] >= static_cast<int64_t>(total_normals))
+                            return fail(line, "face refers to a normal that does not exist");
+                        if (corner_t[c] >= static_cast<int64_t>(total_uvs))
+                            return fail(line, "face refers to a texture coordinate that does not exist");
+                    }
+                    // a fan around the first corner
+                    for (size_t c = 1 ; c + 1 < corner_v.size() ; ++c) {
+                        for (size_t k : { size_t(0), c, c + 1 }) {
+                            indices.push_back(static_cast<uint32_t>(corner_v[k]));
+                            normal_indices.push_back(corner_n[k] < 0 ? mesh_buffers::no_normal : static_cast<uint32_t>(corner_n[k]));
+                            uv_indices.push_back(corner_t[k] < 0 ? mesh_buffers::no_uv : static_cast<uint32_t>(corner_t[k]));
+                            any_normal |= corner_n[k] >= 0;
+                            any_uv |= corner_t[k] >= 0;
+                        }
+                    }
+                    faces++;
+                }
+            }
+        }
+
+    private:
+        const char* next_line(const char* p) const {
+            const void* newline = memchr(p, '\n', static_cast<size_t>(end - p));
+            return newline ? static_cast<const char*>(newline) + 1 : end;
+        }
+
+        const char* skip_spaces(const char* p) const {
+            while (p < end && (*p == ' ' || *p == '\t')) ++p;
+            return p;
+        }
+
+        bool floats(const char* p, float* out, int n = 3) const {
+            for (int k = 0 ; k < n ; ++k) {
+                p = skip_spaces(p);
+                auto result = from_chars(p, end, out[k]);
+                if (result.ec != errc()) return false;
+                p = result.ptr;
+            }
+            return true;
+        }
+
+        // bool face(const char* p, size_t vertex, size_t normal, size_t uv, vector<int64_t>& vs, vector<int64_t>& ns, vector<int64_t>& ts) const
+        // - the corners of a face as 0 based indices, -1 for a missing normal or
+        //   texture coordinate; vertex, normal and uv are how many of each
+        //   precede the line
+        bool face(const char* p, size_t vertex, size_t normal, size_t uv, vector<int64_t>& vs, vector<int64_t>& ns,
+                  vector<int64_t>& ts) const {
+            while (true) {
+                p = skip_spaces(p);
+                if (p >= end || *p == '\n' || *p == '\r' || *p == '#') return true;
+                int64_t v, t = 0, n = 0;
+                auto result = from_chars(p, end, v);
+                if (result.ec != errc() || v == 0) return false;
+                p = result.ptr;
+                if (p < end && *p == '/') {
+                    ++p;
+                    if (p < end && *p != '/') {
+                        result = from_chars(p, end, t);
+                        if (result.ec != errc() || t == 0) return false;
+                        p = result.ptr;
+                    }
+                    if (p < end && *p == '/') {
+                        result = from_chars(p + 1, end, n);
+                        if (result.ec != errc() || n == 0) return false;
+                        p = result.ptr;
+                    }
+                }
+                if (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') return false;
+                vs.push_back(v > 0 ? v - 1 : static_cast<int64_t>(vertex) + v);
+                ns.push_back(n > 0 ? n - 1 : (n < 0 ? static_cast<int64_t>(normal) + n : -1));
+                ts.push_back(t > 0 ? t - 1 : (t < 0 ? static_cast<int64_t>(uv) + t : -1));
+                if ((n < 0 && ns.back() < 0) || (t < 0 && ts.back() < 0)) return false;
+            }
+        }
+
+        void fail(size_t line, const char* message) {
+            error = "line " + to_string(line) + ": " + message;
+        }
+
+};
+
+// bool load_obj(const string& path, mesh_buffers& out, string& error, int threads = 0, obj_stats* stats = nullptr)
+// - reads the OBJ at path into out; threads = 0 uses one per hardware thread
+inline bool load_obj(const string& path, mesh_buffers& out, string& error, int threads = 0, obj_stats* stats = nullptr) {
+    auto start = chrono::steady_clock::now();
+    mapped_file file(path);
+    if (!file.ok()) {
+        error = "cannot read " + path;
+        return false;
+    }
+
+    // runs of at least 1 MiB, cut after a newline
+    if (threads <= 0) threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    size_t run_count = max<size_t>(1, min<size_t>(threads, file.size >> 20));
+    vector<obj_chunk> chunks;
+    const char* last = file.data + file.size;
+    const char* p = file.data;
+    for (size_t k = 1 ; k <= run_count ; ++k) {
+        const char* cut = k == run_count ? last : file.data + (file.size * k / run_count);
+        if (cut < p) cut = p;
+        const void* newline = memchr(cut, '\n', static_cast<size_t>(last - cut));
+        cut = (k == run_count || !newline) ? last : static_cast<const char*>(newline) + 1;
+        chunks.emplace_back(p, cut);
+        p = cut;
+    }
+
+    auto in_parallel = [&](auto&& body) {
+        vector<thread> pool;
+        for (size_t k = 1 ; k < chunks.size() ; ++k)
+            pool.emplace_back([&, k] { body(chunks[k]); });
+        body(chunks[0]);
+        for (thread& t : pool) t.join();
+    };
+
+    in_parallel([](obj_chunk& c) { c.count(); });
+    size_t vertices = 0, normals = 0, uvs = 0, lines = 0;
+    for (obj_chunk& c : chunks) {
+        c.first_vertex = vertices;
+        c.first_normal = normals;
+        c.first_uv = uvs;
+        c.first_line = lines;
+        vertices += c.vertices;
+        normals += c.normals;
+        uvs += c.uvs;
+        lines += c.lines;
+    }
+    if (vertices > UINT32_MAX || normals > UINT32_MAX || uvs > UINT32_MAX) {
+        error = path + " has too many vertices";
+        return false;
+    }
+
+    out = mesh_buffers();
+    out.positions.resize(3 * vertices);
+    out.normals.resize(3 * normals);
+    out.uvs.resize(2 * uvs);
+    in_parallel([&](obj_chunk& c) { c.parse(out, vertices, normals, uvs); });
+
+    size_t triangles = 0, faces = 0;
+    bool any_normal = false, any_uv = false;
+    for (obj_chunk& c : chunks) {
+        if (!c.error.empty()) {
+            error = path + ": " + c.error;
+            return false;
+        }
+        triangles += c.indices.size() / 3;
+        faces += c.faces;
+        any_normal |= c.any_normal;
+        any_uv |= c.any_uv;
+    }
+    out.indices.reserve(3 * triangles);
+    if (any_normal) out.normal_indices.reserve(3 * triangles);
+    if (any_uv) out.uv_indices.reserve(3 * triangles);
+    for (obj_chunk& c : chunks) {
+        out.indices.insert(out.indices.end(), c.indices.begin(), c.indices.end());
+        if (any_normal) out.normal_indices.insert(out.normal_indices.end(), c.normal_indices.begin(), c.normal_indices.end());
+        if (any_uv) out.uv_indices.insert(out.uv_indices.end(), c.uv_indices.begin(), c.uv_indices.end());
+        vector<uint32_t>().swap(c.indices);
+        vector<uint32_t>().swap(c.normal_indices);
+        vector<uint32_t>().swap(c.uv_indices);
+    }
+    if (!any_normal) vector<float>().swap(out.normals);
+    if (!any_uv) vector<float>().swap(out.uvs);
+
+    if (stats) {
+        stats->file_bytes = file.size;
+        stats->faces = faces;
+        stats->threads = static_cast<int>(chunks.size());
+        stats->load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    return true;
+}
+
+#endif
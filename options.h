@@ -0,0 +1,420 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "film.h"
+#include "image_io.h"
+#include "sampler.h"
+
+using namespace std;
+
+enum class accel_type { bvh, list, soa };
+
+// struct render_options
+// - everything main() used to hard-code, overridable from the command line
+struct render_options {
+    double aspect_ratio = 3.0 / 2.0;
+    int image_width = 1200;
+    int samples_per_pixel = 50;
+    int max_depth = 50;
+    int rr_depth = 3;       // Russian roulette from this bounce on, 0 = off
+    bool nee = true;        // sample the scene's lights directly, see integrator.h
+    bool depth_histogram = false;
+    int threads = 0;        // 0 = one per hardware thread
+    int tile_size = 32;
+    unsigned long long seed = 0;
+    sample_pattern sampler = sample_pattern::random;
+    accel_type accel = accel_type::bvh;
+    int packet_size = 0;    // 0 = scalar ray_color, else 4 / 8 / 16 ray packets
+    int scene_grid = 11;    // random_scene() places (2 * grid)^2 small spheres
+    string scene;           // scene file, empty = random_scene()
+    vector<string> meshes;  // OBJ files added to the scene
+    string save_scene;      // write the scene out, binary if it ends in .bin
+    string output = "-";   // "-" = stdout
+    image_format format = image_format::ppm;
+    int texture_cache_mb = 64;  // memory for texture tiles, see texture.h
+    bool film = false;      // splat the samples through a reconstruction filter, see film.h
+    filter_type filter = filter_type::box;
+    double filter_radius = 0;   // pixels, 0 = the filter's usual radius
+    string profile;         // cost heatmaps and report as <profile>_*.png and <profile>.txt, empty = none; see profile.h
+
+    // progressive rendering, see progressive.h
+    bool progressive = false;
+    int pass_samples = 1;   // samples per pixel in each pass
+    string checkpoint;      // checkpoint file, empty = none
+    int checkpoint_every = 8;
+    bool resume = false;
+    string preview;         // preview image, empty = none
+    int preview_every = 8;
+
+    // adaptive sampling, see adaptive.h; samples_per_pixel becomes the average budget
+    bool adaptive = false;
+    int adaptive_min = 8;
+    int adaptive_max = 0;   // 0 = 8 * samples_per_pixel
+    double adaptive_threshold = 0.01;
+    double time_budget = 0;
+    string heatmap;         // samples-per-pixel heatmap image, empty = none
+
+    // distributed rendering, see distributed.h
+    int workers = 0;        // worker processes, 0 = render in this process
+    int fail_worker_after = 0;
+
+    // animation, see moving_sphere.h and the keyframes in scene.h
+    int frames = 0;         // > 0 renders a sequence of this many frames
+    int first_frame = 0;
+    double fps = 24;
+    double shutter = 0.5;   // fraction of the frame time the shutter is open, 0 = no motion blur
+    double orbit = 0;       // degrees per second the camera turns about its lookat
+    bool motion = false;    // random_scene() with bouncing spheres
+    bool instanced = false; // random_scene() with its small spheres as instances of one unit sphere
+
+    // denoising, see denoise.h
+    bool denoise = false;
+    string aov;             // auxiliary buffers written as <aov>_albedo.pfm, _normal.pfm, _depth.pfm; empty = none
+    int denoise_passes = 3;
+
+    // preview server, see preview.h
+    string serve;           // unix socket to serve on, empty = render once and exit
+
+    // batch rendering, see batch.h
+    string batch;           // job file, empty = render the one image of the command line
+    int batch_cache = 4;    // scenes kept loaded
+
+    int image_height() const { return static_cast<int>(image_width / aspect_ratio); }
+
+    // double frame_time(int frame) const
+    // - when frame's shutter opens, in seconds
+    double frame_time(int frame) const { return frame / fps; }
+};
+
+inline bool parse_accel(const char* name, accel_type& a) {
+    if (strcmp(name, "bvh") == 0) { a = accel_type::bvh; return true; }
+    if (strcmp(name, "list") == 0) { a = accel_type::list; return true; }
+    if (strcmp(name, "soa") == 0) { a = accel_type::soa; return true; }
+    return false;
+}
+
+inline void print_usage(const char* prog) {
+    cerr << "usage: " << prog << " [options] [> image.ppm]\n"
+         << "  --width N      image width in pixels (default 1200)\n"
+         << "  --spp N        samples per pixel (default 50)\n"
+         << "  --depth N      maximum ray bounces (default 50)\n"
+         << "  --rr N         Russian roulette from bounce N on, 0 = off (default 3)\n"
+         << "  --no-nee       find lights by scattered rays only, no direct light sampling\n"
+         << "  --histogram    print the path depth histogram\n"
+         << "  --threads N    worker threads, 0 = all cores (default 0)\n"
+         << "  --tile N       tile size in pixels (default 32)\n"
+         << "  --seed N       render seed (default 0)\n"
+         << "  --sampler S    random | halton | sobol (default random)\n"
+         << "  --accel A      bvh | list | soa (default bvh)\n"
+         << "  --packet N     trace packets of 4, 8 or 16 rays, 0 = one ray at a time (default 0)\n"
+         << "  --grid N       random_scene() grid half-size, (2N)^2 spheres (default 11)\n"
+         << "  --scene FILE   load the scene from a text or binary scene file (see scene.h)\n"
+         << "  --mesh FILE    add the triangles of an OBJ file to the scene, in light grey (repeatable)\n"
+         << "  --save-scene FILE  write the scene, binary if FILE ends in .bin\n"
+         << "  --output FILE  image file, - = stdout (default -)\n"
+         << "  --format F     ppm | p3 | png | pfm (default from the --output extension, else ppm)\n"
+         << "  --filter F     box | tent | gaussian | mitchell: reconstruct the image from the samples with filter F\n"
+         << "                 (default: each pixel the plain mean of its own samples)\n"
+         << "  --filter-radius R  the filter's radius in pixels, at most 4 (default 0.5 box, 1 tent, 1.5 gaussian,\n"
+         << "                 2 mitchell)\n"
+         << "  --texture-cache MB  memory for texture tiles; more is read again from the files (default 64)\n"
+         << "  --profile PREFIX  (raytracer_profile only) write what every pixel cost as PREFIX_time.png, _rays.png,\n"
+         << "                 _tests.png and _bounces.png, and a report of the phases and the work done as PREFIX.txt\n"
+         << "progressive rendering (implied by --checkpoint and --preview):\n"
+         << "  --progressive  render the whole image one pass at a time\n"
+         << "  --pass-spp N   samples per pixel in each pass (default 1)\n"
+         << "  --checkpoint FILE   save the accumulated samples to FILE\n"
+         << "  --checkpoint-every N  passes between checkpoints (default 8)\n"
+         << "  --resume       continue from the --checkpoint file if it exists\n"
+         << "  --preview FILE write a preview image every few passes\n"
+         << "  --preview-every N  passes between previews (default 8)\n"
+         << "adaptive sampling (--spp becomes the average budget):\n"
+         << "  --adaptive     spend samples where the pixel variance is high\n"
+         << "  --adaptive-min N   samples every pixel gets first (default 8)\n"
+         << "  --adaptive-max N   samples no pixel goes past (default 8 * spp)\n"
+         << "  --threshold X  converged when the displayed value's standard error is below X, 1/255 = one 8-bit step (default 0.01)\n"
+         << "  --time-budget S    stop refining after S seconds (default none)\n"
+         << "  --heatmap FILE write the samples spent per pixel as an image\n"
+         << "distributed rendering:\n"
+         << "  --workers N    render the tiles in N worker processes, one thread each\n"
+         << "  --fail-worker-after N  (testing) the first worker dies after N tiles\n"
+         << "animation:\n"
+         << "  --frames N     render N frames; --output names them, #### becomes the frame number\n"
+         << "  --frame N      first frame, also the frame a still image shows (default 0)\n"
+         << "  --fps X        frames per second (default 24)\n"
+         << "  --shutter X    fraction of a frame the shutter is open, 0 = no motion blur (default 0.5)\n"
+         << "  --orbit DEG    turn the camera about its lookat, DEG degrees per second from time 0\n"
+         << "  --motion       random_scene() with bouncing spheres\n"
+         << "  --instance     random_scene() with its small still spheres as instances of one unit sphere\n"
+         << "denoising (one ray at a time only):\n"
+         << "  --denoise      filter the image guided by the albedo, normals and depth of the first hits\n"
+         << "  --denoise-passes N  a-trous passes, each reaching twice as far, 1 to 12 (default 3)\n"
+         << "  --aov PREFIX   write those buffers as PREFIX_albedo.pfm, PREFIX_normal.pfm and PREFIX_depth.pfm\n"
+         << "preview server (--spp is the target, --pass-spp the samples a tile gets at a time):\n"
+         << "  --serve SOCKET keep rendering and take camera and material edits on a unix socket (see preview.h)\n"
+         << "  --preview FILE write the image every --preview-every passes\n"
+         << "batch rendering (the other options are the jobs' defaults):\n"
+         << "  --batch FILE   render the jobs of FILE, one per line (see batch.h)\n"
+         << "  --batch-cache N  scenes kept loaded between jobs (default 4)\n";
+}
+
+// bool parse_options(int argc, char** argv, render_options& opts)
+// - fills opts from argv; returns false (after printing usage) on a bad argument
+inline bool parse_options(int argc, char** argv, render_options& opts) {
+    bool format_given = false;
+    for (int k = 1 ; k < argc ; ++k) {
+        const char* arg = argv[k];
+        const char* value = (k + 1 < argc) ? argv[k + 1] : nullptr;
+
+        auto int_option = [&](const char* name, int& out) {
+            if (strcmp(arg, name) != 0 || !value) return false;
+            out = atoi(value);
+            ++k;
+            return true;
+        };
+
+        if (int_option("--width", opts.image_width)) continue;
+        if (int_option("--spp", opts.samples_per_pixel)) continue;
+        if (int_option("--depth", opts.max_depth)) continue;
+        if (int_option("--threads", opts.threads)) continue;
+        if (int_option("--tile", opts.tile_size)) continue;
+        if (int_option("--grid", opts.scene_grid)) continue;
+        if (int_option("--packet", opts.packet_size)) continue;
+        if (int_option("--rr", opts.rr_depth)) continue;
+        if (int_option("--pass-spp", opts.pass_samples)) continue;
+        if (int_option("--checkpoint-every", opts.checkpoint_every)) continue;
+        if (int_option("--preview-every", opts.preview_every)) continue;
+        if (int_option("--adaptive-min", opts.adaptive_min)) continue;
+        if (int_option("--adaptive-max", opts.adaptive_max)) continue;
+        if (int_option("--workers", opts.workers)) continue;
+        if (int_option("--fail-worker-after", opts.fail_worker_after)) continue;
+        if (int_option("--frames", opts.frames)) continue;
+        if (int_option("--frame", opts.first_frame)) continue;
+        if (int_option("--denoise-passes", opts.denoise_passes)) continue;
+        if (int_option("--batch-cache", opts.batch_cache)) continue;
+        if (int_option("--texture-cache", opts.texture_cache_mb)) continue;
+        if (strcmp(arg, "--fps") == 0 && value) {
+            opts.fps = atof(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--shutter") == 0 && value) {
+            opts.shutter = atof(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--orbit") == 0 && value) {
+            opts.orbit = atof(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--motion") == 0) {
+            opts.motion = true;
+            continue;
+        }
+        if (strcmp(arg, "--no-nee") == 0) {
+            opts.nee = false;
+            continue;
+        }
+        if (strcmp(arg, "--instance") == 0) {
+            opts.instanced = true;
+            continue;
+        }
+        if (strcmp(arg, "--adaptive") == 0) {
+            opts.adaptive = true;
+            continue;
+        }
+        if (strcmp(arg, "--threshold") == 0 && value) {
+            opts.adaptive_threshold = atof(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--time-budget") == 0 && value) {
+            opts.time_budget = atof(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--denoise") == 0) {
+            opts.denoise = true;
+            continue;
+        }
+        if (strcmp(arg, "--aov") == 0 && value) {
+            opts.aov = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--batch") == 0 && value) {
+            opts.batch = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--serve") == 0 && value) {
+            opts.serve = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--filter") == 0 && value && parse_filter(value, opts.filter)) {
+            opts.film = true;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--filter-radius") == 0 && value) {
+            opts.filter_radius = atof(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--profile") == 0 && value) {
+            opts.profile = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--heatmap") == 0 && value) {
+            opts.heatmap = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--progressive") == 0) {
+            opts.progressive = true;
+            continue;
+        }
+        if (strcmp(arg, "--resume") == 0) {
+            opts.resume = true;
+            continue;
+        }
+        if (strcmp(arg, "--checkpoint") == 0 && value) {
+            opts.checkpoint = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--preview") == 0 && value) {
+            opts.preview = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--histogram") == 0) {
+            opts.depth_histogram = true;
+            continue;
+        }
+        if (strcmp(arg, "--seed") == 0 && value) {
+            opts.seed = strtoull(value, nullptr, 10);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--accel") == 0 && value && parse_accel(value, opts.accel)) {
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--scene") == 0 && value) {
+            opts.scene = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--mesh") == 0 && value) {
+            opts.meshes.push_back(value);
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--save-scene") == 0 && value) {
+            opts.save_scene = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--output") == 0 && value) {
+            opts.output = value;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--format") == 0 && value && parse_image_format(value, opts.format)) {
+            format_given = true;
+            ++k;
+            continue;
+        }
+        if (strcmp(arg, "--sampler") == 0 && value && parse_sample_pattern(value, opts.sampler)) {
+            ++k;
+            continue;
+        }
+
+        print_usage(argv[0]);
+        return false;
+    }
+
+    if (opts.image_width <= 0 || opts.samples_per_pixel <= 0 || opts.max_depth <= 0 ||
+        opts.tile_size <= 0 || opts.scene_grid < 0 ||
+        opts.pass_samples <= 0 || opts.checkpoint_every <= 0 || opts.preview_every <= 0 ||
+        (opts.packet_size != 0 && opts.packet_size != 4 && opts.packet_size != 8 && opts.packet_size != 16) ||
+        opts.frames < 0 || opts.first_frame < 0 || opts.fps <= 0 || opts.shutter < 0 || opts.shutter > 1 ||
+        opts.texture_cache_mb <= 0 || opts.denoise_passes < 1 || opts.denoise_passes > 12 ||
+        opts.filter_radius < 0 || opts.filter_radius > pixel_filter::max_radius ||
+        (opts.resume && opts.checkpoint.empty())) {
+        print_usage(argv[0]);
+        return false;
+    }
+    if (!format_given)
+        opts.format = format_from_path(opts.output, image_format::ppm);
+    if (!opts.checkpoint.empty() || !opts.preview.empty())
+        opts.progressive = true;
+    if (!opts.heatmap.empty())
+        opts.adaptive = true;
+    if (opts.adaptive_max <= 0)
+        opts.adaptive_max = 8 * opts.samples_per_pixel;
+
+    if (opts.adaptive && (opts.progressive || opts.packet_size > 0 || opts.adaptive_min < 2 ||
+                          opts.adaptive_min > opts.adaptive_max)) {
+        cerr << "--adaptive needs --adaptive-min of at least 2 and at most --adaptive-max, and traces rays one at a"
+                " time: no progressive rendering or --packet\n";
+        return false;
+    }
+    if (opts.workers > 0 && (opts.progressive || opts.adaptive)) {
+        cerr << "--workers does not combine with progressive or adaptive rendering\n";
+        return false;
+    }
+    if (opts.frames > 0 && (opts.progressive || opts.adaptive || opts.workers > 0 || opts.output == "-")) {
+        cerr << "--frames needs an --output file name and does not combine with progressive, adaptive or distributed rendering\n";
+        return false;
+    }
+    if ((opts.denoise || !opts.aov.empty()) &&
+        (opts.packet_size > 0 || opts.adaptive || opts.workers > 0 || opts.frames > 0)) {
+        cerr << "--denoise and --aov need rays traced one at a time in this process: no --packet, --adaptive, --workers or --frames\n";
+        return false;
+    }
+    if (!opts.serve.empty() && (!opts.checkpoint.empty() || opts.adaptive || opts.workers > 0 || opts.frames > 0 ||
+                                opts.denoise || !opts.aov.empty())) {
+        cerr << "--serve renders progressively by itself: no --checkpoint, --adaptive, --workers, --frames, --denoise or --aov\n";
+        return false;
+    }
+    if (opts.film && (opts.packet_size > 0 || opts.workers > 0 || !opts.serve.empty() || !opts.batch.empty() ||
+                      !opts.checkpoint.empty())) {
+        cerr << "--filter splats the samples of rays traced one at a time in this process: no --packet, --workers,"
+                " --serve, --batch or --checkpoint\n";
+        return false;
+    }
+    if (!opts.profile.empty()) {
+#ifndef RAYTRACER_PROFILE
+        cerr << "--profile needs the counting compiled in: run raytracer_profile\n";
+        return false;
+#endif
+        if (opts.packet_size > 0 || opts.workers > 0 || opts.frames > 0 || !opts.serve.empty() || !opts.batch.empty()) {
+            cerr << "--profile measures one image traced one ray at a time in this process: no --packet, --workers,"
+                    " --frames, --serve or --batch\n";
+            return false;
+        }
+    }
+    if (!opts.batch.empty() && (!opts.serve.empty() || opts.progressive || opts.adaptive || opts.workers > 0 ||
+                                opts.frames > 0 || opts.denoise || !opts.aov.empty() || opts.packet_size > 0 ||
+                                !opts.scene.empty() || !opts.meshes.empty() || opts.accel != accel_type::bvh ||
+                                opts.batch_cache <= 0)) {
+        cerr << "--batch takes its scenes from the job file and renders one ray at a time through a bvh: no --scene,"
+                " --mesh, --serve, progressive, adaptive or distributed rendering, --frames, --denoise, --aov, --packet"
+                " or --accel other than bvh, and a --batch-cache of at least 1\n";
+        return false;
+    }
+    return true;
+}
+
+#endif
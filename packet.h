@@ -0,0 +1,184 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "camera.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "material.h"
+#include "renderer.h"
+
+#include <vector>
+
+using namespace std;
+
+// class packet_tracer
+// - renders a tile with ray packets instead of one recursive ray_color per sample
+// - primary rays of a block of neighbouring pixels (2x2, 4x2 or 4x4 for packets
+//   of 4, 8 or 16) are generated together and intersected as one packet
+// - the scattered rays are then traced breadth first: every bounce of the tile's
+//   paths forms one stream that is intersected a ray at a time; scattered diffuse
+//   rays are too incoherent for packets to pay off, and sorting the stream by
+//   direction (octant, then origin) cost more than it saved on random_scene
+// - every path carries its own RNG state (seeded exactly as the scalar path
+//   seeds its sample), so the materials see the same random numbers as in the
+//   scalar renderer and the image matches it up to floating point rounding
+class packet_tracer {
+
+    public:
+        // CONSTRUCTORS
+        packet_tracer(const hittable& w, const material_table& m, const camera& c, int width, int height,
+                      int depth, int roulette_depth, int packet, sample_pattern pattern, uint64_t render_seed,
+                      const light_list* light_sources = nullptr)
+            : world(w), materials(m), cam(c), image_width(width), image_height(height),
+              max_depth(depth), rr_depth(roulette_depth),
+              sampler_pattern(pattern), seed(render_seed),
+              lights(light_sources && !light_sources->empty() ? light_sources : nullptr) {
+            packet_size = packet <= 4 ? 4 : (packet <= 8 ? 8 : 16);
+            block_w = packet_size == 4 ? 2 : 4;
+            block_h = packet_size / block_w;
+        }
+
+        // void render_tile(const tile& t, framebuffer& fb, int first_sample, int end_sample) const
+        // - renders samples [first_sample, end_sample) of every pixel of t and adds
+        //   them to the sums in fb
+        void render_tile(const tile& t, framebuffer& fb, int first_sample, int end_sample) const {
+            const int sample_count = end_sample - first_sample;
+            const int tw = t.x1 - t.x0;
+            const int th = t.y1 - t.y0;
+
+            // the tile's transient arrays live in the thread's scratch arena, which
+            // is reset here; after the first tiles rendering allocates nothing
+            arena& scratch = thread_scratch();
+            scratch.reset();
+            arena_vector<color> accum(static_cast<size_t>(tw) * th, color(0, 0, 0), arena_allocator<color>(scratch));
+            arena_vector<pixel_sampler> samplers{arena_allocator<pixel_sampler>(scratch)};
+            samplers.reserve(accum.size());
+            for (int j = t.y0 ; j < t.y1 ; ++j)
+                for (int i = t.x0 ; i < t.x1 ; ++i)
+                    samplers.emplace_back(sampler_pattern, seed, static_cast<uint64_t>(j) * image_width + i);
+
+            arena_vector<path> stream{arena_allocator<path>(scratch)}, next{arena_allocator<path>(scratch)};
+            stream.reserve(accum.size() * sample_count);
+            next.reserve(accum.size() * sample_count);
+
+            // primary rays: one packet per block of pixels and sample
+            for (int s = first_sample ; s < end_sample ; ++s) {
+                for (int by = 0 ; by < th ; by += block_h) {
+                    for (int bx = 0 ; bx < tw ; bx += block_w) {
+                        path lanes[ray_packet::max_size];
+                        int n = 0;
+                        for (int y = by ; y < min(by + block_h, th) ; ++y) {
+                            for (int x = bx ; x < min(bx + block_w, tw) ; ++x) {
+                                int local = (y * tw) + x;
+                                pixel_sampler& sampler = samplers[local];
+                                sampler.start_sample(s);
+                                lanes[n].r = primary_ray(cam, sampler, t.x0 + x, t.y0 + y, image_width, image_height);
+                                lanes[n].throughput = color(1, 1, 1);
+                                lanes[n].scatter_pdf = 0;
+                                lanes[n].rng = thread_rng();
+                                lanes[n].pixel = local;
+                                lanes[n].depth = 1;
+                                n++;
+                            }
+                        }
+                        trace_packet(lanes, n, accum, stream, true);
+                    }
+                }
+            }
+
+            // secondary rays: breadth first, one stream per bounce
+            for (int depth = 2 ; depth <= max_depth && !stream.empty() ; ++depth) {
+                swap(stream, next);
+                stream.clear();
+                for (size_t first = 0 ; first < next.size() ; first += packet_size) {
+                    int n = static_cast<int>(min(next.size() - first, static_cast<size_t>(packet_size)));
+                    trace_packet(&next[first], n, accum, stream, false);
+                }
+            }
+
+            path_stats& stats = thread_path_stats();
+            stats.truncated += stream.size();
+            for (size_t k = 0 ; k < stream.size() ; ++k)
+                stats.record(max_depth);
+
+            for (int y = 0 ; y < th ; ++y)
+                for (int x = 0 ; x < tw ; ++x)
+                    fb.at(t.x0 + x, t.y0 + y) += accum[(y * tw) + x];
+            flush_render_stats();
+        }
+
+    private:
+        struct path {
+            ray r;
+            color throughput;
+            real scatter_pdf;   // see shade_hit
+            pcg32 rng;
+            int pixel;          // index into the tile
+            int depth;          // rays traced so far, including this one
+        };
+
+        const hittable& world;
+        const material_table& materials;
+        const camera& cam;
+        int image_width, image_height;
+        int max_depth;
+        int rr_depth;
+        sample_pattern sampler_pattern;
+        uint64_t seed;
+        const light_list* lights;
+        int packet_size;
+        int block_w, block_h;
+
+        // void trace_packet(const path* paths, int n, arena_vector<color>& accum, arena_vector<path>& out, bool coherent) const
+        // - intersects n paths, as one packet if coherent and otherwise one ray at a
+        //   time, adds the sky to the paths that escape and appends the scattered
+        //   continuations to out
+        void trace_packet(const path* paths, int n, arena_vector<color>& accum, arena_vector<path>& out, bool coherent) const {
+            ray_packet p;
+            p.size = n;
+            real t_max[ray_packet::max_size];
+            bool hits[ray_packet::max_size];
+            hit_record recs[ray_packet::max_size];
+            for (int k = 0 ; k < ray_packet::max_size ; ++k) {
+                if (k < n) p.set(k, paths[k].r);
+                t_max[k] = k < n ? infinity : -infinity;
+                hits[k] = false;
+            }
+            p.pad();
+
+            if (coherent) {
+                world.hit_packet(p, ray_t_min, t_max, recs, hits);
+            } else {
+                for (int k = 0 ; k < n ; ++k)
+                    hits[k] = world.hit(paths[k].r, ray_t_min, infinity, recs[k]);
+            }
+            thread_ray_count() += n;
+
+            // the same termination rules, in the same order, as ray_color()
+            path_stats& stats = thread_path_stats();
+            for (int k = 0 ; k < n ; ++k) {
+                const path& current = paths[k];
+                if (!hits[k]) {
+                    accum[current.pixel] += current.throughput * sky_color(current.r);
+                    stats.escaped++;
+                    stats.record(current.depth);
+                    continue;
+                }
+
+                path continued = current;
+                thread_rng() = current.rng;
+                if (!shade_hit(current.r, recs[k], world, materials, lights, current.depth, rr_depth,
+                               continued.throughput, continued.scatter_pdf, accum[current.pixel], continued.r))
+                    continue;
+                continued.rng = thread_rng();
+                continued.depth = current.depth + 1;
+                out.push_back(continued);
+            }
+        }
+
+};
+
+#endif
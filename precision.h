@@ -0,0 +1,37 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// PRECISION
+// - real is the scalar of vec3, ray, hit_record and the geometry: double by
+//   default, float when built with RAYTRACER_FLOAT (the raytracer_float and
+//   bench_float targets)
+// - vec3_lanes is the number of scalars a vec3 stores: 3, or 4 with
+//   RAYTRACER_VEC4, where the fourth lane is always zero and the vector is
+//   aligned to its size so the per-lane loops compile to one SIMD operation
+// - a render is only reproducible bit for bit within one configuration;
+//   checkpoints record the layout and refuse to load into another
+
+#ifdef RAYTRACER_FLOAT
+typedef float real;
+#else
+typedef double real;
+#endif
+
+#ifdef RAYTRACER_VEC4
+static const int vec3_lanes = 4;
+#else
+static const int vec3_lanes = 3;
+#endif
+
+// const char* precision_name()
+// - "double" / "float", with "x4" for the 4-lane layout; printed by the
+//   raytracer and recorded in the benchmark report
+inline const char* precision_name() {
+#ifdef RAYTRACER_FLOAT
+    return vec3_lanes == 4 ? "floatx4" : "float";
+#else
+    return vec3_lanes == 4 ? "doublex4" : "double";
+#endif
+}
+
+#endif
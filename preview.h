@@ -0,0 +1,551 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "distributed.h"
+#include "image_io.h"
+#include "integrator.h"
+#include "light.h"
+#include "material.h"
+#include "renderer.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// PREVIEW SERVER
+// - raytracer --serve SOCKET keeps the scene, its hierarchy and the image
+//   resident and goes on rendering progressively; clients on a unix socket
+//   edit the camera and the materials and read the image back, and --preview
+//   FILE gets a copy every few passes
+// - the image is rendered a batch of tiles at a time, the tiles with the
+//   fewest samples first and the middle of the image before its borders, and
+//   commands are read between batches: an edit takes effect after at most one
+//   batch and the first tiles of the new image follow a few milliseconds later
+// - a camera edit restarts every tile; a material edit restarts only the tiles
+//   whose samples hit that material (thread_material_mask, integrator.h) and
+//   the others keep their samples, which the material played no part in; an
+//   emitter restarts every tile, since direct light sampling reaches them all
+// - a restarted tile begins again at sample 0, so once every tile reaches the
+//   target the image is the one raytracer renders offline with the same scene
+//   and settings
+//
+// protocol, one command per line and one reply line each, "ok ..." or "error <why>":
+//   camera                       ok lookfrom x y z lookat x y z vup x y z vfov f aperture f focus f
+//   camera [lookfrom x y z] [lookat x y z] [vup x y z] [vfov f] [aperture f] [focus f]
+//   materials                    ok <n>, then n lines "<id> <type> <r g b> <param>"
+//   material <id> [albedo r g b] [fuzz f] [ir f] [emit r g b]
+//                                ok <tiles restarted> of <tiles>
+//   status                       ok spp <min> <max> target <spp> tiles <n> restarted <n> edits <n>
+//                                first_tile_ms <ms> first_pass_ms <ms> rays <n>
+//   wait <spp>                   the status reply, once every tile has min(spp, target) samples
+//   frame [ppm|png|pfm]          ok <bytes> <min spp>, then the encoded image (ppm by default)
+//   write <file>                 ok, after writing the image to file (format from the extension)
+//   save <file>                  ok, after writing the edited scene (binary if file ends in .bin)
+//   quit                         ok, and the server exits
+// (a material id is an entry of the scene's deduplicated table, m<id> in a
+// saved text scene, and editing it changes every object that shares it; a
+// camera edit drops the scene's keyframes)
+
+// struct preview_settings
+struct preview_settings {
+    int samples_per_pixel = 50;     // the target every tile is rendered to
+    int pass_samples = 1;           // samples per pixel a tile gets in one batch
+    double aspect_ratio = 1.5;
+    double time0 = 0, time1 = 0;    // the shutter interval, see scene_desc::make_camera
+};
+
+// struct preview_stats
+// - the timings are from the last edit (or the start) on, -1 until reached
+struct preview_stats {
+    uint64_t edits = 0;
+    uint64_t tiles_restarted = 0;   // by material edits, which may leave tiles alone
+    double first_tile_ms = -1;      // until the first batch of tiles is done
+    double first_pass_ms = -1;      // until every tile has a sample
+};
+
+// class preview_session
+// - the render state of the preview server without the socket: the tiles'
+//   sample counts and material masks, the edits and the batches
+// - render_tile(t, fb, first, end) adds samples [first, end) of tile t to fb,
+//   as for render_coordinator; the camera and materials it renders with are
+//   the ones the session edits
+class preview_session {
+
+    public:
+        typedef function<void(const tile&, framebuffer&, int, int)> render_function;
+
+        // MEMBERS
+        preview_stats stats;
+
+    public:
+        // CONSTRUCTORS
+        preview_session(scene_desc& d, material_table& m, light_list& l, camera& c, framebuffer& f,
+                        const tile_renderer& r, render_function render, const preview_settings& s)
+            : desc(d), materials(m), lights(l), cam(c), fb(f), renderer(r), render_tile(move(render)), settings(s) {
+            tiles = renderer.make_tiles(fb.width, fb.height);
+            columns = (fb.width + renderer.tile_size - 1) / renderer.tile_size;
+            mask_words = max<size_t>(1, (materials.size() + 63) / 64);
+            samples.assign(tiles.size(), 0);
+            masks.assign(tiles.size() * mask_words, 0);
+            fb.sample_counts.assign(fb.pixels.size(), 0);
+
+            // the middle of the image first, where the eye is
+            order.resize(tiles.size());
+            for (size_t k = 0 ; k < tiles.size() ; ++k)
+                order[k] = static_cast<uint32_t>(k);
+            auto distance = [&](uint32_t k) {
+                double dx = (tiles[k].x0 + tiles[k].x1 - fb.width) * 0.5;
+                double dy = (tiles[k].y0 + tiles[k].y1 - fb.height) * 0.5;
+                return (dx * dx) + (dy * dy);
+            };
+            stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return distance(a) < distance(b); });
+            restart_all();
+            stats.edits = 0;
+        }
+
+        size_t tile_count() const { return tiles.size(); }
+        int target() const { return settings.samples_per_pixel; }
+        int min_samples() const { return *min_element(samples.begin(), samples.end()); }
+        int max_samples() const { return *max_element(samples.begin(), samples.end()); }
+        bool converged() const { return min_samples() >= settings.samples_per_pixel; }
+
+        // void render_batch()
+        // - one pass over the next batch of tiles: two per thread among those
+        //   with the fewest samples
+        void render_batch() {
+            const int first = min_samples();
+            if (first >= settings.samples_per_pixel) return;
+            const int end = min(first + settings.pass_samples, settings.samples_per_pixel);
+            const size_t batch_size = static_cast<size_t>(2 * max(renderer.thread_count, 1));
+
+            batch.clear();
+            for (uint32_t k : order) {
+                if (samples[k] != first) continue;
+                batch.push_back(tiles[k]);
+                if (batch.size() == batch_size) break;
+            }
+            renderer.render_tiles(batch, [&](const tile& t) {
+                size_t k = tile_index(t);
+                thread_material_mask() = &masks[k * mask_words];
+                render_tile(t, fb, first, end);
+                thread_material_mask() = nullptr;
+            });
+            for (const tile& t : batch) {
+                samples[tile_index(t)] = end;
+                set_sample_counts(t, end);
+            }
+
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - edit_time).count();
+            if (stats.first_tile_ms < 0) stats.first_tile_ms = ms;
+            if (stats.first_pass_ms < 0 && min_samples() > 0) stats.first_pass_ms = ms;
+        }
+
+        // void restart_all()
+        // - every tile from sample 0
+        void restart_all() {
+            for (size_t k = 0 ; k < tiles.size() ; ++k)
+                restart_tile(k);
+            fill(masks.begin(), masks.end(), 0);
+            edited();
+        }
+
+        const scene_desc& scene() const { return desc; }
+
+        // bool edit_camera(const scene_camera& c, string& error)
+        bool edit_camera(const scene_camera& c, string& error) {
+            if (!check_camera(c, error)) return false;
+            desc.cam = c;
+            desc.keyframes.clear();
+            cam = desc.make_camera(settings.aspect_ratio, settings.time0, settings.time1);
+            restart_all();
+            return true;
+        }
+
+        // bool edit_material(uint32_t id, const scene_material& m, size_t& restarted, string& error)
+        // - m must keep the material's type; restarted is the number of tiles
+        //   the edit sent back to sample 0
+        bool edit_material(uint32_t id, const scene_material& m, size_t& restarted, string& error) {
+            if (id >= desc.materials.size() || id >= materials.size()) {
+                error = "no material " + to_string(id);
+                return false;
+            }
+            if (m.type != desc.materials[id].type) {
+                error = "a material keeps its type";
+                return false;
+            }
+            if (!check_material(m, error)) return false;
+            desc.set_material(id, m);
+            materials.materials[id] = make_material(m, desc.texture_ids);
+
+            if (m.type == material_type::emissive) {
+                for (sphere_light& l : lights.lights)
+                    if (l.material_id == id) l.emission = color(m.albedo[0], m.albedo[1], m.albedo[2]);
+                lights.prepare();
+                restart_all();
+                restarted = tiles.size();
+                stats.tiles_restarted += restarted;
+                return true;
+            }
+
+            restarted = 0;
+            const size_t word = id >> 6;
+            const uint64_t bit = uint64_t(1) << (id & 63);
+            for (size_t k = 0 ; k < tiles.size() ; ++k) {
+                uint64_t& w = masks[(k * mask_words) + word];
+                if (!(w & bit)) continue;
+                fill(masks.begin() + (k * mask_words), masks.begin() + ((k + 1) * mask_words), 0);
+                restart_tile(k);
+                restarted++;
+            }
+            stats.tiles_restarted += restarted;
+            edited();
+            return true;
+        }
+
+    private:
+        scene_desc& desc;
+        material_table& materials;
+        light_list& lights;
+        camera& cam;
+        framebuffer& fb;
+        const tile_renderer& renderer;
+        render_function render_tile;
+        preview_settings settings;
+
+        vector<tile> tiles;
+        vector<uint32_t> order;         // tile indices, middle first
+        vector<int> samples;            // per tile
+        vector<uint64_t> masks;         // per tile, mask_words words: the materials its samples hit
+        size_t mask_words;
+        int columns;
+        vector<tile> batch;
+        chrono::steady_clock::time_point edit_time;
+
+        size_t tile_index(const tile& t) const {
+            return (static_cast<size_t>(t.y0 / renderer.tile_size) * columns) + (t.x0 / renderer.tile_size);
+        }
+
+        void restart_tile(size_t k) {
+            const tile& t = tiles[k];
+            for (int j = t.y0 ; j < t.y1 ; ++j)
+                for (int i = t.x0 ; i < t.x1 ; ++i)
+                    fb.at(i, j) = color(0, 0, 0);
+            set_sample_counts(t, 0);
+            samples[k] = 0;
+        }
+
+        void set_sample_counts(const tile& t, int n) {
+            for (int j = t.y0 ; j < t.y1 ; ++j)
+                fill(fb.sample_counts.begin() + (static_cast<size_t>(j) * fb.width) + t.x0,
+                     fb.sample_counts.begin() + (static_cast<size_t>(j) * fb.width) + t.x1, n);
+        }
+
+        void edited() {
+            stats.edits++;
+            stats.first_tile_ms = -1;
+            stats.first_pass_ms = -1;
+            edit_time = chrono::steady_clock::now();
+        }
+
+};
+
+// class preview_server
+// - the socket side: accepts clients, runs their commands between the
+//   session's batches and writes the --preview file
+class preview_server {
+
+    public:
+        // CONSTRUCTORS
+        preview_server(preview_session& s, const framebuffer& f, string socket, string preview_file, int every)
+            : session(s), fb(f), socket_path(move(socket)), preview(move(preview_file)), preview_every(max(every, 1)) {}
+
+        // bool run(const function<bool()>& stop, string& error)
+        // - serves until a client sends quit or stop() is true, which is asked
+        //   between batches and whenever a signal interrupts the wait
+        bool run(const function<bool()>& stop, string& error) {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (socket_path.size() >= sizeof(address.sun_path)) {
+                error = "socket path too long: " + socket_path;
+                return false;
+            }
+            memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+            int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(socket_path.c_str());
+            if (listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+                listen(listener, 8) != 0) {
+                error = "cannot listen on " + socket_path;
+                if (listener >= 0) close(listener);
+                return false;
+            }
+            cerr << "serving on " << socket_path << ", " << session.tile_count() << " tiles to "
+                 << session.target() << " spp\n";
+
+            vector<pollfd> fds;
+            int passes_written = 0;
+            while (!quitting && !stop()) {
+                fds.clear();
+                fds.push_back({ listener, POLLIN, 0 });
+                for (const client& c : clients)
+                    fds.push_back({ c.fd, POLLIN, 0 });
+                // idle once the image is done: block until a client says something
+                if (poll(fds.data(), fds.size(), session.converged() ? -1 : 0) < 0) {
+                    if (errno == EINTR) continue;
+                    error = "poll failed";
+                    break;
+                }
+                if (fds[0].revents & POLLIN) {
+                    int fd = accept(listener, nullptr, nullptr);
+                    if (fd >= 0) clients.push_back({ fd, string(), -1 });
+                }
+                for (size_t k = 1 ; k < fds.size() ; ++k)
+                    if (fds[k].revents) receive(clients[k - 1]);
+
+                if (!session.converged()) {
+                    int before = session.min_samples();
+                    session.render_batch();
+                    int after = session.min_samples();
+                    if (!preview.empty() && after > before &&
+                        (++passes_written % preview_every == 0 || after == session.target() || after == 1))
+                        write_preview();
+                }
+                for (client& c : clients) {
+                    if (c.fd >= 0 && c.wait_samples >= 0 && session.min_samples() >= c.wait_samples) {
+                        c.wait_samples = -1;
+                        reply(c, status());
+                        run_commands(c);
+                    }
+                }
+                clients.erase(remove_if(clients.begin(), clients.end(), [](const client& c) { return c.fd < 0; }),
+                              clients.end());
+            }
+
+            for (client& c : clients)
+                close(c.fd);
+            close(listener);
+            unlink(socket_path.c_str());
+            return error.empty();
+        }
+
+    private:
+        struct client {
+            int fd;
+            string input;           // received, not yet run
+            int wait_samples;       // a wait command's spp, -1 = none
+        };
+
+        preview_session& session;
+        const framebuffer& fb;
+        string socket_path;
+        string preview;
+        int preview_every;
+        vector<client> clients;
+        bool quitting = false;
+
+        void receive(client& c) {
+            char buffer[4096];
+            ssize_t got = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (got < 0 && errno == EINTR) return;
+            if (got <= 0 || c.input.size() > (64 << 10)) {
+                drop(c);
+                return;
+            }
+            c.input.append(buffer, static_cast<size_t>(got));
+            run_commands(c);
+        }
+
+        // runs the client's complete lines, stopping at a wait until it is answered
+        void run_commands(client& c) {
+            size_t start = 0, end;
+            while (c.fd >= 0 && c.wait_samples < 0 && !quitting && (end = c.input.find('\n', start)) != string::npos) {
+                string line = c.input.substr(start, end - start);
+                start = end + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                command(c, line);
+            }
+            c.input.erase(0, start);
+        }
+
+        void command(client& c, const string& line) {
+            istringstream in(line);
+            string name;
+            if (!(in >> name)) return;
+
+            if (name == "camera") {
+                scene_camera cam = session.scene().cam;
+                string key;
+                bool any = false;
+                while (in >> key) {
+                    any = true;
+                    bool ok = key == "lookfrom" ? read_vec(in, cam.lookfrom) :
+                              key == "lookat" ? read_vec(in, cam.lookat) :
+                              key == "vup" ? read_vec(in, cam.vup) :
+                              key == "vfov" ? bool(in >> cam.vfov) :
+                              key == "aperture" ? bool(in >> cam.aperture) :
+                              key == "focus" ? bool(in >> cam.focus_dist) : false;
+                    if (!ok) return reply(c, "error camera takes lookfrom, lookat, vup (x y z each), vfov, aperture and focus");
+                }
+                string error;
+                if (any && !session.edit_camera(cam, error)) return reply(c, "error " + error);
+                const scene_camera& now = session.scene().cam;
+                ostringstream out;
+                out.precision(17);
+                out << "ok lookfrom " << now.lookfrom << " lookat " << now.lookat << " vup " << now.vup << " vfov " << now.vfov
+                    << " aperture " << now.aperture << " focus " << now.focus_dist;
+                return reply(c, out.str());
+            }
+            if (name == "materials") {
+                const vector<scene_material>& list = materials();
+                ostringstream out;
+                out.precision(17);
+                out << "ok " << list.size() << '\n';
+                for (size_t k = 0 ; k < list.size() ; ++k) {
+                    const scene_material& m = list[k];
+                    out << k << ' ' << material_name(m.type) << ' ' << m.albedo[0] << ' ' << m.albedo[1] << ' '
+                        << m.albedo[2] << ' ' << m.param << (k + 1 < list.size() ? "\n" : "");
+                }
+                return reply(c, out.str());
+            }
+            if (name == "material") {
+                uint32_t id;
+                if (!(in >> id) || id >= materials().size())
+                    return reply(c, "error material needs the id of one of the " + to_string(materials().size()) + " materials");
+                scene_material m = materials()[id];
+                string key;
+                while (in >> key) {
+                    color v;
+                    bool ok;
+                    if (key == "albedo" && (m.type == material_type::lambertian || m.type == material_type::metal)) {
+                        ok = read_vec(in, v);
+                    } else if (key == "emit" && m.type == material_type::emissive) {
+                        ok = read_vec(in, v);
+                    } else if (key == "fuzz" && m.type == material_type::metal) {
+                        ok = bool(in >> m.param);
+                    } else if (key == "ir" && m.type == material_type::dielectric) {
+                        ok = bool(in >> m.param);
+                    } else {
+                        return reply(c, "error material " + to_string(id) + " is " + material_name(m.type) +
+                                        ": lambertian takes albedo, metal albedo and fuzz, dielectric ir, emissive emit");
+                    }
+                    if (!ok) return reply(c, "error bad value for " + key);
+                    if (key == "albedo" || key == "emit") {
+                        m.albedo[0] = v.x();
+                        m.albedo[1] = v.y();
+                        m.albedo[2] = v.z();
+                    }
+                }
+                size_t restarted = 0;
+                string error;
+                if (!session.edit_material(id, m, restarted, error)) return reply(c, "error " + error);
+                return reply(c, "ok " + to_string(restarted) + " of " + to_string(session.tile_count()));
+            }
+            if (name == "status") return reply(c, status());
+            if (name == "wait") {
+                int spp;
+                if (!(in >> spp)) return reply(c, "error wait needs a sample count");
+                c.wait_samples = max(0, min(spp, session.target()));
+                if (session.min_samples() >= c.wait_samples) {
+                    c.wait_samples = -1;
+                    reply(c, status());
+                }
+                return;
+            }
+            if (name == "frame") {
+                string format_name = "ppm";
+                in >> format_name;
+                image_format format;
+                if (!parse_image_format(format_name.c_str(), format)) return reply(c, "error unknown format " + format_name);
+                string data;
+                encode_image(fb, 1, format, data);
+                reply(c, "ok " + to_string(data.size()) + ' ' + to_string(session.min_samples()));
+                if (c.fd >= 0 && !send_all(c.fd, data.data(), data.size())) drop(c);
+                return;
+            }
+            if (name == "write" || name == "save") {
+                string path;
+                if (!(in >> path)) return reply(c, "error " + name + " needs a file name");
+                bool ok;
+                if (name == "write") {
+                    ok = write_image(fb, 1, format_from_path(path, image_format::ppm), path);
+                } else {
+                    bool binary = path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+                    ok = save_scene(path, session.scene(), binary);
+                }
+                return reply(c, ok ? "ok" : "error cannot write " + path);
+            }
+            if (name == "quit") {
+                quitting = true;
+                return reply(c, "ok");
+            }
+            reply(c, "error unknown command " + name);
+        }
+
+        string status() const {
+            char line[256];
+            snprintf(line, sizeof(line), "ok spp %d %d target %d tiles %zu restarted %llu edits %llu first_tile_ms %.3f "
+                                         "first_pass_ms %.3f rays %llu",
+                     session.min_samples(), session.max_samples(), session.target(), session.tile_count(),
+                     static_cast<unsigned long long>(session.stats.tiles_restarted),
+                     static_cast<unsigned long long>(session.stats.edits), session.stats.first_tile_ms,
+                     session.stats.first_pass_ms, static_cast<unsigned long long>(total_ray_count().load()));
+            return line;
+        }
+
+        void reply(client& c, const string& line) {
+            if (c.fd < 0) return;
+            string out = line + '\n';
+            if (!send_all(c.fd, out.data(), out.size())) drop(c);
+        }
+
+        void drop(client& c) {
+            if (c.fd >= 0) close(c.fd);
+            c.fd = -1;
+        }
+
+        // the preview is written next to its name and renamed over it, so a
+        // viewer polling the file never reads half an image
+        void write_preview() {
+            string tmp = preview + ".tmp";
+            if (!write_image(fb, 1, format_from_path(preview, image_format::ppm), tmp) || rename(tmp.c_str(), preview.c_str()) != 0)
+                cerr << "cannot write " << preview << '\n';
+        }
+
+        const vector<scene_material>& materials() const { return session.scene().materials; }
+
+        static bool read_vec(istream& in, vec3& v) {
+            double x, y, z;
+            if (!(in >> x >> y >> z)) return false;
+            v = vec3(x, y, z);
+            return true;
+        }
+
+        static const char* material_name(material_type t) {
+            switch (t) {
+                case material_type::metal: return "metal";
+                case material_type::dielectric: return "dielectric";
+                case material_type::emissive: return "emissive";
+                default: return "lambertian";
+            }
+        }
+
+};
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "material_type.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// PROFILING
+// - built with RAYTRACER_PROFILE defined (the raytracer_profile target) the
+//   render core counts its work as it goes: rays and shadow rays traced,
+//   hierarchy boxes and primitives tested, materials evaluated by type and
+//   dielectric bounces that could not refract
+// - the counts are plain thread-locals, never atomics; totals are summed over
+//   every thread's counters when asked for
+// - render loops bracket the samples of a pixel with profile_pixel_begin()
+//   and profile_pixel_end(), which adds what the thread counted in between,
+//   and how long it took, to that pixel of the active pixel_profile
+// - without RAYTRACER_PROFILE every profile_* function is empty and the
+//   counting compiles away
+
+// the names of material_type, in its order
+const char* const profile_material_names[] = { "lambertian", "metal", "dielectric", "emissive" };
+static_assert(sizeof(profile_material_names) / sizeof(profile_material_names[0]) == material_type_count,
+              "profile_material_names names every material_type");
+
+// struct profile_counters
+struct profile_counters {
+    uint64_t rays = 0;              // camera and scattered rays
+    uint64_t shadow_rays = 0;
+    uint64_t box_tests = 0;         // hierarchy nodes whose box a ray was tested against
+    uint64_t primitive_tests = 0;   // spheres and triangles a ray was tested against
+    uint64_t total_internal = 0;    // dielectric bounces that could only reflect
+    uint64_t material_evals[material_type_count] = {};
+
+    uint64_t bounces() const {
+        uint64_t n = 0;
+        for (int k = 0 ; k < material_type_count ; ++k) n += material_evals[k];
+        return n;
+    }
+
+    void add(const profile_counters& o) {
+        rays += o.rays;
+        shadow_rays += o.shadow_rays;
+        box_tests += o.box_tests;
+        primitive_tests += o.primitive_tests;
+        total_internal += o.total_internal;
+        for (int k = 0 ; k < material_type_count ; ++k) material_evals[k] += o.material_evals[k];
+    }
+};
+
+// struct profile_threads
+// - the counters of every thread that has counted anything; a thread's
+//   counters are folded into retired when it exits
+struct profile_threads {
+    mutex lock;
+    vector<const profile_counters*> live;
+    profile_counters retired;
+};
+
+inline profile_threads& all_profile_threads() {
+    static profile_threads threads;
+    return threads;
+}
+
+// struct thread_profile_counters
+// - a thread's counters, registered with all_profile_threads() while it runs
+struct thread_profile_counters : profile_counters {
+    thread_profile_counters() {
+        profile_threads& threads = all_profile_threads();
+        lock_guard<mutex> lock(threads.lock);
+        threads.live.push_back(this);
+    }
+
+    ~thread_profile_counters() {
+        profile_threads& threads = all_profile_threads();
+        lock_guard<mutex> lock(threads.lock);
+        threads.retired.add(*this);
+        threads.live.erase(find(threads.live.begin(), threads.live.end(), this));
+    }
+};
+
+inline profile_counters& thread_profile() {
+    thread_local thread_profile_counters counters;
+    return counters;
+}
+
+// profile_counters total_profile()
+// - the counts of all threads so far; read while no render is running
+inline profile_counters total_profile() {
+    profile_threads& threads = all_profile_threads();
+    lock_guard<mutex> lock(threads.lock);
+    profile_counters total = threads.retired;
+    for (const profile_counters* counters : threads.live) total.add(*counters);
+    return total;
+}
+
+// void profile_count(uint64_t profile_counters::* counter, uint64_t n = 1)
+// - adds n to one of the thread's counters
+inline void profile_count(uint64_t profile_counters::* counter, uint64_t n = 1) {
+#ifdef RAYTRACER_PROFILE
+    thread_profile().*counter += n;
+#else
+    (void)counter;
+    (void)n;
+#endif
+}
+
+// void profile_material(material_type type)
+// - counts an evaluation of a material of the given type
+inline void profile_material(material_type type) {
+#ifdef RAYTRACER_PROFILE
+    thread_profile().material_evals[static_cast<int>(type)]++;
+#else
+    (void)type;
+#endif
+}
+
+// struct pixel_cost
+// - what the samples of one pixel cost, summed over every pass that rendered it
+struct pixel_cost {
+    uint32_t rays = 0;              // shadow rays included
+    uint32_t box_tests = 0;
+    uint32_t primitive_tests = 0;
+    uint32_t bounces = 0;           // material evaluations
+    float microseconds = 0;
+};
+
+// class pixel_profile
+// - the cost of every pixel of an image, rows bottom to top like framebuffer
+class pixel_profile {
+
+    public:
+        // MEMBERS
+        int width, height;
+        vector<pixel_cost> pixels;
+
+        // the measures heatmap() can draw
+        enum class measure { time, rays, tests, bounces };
+
+    public:
+        // CONSTRUCTORS
+        pixel_profile(int w, int h) : width(w), height(h), pixels(size_t(w) * h) {}
+
+        pixel_cost& at(int i, int j) { return pixels[static_cast<size_t>(j) * width + i]; }
+        const pixel_cost& at(int i, int j) const { return pixels[static_cast<size_t>(j) * width + i]; }
+
+        static double value(const pixel_cost& c, measure m) {
+            switch (m) {
+                case measure::time: return c.microseconds;
+                case measure::rays: return c.rays;
+                case measure::tests: return double(c.box_tests) + c.primitive_tests;
+                default: return c.bounces;
+            }
+        }
+
+        // double scale(measure m) const
+        // - the value heatmap() draws white: the 99th percentile of m, not the
+        //   largest value, since a pixel whose thread was preempted can take a
+        //   hundred times the time of its neighbours and would leave the rest
+        //   of the image black
+        double scale(measure m) const {
+            vector<double> values(pixels.size());
+            for (size_t k = 0 ; k < pixels.size() ; ++k) values[k] = value(pixels[k], m);
+            if (values.empty()) return 1;
+            auto at = values.begin() + static_cast<ptrdiff_t>((values.size() - 1) * 99 / 100);
+            nth_element(values.begin(), at, values.end());
+            return *at > 0 ? *at : 1;
+        }
+
+        // void heatmap(measure m, vector<uint8_t>& rgb) const
+        // - m per pixel as an 8-bit image (rows top to bottom), black through
+        //   red and yellow to white at scale(m) and above, like the adaptive
+        //   sampler's heatmap
+        void heatmap(measure m, vector<uint8_t>& rgb) const {
+            const double most = scale(m);
+            rgb.resize(pixels.size() * 3);
+            for (int y = 0 ; y < height ; ++y) {
+                for (int x = 0 ; x < width ; ++x) {
+                    double t = value(at(x, height - 1 - y), m) / most;
+                    uint8_t* dst = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+                    dst[0] = static_cast<uint8_t>(255 * clamp(3 * t, 0.0, 1.0));
+                    dst[1] = static_cast<uint8_t>(255 * clamp((3 * t) - 1, 0.0, 1.0));
+                    dst[2] = static_cast<uint8_t>(255 * clamp((3 * t) - 2, 0.0, 1.0));
+                }
+            }
+        }
+
+};
+
+inline pixel_profile*& active_pixel_profile() {
+    static pixel_profile* profile = nullptr;
+    return profile;
+}
+
+// struct pixel_mark
+// - the thread's counters and the time when its current pixel began
+struct pixel_mark {
+    profile_counters counters;
+    chrono::steady_clock::time_point start;
+};
+
+inline pixel_mark& thread_pixel_mark() {
+    thread_local pixel_mark mark;
+    return mark;
+}
+
+// void profile_pixel_begin()
+inline void profile_pixel_begin() {
+#ifdef RAYTRACER_PROFILE
+    pixel_mark& mark = thread_pixel_mark();
+    mark.counters = thread_profile();
+    mark.start = chrono::steady_clock::now();
+#endif
+}
+
+// void profile_pixel_end(int i, int j)
+// - adds what the thread counted since profile_pixel_begin() to pixel (i, j)
+//   of the active pixel_profile, if there is one; a pixel is only ever
+//   rendered by one thread at a time, so no lock is needed
+inline void profile_pixel_end(int i, int j) {
+#ifdef RAYTRACER_PROFILE
+    pixel_profile* profile = active_pixel_profile();
+    if (!profile) return;
+    const pixel_mark& mark = thread_pixel_mark();
+    const profile_counters& now = thread_profile();
+    pixel_cost& c = profile->at(i, j);
+    c.rays += static_cast<uint32_t>((now.rays - mark.counters.rays) + (now.shadow_rays - mark.counters.shadow_rays));
+    c.box_tests += static_cast<uint32_t>(now.box_tests - mark.counters.box_tests);
+    c.primitive_tests += static_cast<uint32_t>(now.primitive_tests - mark.counters.primitive_tests);
+    c.bounces += static_cast<uint32_t>(now.bounces() - mark.counters.bounces());
+    c.microseconds += chrono::duration<float, micro>(chrono::steady_clock::now() - mark.start).count();
+#else
+    (void)i;
+    (void)j;
+#endif
+}
+
+// class phase_clock
+// - wall time of the phases of a run, each lap() ending one
+class phase_clock {
+
+    public:
+        // MEMBERS
+        vector<pair<string, double>> phases;    // name and milliseconds, in order
+
+    public:
+        // CONSTRUCTORS
+        phase_clock() : last(chrono::steady_clock::now()) {}
+
+        // void lap(const string& name)
+        // - the time since the last lap (or since the clock was made) is phase name
+        void lap(const string& name) {
+            auto now = chrono::steady_clock::now();
+            phases.emplace_back(name, chrono::duration<double, milli>(now - last).count());
+            last = now;
+        }
+
+    private:
+        chrono::steady_clock::time_point last;
+
+};
+
+// void write_profile_report(ostream& out, const phase_clock& clock, const profile_counters& total, const pixel_profile& pixels)
+// - where the time went: the phases, the work per ray and per material type,
+//   and the costliest pixels
+inline void write_profile_report(ostream& out, const phase_clock& clock, const profile_counters& total,
+                                 const pixel_profile& pixels) {
+    char line[256];
+    out << "phases:";
+    for (size_t k = 0 ; k < clock.phases.size() ; ++k) {
+        snprintf(line, sizeof(line), "%s %s %.1f ms", k ? "," : "", clock.phases[k].first.c_str(), clock.phases[k].second);
+        out << line;
+    }
+    out << '\n';
+
+    const uint64_t rays = total.rays + total.shadow_rays;
+    const double per_ray = rays ? 1.0 / rays : 0.0;
+    snprintf(line, sizeof(line), "rays: %llu (%llu shadow), %.2f boxes and %.2f primitives tested per ray\n",
+             static_cast<unsigned long long>(rays), static_cast<unsigned long long>(total.shadow_rays),
+             total.box_tests * per_ray, total.primitive_tests * per_ray);
+    out << line;
+
+    const uint64_t bounces = total.bounces();
+    snprintf(line, sizeof(line), "bounces: %llu, %.2f per camera or scattered ray\n", static_cast<unsigned long long>(bounces),
+             total.rays ? double(bounces) / total.rays : 0.0);
+    out << line;
+    for (int k = 0 ; k < material_type_count ; ++k) {
+        if (total.material_evals[k] == 0) continue;
+        snprintf(line, sizeof(line), "  %-10s %12llu evaluations %6.2f%%", profile_material_names[k],
+                 static_cast<unsigned long long>(total.material_evals[k]), 100.0 * total.material_evals[k] / bounces);
+        out << line;
+        if (k == static_cast<int>(material_type::dielectric)) {
+            snprintf(line, sizeof(line), ", %.2f%% total internal reflection",
+                     100.0 * total.total_internal / total.material_evals[k]);
+            out << line;
+        }
+        out << '\n';
+    }
+
+    // the pixels, costliest first by time
+    vector<size_t> order(pixels.pixels.size());
+    double sum_us = 0;
+    for (size_t k = 0 ; k < order.size() ; ++k) {
+        order[k] = k;
+        sum_us += pixels.pixels[k].microseconds;
+    }
+    if (order.empty()) return;
+    const size_t shown = min(order.size(), size_t(5));
+    partial_sort(order.begin(), order.begin() + shown, order.end(), [&](size_t a, size_t b) {
+        return pixels.pixels[a].microseconds > pixels.pixels[b].microseconds;
+    });
+    snprintf(line, sizeof(line), "pixels: %d x %d, %.1f us each on average; the costliest:\n", pixels.width, pixels.height,
+             sum_us / order.size());
+    out << line;
+    for (size_t k = 0 ; k < shown ; ++k) {
+        const pixel_cost& c = pixels.pixels[order[k]];
+        int x = static_cast<int>(order[k] % pixels.width);
+        int y = pixels.height - 1 - static_cast<int>(order[k] / pixels.width);     // counted from the top, as in the image
+        snprintf(line, sizeof(line), "  (%d, %d) %.1f us, %u rays, %u boxes, %u primitives, %u bounces\n", x, y,
+                 c.microseconds, c.rays, c.box_tests, c.primitive_tests, c.bounces);
+        out << line;
+    }
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "rtweekend.h"
+
+#include "options.h"
+#include "renderer.h"
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+// PROGRESSIVE RENDERING
+// - the image is rendered in passes of a few samples per pixel over the whole
+//   framebuffer; because every sample seeds its own RNG the sums after the last
+//   pass are the same as rendering each pixel's samples in one go
+// - between passes the framebuffer and the number of finished samples can be
+//   saved to a checkpoint and a later run resumes from it
+
+// struct checkpoint_header
+// - the start of a checkpoint file, followed by width * height colors as they
+//   are in memory: color_lanes scalars of real_bytes each (precision.h)
+// - everything that changes the random numbers or the paths is recorded and must
+//   match to resume, the scene by the hash of its description (so the scene
+//   file, --mesh, --instance, --motion and --orbit are all in it) and the
+//   frame by its shutter interval; the sample count may grow between runs
+// - written in native byte order: checkpoints are for resuming on the same kind
+//   of machine, not for exchange
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t samples_done;
+    uint64_t seed;
+    int32_t sampler;
+    int32_t max_depth;
+    int32_t rr_depth;
+    int32_t scene_grid;
+    int32_t real_bytes;
+    int32_t color_lanes;
+    int32_t nee;
+    int32_t reserved;
+    uint64_t scene_hash;
+    double time0;
+    double time1;
+};
+
+// struct checkpoint_scene
+// - what a checkpoint is of beyond the options: scene_desc::content_hash()
+//   of the scene and the shutter interval of the frame
+struct checkpoint_scene {
+    uint64_t hash = 0;
+    double time0 = 0;
+    double time1 = 0;
+};
+
+static const char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+static const uint32_t checkpoint_version = 4;
+
+inline checkpoint_header make_checkpoint_header(const render_options& opts, const checkpoint_scene& scene, int samples_done) {
+    checkpoint_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, checkpoint_magic, sizeof(h.magic));
+    h.version = checkpoint_version;
+    h.width = opts.image_width;
+    h.height = opts.image_height();
+    h.samples_done = samples_done;
+    h.seed = opts.seed;
+    h.sampler = static_cast<int32_t>(opts.sampler);
+    h.max_depth = opts.max_depth;
+    h.rr_depth = opts.rr_depth;
+    h.scene_grid = opts.scene_grid;
+    h.real_bytes = sizeof(real);
+    h.color_lanes = vec3_lanes;
+    h.nee = opts.nee;
+    h.scene_hash = scene.hash;
+    h.time0 = scene.time0;
+    h.time1 = scene.time1;
+    return h;
+}
+
+// bool save_checkpoint(const string& path, const render_options& opts, const checkpoint_scene& scene,
+//                      const framebuffer& fb, int samples_done)
+// - writes to path + ".tmp" and renames it over path, so a job killed while
+//   saving leaves the previous checkpoint intact
+inline bool save_checkpoint(const string& path, const render_options& opts, const checkpoint_scene& scene,
+                            const framebuffer& fb, int samples_done) {
+    string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+
+    checkpoint_header h = make_checkpoint_header(opts, scene, samples_done);
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = ok && fwrite(fb.pixels.data(), sizeof(color), fb.pixels.size(), f) == fb.pixels.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline bool checkpoint_exists(const string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    fclose(f);
+    return true;
+}
+
+// bool load_checkpoint(const string& path, const render_options& opts, const checkpoint_scene& scene,
+//                      framebuffer& fb, int& samples_done, string& error)
+// - reads a checkpoint written by save_checkpoint() for the same render settings
+//   and scene into fb; on failure returns false with the reason in error and
+//   leaves fb alone
+inline bool load_checkpoint(const string& path, const render_options& opts, const checkpoint_scene& scene,
+                            framebuffer& fb, int& samples_done, string& error) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    checkpoint_header h;
+    checkpoint_header expected = make_checkpoint_header(opts, scene, 0);
+    vector<color> pixels(fb.pixels.size());
+    bool ok = fread(&h, sizeof(h), 1, f) == 1;
+    if (!ok || memcmp(h.magic, checkpoint_magic, sizeof(h.magic)) != 0 || h.version != checkpoint_version) {
+        error = path + " is not a checkpoint";
+        ok = false;
+    } else if (h.real_bytes != expected.real_bytes || h.color_lanes != expected.color_lanes) {
+        error = path + " was written by a build with another precision (" + precision_name() + " here)";
+        ok = false;
+    } else if (h.width != expected.width || h.height != expected.height || h.seed != expected.seed ||
+               h.sampler != expected.sampler || h.max_depth != expected.max_depth ||
+               h.rr_depth != expected.rr_depth || h.scene_grid != expected.scene_grid || h.nee != expected.nee) {
+        error = path + " was written with different render settings";
+        ok = false;
+    } else if (h.scene_hash != expected.scene_hash || h.time0 != expected.time0 || h.time1 != expected.time1) {
+        error = path + " was written for another scene or frame";
+        ok = false;
+    } else if (fread(pixels.data(), sizeof(color), pixels.size(), f) != pixels.size()) {
+        error = path + " is truncated";
+        ok = false;
+    }
+    fclose(f);
+
+    if (!ok) return false;
+    fb.pixels.swap(pixels);
+    samples_done = h.samples_done;
+    return true;
+}
+
+// STOP REQUESTS
+// - SIGINT / SIGTERM (a scheduler preempting the job) only set a flag; the
+//   progressive loop checks it between passes, saves a checkpoint and exits
+inline volatile sig_atomic_t& stop_flag() {
+    static volatile sig_atomic_t flag = 0;
+    return flag;
+}
+
+inline void install_stop_handlers() {
+    auto handler = [](int) { stop_flag() = 1; };
+    signal(SIGINT, handler);
+    signal(SIGTERM, handler);
+}
+
+inline bool stop_requested() { return stop_flag() != 0; }
+
+#endif
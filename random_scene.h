@@ -0,0 +1,73 @@
+#ifndef RANDOM_SCENE_H
+#define RANDOM_SCENE_H
+
+#include "rtweekend.h"
+
+#include "scene.h"
+
+// scene_desc random_scene(int grid, bool moving, bool instanced)
+// - a ground sphere, three large spheres and a (2 * grid) x (2 * grid) field of
+//   small random spheres; grid = 11 is the classic ~480 sphere scene
+// - moving makes the small diffuse spheres bounce up to half a unit, each at
+//   its own rate (the other spheres are placed as in the still scene only up
+//   to the first bouncing one, which draws extra random numbers)
+// - instanced makes the small spheres that stay still instances of the unit
+//   sphere, scaled to 0.2; the scene is the same, the image differs in the
+//   last bits
+inline scene_desc random_scene(int grid = 11, bool moving = false, bool instanced = false) {
+    scene_desc world;
+
+    auto ground_material = world.add_material(diffuse_material(color(0.5, 0.5, 0.5)));
+    world.add_sphere(point3(0,-1000,0), 1000, ground_material);
+
+    auto small_sphere = [&](const point3& center, uint32_t material) {
+        if (instanced) world.add_instance("sphere", center, 0, 0.2, material);
+        else world.add_sphere(center, 0.2, material);
+    };
+
+    for (int a = -grid; a < grid; a++) {
+        for (int b = -grid; b < grid; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                uint32_t sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = world.add_material(diffuse_material(albedo));
+                    if (moving) {
+                        world.add_sphere(center, 0.2, sphere_material);
+                        world.add_motion(world.spheres.size() - 1, vec3(0, random_double(0, 0.5), 0), random_double(0.5, 1.5));
+                    } else {
+                        small_sphere(center, sphere_material);
+                    }
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = world.add_material(metal_material(albedo, fuzz));
+                    small_sphere(center, sphere_material);
+                } else {
+                    // glass
+                    sphere_material = world.add_material(glass_material(1.5));
+                    small_sphere(center, sphere_material);
+                }
+            }
+        }
+    }
+
+    auto material1 = world.add_material(glass_material(1.5));
+    world.add_sphere(point3(0, 1, 0), 1.0, material1);
+
+    auto material2 = world.add_material(diffuse_material(color(0.4, 0.2, 0.1)));
+    world.add_sphere(point3(-4, 1, 0), 1.0, material2);
+
+    auto material3 = world.add_material(metal_material(color(0.7, 0.6, 0.5), 0.0));
+    world.add_sphere(point3(4, 1, 0), 1.0, material3);
+
+    return world;
+}
+
+#endif
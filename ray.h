@@ -5,27 +5,108 @@
 
 #include "vec3.h"
 
+#include <cstdint>
+#include <cstring>
+
 class ray {
 
     public:
         // MEMBERS
         point3 orig;
         vec3 dir;
+        real tm = 0;        // when the ray is cast, inside the camera's shutter interval
+        real cone_width = 0;    // the ray cone (texture.h): its width at the origin
+        real cone_spread = 0;   // and how much it widens per unit of distance
 
     public:
         // CONSTRUCTORS
         ray() {}
-        ray(const point3& origin, const vec3& direction)
-            : orig(origin), dir(direction) {}
+        ray(const point3& origin, const vec3& direction, real time = 0)
+            : orig(origin), dir(direction), tm(time) {}
 
         // GETTER METHODS
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
+        real time() const { return tm; }
 
-        point3 at(double t) const {
+        point3 at(real t) const {
             return orig + (t * dir);
         }
 
 };
 
+// point3 offset_ray_origin(const point3& p, real p_error, const vec3& n, const vec3& dir)
+// - where a ray leaving a surface at p should start so it cannot hit that
+//   surface again: p pushed off along the normal n to the side dir points to
+// - in double the hit points are accurate enough for the fixed t_min of the
+//   integrator and p is returned unchanged
+// - in float p is first moved by p_error, the hit's own bound on how far it is
+//   from the surface (which for a sphere grows with its center and radius, not
+//   with p), then by a number of ulps of each coordinate to cover the rounding
+//   of that step, with a small absolute step near zero where ulps vanish
+//   (Waechter and Binder, "A Fast and Robust Method for Avoiding
+//   Self-Intersection", Ray Tracing Gems ch. 6)
+inline point3 offset_ray_origin(const point3& p, real p_error, const vec3& n, const vec3& dir) {
+#ifdef RAYTRACER_FLOAT
+    const float origin = 1.0f / 32;
+    const float float_scale = 1.0f / 65536;
+    const float int_scale = 256;
+
+    vec3 side = dot(dir, n) < 0 ? -n : n;
+    point3 moved = p + (p_error * side);
+    point3 out;
+    for (int a = 0 ; a < 3 ; a++) {
+        int32_t bits, offset = static_cast<int32_t>(int_scale * side[a]);
+        memcpy(&bits, &moved.e[a], sizeof(bits));
+        bits += moved[a] < 0 ? -offset : offset;
+        float nudged;
+        memcpy(&nudged, &bits, sizeof(nudged));
+        out[a] = fabs(moved[a]) < origin ? moved[a] + (float_scale * side[a]) : nudged;
+    }
+    return out;
+#else
+    (void)p_error;
+    (void)n;
+    (void)dir;
+    return p;
+#endif
+}
+
+// struct ray_packet
+// - up to max_size rays in structure-of-arrays form, so the packet kernels can
+//   run one SIMD lane per ray
+struct ray_packet {
+    static const int max_size = 16;
+
+    int size = 0;
+    real ox[max_size], oy[max_size], oz[max_size];
+    real dx[max_size], dy[max_size], dz[max_size];
+    real tm[max_size];
+
+    void set(int k, const ray& r) {
+        ox[k] = r.orig.x(); oy[k] = r.orig.y(); oz[k] = r.orig.z();
+        dx[k] = r.dir.x(); dy[k] = r.dir.y(); dz[k] = r.dir.z();
+        tm[k] = r.tm;
+    }
+
+    ray get(int k) const {
+        return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k]), tm[k]);
+    }
+
+    // int width() const
+    // - lane count the kernels run with: size rounded up to 4, 8 or 16
+    int width() const { return size <= 4 ? 4 : (size <= 8 ? 8 : 16); }
+
+    // void pad()
+    // - fills the unused lanes with copies of ray 0 so the kernels can run the
+    //   full width without reading garbage; callers give them an empty interval
+    void pad() {
+        for (int k = size ; k < max_size ; ++k) {
+            ox[k] = ox[0]; oy[k] = oy[0]; oz[k] = oz[0];
+            dx[k] = dx[0]; dy[k] = dy[0]; dz[k] = dz[0];
+            tm[k] = tm[0];
+        }
+    }
+};
+
 #endif
\ No newline at end of file
@@ -1,141 +1,431 @@
 #include "rtweekend.h"
 
+#include "adaptive.h"
+#include "batch.h"
 #include "color.h"
+#include "distributed.h"
+#include "film.h"
+#include "image_io.h"
 #include "hittable_list.h"
+#include "bvh.h"
 #include "sphere.h"
+#include "sphere_set.h"
 #include "camera.h"
+#include "denoise.h"
 #include "material.h"
+#include "integrator.h"
+#include "memory_stats.h"
+#include "options.h"
+#include "packet.h"
+#include "preview.h"
+#include "profile.h"
+#include "progressive.h"
+#include "random_scene.h"
+#include "renderer.h"
+#include "scene.h"
+#include "tracer.h"
 
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
-// color ray_color(const ray& r, const hittable& world)
-// - takes in a ray and a hittable object 
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0, 0, 0);
-
-    // if the ray hits a hittable object, return the resulting ray color
-    // because the resulting ray may hit another hittable object, we recursively
-    // call the ray_color function - with a max depth so that the ray cannot
-    // infinitely bounce
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth - 1);
-        return color(0, 0, 0);
-    }
+int main(int argc, char** argv) {
 
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5 * (unit_direction.y() + 1.0);
+    // IMAGE
+    render_options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
 
-    // linear interpolation
-    // blendedValue = (1 - t) * startValue + (t * endValue)
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + (t * color(0.5, 0.7, 1.0));
-}
+    // BATCH
+    // many jobs in one process, each scene loaded and built once
+    if (!opts.batch.empty()) {
+        batch_settings settings;
+        settings.defaults.width = opts.image_width;
+        settings.defaults.aspect_ratio = opts.aspect_ratio;
+        settings.defaults.samples_per_pixel = opts.samples_per_pixel;
+        settings.defaults.max_depth = opts.max_depth;
+        settings.defaults.seed = opts.seed;
+        settings.defaults.frame = opts.first_frame;
+        settings.rr_depth = opts.rr_depth;
+        settings.nee = opts.nee;
+        settings.sampler = opts.sampler;
+        settings.tile_size = opts.tile_size;
+        settings.threads = opts.threads;
+        settings.cache_scenes = opts.batch_cache;
+        settings.scene_grid = opts.scene_grid;
+        settings.motion = opts.motion;
+        settings.instanced = opts.instanced;
+        settings.fps = opts.fps;
+        settings.shutter = opts.shutter;
+        settings.texture_cache_bytes = size_t(opts.texture_cache_mb) << 20;
 
-// hittable_list random_scene()
-hittable_list random_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+        vector<batch_job> jobs;
+        string error;
+        if (!parse_job_file(opts.batch, settings.defaults, jobs, error)) {
+            cerr << error << '\n';
+            return 1;
         }
+        batch_runner runner(settings);
+        return runner.run(jobs) ? 0 : 1;
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    const auto aspect_ratio = opts.aspect_ratio;
+    const int image_width = opts.image_width;
+    const int image_height = opts.image_height();
+    const int samples_per_pixel = opts.samples_per_pixel;
+    const int max_depth = opts.max_depth;
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    // WORLD
+    phase_clock clock;      // for --profile
+    scene_desc desc;
+    size_t memory_before = resident_memory_bytes();
+    if (opts.scene.empty()) {
+        desc = random_scene(opts.scene_grid, opts.motion, opts.instanced);
+    } else {
+        string error;
+        if (!load_scene(opts.scene, desc, error)) {
+            cerr << error << '\n';
+            return 1;
+        }
+    }
+    if (!opts.meshes.empty()) {
+        uint32_t grey = desc.add_material(diffuse_material(color(0.7, 0.7, 0.7)));
+        for (const string& path : opts.meshes)
+            desc.add_mesh(path, vec3(0, 0, 0), 1, grey);
+        string error;
+        if (!desc.load_meshes("", error)) {
+            cerr << error << '\n';
+            return 1;
+        }
+    }
+    if (opts.orbit != 0) {
+        // a key at every frame from the sequence's start to past the last
+        // frame's shutter, so any run of frames sees the same orbit
+        desc.orbit_camera(opts.orbit, opts.fps, opts.first_frame + max(opts.frames, 1));
+    }
+    if (!opts.save_scene.empty()) {
+        bool binary = opts.save_scene.size() > 4 && opts.save_scene.compare(opts.save_scene.size() - 4, 4, ".bin") == 0;
+        if (!save_scene(opts.save_scene, desc, binary))
+            cerr << "cannot write " << opts.save_scene << '\n';
+    }
+    clock.lap("load");
+    material_table materials;
+    if (!desc.textures.empty())
+        materials.textures = make_shared<texture_cache>(size_t(opts.texture_cache_mb) << 20);
+    hittable_list scene = desc.build(materials);
+    light_list lights;
+    desc.build_lights(lights);
+    const light_list* sampled_lights = opts.nee && !lights.empty() ? &lights : nullptr;
+    cerr << desc.stats << '\n'
+         << "scene: " << desc.spheres.size() << " spheres, " << desc.instances.size() << " instances of "
+         << desc.instance_sources.size() << " sources, " << desc.materials.size() << " distinct materials, "
+         << lights.size() << " lights" << (lights.empty() || opts.nee ? "" : " (not sampled)") << ", "
+         << (max(resident_memory_bytes(), memory_before) - memory_before) / (1024 * 1024) << " MiB resident\n";
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    shared_ptr<hittable> world_ptr;
+    shared_ptr<bvh> tree;
+    if (opts.accel == accel_type::bvh) {
+        tree = make_shared<bvh>(scene);
+        cerr << tree->stats << '\n';
+        world_ptr = tree;
+    } else if (opts.accel == accel_type::soa) {
+        auto packed = make_shared<sphere_set>();
+        packed->extract_spheres(scene);
+        cerr << "sphere_set: " << packed->count << " spheres, " << packed->kernel_name() << " kernel\n";
+        scene.add(packed);
+        world_ptr = make_shared<hittable_list>(scene);
+    } else {
+        world_ptr = make_shared<hittable_list>(scene);
+    }
+    const hittable& world = *world_ptr;
+    cerr << "build: " << allocation_count() << " allocations, "
+         << allocated_bytes() / (1024 * 1024) << " MiB requested\n";
+    uint64_t allocations_before_render = allocation_count();
+    clock.lap("build");
 
-    return world;
-}
+    // the texture tiles the render read, and the images it could not
+    auto report_textures = [&] {
+        if (!materials.textures) return;
+        cerr << materials.textures->stats() << '\n';
+        string error = materials.textures->error();
+        if (!error.empty()) cerr << error << '\n';
+    };
 
-int main() {
-    
-    // IMAGE
-    const auto aspect_ratio = 3.0 / 2.0;
-    const int image_width = 1200;
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 50;
-    const int max_depth = 50;
+    // CAMERA
+    // the shutter only opens when something moves, so still scenes render
+    // exactly as they did before there was a shutter
+    const double shutter_time = desc.motions.empty() ? 0 : opts.shutter / opts.fps;
+    double frame_open = opts.frame_time(opts.first_frame);
+    world_ptr->update(frame_open, frame_open + shutter_time);
+    camera cam = desc.make_camera(aspect_ratio, frame_open, frame_open + shutter_time);
 
-    // WORLD
- /*    hittable_list world;
+    // RENDER
+    // every sample reseeds the RNG from (seed, pixel, sample), so the image is the
+    // same for any thread count, tile size or split into progressive passes
+    framebuffer fb(image_width, image_height);
+    tile_renderer renderer(opts.tile_size, opts.threads);
+    packet_tracer tracer(world, materials, cam, image_width, image_height, max_depth,
+                         opts.rr_depth, opts.packet_size, opts.sampler, opts.seed, sampled_lights);
+    scalar_tracer scalar(world, materials, cam, image_width, image_height, max_depth,
+                         opts.rr_depth, opts.sampler, opts.seed, sampled_lights);
 
-    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto material_left   = make_shared<dielectric>(1.5);
-    auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
+    // the first hits of the camera rays, for the denoiser and the AOV images
+    unique_ptr<feature_buffer> features;
+    if (opts.denoise || !opts.aov.empty())
+        features = make_unique<feature_buffer>(image_width, image_height);
+    scalar.features = features.get();
 
-    world.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),   0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0), -0.45, material_left));
-    world.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right)); */
+    // with --filter the samples are splatted onto a film instead of summed
+    // into fb, which then only receives the film's image (film.h)
+    unique_ptr<film> image_film;
+    if (opts.film)
+        image_film = make_unique<film>(image_width, image_height, pixel_filter(opts.filter, opts.filter_radius));
+    scalar.image_film = image_film.get();
 
-    hittable_list world = random_scene();
+    // adds samples [first_sample, end_sample) of every pixel of t to target
+    auto render_tile = [&](const tile& t, framebuffer& target, int first_sample, int end_sample) {
+        if (opts.packet_size > 0)
+            tracer.render_tile(t, target, first_sample, end_sample);
+        else
+            scalar.render_tile(t, target, first_sample, end_sample);
+    };
 
-    // CAMERA
-    point3 lookfrom(13, 2, 3);
-    point3 lookat(0, 0, 0);
-    vec3 vup(0, 1, 0);
-    auto dist_to_focus = 10.0;
-    auto aperture = 0.1;
+    // adds samples [first_sample, end_sample) of every pixel to fb
+    auto render_samples = [&](int first_sample, int end_sample) {
+        renderer.render_tiles(image_width, image_height, [&](const tile& t) {
+            render_tile(t, fb, first_sample, end_sample);
+        });
+    };
 
-    camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
+    // PREVIEW SERVER
+    // the scene, the bvh and the image stay resident and the clients edit the
+    // camera and materials the render_tile above traces with
+    if (!opts.serve.empty()) {
+        preview_settings settings;
+        settings.samples_per_pixel = samples_per_pixel;
+        settings.pass_samples = opts.pass_samples;
+        settings.aspect_ratio = aspect_ratio;
+        settings.time0 = frame_open;
+        settings.time1 = frame_open + shutter_time;
+        renderer.show_progress = false;
+        preview_session session(desc, materials, lights, cam, fb, renderer, render_tile, settings);
+        preview_server server(session, fb, opts.serve, opts.preview, opts.preview_every);
+        string error;
+        install_stop_handlers();
+        if (!server.run(stop_requested, error)) {
+            cerr << error << '\n';
+            return 1;
+        }
+        cerr << "Served " << session.stats.edits << " edits, " << total_ray_count() << " rays\n";
+        return 0;
+    }
 
-    // RENDER
-    cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    // loops the pixels in each row (height) and column (width) and each
-    // sample within each pixel
-    for (int j = image_height ; j >= 0 ; --j) {
-        cerr << "\rScanlines remaining: " << j << ' ' << flush;         // Progress Indicator
-        for (int i = 0 ; i < image_width ; ++i) {
-            color pixel_color(0, 0, 0);
-            for (int s = 0 ; s < samples_per_pixel ; ++s) {
-                // for each sample in the current pixel increment the pixel_color
-                auto u = double(i + random_double()) / (image_width - 1);
-                auto v = double(j + random_double()) / (image_height - 1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
+    // SEQUENCE
+    // the process, the scene and the acceleration structure stay resident from
+    // frame to frame: each frame moves the animated spheres and refits the bvh
+    // over them instead of building anything again
+    if (opts.frames > 0) {
+        double refit_ms = 0, write_ms = 0;
+        size_t refit_nodes = 0;
+        auto sequence_start = chrono::steady_clock::now();
+        for (int frame = opts.first_frame ; frame < opts.first_frame + opts.frames ; ++frame) {
+            double time0 = opts.frame_time(frame);
+            auto refit_start = chrono::steady_clock::now();
+            if (frame != opts.first_frame)
+                world_ptr->update(time0, time0 + shutter_time);
+            refit_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - refit_start).count();
+            if (tree) refit_nodes += tree->stats.refit_nodes;
+            cam = desc.make_camera(aspect_ratio, time0, time0 + shutter_time);
+
+            fill(fb.pixels.begin(), fb.pixels.end(), color(0, 0, 0));
+            if (image_film) image_film->clear();
+            render_samples(0, samples_per_pixel);
+            if (image_film) image_film->resolve(fb);
+
+            auto write_start = chrono::steady_clock::now();
+            string path = frame_path(opts.output, frame);
+            if (!write_image(fb, image_film ? 1 : samples_per_pixel, opts.format, path)) {
+                cerr << "cannot write " << path << '\n';
+                return 1;
             }
-            write_color(cout, pixel_color, samples_per_pixel);
+            write_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - write_start).count();
+            cerr << "\rFrame " << frame - opts.first_frame + 1 << '/' << opts.frames << ' ' << flush;
         }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - sequence_start).count();
+        cerr << "\nSequence: " << opts.frames << " frames in " << seconds << " s, " << opts.frames / seconds
+             << " frames/s (" << seconds * 1e3 / opts.frames << " ms per frame: " << refit_ms / opts.frames
+             << " ms refit, " << write_ms / opts.frames << " ms writing), " << total_ray_count() << " rays, "
+             << (total_ray_count() / seconds) * 1e-6 << " Mrays/s (" << precision_name() << ")\n";
+        if (tree)
+            cerr << "refit: " << tree->stats.moving_primitives << " moving primitives, "
+                 << double(refit_nodes) / opts.frames << " of " << tree->nodes.size() << " nodes per frame, against "
+                 << tree->stats.build_ms << " ms for a rebuild\n";
+        cerr << total_path_stats() << '\n';
+        cerr << "memory: " << peak_resident_memory_bytes() / (1024 * 1024) << " MiB peak resident, "
+             << allocation_count() - allocations_before_render << " allocations while rendering\n";
+        report_textures();
+        cerr << "Done.\n";
+        return 0;
     }
-    cerr << "\nDone.\n";
-}
\ No newline at end of file
+
+    // what every pixel costs, counted by the render loops above
+    unique_ptr<pixel_profile> pixel_costs;
+    if (!opts.profile.empty()) {
+        pixel_costs = make_unique<pixel_profile>(image_width, image_height);
+        active_pixel_profile() = pixel_costs.get();
+    }
+
+    int samples_done = 0;
+    int first_new_sample = 0;       // the checkpoint has no features, only this run's samples do
+    clock.lap("setup");
+    auto render_start = chrono::steady_clock::now();
+    if (opts.adaptive) {
+        adaptive_settings settings;
+        settings.min_samples = opts.adaptive_min;
+        settings.max_samples = opts.adaptive_max;
+        settings.threshold = opts.adaptive_threshold;
+        settings.sample_budget = uint64_t(samples_per_pixel) * image_width * image_height;
+        settings.time_budget = opts.time_budget;
+
+        adaptive_renderer adaptive(renderer, fb, settings);
+        adaptive.render([&](int i, int j, int s) { return scalar.trace_sample(i, j, s); });
+        samples_done = samples_per_pixel;
+        cerr << "\nAdaptive: " << adaptive.rounds << " rounds, "
+             << double(adaptive.samples_spent) / fb.pixels.size() << " spp on average, "
+             << 100.0 * adaptive.converged / fb.pixels.size() << "% of pixels converged\n";
+
+        if (!opts.heatmap.empty()) {
+            vector<uint8_t> rgb;
+            adaptive.heatmap(rgb);
+            if (!write_rgb8(image_width, image_height, rgb, format_from_path(opts.heatmap, image_format::ppm), opts.heatmap))
+                cerr << "cannot write " << opts.heatmap << '\n';
+        }
+    } else if (opts.workers > 0) {
+        render_coordinator coordinator(opts.workers, 2, opts.fail_worker_after);
+        if (!coordinator.render(fb, renderer.make_tiles(image_width, image_height), 0, samples_per_pixel, render_tile)) {
+            cerr << "cannot start worker processes\n";
+            return 1;
+        }
+        samples_done = samples_per_pixel;
+        cerr << "\nWorkers: " << coordinator.workers_started << " started, " << coordinator.workers_lost << " lost, "
+             << coordinator.tiles_reassigned << " tiles reassigned, " << coordinator.tiles_local << " rendered locally";
+    } else if (!opts.progressive) {
+        render_samples(0, samples_per_pixel);
+        samples_done = samples_per_pixel;
+    } else {
+        checkpoint_scene checkpointed;
+        if (!opts.checkpoint.empty()) {
+            checkpointed.hash = desc.content_hash();
+            checkpointed.time0 = frame_open;
+            checkpointed.time1 = frame_open + shutter_time;
+        }
+        if (opts.resume && checkpoint_exists(opts.checkpoint)) {
+            string error;
+            if (!load_checkpoint(opts.checkpoint, opts, checkpointed, fb, samples_done, error)) {
+                cerr << error << '\n';
+                return 1;
+            }
+            cerr << "Resuming " << opts.checkpoint << " at " << samples_done << " spp\n";
+            first_new_sample = samples_done;
+        }
+
+        install_stop_handlers();
+        for (int pass = 1 ; samples_done < samples_per_pixel ; ++pass) {
+            int end_sample = min(samples_done + opts.pass_samples, samples_per_pixel);
+            render_samples(samples_done, end_sample);
+            samples_done = end_sample;
+            cerr << "\rPass " << pass << ": " << samples_done << '/' << samples_per_pixel << " spp " << flush;
+
+            bool last = samples_done == samples_per_pixel;
+            bool stopping = stop_requested();
+            if (!opts.checkpoint.empty() && (last || stopping || pass % opts.checkpoint_every == 0)) {
+                if (!save_checkpoint(opts.checkpoint, opts, checkpointed, fb, samples_done))
+                    cerr << "\ncannot write checkpoint " << opts.checkpoint << '\n';
+            }
+            if (!opts.preview.empty() && (last || pass % opts.preview_every == 0)) {
+                if (image_film) image_film->resolve(fb);
+                write_image(fb, image_film ? 1 : samples_done, format_from_path(opts.preview, image_format::ppm),
+                            opts.preview);
+            }
+            if (stopping && !last) {
+                cerr << "\nStopped at " << samples_done << " spp";
+                if (!opts.checkpoint.empty()) cerr << ", resume with --resume --checkpoint " << opts.checkpoint;
+                cerr << '\n';
+                return 2;
+            }
+        }
+    }
+    double render_seconds = chrono::duration<double>(chrono::steady_clock::now() - render_start).count();
+    active_pixel_profile() = nullptr;
+    clock.lap("render");
+    cerr << "\nRendered in " << render_seconds << " s, " << total_ray_count() << " rays, "
+         << (total_ray_count() / render_seconds) * 1e-6 << " Mrays/s (" << precision_name() << ")\n";
+    cerr << total_path_stats() << '\n';
+    if (opts.depth_histogram)
+        total_path_stats().print_histogram(cerr);
+    cerr << "memory: " << peak_resident_memory_bytes() / (1024 * 1024) << " MiB peak resident, "
+         << allocation_count() - allocations_before_render << " allocations while rendering\n";
+    report_textures();
+
+    // the film's image replaces the sums, as averages
+    int fb_samples = samples_done;
+    if (image_film) {
+        image_film->resolve(fb);
+        fb_samples = 1;
+    }
+
+    // DENOISE
+    const framebuffer* image = &fb;
+    int image_samples = fb_samples;
+    framebuffer denoised(0, 0);
+    if (features) {
+        int feature_samples = samples_done - first_new_sample;
+        if (!opts.aov.empty() && !features->write(opts.aov, feature_samples))
+            cerr << "cannot write " << opts.aov << "_albedo.pfm, _normal.pfm or _depth.pfm\n";
+        if (opts.denoise && feature_samples == 0) {
+            cerr << "no samples rendered in this run to guide the denoiser, writing the image as it is\n";
+        } else if (opts.denoise) {
+            denoise_settings settings;
+            settings.passes = opts.denoise_passes;
+            settings.threads = opts.threads;
+            denoiser filter(settings);
+            filter.run(fb, fb_samples, *features, feature_samples, denoised);
+            cerr << filter.stats << '\n';
+            image = &denoised;
+            image_samples = 1;
+        }
+        clock.lap("denoise");
+    }
+
+    // OUTPUT
+    auto write_start = chrono::steady_clock::now();
+    if (!write_image(*image, image_samples, opts.format, opts.output)) {
+        cerr << "cannot write " << opts.output << '\n';
+        return 1;
+    }
+    double write_seconds = chrono::duration<double>(chrono::steady_clock::now() - write_start).count();
+    cerr << "Wrote image in " << write_seconds * 1e3 << " ms\n";
+    clock.lap("output");
+
+    // PROFILE
+    if (pixel_costs) {
+        const pair<pixel_profile::measure, const char*> measures[] = {
+            { pixel_profile::measure::time, "time" }, { pixel_profile::measure::rays, "rays" },
+            { pixel_profile::measure::tests, "tests" }, { pixel_profile::measure::bounces, "bounces" } };
+        vector<uint8_t> rgb;
+        for (const auto& m : measures) {
+            string path = opts.profile + "_" + m.second + ".png";
+            pixel_costs->heatmap(m.first, rgb);
+            if (!write_rgb8(image_width, image_height, rgb, image_format::png, path))
+                cerr << "cannot write " << path << '\n';
+        }
+        ostringstream report;
+        write_profile_report(report, clock, total_profile(), *pixel_costs);
+        cerr << report.str();
+        ofstream out(opts.profile + ".txt");
+        if (!(out << report.str()))
+            cerr << "cannot write " << opts.profile << ".txt\n";
+    }
+    cerr << "Done.\n";
+}
@@ -0,0 +1,187 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "rtweekend.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// struct tile
+// - a rectangular block of pixels [x0, x1) x [y0, y1) rendered as one unit of work
+struct tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// class framebuffer
+// - shared image that every worker writes its tiles into; tiles never overlap
+//   so no locking is needed on the pixels themselves
+class framebuffer {
+
+    public:
+        // MEMBERS
+        int width;
+        int height;
+        vector<color> pixels;
+        vector<int> sample_counts;      // per-pixel sample counts, empty when every pixel has the same
+
+    public:
+        // CONSTRUCTORS
+        framebuffer(int w, int h)
+            : width(w), height(h), pixels(static_cast<size_t>(w) * h) {}
+
+        color& at(int i, int j) { return pixels[static_cast<size_t>(j) * width + i]; }
+        const color& at(int i, int j) const { return pixels[static_cast<size_t>(j) * width + i]; }
+
+        // double sample_scale(size_t k, int samples_per_pixel) const
+        // - the factor that turns pixel k's sum into its average
+        double sample_scale(size_t k, int samples_per_pixel) const {
+            int n = sample_counts.empty() ? samples_per_pixel : sample_counts[k];
+            return n > 0 ? 1.0 / n : 0.0;
+        }
+
+};
+
+// class tile_queue
+// - a per-worker double ended queue of tiles
+// - the owner pops from the front (scanline order), thieves steal from the back
+//   so the two ends rarely contend for the same tile
+class tile_queue {
+
+    public:
+        void push(const tile& t) {
+            lock_guard<mutex> lock(m);
+            tiles.push_back(t);
+        }
+
+        bool pop(tile& t) {
+            lock_guard<mutex> lock(m);
+            if (tiles.empty()) return false;
+            t = tiles.front();
+            tiles.pop_front();
+            return true;
+        }
+
+        bool steal(tile& t) {
+            lock_guard<mutex> lock(m);
+            if (tiles.empty()) return false;
+            t = tiles.back();
+            tiles.pop_back();
+            return true;
+        }
+
+    private:
+        mutex m;
+        deque<tile> tiles;
+
+};
+
+// class tile_renderer
+// - splits the image into tiles and renders them on a pool of worker threads
+// - each worker owns a queue of tiles and steals from the other workers once its
+//   own queue runs dry, so expensive (glass/metal) tiles don't leave cores idle
+class tile_renderer {
+
+    public:
+        // MEMBERS
+        int tile_size;
+        int thread_count;
+        bool show_progress = true;      // the "Tiles remaining" count on stderr
+
+    public:
+        // CONSTRUCTORS
+        tile_renderer(int tile_sz, int threads)
+            : tile_size(tile_sz > 0 ? tile_sz : 32), thread_count(threads) {
+            if (thread_count <= 0) {
+                thread_count = static_cast<int>(thread::hardware_concurrency());
+                if (thread_count <= 0) thread_count = 1;
+            }
+        }
+
+        // vector<tile> make_tiles(int width, int height) const
+        // - cuts a width x height image into tile_size x tile_size blocks (scanline order)
+        vector<tile> make_tiles(int width, int height) const {
+            vector<tile> tiles;
+            for (int y = 0 ; y < height ; y += tile_size) {
+                for (int x = 0 ; x < width ; x += tile_size) {
+                    tiles.push_back({ x, y, min(x + tile_size, width), min(y + tile_size, height) });
+                }
+            }
+            return tiles;
+        }
+
+        // void render(framebuffer& fb, const function<color(int, int)>& shade_pixel) const
+        // - calls shade_pixel(i, j) for every pixel of fb and stores the result
+        // - shade_pixel must only depend on (i, j) (seed its own RNG from the pixel)
+        //   for the image to be independent of the thread count
+        void render(framebuffer& fb, const function<color(int, int)>& shade_pixel) const {
+            render_tiles(fb.width, fb.height, [&](const tile& t) {
+                for (int j = t.y0 ; j < t.y1 ; ++j)
+                    for (int i = t.x0 ; i < t.x1 ; ++i)
+                        fb.at(i, j) = shade_pixel(i, j);
+            });
+        }
+
+        // void render_tiles(int width, int height, const function<void(const tile&)>& render_tile) const
+        // - calls render_tile once for every tile of a width x height image, spread
+        //   over the worker pool; for renderers that work on a whole tile at once
+        void render_tiles(int width, int height, const function<void(const tile&)>& render_tile) const {
+            render_tiles(make_tiles(width, height), render_tile);
+        }
+
+        // void render_tiles(const vector<tile>& tiles, const function<void(const tile&)>& render_tile) const
+        // - the same for a given set of tiles, e.g. the ones a preview restarts
+        void render_tiles(const vector<tile>& tiles, const function<void(const tile&)>& render_tile) const {
+            int workers = min(thread_count, max(1, static_cast<int>(tiles.size())));
+
+            // deal the tiles out round-robin so every worker starts with a spread of the image
+            vector<tile_queue> queues(workers);
+            for (size_t t = 0 ; t < tiles.size() ; ++t)
+                queues[t % workers].push(tiles[t]);
+
+            atomic<int> tiles_remaining(static_cast<int>(tiles.size()));
+            mutex progress_mutex;
+
+            auto worker = [&](int id) {
+                tile t;
+                while (next_tile(queues, id, t)) {
+                    render_tile(t);
+
+                    int remaining = --tiles_remaining;
+                    if (!show_progress) continue;
+                    lock_guard<mutex> lock(progress_mutex);
+                    cerr << "\rTiles remaining: " << remaining << ' ' << flush;      // Progress Indicator
+                }
+            };
+
+            vector<thread> pool;
+            for (int id = 1 ; id < workers ; ++id)
+                pool.emplace_back(worker, id);
+            worker(0);
+            for (auto& th : pool)
+                th.join();
+        }
+
+    private:
+        // bool next_tile(vector<tile_queue>& queues, int id, tile& t) const
+        // - takes the next tile from the worker's own queue, otherwise steals one
+        //   from the other workers; returns false once every queue is empty
+        bool next_tile(vector<tile_queue>& queues, int id, tile& t) const {
+            if (queues[id].pop(t)) return true;
+            int n = static_cast<int>(queues.size());
+            for (int k = 1 ; k < n ; ++k) {
+                if (queues[(id + k) % n].steal(t)) return true;
+            }
+            return false;
+        }
+
+};
+
+#endif
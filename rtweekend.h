@@ -10,6 +10,8 @@
 
 using namespace std;
 
+#include "sampler.h"
+
 // Constants
 
 const double infinity = numeric_limits<double>::infinity();
@@ -22,8 +24,8 @@ const inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-    // Return a random real in (0, 1]
-    return rand() / (RAND_MAX + 1.0);
+    // Return a random real in [0, 1)
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,206 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// class pcg32
+// - small, fast generator (PCG-XSH-RR, O'Neill 2014) with 64 bits of state
+// - cheap enough to reseed for every sample, which is what keeps renders
+//   deterministic no matter which thread draws the numbers
+class pcg32 {
+
+    public:
+        // MEMBERS
+        uint64_t state;
+        uint64_t inc;
+
+    public:
+        // CONSTRUCTORS
+        pcg32() { seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull); }
+        pcg32(uint64_t initstate, uint64_t initseq = 1) { seed(initstate, initseq); }
+
+        void seed(uint64_t initstate, uint64_t initseq = 1) {
+            state = 0;
+            inc = (initseq << 1u) | 1u;
+            next();
+            state += initstate;
+            next();
+        }
+
+        uint32_t next() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ull + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+            uint32_t rot = static_cast<uint32_t>(old >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        // double next_double()
+        // - returns a random real in [0, 1)
+        double next_double() {
+            return next() * (1.0 / 4294967296.0);
+        }
+
+};
+
+// pcg32& thread_rng()
+// - each thread owns its own generator so workers never share RNG state
+inline pcg32& thread_rng() {
+    thread_local pcg32 gen;
+    return gen;
+}
+
+// uint64_t mix_seed(uint64_t a, uint64_t b)
+// - splitmix64 style hash of two values, used to derive independent seeds
+inline uint64_t mix_seed(uint64_t a, uint64_t b) {
+    uint64_t z = a + (b + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t pixel_seed(uint64_t seed, uint64_t pixel) {
+    return mix_seed(seed, pixel);
+}
+
+inline uint64_t sample_seed(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    return mix_seed(pixel_seed(seed, pixel), sample);
+}
+
+inline void seed_random(uint64_t seed) {
+    thread_rng().seed(seed, seed >> 32);
+}
+
+// LOW-DISCREPANCY SEQUENCES
+
+// double radical_inverse(uint32_t base, uint64_t i)
+// - mirrors the digits of i in the given base about the decimal point (Halton)
+inline double radical_inverse(uint32_t base, uint64_t i) {
+    const double inv_base = 1.0 / base;
+    double inv = inv_base;
+    double result = 0;
+    while (i > 0) {
+        uint64_t next = i / base;
+        result += (i - next * base) * inv;
+        inv *= inv_base;
+        i = next;
+    }
+    return result;
+}
+
+// uint32_t van_der_corput(uint32_t i, uint32_t scramble)
+// - first dimension of the Sobol (0,2)-sequence, xor scrambled
+inline uint32_t van_der_corput(uint32_t i, uint32_t scramble) {
+    i = (i << 16) | (i >> 16);
+    i = ((i & 0x00ff00ffu) << 8) | ((i & 0xff00ff00u) >> 8);
+    i = ((i & 0x0f0f0f0fu) << 4) | ((i & 0xf0f0f0f0u) >> 4);
+    i = ((i & 0x33333333u) << 2) | ((i & 0xccccccccu) >> 2);
+    i = ((i & 0x55555555u) << 1) | ((i & 0xaaaaaaaau) >> 1);
+    return i ^ scramble;
+}
+
+// uint32_t sobol2(uint32_t i, uint32_t scramble)
+// - second dimension of the Sobol (0,2)-sequence (Kollig & Keller 2002), xor scrambled
+inline uint32_t sobol2(uint32_t i, uint32_t scramble) {
+    for (uint32_t v = 1u << 31 ; i ; i >>= 1, v ^= v >> 1)
+        if (i & 1) scramble ^= v;
+    return scramble;
+}
+
+inline double wrap_unit(double x) {
+    return x >= 1.0 ? x - 1.0 : x;
+}
+
+enum class sample_pattern { random, halton, sobol };
+
+// class pixel_sampler
+// - hands out the sample positions for one pixel
+// - start_sample() reseeds the thread's RNG from (seed, pixel, sample), so the
+//   random numbers of every sample are reproducible on their own; this is what
+//   lets the tile, progressive and distributed renderers agree bit for bit
+// - pixel_offset() and lens_offset() are stratified across the pixel's samples
+//   for the halton / sobol patterns, and are randomised per pixel (Cranley-Patterson
+//   rotation / xor scrambling) so neighbouring pixels don't share a pattern
+class pixel_sampler {
+
+    public:
+        // CONSTRUCTORS
+        pixel_sampler(sample_pattern p, uint64_t seed, uint64_t pixel_index)
+            : pattern(p), render_seed(seed), pixel(pixel_index) {
+            pcg32 scramble_rng(pixel_seed(seed, pixel_index), 0x5eed);
+            for (int k = 0 ; k < 4 ; ++k) {
+                scramble[k] = scramble_rng.next();
+                offset[k] = scramble[k] * (1.0 / 4294967296.0);
+            }
+        }
+
+        void start_sample(int s) {
+            sample = s;
+            seed_random(sample_seed(render_seed, pixel, static_cast<uint64_t>(s)));
+        }
+
+        // void pixel_offset(double& x, double& y) const
+        // - position of the current sample inside the pixel, in [0, 1)^2
+        void pixel_offset(double& x, double& y) const {
+            switch (pattern) {
+                case sample_pattern::halton:
+                    x = wrap_unit(radical_inverse(2, sample) + offset[0]);
+                    y = wrap_unit(radical_inverse(3, sample) + offset[1]);
+                    return;
+                case sample_pattern::sobol:
+                    x = van_der_corput(static_cast<uint32_t>(sample), scramble[0]) * (1.0 / 4294967296.0);
+                    y = sobol2(static_cast<uint32_t>(sample), scramble[1]) * (1.0 / 4294967296.0);
+                    return;
+                default:
+                    x = thread_rng().next_double();
+                    y = thread_rng().next_double();
+                    return;
+            }
+        }
+
+        // void lens_offset(double& x, double& y) const
+        // - position of the current sample on the lens, in [0, 1)^2
+        // - sobol pads its lens dimensions with rotated halton points (bases 5/7)
+        //   rather than reusing the correlated pixel dimensions
+        void lens_offset(double& x, double& y) const {
+            if (pattern == sample_pattern::random) {
+                x = thread_rng().next_double();
+                y = thread_rng().next_double();
+                return;
+            }
+            x = wrap_unit(radical_inverse(5, sample) + offset[2]);
+            y = wrap_unit(radical_inverse(7, sample) + offset[3]);
+        }
+
+        // double time_offset() const
+        // - when the current sample is taken inside the shutter interval, in [0, 1)
+        // - only drawn for cameras with an open shutter, so still renders use the
+        //   same random numbers as they always did
+        double time_offset() const {
+            if (pattern == sample_pattern::random)
+                return thread_rng().next_double();
+            return wrap_unit(radical_inverse(11, sample) + offset[0]);
+        }
+
+    private:
+        sample_pattern pattern;
+        uint64_t render_seed;
+        uint64_t pixel;
+        int sample = 0;
+        uint32_t scramble[4];
+        double offset[4];
+
+};
+
+// bool parse_sample_pattern(const char* name, sample_pattern& p)
+inline bool parse_sample_pattern(const char* name, sample_pattern& p) {
+    if (strcmp(name, "random") == 0) { p = sample_pattern::random; return true; }
+    if (strcmp(name, "halton") == 0) { p = sample_pattern::halton; return true; }
+    if (strcmp(name, "sobol") == 0) { p = sample_pattern::sobol; return true; }
+    return false;
+}
+
+#endif
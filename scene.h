@@ -0,0 +1,1195 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "light.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "mesh.h"
+#include "moving_sphere.h"
+#include "obj_loader.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+// SCENE FILES
+// - a scene is a camera, a table of materials, some of which are textured by
+//   image files, a list of spheres, some of which may move, triangle meshes
+//   read from OBJ files, instances of a unit sphere or of OBJ files and
+//   optionally camera keyframes for animations; the
+//   text form is for writing by hand, the binary form is what large generated
+//   scenes should be stored as
+//
+// text form, one statement per line, '#' starts a comment:
+//   camera <lookfrom xyz> <lookat xyz> <vup xyz> <vfov> <aperture> <focus_dist>
+//   texture <name> <ppm or pfm file>
+//   material <name> lambertian <r g b> [texture <texture name>]
+//   material <name> metal <r g b> <fuzz> [texture <texture name>]
+//   material <name> dielectric <index of refraction>
+//   material <name> emissive <r g b>       (a light: emitted radiance, any brightness)
+//   sphere <center xyz> <radius> <material name>
+//   sphere <center xyz> <radius> lambertian|metal|dielectric|emissive <parameters>
+//   motion <offset xyz> <period>          (moves the sphere above it, see sphere_motion)
+//   mesh <obj file> <translate xyz> <scale> <material name>
+//   mesh <obj file> <translate xyz> <scale> lambertian|metal|dielectric|emissive <parameters>
+//   instance sphere|<obj file> <translate xyz> <rotate_y degrees> <scale> <material name>
+//   instance sphere|<obj file> <translate xyz> <rotate_y degrees> <scale> lambertian|metal|dielectric|emissive <parameters>
+//   keyframe <time> <lookfrom xyz> <lookat xyz> <vup xyz> <vfov> <aperture> <focus_dist>
+// (the aspect ratio of the camera comes from the image size; with keyframes the
+// camera statement is only the default for scenes rendered without them; a
+// texture multiplies the albedo (texture.h); mesh and texture paths are
+// relative to the scene file and cannot contain spaces; "sphere" is
+// the unit sphere at the origin, and every file is read once however many
+// instances it has)
+//
+// binary form, native byte order: the 8 byte magic "RTSCENE1", the camera as 12
+// doubles, a uint32 material count and the materials as scene_material records,
+// a uint64 sphere count and the spheres as scene_sphere records; scenes with
+// motion or keyframes continue with a uint64 motion count and scene_motion
+// records, then a uint32 keyframe count and the keyframes as 13 doubles (time
+// first, then laid out like the camera), then a uint32 mesh count and per mesh
+// a uint32 path length, the path, 4 doubles (translation, scale) and a uint32
+// material, then a uint32 instance source count and per source a uint32 length
+// and the path ("sphere" for the unit sphere), a uint64 instance count and the
+// instances as scene_instance records, then a uint32 texture count and per
+// texture a uint32 length and the path; files that end after the spheres, the
+// keyframes, the meshes or the instances are still scenes
+
+// struct scene_material
+// - lambertian: albedo; metal: albedo and param = fuzz; dielectric: param = index of refraction;
+//   emissive: albedo = emitted radiance
+// - texture is 1 + the index in scene_desc::textures of the image a
+//   lambertian or metal albedo is multiplied by, 0 for none
+struct scene_material {
+    material_type type;
+    uint32_t texture;
+    double albedo[3];
+    double param;
+
+    bool operator==(const scene_material& o) const {
+        return type == o.type && texture == o.texture && albedo[0] == o.albedo[0] && albedo[1] == o.albedo[1] &&
+               albedo[2] == o.albedo[2] && param == o.param;
+    }
+};
+
+inline scene_material diffuse_material(const color& albedo) {
+    return { material_type::lambertian, 0, { albedo.x(), albedo.y(), albedo.z() }, 0 };
+}
+
+inline scene_material metal_material(const color& albedo, double fuzz) {
+    return { material_type::metal, 0, { albedo.x(), albedo.y(), albedo.z() }, fuzz };
+}
+
+inline scene_material glass_material(double index_of_refraction) {
+    return { material_type::dielectric, 0, { 0, 0, 0 }, index_of_refraction };
+}
+
+inline scene_material emissive_material(const color& radiance) {
+    return { material_type::emissive, 0, { radiance.x(), radiance.y(), radiance.z() }, 0 };
+}
+
+// bool check_material(const scene_material& m, string& error)
+// - whether m renders as meant: its type is one of material_type and a
+//   dielectric needs an index of refraction above 0; what is wrong goes to error
+inline bool check_material(const scene_material& m, string& error) {
+    if (static_cast<uint32_t>(m.type) >= static_cast<uint32_t>(material_type_count)) {
+        error = "unknown material type " + to_string(static_cast<uint32_t>(m.type));
+        return false;
+    }
+    if (m.type == material_type::dielectric && !(m.param > 0)) {
+        error = "a dielectric needs an index of refraction above 0";
+        return false;
+    }
+    return true;
+}
+
+// material make_material(const scene_material& m, const vector<uint32_t>& texture_ids)
+// - the material table's entry for m; texture_ids[k] is the id of the
+//   scene's texture k in the table's texture_cache
+inline material make_material(const scene_material& m, const vector<uint32_t>& texture_ids) {
+    color albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+    uint32_t texture = m.texture > 0 && m.texture <= texture_ids.size() ? texture_ids[m.texture - 1] : no_texture;
+    switch (m.type) {
+        case material_type::metal: return metal(albedo, m.param, texture);
+        case material_type::dielectric: return dielectric(m.param);
+        case material_type::emissive: return diffuse_light(albedo);
+        default: return lambertian(albedo, texture);
+    }
+}
+
+struct scene_sphere {
+    double center[3];
+    double radius;
+    uint32_t material;
+    uint32_t reserved;
+};
+
+// bool check_radius(double radius, string& error)
+// - whether a sphere of this radius is anything: finite and not 0 (a negative
+//   radius is a hollow sphere, its normals pointing in); what is wrong goes to error
+inline bool check_radius(double radius, string& error) {
+    if (!isfinite(radius) || radius == 0) {
+        error = "a sphere needs a finite radius other than 0";
+        return false;
+    }
+    return true;
+}
+
+// struct scene_motion
+// - the motion of spheres[sphere], see sphere_motion
+struct scene_motion {
+    uint64_t sphere;
+    double offset[3];
+    double period;
+};
+
+struct scene_camera {
+    point3 lookfrom = point3(13, 2, 3);
+    point3 lookat = point3(0, 0, 0);
+    vec3 vup = vec3(0, 1, 0);
+    double vfov = 20;
+    double aperture = 0.1;
+    double focus_dist = 10;
+};
+
+// bool check_camera(const scene_camera& c, string& error)
+// - whether c makes a camera that sees anything: 0 < vfov < 180, aperture
+//   >= 0, focus_dist > 0, lookfrom away from lookat and vup off the view
+//   axis; what is wrong goes to error
+inline bool check_camera(const scene_camera& c, string& error) {
+    if (!(c.vfov > 0 && c.vfov < 180) || !(c.aperture >= 0) || !(c.focus_dist > 0) ||
+        (c.lookfrom - c.lookat).near_zero() || cross(c.lookfrom - c.lookat, c.vup).near_zero()) {
+        error = "the camera needs 0 < vfov < 180, aperture >= 0, focus > 0, lookfrom away from lookat and vup off the view axis";
+        return false;
+    }
+    return true;
+}
+
+// struct scene_mesh
+// - an OBJ file, its vertices scaled by scale and then moved by translate
+struct scene_mesh {
+    string path;
+    double translate[3];
+    double scale;
+    uint32_t material;
+};
+
+// struct scene_instance
+// - instance_sources[source] scaled by scale, turned rotate_y degrees about
+//   the y axis and moved by translate, in material
+struct scene_instance {
+    uint32_t source;
+    uint32_t material;
+    double translate[3];
+    double rotate_y;
+    double scale;
+};
+
+// struct camera_keyframe
+// - the camera at time (seconds); between keyframes every parameter is
+//   interpolated linearly, before the first and after the last it holds
+struct camera_keyframe {
+    double time;
+    scene_camera cam;
+};
+
+// struct scene_stats
+// - what the last load cost
+struct scene_stats {
+    double load_ms = 0;
+    double build_ms = 0;
+    size_t file_bytes = 0;
+    size_t materials_read = 0;      // before deduplication
+    size_t memory_bytes = 0;        // approximate size of the built hittables and materials
+};
+
+inline ostream& operator<<(ostream& out, const scene_stats& s) {
+    return out << "scene: " << s.file_bytes / 1024 << " KiB file, " << s.materials_read
+               << " material records, loaded in " << s.load_ms << " ms, built in " << s.build_ms
+               << " ms, ~" << s.memory_bytes / (1024 * 1024) << " MiB of objects";
+}
+
+// uint64_t fnv1a(const void* data, size_t n, uint64_t h)
+inline uint64_t fnv1a(const void* data, size_t n, uint64_t h = 1469598103934665603ull) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t k = 0 ; k < n ; ++k)
+        h = (h ^ bytes[k]) * 1099511628211ull;
+    return h;
+}
+
+// string resolve_path(const string& base_dir, const string& path)
+// - path made absolute: a relative path is taken from base_dir, itself from
+//   the current directory (empty is the current directory); a file that does
+//   not exist keeps the path as it was joined, for the error that follows
+inline string resolve_path(const string& base_dir, const string& path) {
+    if (path.empty()) return path;
+    string joined = path[0] != '/' && !base_dir.empty() ? base_dir + "/" + path : path;
+    char resolved[PATH_MAX];
+    return realpath(joined.c_str(), resolved) ? string(resolved) : joined;
+}
+
+// class scene_desc
+// - the parsed scene before it becomes hittables; materials are deduplicated as
+//   they are added, so a million spheres sharing a handful of distinct materials
+//   keep a handful of material table entries
+class scene_desc {
+
+    public:
+        // MEMBERS
+        scene_camera cam;
+        vector<scene_material> materials;
+        vector<scene_sphere> spheres;
+        vector<scene_motion> motions;
+        vector<scene_mesh> meshes;
+        vector<shared_ptr<const triangle_mesh>> mesh_geometry;     // meshes[k]'s, once load_meshes() ran
+        vector<string> instance_sources;        // "sphere" or an OBJ file
+        vector<scene_instance> instances;
+        vector<shared_ptr<const triangle_mesh>> instance_geometry; // instance_sources[k]'s, null for the sphere
+        vector<camera_keyframe> keyframes;     // sorted by time
+        vector<string> textures;                // image files
+        vector<uint32_t> texture_ids;           // textures[k]'s id in the texture_cache, once build() ran
+        scene_stats stats;
+
+    public:
+        // uint32_t add_material(const scene_material& m)
+        // - index of m in the material table, adding it if no equal material exists
+        uint32_t add_material(const scene_material& m) {
+            stats.materials_read++;
+            if (2 * (materials.size() + 1) > material_slots.size())
+                grow_material_slots();
+
+            const size_t mask = material_slots.size() - 1;
+            for (size_t k = material_hash(m) & mask ; ; k = (k + 1) & mask) {
+                uint32_t index = material_slots[k];
+                if (index == empty_slot) {
+                    index = static_cast<uint32_t>(materials.size());
+                    materials.push_back(m);
+                    material_slots[k] = index;
+                    return index;
+                }
+                if (materials[index] == m) return index;
+            }
+        }
+
+        // void set_material(uint32_t index, const scene_material& m)
+        // - replaces the material at index, for every object that shares it
+        void set_material(uint32_t index, const scene_material& m) {
+            materials[index] = m;
+            if (!material_slots.empty())
+                index_materials(material_slots.size());
+        }
+
+        // uint32_t add_texture(const string& path)
+        // - index of the texture read from path, adding it if it is new
+        uint32_t add_texture(const string& path) {
+            for (size_t k = 0 ; k < textures.size() ; ++k)
+                if (textures[k] == path) return static_cast<uint32_t>(k);
+            textures.push_back(path);
+            return static_cast<uint32_t>(textures.size() - 1);
+        }
+
+        void add_sphere(const point3& center, double radius, uint32_t material) {
+            scene_sphere s;
+            s.center[0] = center.x();
+            s.center[1] = center.y();
+            s.center[2] = center.z();
+            s.radius = radius;
+            s.material = material;
+            s.reserved = 0;
+            spheres.push_back(s);
+        }
+
+        // void add_motion(size_t sphere, const vec3& offset, double period)
+        void add_motion(size_t sphere, const vec3& offset, double period) {
+            motions.push_back({ sphere, { offset.x(), offset.y(), offset.z() }, period });
+        }
+
+        // void add_mesh(const string& path, const vec3& translate, double scale, uint32_t material)
+        void add_mesh(const string& path, const vec3& translate, double scale, uint32_t material) {
+            meshes.push_back({ path, { translate.x(), translate.y(), translate.z() }, scale, material });
+        }
+
+        // void add_instance(const string& source, const vec3& translate, double rotate_y, double scale, uint32_t material)
+        // - source is "sphere" or an OBJ file; each source is listed once
+        void add_instance(const string& source, const vec3& translate, double rotate_y, double scale, uint32_t material) {
+            uint32_t index = 0;
+            while (index < instance_sources.size() && instance_sources[index] != source) ++index;
+            if (index == instance_sources.size()) instance_sources.push_back(source);
+            instances.push_back({ index, material, { translate.x(), translate.y(), translate.z() }, rotate_y, scale });
+        }
+
+        // bool load_meshes(const string& base_dir, string& error)
+        // - reads the OBJ files of the meshes and instance sources not loaded
+        //   yet and builds their hierarchies; relative paths are taken from
+        //   base_dir and stored back absolute (resolve_path()), so a saved copy
+        //   of the scene finds them wherever it is written
+        bool load_meshes(const string& base_dir, string& error) {
+            auto load = [&](string& path, const scene_mesh* placement, shared_ptr<const triangle_mesh>& out) {
+                path = resolve_path(base_dir, path);
+                mesh_buffers buffers;
+                obj_stats loaded;
+                if (!load_obj(path, buffers, error, 0, &loaded))
+                    return false;
+                if (placement) {
+                    for (size_t v = 0 ; v < buffers.positions.size() ; ++v)
+                        buffers.positions[v] = static_cast<float>((buffers.positions[v] * placement->scale) + placement->translate[v % 3]);
+                    if (placement->scale < 0)
+                        for (float& n : buffers.normals) n = -n;
+                }
+                auto geometry = make_shared<triangle_mesh>(move(buffers));
+                cerr << loaded << '\n' << geometry->stats << '\n';
+                out = geometry;
+                return true;
+            };
+            for (size_t k = mesh_geometry.size() ; k < meshes.size() ; ++k) {
+                mesh_geometry.emplace_back();
+                if (!load(meshes[k].path, &meshes[k], mesh_geometry.back())) return false;
+            }
+            for (size_t k = instance_geometry.size() ; k < instance_sources.size() ; ++k) {
+                instance_geometry.emplace_back();
+                if (instance_sources[k] != "sphere" && !load(instance_sources[k], nullptr, instance_geometry.back()))
+                    return false;
+            }
+            return true;
+        }
+
+        // void add_keyframe(double time, const scene_camera& c)
+        void add_keyframe(double time, const scene_camera& c) {
+            auto it = upper_bound(keyframes.begin(), keyframes.end(), time,
+                                  [](double t, const camera_keyframe& k) { return t < k.time; });
+            keyframes.insert(it, { time, c });
+        }
+
+        // void orbit_camera(double degrees_per_second, double keys_per_second, int keys)
+        // - replaces the keyframes with cam turning degrees_per_second about the
+        //   vertical through its lookat, keyed at times k / keys_per_second for
+        //   k = 0 to keys (linear interpolation between close keys keeps it
+        //   circular)
+        // - a key's time and angle depend on k alone, so orbits keyed over
+        //   different lengths agree wherever both have keys
+        void orbit_camera(double degrees_per_second, double keys_per_second, int keys) {
+            keyframes.clear();
+            keys = max(keys, 1);
+            vec3 axis = unit_vector(cam.vup);
+            for (int k = 0 ; k <= keys ; ++k) {
+                double time = k / keys_per_second;
+                double angle = degrees_to_radians(degrees_per_second * time);
+                vec3 arm = cam.lookfrom - cam.lookat;
+                // Rodrigues' rotation of the arm about the axis
+                vec3 turned = (cos(angle) * arm) + (sin(angle) * cross(axis, arm)) +
+                              ((1 - cos(angle)) * dot(axis, arm) * axis);
+                scene_camera c = cam;
+                c.lookfrom = cam.lookat + turned;
+                keyframes.push_back({ time, c });
+            }
+        }
+
+        // uint64_t content_hash() const
+        // - a hash of everything the scene renders from: the camera and its
+        //   keyframes, materials, spheres, motions, the meshes, instances and
+        //   textures by path and placement; not the contents of the files
+        //   those paths name
+        uint64_t content_hash() const {
+            uint64_t h = fnv1a("scene_desc", 10);
+            auto add = [&](const void* data, size_t n) { h = fnv1a(data, n, h); };
+            auto add_string = [&](const string& text) {
+                uint64_t n = text.size();
+                add(&n, sizeof(n));
+                add(text.data(), text.size());
+            };
+            auto add_camera = [&](const scene_camera& c) {
+                double v[12] = { c.lookfrom.x(), c.lookfrom.y(), c.lookfrom.z(), c.lookat.x(), c.lookat.y(), c.lookat.z(),
+                                 c.vup.x(), c.vup.y(), c.vup.z(), c.vfov, c.aperture, c.focus_dist };
+                add(v, sizeof(v));
+            };
+            uint64_t counts[8] = { materials.size(), spheres.size(), motions.size(), meshes.size(),
+                                   instance_sources.size(), instances.size(), keyframes.size(), textures.size() };
+            add(counts, sizeof(counts));
+            add_camera(cam);
+            for (const camera_keyframe& k : keyframes) {
+                add(&k.time, sizeof(k.time));
+                add_camera(k.cam);
+            }
+            for (const scene_material& m : materials) {
+                uint32_t tags[2] = { static_cast<uint32_t>(m.type), m.texture };
+                add(tags, sizeof(tags));
+                add(m.albedo, sizeof(m.albedo));
+                add(&m.param, sizeof(m.param));
+            }
+            for (const scene_sphere& sp : spheres) {
+                add(sp.center, sizeof(sp.center));
+                add(&sp.radius, sizeof(sp.radius));
+                add(&sp.material, sizeof(sp.material));
+            }
+            for (const scene_motion& m : motions) {
+                add(&m.sphere, sizeof(m.sphere));
+                add(m.offset, sizeof(m.offset));
+                add(&m.period, sizeof(m.period));
+            }
+            for (const scene_mesh& m : meshes) {
+                add_string(m.path);
+                add(m.translate, sizeof(m.translate));
+                add(&m.scale, sizeof(m.scale));
+                add(&m.material, sizeof(m.material));
+            }
+            for (const string& source : instance_sources)
+                add_string(source);
+            for (const scene_instance& i : instances) {
+                uint32_t ids[2] = { i.source, i.material };
+                add(ids, sizeof(ids));
+                add(i.translate, sizeof(i.translate));
+                add(&i.rotate_y, sizeof(i.rotate_y));
+                add(&i.scale, sizeof(i.scale));
+            }
+            for (const string& texture : textures)
+                add_string(texture);
+            return h;
+        }
+
+        // scene_camera camera_at(double time) const
+        // - cam if there are no keyframes, else the keyframes interpolated at time
+        scene_camera camera_at(double time) const {
+            if (keyframes.empty()) return cam;
+            if (time <= keyframes.front().time) return keyframes.front().cam;
+            if (time >= keyframes.back().time) return keyframes.back().cam;
+            size_t k = 1;
+            while (keyframes[k].time < time) ++k;
+            const camera_keyframe& a = keyframes[k - 1];
+            const camera_keyframe& b = keyframes[k];
+            double f = (b.time > a.time) ? (time - a.time) / (b.time - a.time) : 0;
+            auto mix = [f](auto x, auto y) { return x + (f * (y - x)); };
+            scene_camera c;
+            c.lookfrom = mix(a.cam.lookfrom, b.cam.lookfrom);
+            c.lookat = mix(a.cam.lookat, b.cam.lookat);
+            c.vup = mix(a.cam.vup, b.cam.vup);
+            c.vfov = mix(a.cam.vfov, b.cam.vfov);
+            c.aperture = mix(a.cam.aperture, b.cam.aperture);
+            c.focus_dist = mix(a.cam.focus_dist, b.cam.focus_dist);
+            return c;
+        }
+
+        // bool animated() const
+        bool animated() const { return !motions.empty() || keyframes.size() > 1; }
+
+        // camera make_camera(double aspect_ratio, double time0 = 0, double time1 = 0) const
+        // - the camera for a frame whose shutter is open over [time0, time1]; it
+        //   is placed where the keyframes have it at time0 and does not move
+        //   while the shutter is open, so only the objects blur
+        camera make_camera(double aspect_ratio, double time0 = 0, double time1 = 0) const {
+            scene_camera c = camera_at(time0);
+            return camera(c.lookfrom, c.lookat, c.vup, c.vfov, aspect_ratio, c.aperture, c.focus_dist, time0, time1);
+        }
+
+        // hittable_list build(material_table& table)
+        // - fills table with the materials (same indices as the scene's) and
+        //   returns the spheres
+        // - the textures are added to the table's texture_cache, which is made
+        //   with the default budget if the caller gave it none; no image is
+        //   read until a lookup needs it
+        hittable_list build(material_table& table) {
+            auto start = chrono::steady_clock::now();
+            texture_ids.clear();
+            if (!textures.empty() && !table.textures) table.textures = make_shared<texture_cache>();
+            for (const string& path : textures)
+                texture_ids.push_back(table.textures->add(path));
+            table.materials.clear();
+            table.materials.reserve(materials.size());
+            for (const auto& m : materials)
+                table.add(make_material(m, texture_ids));
+
+            // the spheres sit side by side in one arena instead of one heap block
+            // each; every pointer shares the arena's ownership (the aliasing
+            // constructor allocates nothing), so it lives as long as any of them
+            auto storage = make_shared<arena>(max<size_t>(64 << 10, (spheres.size() * sizeof(sphere)) +
+                                                                   (motions.size() * sizeof(moving_sphere)) + alignof(moving_sphere)));
+            hittable_list world;
+            world.objects.reserve(spheres.size());
+            vector<int64_t> motion_of(motions.empty() ? 0 : spheres.size(), -1);
+            for (size_t k = 0 ; k < motions.size() ; ++k)
+                if (motions[k].sphere < spheres.size()) motion_of[motions[k].sphere] = static_cast<int64_t>(k);
+            for (size_t k = 0 ; k < spheres.size() ; ++k) {
+                const scene_sphere& s = spheres[k];
+                point3 center(s.center[0], s.center[1], s.center[2]);
+                hittable* object;
+                if (!motion_of.empty() && motion_of[k] >= 0) {
+                    const scene_motion& m = motions[motion_of[k]];
+                    sphere_motion path;
+                    path.center = center;
+                    path.offset = vec3(m.offset[0], m.offset[1], m.offset[2]);
+                    path.period = m.period;
+                    object = storage->create<moving_sphere>(path, s.radius, s.material);
+                } else {
+                    object = storage->create<sphere>(center, s.radius, s.material);
+                }
+                world.add(shared_ptr<hittable>(storage, object));
+            }
+            for (size_t k = 0 ; k < mesh_geometry.size() ; ++k)
+                world.add(make_shared<mesh>(mesh_geometry[k], meshes[k].material));
+
+            // all instances go into one set: a prototype per source, whose own
+            // material is replaced by every instance's; instances of OBJ files
+            // load_meshes() has not read are left out
+            shared_ptr<instance_set> set;
+            if (!instances.empty()) {
+                set = make_shared<instance_set>();
+                vector<int64_t> prototype_of(instance_sources.size(), -1);
+                for (size_t k = 0 ; k < instance_sources.size() ; ++k) {
+                    if (instance_sources[k] == "sphere")
+                        prototype_of[k] = set->add_prototype(make_shared<sphere>(point3(0, 0, 0), 1, 0));
+                    else if (k < instance_geometry.size() && instance_geometry[k])
+                        prototype_of[k] = set->add_prototype(make_shared<mesh>(instance_geometry[k], 0));
+                }
+                set->placements.reserve(instances.size());
+                for (const scene_instance& i : instances) {
+                    if (prototype_of[i.source] < 0) continue;
+                    affine xf = affine::translate(vec3(i.translate[0], i.translate[1], i.translate[2])) *
+                                   affine::rotate(vec3(0, 1, 0), i.rotate_y) * affine::scale(i.scale);
+                    set->add(static_cast<uint32_t>(prototype_of[i.source]), xf, i.material);
+                }
+                set->build();
+                world.add(set);
+            }
+
+            stats.memory_bytes = storage->bytes_reserved() + (spheres.size() * sizeof(shared_ptr<hittable>)) +
+                                 (materials.size() * sizeof(material));
+            for (const auto& geometry : mesh_geometry)
+                stats.memory_bytes += geometry->stats.memory_bytes;
+            for (const auto& geometry : instance_geometry)
+                if (geometry) stats.memory_bytes += geometry->stats.memory_bytes;
+            if (set) stats.memory_bytes += set->stats.memory_bytes;
+            stats.build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            return world;
+        }
+
+        // void build_lights(light_list& lights) const
+        // - the spheres with an emissive material that do not move, for direct
+        //   light sampling; other emitters are left to be found by scattering
+        void build_lights(light_list& lights) const {
+            lights = light_list();
+            vector<bool> moving(spheres.size());
+            for (const scene_motion& m : motions)
+                if (m.sphere < spheres.size()) moving[m.sphere] = true;
+            for (size_t k = 0 ; k < spheres.size() ; ++k) {
+                const scene_sphere& s = spheres[k];
+                if (moving[k] || s.material >= materials.size()) continue;
+                const scene_material& m = materials[s.material];
+                if (m.type != material_type::emissive) continue;
+                lights.add(point3(s.center[0], s.center[1], s.center[2]), s.radius, s.material,
+                           color(m.albedo[0], m.albedo[1], m.albedo[2]));
+            }
+            lights.prepare();
+        }
+
+    private:
+        // open addressing table of material indices, at most half full; one
+        // allocation per doubling instead of a hash node per material
+        static constexpr uint32_t empty_slot = UINT32_MAX;
+        vector<uint32_t> material_slots;
+
+        void grow_material_slots() {
+            index_materials(max<size_t>(64, 2 * material_slots.size()));
+        }
+
+        void index_materials(size_t slots) {
+            material_slots.assign(slots, empty_slot);
+            const size_t mask = material_slots.size() - 1;
+            for (uint32_t index = 0 ; index < materials.size() ; ++index) {
+                size_t k = material_hash(materials[index]) & mask;
+                while (material_slots[k] != empty_slot)
+                    k = (k + 1) & mask;
+                material_slots[k] = index;
+            }
+        }
+
+        static size_t material_hash(const scene_material& m) {
+            size_t h = hash<uint32_t>()(static_cast<uint32_t>(m.type) ^ (m.texture << 2));
+            for (double v : { m.albedo[0], m.albedo[1], m.albedo[2], m.param })
+                h = (h * 1099511628211ull) ^ hash<double>()(v);
+            return h;
+        }
+
+};
+
+static const char scene_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+
+// class scene_parser
+// - tokenizes the text form straight out of the mapped file, one line at a time
+class scene_parser {
+
+    public:
+        scene_parser(const char* begin, const char* end) : p(begin), last(end) {}
+
+        // bool parse(scene_desc& scene, string& error)
+        bool parse(scene_desc& scene, string& error) {
+            unordered_map<string, uint32_t> names;
+            string keyword;
+            while (skip_blank()) {
+                if (!word(keyword)) return fail(error, "expected a statement");
+
+                if (keyword == "camera") {
+                    scene_camera& c = scene.cam;
+                    if (!vec(c.lookfrom) || !vec(c.lookat) || !vec(c.vup) ||
+                        !number(c.vfov) || !number(c.aperture) || !number(c.focus_dist))
+                        return fail(error, "camera needs lookfrom, lookat, vup, vfov, aperture and focus_dist");
+                    string message;
+                    if (!check_camera(c, message)) return fail(error, message);
+                } else if (keyword == "texture") {
+                    string name, path;
+                    if (!word(name) || !word(path))
+                        return fail(error, "texture needs a name and an image file");
+                    texture_names[name] = scene.add_texture(path);
+                } else if (keyword == "material") {
+                    string name, type;
+                    scene_material m;
+                    if (!word(name) || !word(type) || !material_params(type, m))
+                        return fail(error, "material needs a name, a type and the type's parameters");
+                    string message;
+                    if (!check_material(m, message)) return fail(error, message);
+                    names[name] = scene.add_material(m);
+                } else if (keyword == "sphere") {
+                    point3 center;
+                    double radius;
+                    string name;
+                    if (!vec(center) || !number(radius) || !word(name))
+                        return fail(error, "sphere needs center, radius and material");
+                    string message;
+                    if (!check_radius(radius, message)) return fail(error, message);
+                    uint32_t index;
+                    if (!material_ref(name, names, scene, index, error)) return false;
+                    scene.add_sphere(center, radius, index);
+                } else if (keyword == "mesh") {
+                    string path, name;
+                    vec3 translate;
+                    double scale;
+                    if (!word(path) || !vec(translate) || !number(scale) || !word(name))
+                        return fail(error, "mesh needs an OBJ file, translation, scale and material");
+                    uint32_t index;
+                    if (!material_ref(name, names, scene, index, error)) return false;
+                    scene.add_mesh(path, translate, scale, index);
+                } else if (keyword == "instance") {
+                    string source, name;
+                    vec3 translate;
+                    double rotate_y, scale;
+                    if (!word(source) || !vec(translate) || !number(rotate_y) || !number(scale) || !word(name) || scale == 0)
+                        return fail(error, "instance needs sphere or an OBJ file, translation, rotation, a scale other than 0 and material");
+                    uint32_t index;
+                    if (!material_ref(name, names, scene, index, error)) return false;
+                    scene.add_instance(source, translate, rotate_y, scale, index);
+                } else if (keyword == "motion") {
+                    vec3 offset;
+                    double period;
+                    if (scene.spheres.empty()) return fail(error, "motion must follow a sphere");
+                    if (!vec(offset) || !number(period) || period < 0)
+                        return fail(error, "motion needs an offset and a period of at least 0");
+                    scene.add_motion(scene.spheres.size() - 1, offset, period);
+                } else if (keyword == "keyframe") {
+                    double time;
+                    scene_camera c;
+                    if (!number(time) || !vec(c.lookfrom) || !vec(c.lookat) || !vec(c.vup) ||
+                        !number(c.vfov) || !number(c.aperture) || !number(c.focus_dist))
+                        return fail(error, "keyframe needs time, lookfrom, lookat, vup, vfov, aperture and focus_dist");
+                    string message;
+                    if (!check_camera(c, message)) return fail(error, message);
+                    scene.add_keyframe(time, c);
+                } else {
+                    return fail(error, "unknown statement '" + keyword + "'");
+                }
+
+                skip_spaces();
+                if (p < last && *p != '\n' && *p != '#') return fail(error, "unexpected text at end of line");
+            }
+            return true;
+        }
+
+    private:
+        const char* p;
+        const char* last;
+        int line = 1;
+        unordered_map<string, uint32_t> texture_names;
+
+        bool fail(string& error, const string& message) {
+            error = "line " + to_string(line) + ": " + message;
+            return false;
+        }
+
+        void skip_spaces() {
+            while (p < last && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        }
+
+        // skips whitespace, comments and empty lines; false at the end of the file
+        bool skip_blank() {
+            while (p < last) {
+                skip_spaces();
+                if (p < last && *p == '#')
+                    while (p < last && *p != '\n') ++p;
+                if (p < last && *p == '\n') {
+                    ++p;
+                    ++line;
+                    continue;
+                }
+                return p < last;
+            }
+            return false;
+        }
+
+        bool word(string& out) {
+            skip_spaces();
+            const char* start = p;
+            while (p < last && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') ++p;
+            out.assign(start, p);
+            return p > start;
+        }
+
+        bool number(double& out) {
+            skip_spaces();
+            auto result = from_chars(p, last, out);
+            if (result.ec != errc()) return false;
+            p = result.ptr;
+            return true;
+        }
+
+        bool vec(vec3& out) {
+            double x, y, z;
+            if (!number(x) || !number(y) || !number(z)) return false;
+            out = vec3(x, y, z);
+            return true;
+        }
+
+        // bool material_ref(const string& name, ...)
+        // - the material a sphere, mesh or instance statement names: a material defined
+        //   earlier, or a type whose parameters follow inline
+        bool material_ref(const string& name, const unordered_map<string, uint32_t>& names, scene_desc& scene,
+                          uint32_t& index, string& error) {
+            if (name == "lambertian" || name == "metal" || name == "dielectric" || name == "emissive") {
+                scene_material m;
+                if (!material_params(name, m)) return fail(error, "bad " + name + " parameters");
+                string message;
+                if (!check_material(m, message)) return fail(error, message);
+                index = scene.add_material(m);
+                return true;
+            }
+            auto it = names.find(name);
+            if (it == names.end()) return fail(error, "unknown material '" + name + "'");
+            index = it->second;
+            return true;
+        }
+
+        bool material_params(const string& type, scene_material& m) {
+            memset(&m, 0, sizeof(m));
+            vec3 albedo;
+            if (type == "lambertian") {
+                m.type = material_type::lambertian;
+                if (!vec(albedo) || !texture_ref(m)) return false;
+            } else if (type == "metal") {
+                m.type = material_type::metal;
+                if (!vec(albedo) || !number(m.param) || !texture_ref(m)) return false;
+            } else if (type == "dielectric") {
+                m.type = material_type::dielectric;
+                return number(m.param);
+            } else if (type == "emissive") {
+                m.type = material_type::emissive;
+                if (!vec(albedo)) return false;
+            } else {
+                return false;
+            }
+            for (int c = 0 ; c < 3 ; ++c) m.albedo[c] = albedo[c];
+            return true;
+        }
+
+        // bool texture_ref(scene_material& m)
+        // - an optional "texture <name>" after the parameters, naming a texture
+        //   defined earlier
+        bool texture_ref(scene_material& m) {
+            const char* start = p;
+            string keyword, name;
+            if (!word(keyword) || keyword != "texture") {
+                p = start;
+                return true;
+            }
+            auto it = word(name) ? texture_names.find(name) : texture_names.end();
+            if (it == texture_names.end()) return false;
+            m.texture = it->second + 1;
+            return true;
+        }
+
+};
+
+// bool load_scene(const string& path, scene_desc& scene, string& error)
+// - maps path and reads it as the binary form if it starts with the magic,
+//   otherwise as text; the binary sphere records are copied out in one block
+inline bool load_scene(const string& path, scene_desc& scene, string& error) {
+    auto start = chrono::steady_clock::now();
+    mapped_file file(path);
+    if (!file.ok()) {
+        error = "cannot read " + path;
+        return false;
+    }
+    scene.stats.file_bytes = file.size;
+    const size_t first_texture = scene.textures.size();
+
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    if (file.size >= sizeof(scene_magic) && memcmp(p, scene_magic, sizeof(scene_magic)) == 0) {
+        p += sizeof(scene_magic);
+        auto take = [&](void* out, size_t bytes) {
+            if (static_cast<size_t>(end - p) < bytes) return false;
+            memcpy(out, p, bytes);
+            p += bytes;
+            return true;
+        };
+        // whether count records of record_bytes each are left, without
+        // multiplying a count read from the file
+        auto fits = [&](uint64_t count, size_t record_bytes) {
+            return count <= static_cast<uint64_t>(end - p) / record_bytes;
+        };
+
+        double c[12];
+        uint32_t material_count;
+        uint64_t sphere_count;
+        if (!take(c, sizeof(c)) || !take(&material_count, sizeof(material_count))) {
+            error = path + " is truncated";
+            return false;
+        }
+        scene.cam.lookfrom = point3(c[0], c[1], c[2]);
+        scene.cam.lookat = point3(c[3], c[4], c[5]);
+        scene.cam.vup = vec3(c[6], c[7], c[8]);
+        scene.cam.vfov = c[9];
+        scene.cam.aperture = c[10];
+        scene.cam.focus_dist = c[11];
+        string message;
+        if (!check_camera(scene.cam, message)) {
+            error = path + ": " + message;
+            return false;
+        }
+
+        // material records are merged through the table, which remaps the spheres' indices
+        if (!fits(material_count, sizeof(scene_material))) {
+            error = path + " is truncated";
+            return false;
+        }
+        vector<uint32_t> remap(material_count);
+        uint32_t textures_used = 0;
+        for (uint32_t k = 0 ; k < material_count ; ++k) {
+            scene_material m;
+            if (!take(&m, sizeof(m))) {
+                error = path + " is truncated";
+                return false;
+            }
+            if (!check_material(m, message)) {
+                error = path + ": material " + to_string(k) + ": " + message;
+                return false;
+            }
+            textures_used = max(textures_used, m.texture);
+            if (m.texture > 0) m.texture += static_cast<uint32_t>(first_texture);
+            remap[k] = scene.add_material(m);
+        }
+
+        if (!take(&sphere_count, sizeof(sphere_count)) || !fits(sphere_count, sizeof(scene_sphere))) {
+            error = path + " is truncated";
+            return false;
+        }
+        size_t first = scene.spheres.size();
+        scene.spheres.resize(first + sphere_count);
+        memcpy(&scene.spheres[first], p, sphere_count * sizeof(scene_sphere));
+        for (size_t k = first ; k < scene.spheres.size() ; ++k) {
+            uint32_t& m = scene.spheres[k].material;
+            if (m >= material_count) {
+                error = path + ": sphere " + to_string(k - first) + " has no material";
+                return false;
+            }
+            if (!check_radius(scene.spheres[k].radius, message)) {
+                error = path + ": sphere " + to_string(k - first) + ": " + message;
+                return false;
+            }
+            m = remap[m];
+        }
+        p += sphere_count * sizeof(scene_sphere);
+
+        if (p < end) {
+            uint64_t motion_count;
+            uint32_t keyframe_count;
+            if (!take(&motion_count, sizeof(motion_count)) || !fits(motion_count, sizeof(scene_motion))) {
+                error = path + " is truncated";
+                return false;
+            }
+            size_t first_motion = scene.motions.size();
+            scene.motions.resize(first_motion + motion_count);
+            memcpy(&scene.motions[first_motion], p, motion_count * sizeof(scene_motion));
+            p += motion_count * sizeof(scene_motion);
+            for (size_t k = first_motion ; k < scene.motions.size() ; ++k) {
+                if (scene.motions[k].sphere >= sphere_count) {
+                    error = path + ": motion " + to_string(k - first_motion) + " has no sphere";
+                    return false;
+                }
+                scene.motions[k].sphere += first;
+            }
+
+            if (!take(&keyframe_count, sizeof(keyframe_count))) {
+                error = path + " is truncated";
+                return false;
+            }
+            for (uint32_t k = 0 ; k < keyframe_count ; ++k) {
+                double f[13];
+                if (!take(f, sizeof(f))) {
+                    error = path + " is truncated";
+                    return false;
+                }
+                scene_camera key;
+                key.lookfrom = point3(f[1], f[2], f[3]);
+                key.lookat = point3(f[4], f[5], f[6]);
+                key.vup = vec3(f[7], f[8], f[9]);
+                key.vfov = f[10];
+                key.aperture = f[11];
+                key.focus_dist = f[12];
+                if (!check_camera(key, message)) {
+                    error = path + ": keyframe " + to_string(k) + ": " + message;
+                    return false;
+                }
+                scene.add_keyframe(f[0], key);
+            }
+
+            uint32_t mesh_count = 0;
+            if (p < end && !take(&mesh_count, sizeof(mesh_count))) {
+                error = path + " is truncated";
+                return false;
+            }
+            for (uint32_t k = 0 ; k < mesh_count ; ++k) {
+                uint32_t length, material;
+                double placement[4];
+                if (!take(&length, sizeof(length)) || static_cast<size_t>(end - p) < length) {
+                    error = path + " is truncated";
+                    return false;
+                }
+                string mesh_path(p, length);
+                p += length;
+                if (!take(placement, sizeof(placement)) || !take(&material, sizeof(material))) {
+                    error = path + " is truncated";
+                    return false;
+                }
+                if (material >= material_count) {
+                    error = path + ": mesh " + to_string(k) + " has no material";
+                    return false;
+                }
+                scene.add_mesh(mesh_path, vec3(placement[0], placement[1], placement[2]), placement[3], remap[material]);
+            }
+
+            uint32_t source_count = 0;
+            uint64_t instance_count = 0;
+            if (p < end && !take(&source_count, sizeof(source_count))) {
+                error = path + " is truncated";
+                return false;
+            }
+            size_t first_source = scene.instance_sources.size();
+            for (uint32_t k = 0 ; k < source_count ; ++k) {
+                uint32_t length;
+                if (!take(&length, sizeof(length)) || static_cast<size_t>(end - p) < length) {
+                    error = path + " is truncated";
+                    return false;
+                }
+                scene.instance_sources.emplace_back(p, length);
+                p += length;
+            }
+            if (source_count > 0 && (!take(&instance_count, sizeof(instance_count)) ||
+                                     !fits(instance_count, sizeof(scene_instance)))) {
+                error = path + " is truncated";
+                return false;
+            }
+            size_t first_instance = scene.instances.size();
+            scene.instances.resize(first_instance + instance_count);
+            memcpy(scene.instances.data() + first_instance, p, instance_count * sizeof(scene_instance));
+            p += instance_count * sizeof(scene_instance);
+            for (size_t k = first_instance ; k < scene.instances.size() ; ++k) {
+                scene_instance& i = scene.instances[k];
+                if (i.source >= source_count || i.material >= material_count || i.scale == 0) {
+                    error = path + ": instance " + to_string(k - first_instance) + " is not valid";
+                    return false;
+                }
+                i.source += static_cast<uint32_t>(first_source);
+                i.material = remap[i.material];
+            }
+
+            uint32_t texture_count = 0;
+            if (p < end && !take(&texture_count, sizeof(texture_count))) {
+                error = path + " is truncated";
+                return false;
+            }
+            for (uint32_t k = 0 ; k < texture_count ; ++k) {
+                uint32_t length;
+                if (!take(&length, sizeof(length)) || static_cast<size_t>(end - p) < length) {
+                    error = path + " is truncated";
+                    return false;
+                }
+                scene.textures.emplace_back(p, length);
+                p += length;
+            }
+            if (textures_used > texture_count) {
+                error = path + ": a material has no texture " + to_string(textures_used - 1);
+                return false;
+            }
+        } else if (textures_used > 0) {
+            error = path + ": a material has no texture " + to_string(textures_used - 1);
+            return false;
+        }
+    } else {
+        scene_parser parser(p, end);
+        if (!parser.parse(scene, error)) {
+            error = path + ": " + error;
+            return false;
+        }
+    }
+
+    scene.stats.load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    // texture paths are resolved like the meshes', see load_meshes()
+    size_t slash = path.rfind('/');
+    string base_dir = slash == string::npos ? string() : path.substr(0, slash);
+    for (size_t k = first_texture ; k < scene.textures.size() ; ++k)
+        scene.textures[k] = resolve_path(base_dir, scene.textures[k]);
+    return scene.load_meshes(base_dir, error);
+}
+
+// bool save_scene(const string& path, const scene_desc& scene, bool binary)
+inline bool save_scene(const string& path, const scene_desc& scene, bool binary) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    const scene_camera& c = scene.cam;
+    bool ok = true;
+
+    if (binary) {
+        double cam[12] = { c.lookfrom.x(), c.lookfrom.y(), c.lookfrom.z(), c.lookat.x(), c.lookat.y(), c.lookat.z(),
+                           c.vup.x(), c.vup.y(), c.vup.z(), c.vfov, c.aperture, c.focus_dist };
+        uint32_t material_count = static_cast<uint32_t>(scene.materials.size());
+        uint64_t sphere_count = scene.spheres.size();
+        ok = fwrite(scene_magic, sizeof(scene_magic), 1, f) == 1 &&
+             fwrite(cam, sizeof(cam), 1, f) == 1 &&
+             fwrite(&material_count, sizeof(material_count), 1, f) == 1 &&
+             fwrite(scene.materials.data(), sizeof(scene_material), material_count, f) == material_count &&
+             fwrite(&sphere_count, sizeof(sphere_count), 1, f) == 1 &&
+             fwrite(scene.spheres.data(), sizeof(scene_sphere), sphere_count, f) == sphere_count;
+        if (ok && (!scene.motions.empty() || !scene.keyframes.empty() || !scene.meshes.empty() || !scene.instances.empty() ||
+                   !scene.textures.empty())) {
+            uint64_t motion_count = scene.motions.size();
+            uint32_t keyframe_count = static_cast<uint32_t>(scene.keyframes.size());
+            ok = fwrite(&motion_count, sizeof(motion_count), 1, f) == 1 &&
+                 fwrite(scene.motions.data(), sizeof(scene_motion), motion_count, f) == motion_count &&
+                 fwrite(&keyframe_count, sizeof(keyframe_count), 1, f) == 1;
+            for (const camera_keyframe& key : scene.keyframes) {
+                const scene_camera& k = key.cam;
+                double f13[13] = { key.time, k.lookfrom.x(), k.lookfrom.y(), k.lookfrom.z(), k.lookat.x(), k.lookat.y(), k.lookat.z(),
+                                   k.vup.x(), k.vup.y(), k.vup.z(), k.vfov, k.aperture, k.focus_dist };
+                ok = ok && fwrite(f13, sizeof(f13), 1, f) == 1;
+            }
+            uint32_t mesh_count = static_cast<uint32_t>(scene.meshes.size());
+            ok = ok && fwrite(&mesh_count, sizeof(mesh_count), 1, f) == 1;
+            for (const scene_mesh& m : scene.meshes) {
+                uint32_t length = static_cast<uint32_t>(m.path.size());
+                double placement[4] = { m.translate[0], m.translate[1], m.translate[2], m.scale };
+                ok = ok && fwrite(&length, sizeof(length), 1, f) == 1 &&
+                     fwrite(m.path.data(), 1, length, f) == length &&
+                     fwrite(placement, sizeof(placement), 1, f) == 1 &&
+                     fwrite(&m.material, sizeof(m.material), 1, f) == 1;
+            }
+            if (!scene.instances.empty() || !scene.textures.empty()) {
+                uint32_t source_count = scene.instances.empty() ? 0 : static_cast<uint32_t>(scene.instance_sources.size());
+                uint64_t instance_count = scene.instances.size();
+                ok = ok && fwrite(&source_count, sizeof(source_count), 1, f) == 1;
+                for (uint32_t k = 0 ; k < source_count ; ++k) {
+                    const string& source = scene.instance_sources[k];
+                    uint32_t length = static_cast<uint32_t>(source.size());
+                    ok = ok && fwrite(&length, sizeof(length), 1, f) == 1 && fwrite(source.data(), 1, length, f) == length;
+                }
+                if (source_count > 0)
+                    ok = ok && fwrite(&instance_count, sizeof(instance_count), 1, f) == 1 &&
+                         fwrite(scene.instances.data(), sizeof(scene_instance), instance_count, f) == instance_count;
+            }
+            if (!scene.textures.empty()) {
+                uint32_t texture_count = static_cast<uint32_t>(scene.textures.size());
+                ok = ok && fwrite(&texture_count, sizeof(texture_count), 1, f) == 1;
+                for (const string& texture : scene.textures) {
+                    uint32_t length = static_cast<uint32_t>(texture.size());
+                    ok = ok && fwrite(&length, sizeof(length), 1, f) == 1 && fwrite(texture.data(), 1, length, f) == length;
+                }
+            }
+        }
+    } else {
+        // %.17g round-trips every double exactly
+        fprintf(f, "camera %.17g %.17g %.17g  %.17g %.17g %.17g  %.17g %.17g %.17g  %.17g %.17g %.17g\n",
+                c.lookfrom.x(), c.lookfrom.y(), c.lookfrom.z(), c.lookat.x(), c.lookat.y(), c.lookat.z(),
+                c.vup.x(), c.vup.y(), c.vup.z(), c.vfov, c.aperture, c.focus_dist);
+        for (size_t k = 0 ; k < scene.textures.size() ; ++k)
+            fprintf(f, "texture t%zu %s\n", k, scene.textures[k].c_str());
+        for (size_t k = 0 ; k < scene.materials.size() ; ++k) {
+            const scene_material& m = scene.materials[k];
+            if (m.type == material_type::dielectric)
+                fprintf(f, "material m%zu dielectric %.17g", k, m.param);
+            else if (m.type == material_type::metal)
+                fprintf(f, "material m%zu metal %.17g %.17g %.17g %.17g", k, m.albedo[0], m.albedo[1], m.albedo[2], m.param);
+            else if (m.type == material_type::emissive)
+                fprintf(f, "material m%zu emissive %.17g %.17g %.17g", k, m.albedo[0], m.albedo[1], m.albedo[2]);
+            else
+                fprintf(f, "material m%zu lambertian %.17g %.17g %.17g", k, m.albedo[0], m.albedo[1], m.albedo[2]);
+            if (m.texture > 0 && (m.type == material_type::lambertian || m.type == material_type::metal))
+                fprintf(f, " texture t%u", m.texture - 1);
+            fputc('\n', f);
+        }
+        // motions are written after the sphere they belong to
+        vector<int64_t> motion_of(scene.motions.empty() ? 0 : scene.spheres.size(), -1);
+        for (size_t k = 0 ; k < scene.motions.size() ; ++k)
+            if (scene.motions[k].sphere < scene.spheres.size()) motion_of[scene.motions[k].sphere] = static_cast<int64_t>(k);
+        for (size_t k = 0 ; k < scene.spheres.size() ; ++k) {
+            const scene_sphere& s = scene.spheres[k];
+            fprintf(f, "sphere %.17g %.17g %.17g %.17g m%u\n", s.center[0], s.center[1], s.center[2], s.radius, s.material);
+            if (!motion_of.empty() && motion_of[k] >= 0) {
+                const scene_motion& m = scene.motions[motion_of[k]];
+                fprintf(f, "motion %.17g %.17g %.17g %.17g\n", m.offset[0], m.offset[1], m.offset[2], m.period);
+            }
+        }
+        for (const scene_mesh& m : scene.meshes)
+            fprintf(f, "mesh %s %.17g %.17g %.17g %.17g m%u\n", m.path.c_str(), m.translate[0], m.translate[1],
+                    m.translate[2], m.scale, m.material);
+        for (const scene_instance& i : scene.instances)
+            fprintf(f, "instance %s %.17g %.17g %.17g %.17g %.17g m%u\n", scene.instance_sources[i.source].c_str(),
+                    i.translate[0], i.translate[1], i.translate[2], i.rotate_y, i.scale, i.material);
+        for (const camera_keyframe& key : scene.keyframes) {
+            const scene_camera& k = key.cam;
+            fprintf(f, "keyframe %.17g  %.17g %.17g %.17g  %.17g %.17g %.17g  %.17g %.17g %.17g  %.17g %.17g %.17g\n", key.time,
+                    k.lookfrom.x(), k.lookfrom.y(), k.lookfrom.z(), k.lookat.x(), k.lookat.y(), k.lookat.z(),
+                    k.vup.x(), k.vup.y(), k.vup.z(), k.vfov, k.aperture, k.focus_dist);
+        }
+        ok = !ferror(f);
+    }
+    return (fclose(f) == 0) && ok;
+}
+
+// size_t resident_memory_bytes()
+// - the process's current resident set, 0 where /proc is not available
+inline size_t resident_memory_bytes() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long pages = 0, resident = 0;
+    int n = fscanf(f, "%lu %lu", &pages, &resident);
+    fclose(f);
+    return n == 2 ? static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+#endif
@@ -4,52 +4,184 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "profile.h"
 #include "vec3.h"
 
+// point3 sphere_surface_point(const point3& p, const point3& center, real radius, real& p_error)
+// - in float, p moved back onto the sphere along the normal, as r.at(t) is only
+//   as good as t, and in p_error a bound on its remaining distance from the
+//   surface: a few ulps of the center and radius it was rebuilt from
+// - in double p unchanged and no bound, the fixed t_min covers it
+inline point3 sphere_surface_point(const point3& p, const point3& center, real radius, real& p_error) {
+#ifdef RAYTRACER_FLOAT
+    vec3 offset = p - center;
+    real extent = fmax(fabs(center.x()), fmax(fabs(center.y()), fabs(center.z()))) + fabs(radius);
+    p_error = 4 * numeric_limits<real>::epsilon() * extent;
+    return center + (offset * (fabs(radius) / offset.length()));
+#else
+    (void)center;
+    (void)radius;
+    p_error = 0;
+    return p;
+#endif
+}
+
+// void sphere_uv(const vec3& offset, real radius, hit_record& rec)
+// - the texture coordinates of the hit offset from the centre of a sphere:
+//   offset is kept and hit_record::texture_uv() turns it into u and v only
+//   when a texture asks, as the trigonometry would slow every hit down; one
+//   unit of v spans half the circumference
+inline void sphere_uv(const vec3& offset, real radius, hit_record& rec) {
+    rec.sphere_dir = offset;
+    rec.uv_extent = static_cast<real>(pi * fabs(radius));
+}
+
 class sphere : public hittable {
 
     public:
         point3 center;
-        double radius;
-        shared_ptr<material> mat_ptr;
+        real radius;
+        uint32_t material_id;
 
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m)
-            : center(cen), radius(r), mat_ptr(m) {};
+        sphere(point3 cen, real r, uint32_t m)
+            : center(cen), radius(r), material_id(m) {};
 
-        // bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+        // bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
         // - takes in a ray, lower/upper bound, and a hit record
         // - determines whether something is hit during search and stores the point in space
         //   in which it was hit, the normal, and the root t
-        bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
-            vec3 oc = r.origin() - center;
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            return hit_at(center, r, t_min, t_max, rec);
+        }
+
+        // bool hit_at(const point3& cen, const ray& r, real t_min, real t_max, hit_record& rec) const
+        // - hit() for this sphere moved to cen; what moving spheres intersect
+        bool hit_at(const point3& cen, const ray& r, real t_min, real t_max, hit_record& rec) const {
+            profile_count(&profile_counters::primitive_tests);
+            vec3 oc = r.origin() - cen;
             auto a = r.direction().length_squared();
             auto half_b = dot(oc, r.direction());
             auto c = oc.length_squared() - (radius * radius);
 
+#ifdef RAYTRACER_FLOAT
+            // b^2 - ac cancels for small or distant spheres in float; the squared
+            // distance from the centre to the line loses far less (Ray Tracing Gems ch. 7)
+            vec3 l = oc - ((half_b / a) * r.direction());
+            auto discriminant = a * ((radius * radius) - l.length_squared());
+#else
             auto discriminant = (half_b * half_b) - (a * c);
+#endif
             if (discriminant < 0 ) return false;
             auto sqrtd = sqrt(discriminant);
 
+            real near_root, far_root;
+            roots(a, half_b, c, sqrtd, near_root, far_root);
+
             // Find the nearest root that lies in the acceptable range.
-            auto root = (-half_b - sqrtd) / a;
-            if (root < t_min || t_max < root) {
-                root = (-half_b + sqrtd) / a;
-                if (root < t_min || t_max < root) {
+            auto root = near_root;
+            if (!(root >= t_min && root <= t_max)) {
+                root = far_root;
+                if (!(root >= t_min && root <= t_max)) {
                     return false;
                 }
             }
 
             rec.t = root;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
+            rec.p = sphere_surface_point(r.at(rec.t), cen, radius, rec.p_error);
+            vec3 outward_normal = (rec.p - cen) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.material_id = material_id;
+            sphere_uv(rec.p - cen, radius, rec);
 
             return true;
         }
 
+        // void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override
+        // - the quadratic of hit() for all the rays of a packet, one lane per ray;
+        //   only lanes that hit pay for filling in their hit_record
+        // - p must be padded (ray_packet::pad)
+        void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override {
+            switch (p.width()) {
+                case 4: intersect_packet<4>(p, t_min, t_max, recs, hits); break;
+                case 8: intersect_packet<8>(p, t_min, t_max, recs, hits); break;
+                default: intersect_packet<16>(p, t_min, t_max, recs, hits); break;
+            }
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            auto r = vec3(fabs(radius), fabs(radius), fabs(radius));
+            output_box = aabb(center - r, center + r);
+            return true;
+        }
+
+    private:
+        // static void roots(real a, real half_b, real c, real sqrtd, real& near_root, real& far_root)
+        // - the two solutions of a t^2 + 2 half_b t + c = 0, near_root <= far_root
+        // - in float the root that would subtract two close numbers is taken from
+        //   the other through c / q instead; a tangent ray through the centre gives
+        //   NaN, which no interval test accepts
+        static void roots(real a, real half_b, real c, real sqrtd, real& near_root, real& far_root) {
+#ifdef RAYTRACER_FLOAT
+            real q = -half_b - copysign(sqrtd, half_b);
+            near_root = c / q;
+            far_root = q / a;
+            if (near_root > far_root) swap(near_root, far_root);
+#else
+            (void)c;
+            near_root = (-half_b - sqrtd) / a;
+            far_root = (-half_b + sqrtd) / a;
+#endif
+        }
+
+        template <int lanes>
+        void intersect_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const {
+            const real cx = center.x(), cy = center.y(), cz = center.z();
+            const real rr = radius * radius;
+            real roots_found[lanes];
+            bool lane_ok[lanes];
+            int any = 0;
+
+            for (int k = 0 ; k < lanes ; ++k) {
+                real ocx = p.ox[k] - cx;
+                real ocy = p.oy[k] - cy;
+                real ocz = p.oz[k] - cz;
+                real a = (p.dx[k] * p.dx[k]) + (p.dy[k] * p.dy[k]) + (p.dz[k] * p.dz[k]);
+                real half_b = (ocx * p.dx[k]) + (ocy * p.dy[k]) + (ocz * p.dz[k]);
+                real c = ((ocx * ocx) + (ocy * ocy) + (ocz * ocz)) - rr;
+#ifdef RAYTRACER_FLOAT
+                real s = half_b / a;
+                real lx = ocx - (s * p.dx[k]), ly = ocy - (s * p.dy[k]), lz = ocz - (s * p.dz[k]);
+                real disc = a * (rr - ((lx * lx) + (ly * ly) + (lz * lz)));
+#else
+                real disc = (half_b * half_b) - (a * c);
+#endif
+                real sqrtd = sqrt(disc > 0 ? disc : 0);
+                real near_root, far_root;
+                roots(a, half_b, c, sqrtd, near_root, far_root);
+                bool near_ok = near_root >= t_min && near_root <= t_max[k];
+                bool far_ok = far_root >= t_min && far_root <= t_max[k];
+                roots_found[k] = near_ok ? near_root : far_root;
+                lane_ok[k] = (k < p.size) && disc >= 0 && (near_ok || far_ok);
+                any |= lane_ok[k];
+            }
+            if (!any) return;
+
+            for (int k = 0 ; k < p.size ; ++k) {
+                if (!lane_ok[k]) continue;
+                ray r = p.get(k);
+                recs[k].t = roots_found[k];
+                recs[k].p = sphere_surface_point(r.at(recs[k].t), center, radius, recs[k].p_error);
+                vec3 outward_normal = (recs[k].p - center) / radius;
+                recs[k].set_face_normal(r, outward_normal);
+                recs[k].material_id = material_id;
+                sphere_uv(recs[k].p - center, radius, recs[k]);
+                hits[k] = true;
+                t_max[k] = roots_found[k];
+            }
+        }
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,351 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPHERE_SET_X86 1
+#endif
+
+using namespace std;
+
+// class sphere_set
+// - packed collection of spheres that plugs into the world as one hittable
+// - centers and radii live in structure-of-arrays form so a kernel can test
+//   several spheres against one ray per instruction; materials are indices
+//   into the scene's material_table like everywhere else
+// - the arrays are padded to a multiple of kernel_width with NaN spheres, which
+//   fail every comparison and are never hit
+// - the kernel (AVX2 / SSE2 / scalar) is picked at runtime from the CPU features;
+//   all three evaluate the same quadratic as sphere::hit, without FMA, so they
+//   return the same roots
+class sphere_set : public hittable {
+
+    public:
+        enum class kernel_type { scalar, sse2, avx2 };
+
+        static const int kernel_width = 4;
+
+        // MEMBERS
+        vector<double> center_x, center_y, center_z;
+        vector<double> radius;
+        vector<uint32_t> material_index;
+        size_t count = 0;
+        kernel_type kernel;
+
+    public:
+        // CONSTRUCTORS
+        sphere_set() : kernel(detect_kernel()) {}
+        sphere_set(kernel_type k) : kernel(k) {}
+
+        // void add(const point3& center, double r, uint32_t material_id)
+        // - appends a sphere
+        void add(const point3& center, double r, uint32_t material_id) {
+            unpad();
+            center_x.push_back(center.x());
+            center_y.push_back(center.y());
+            center_z.push_back(center.z());
+            radius.push_back(r);
+            material_index.push_back(material_id);
+            count++;
+            pad();
+        }
+
+        // void extract_spheres(hittable_list& list)
+        // - moves every sphere of list into the set; other objects stay in list
+        void extract_spheres(hittable_list& list) {
+            vector<shared_ptr<hittable>> rest;
+            for (const auto& object : list.objects) {
+                auto s = dynamic_pointer_cast<sphere>(object);
+                if (s)
+                    add(s->center, s->radius, s->material_id);
+                else
+                    rest.push_back(object);
+            }
+            list.objects = rest;
+        }
+
+        const char* kernel_name() const {
+            switch (kernel) {
+                case kernel_type::avx2: return "avx2";
+                case kernel_type::sse2: return "sse2";
+                default: return "scalar";
+            }
+        }
+
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            if (count == 0) return false;
+            profile_count(&profile_counters::primitive_tests, count);
+
+            int index = -1;
+            double t = t_max;
+            switch (kernel) {
+#ifdef SPHERE_SET_X86
+                case kernel_type::avx2: index = closest_avx2(r, t_min, t); break;
+                case kernel_type::sse2: index = closest_sse2(r, t_min, t); break;
+#endif
+                default: index = closest_scalar(r, t_min, t); break;
+            }
+            if (index < 0) return false;
+
+            point3 center(center_x[index], center_y[index], center_z[index]);
+            rec.t = t;
+            rec.p = sphere_surface_point(r.at(rec.t), center, radius[index], rec.p_error);
+            vec3 outward_normal = (rec.p - center) / radius[index];
+            rec.set_face_normal(r, outward_normal);
+            rec.material_id = material_index[index];
+            sphere_uv(rec.p - center, radius[index], rec);
+            return true;
+        }
+
+        // void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override
+        // - spheres in the outer loop, rays in the inner one: the inner loop is
+        //   branch free over the packet's SoA arrays so the compiler runs it one
+        //   SIMD lane per ray
+        void hit_packet(const ray_packet& p, real t_min, real* t_max, hit_record* recs, bool* hits) const override {
+            const int n_rays = p.size;
+            double a[ray_packet::max_size], best_t[ray_packet::max_size];
+            int best_i[ray_packet::max_size];
+            for (int k = 0 ; k < n_rays ; ++k) {
+                a[k] = (p.dx[k] * p.dx[k]) + (p.dy[k] * p.dy[k]) + (p.dz[k] * p.dz[k]);
+                best_t[k] = t_max[k];
+                best_i[k] = -1;
+            }
+
+            for (size_t j = 0 ; j < count ; ++j) {
+                const double cx = center_x[j], cy = center_y[j], cz = center_z[j];
+                const double rr = radius[j] * radius[j];
+                for (int k = 0 ; k < n_rays ; ++k) {
+                    double ocx = p.ox[k] - cx;
+                    double ocy = p.oy[k] - cy;
+                    double ocz = p.oz[k] - cz;
+                    double half_b = (ocx * p.dx[k]) + (ocy * p.dy[k]) + (ocz * p.dz[k]);
+                    double c = ((ocx * ocx) + (ocy * ocy) + (ocz * ocz)) - rr;
+                    double disc = (half_b * half_b) - (a[k] * c);
+                    double sqrtd = sqrt(disc > 0 ? disc : 0);
+                    double near_root = (-half_b - sqrtd) / a[k];
+                    double far_root = (-half_b + sqrtd) / a[k];
+                    bool near_ok = near_root >= t_min && near_root <= best_t[k];
+                    bool far_ok = far_root >= t_min && far_root <= best_t[k];
+                    bool ok = disc >= 0 && (near_ok || far_ok);
+                    double root = near_ok ? near_root : far_root;
+                    best_t[k] = ok ? root : best_t[k];
+                    best_i[k] = ok ? static_cast<int>(j) : best_i[k];
+                }
+            }
+
+            for (int k = 0 ; k < n_rays ; ++k) {
+                if (best_i[k] < 0) continue;
+                int index = best_i[k];
+                ray r = p.get(k);
+                point3 center(center_x[index], center_y[index], center_z[index]);
+                recs[k].t = best_t[k];
+                recs[k].p = sphere_surface_point(r.at(recs[k].t), center, radius[index], recs[k].p_error);
+                vec3 outward_normal = (recs[k].p - center) / radius[index];
+                recs[k].set_face_normal(r, outward_normal);
+                recs[k].material_id = material_index[index];
+                sphere_uv(recs[k].p - center, radius[index], recs[k]);
+                hits[k] = true;
+                t_max[k] = best_t[k];
+            }
+        }
+
+        bool bounding_box(aabb& output_box) const override {
+            if (count == 0) return false;
+            output_box = aabb();
+            for (size_t k = 0 ; k < count ; ++k) {
+                auto r = fabs(radius[k]);
+                output_box.grow(point3(center_x[k] - r, center_y[k] - r, center_z[k] - r));
+                output_box.grow(point3(center_x[k] + r, center_y[k] + r, center_z[k] + r));
+            }
+            return true;
+        }
+
+    private:
+        // int closest_scalar(const ray& r, double t_min, double& t) const
+        // - returns the index of the closest sphere hit in [t_min, t] and narrows t to it,
+        //   or -1 when nothing is hit
+        int closest_scalar(const ray& r, double t_min, double& t) const {
+            const point3 o = r.origin();
+            const vec3 d = r.direction();
+            const double a = d.length_squared();
+            int index = -1;
+
+            for (size_t k = 0 ; k < count ; ++k) {
+                double ocx = o.x() - center_x[k];
+                double ocy = o.y() - center_y[k];
+                double ocz = o.z() - center_z[k];
+                double half_b = (ocx * d.x()) + (ocy * d.y()) + (ocz * d.z());
+                double c = ((ocx * ocx) + (ocy * ocy) + (ocz * ocz)) - (radius[k] * radius[k]);
+
+                double discriminant = (half_b * half_b) - (a * c);
+                if (discriminant < 0) continue;
+                double sqrtd = sqrt(discriminant);
+
+                double root = (-half_b - sqrtd) / a;
+                if (root < t_min || t < root) {
+                    root = (-half_b + sqrtd) / a;
+                    if (root < t_min || t < root) continue;
+                }
+                t = root;
+                index = static_cast<int>(k);
+            }
+            return index;
+        }
+
+#ifdef SPHERE_SET_X86
+        // int closest_sse2(const ray& r, double t_min, double& t) const
+        // - two spheres per instruction; each lane keeps its own closest root and
+        //   the lanes are reduced at the end
+        int closest_sse2(const ray& r, double t_min, double& t) const {
+            const point3 o = r.origin();
+            const vec3 d = r.direction();
+            const __m128d ox = _mm_set1_pd(o.x()), oy = _mm_set1_pd(o.y()), oz = _mm_set1_pd(o.z());
+            const __m128d dx = _mm_set1_pd(d.x()), dy = _mm_set1_pd(d.y()), dz = _mm_set1_pd(d.z());
+            const __m128d a = _mm_set1_pd(d.length_squared());
+            const __m128d tmin = _mm_set1_pd(t_min);
+            const __m128d zero = _mm_setzero_pd();
+
+            __m128d best_t = _mm_set1_pd(t);
+            __m128d best_i = _mm_set1_pd(-1);
+
+            for (size_t k = 0 ; k < center_x.size() ; k += 2) {
+                __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(&center_x[k]));
+                __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(&center_y[k]));
+                __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(&center_z[k]));
+                __m128d rad = _mm_loadu_pd(&radius[k]);
+
+                __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+                __m128d c = _mm_sub_pd(
+                    _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)),
+                    _mm_mul_pd(rad, rad));
+                __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+                __m128d has_root = _mm_cmpge_pd(disc, zero);
+                if (_mm_movemask_pd(has_root) == 0) continue;
+
+                __m128d sqrtd = _mm_sqrt_pd(_mm_max_pd(disc, zero));
+                __m128d neg_b = _mm_sub_pd(zero, half_b);
+                __m128d near_root = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+                __m128d far_root = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+
+                __m128d near_ok = _mm_and_pd(_mm_cmpge_pd(near_root, tmin), _mm_cmple_pd(near_root, best_t));
+                __m128d far_ok = _mm_and_pd(_mm_cmpge_pd(far_root, tmin), _mm_cmple_pd(far_root, best_t));
+                __m128d root = _mm_or_pd(_mm_and_pd(near_ok, near_root), _mm_andnot_pd(near_ok, far_root));
+                __m128d ok = _mm_and_pd(has_root, _mm_or_pd(near_ok, far_ok));
+
+                __m128d idx = _mm_set_pd(static_cast<double>(k + 1), static_cast<double>(k));
+                best_t = _mm_or_pd(_mm_and_pd(ok, root), _mm_andnot_pd(ok, best_t));
+                best_i = _mm_or_pd(_mm_and_pd(ok, idx), _mm_andnot_pd(ok, best_i));
+            }
+
+            double lane_t[2], lane_i[2];
+            _mm_storeu_pd(lane_t, best_t);
+            _mm_storeu_pd(lane_i, best_i);
+            return reduce_lanes(lane_t, lane_i, 2, t);
+        }
+
+        // int closest_avx2(const ray& r, double t_min, double& t) const
+        // - four spheres per instruction, same structure as closest_sse2
+        __attribute__((target("avx2")))
+        int closest_avx2(const ray& r, double t_min, double& t) const {
+            const point3 o = r.origin();
+            const vec3 d = r.direction();
+            const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+            const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+            const __m256d a = _mm256_set1_pd(d.length_squared());
+            const __m256d tmin = _mm256_set1_pd(t_min);
+            const __m256d zero = _mm256_setzero_pd();
+            const __m256d lane_offset = _mm256_set_pd(3, 2, 1, 0);
+
+            __m256d best_t = _mm256_set1_pd(t);
+            __m256d best_i = _mm256_set1_pd(-1);
+
+            for (size_t k = 0 ; k < center_x.size() ; k += 4) {
+                __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&center_x[k]));
+                __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&center_y[k]));
+                __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&center_z[k]));
+                __m256d rad = _mm256_loadu_pd(&radius[k]);
+
+                __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+                __m256d c = _mm256_sub_pd(
+                    _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)),
+                    _mm256_mul_pd(rad, rad));
+                __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+                __m256d has_root = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+                if (_mm256_movemask_pd(has_root) == 0) continue;
+
+                __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+                __m256d neg_b = _mm256_sub_pd(zero, half_b);
+                __m256d near_root = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+                __m256d far_root = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+
+                __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(near_root, tmin, _CMP_GE_OQ), _mm256_cmp_pd(near_root, best_t, _CMP_LE_OQ));
+                __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(far_root, tmin, _CMP_GE_OQ), _mm256_cmp_pd(far_root, best_t, _CMP_LE_OQ));
+                __m256d root = _mm256_blendv_pd(far_root, near_root, near_ok);
+                __m256d ok = _mm256_and_pd(has_root, _mm256_or_pd(near_ok, far_ok));
+
+                __m256d idx = _mm256_add_pd(_mm256_set1_pd(static_cast<double>(k)), lane_offset);
+                best_t = _mm256_blendv_pd(best_t, root, ok);
+                best_i = _mm256_blendv_pd(best_i, idx, ok);
+            }
+
+            double lane_t[4], lane_i[4];
+            _mm256_storeu_pd(lane_t, best_t);
+            _mm256_storeu_pd(lane_i, best_i);
+            return reduce_lanes(lane_t, lane_i, 4, t);
+        }
+#endif
+
+        // int reduce_lanes(const double* lane_t, const double* lane_i, int lanes, double& t) const
+        // - picks the closest of the per-lane winners (the later sphere wins a tie,
+        //   like the sequential loops)
+        static int reduce_lanes(const double* lane_t, const double* lane_i, int lanes, double& t) {
+            int index = -1;
+            for (int l = 0 ; l < lanes ; ++l) {
+                if (lane_i[l] < 0) continue;
+                int k = static_cast<int>(lane_i[l]);
+                if (index < 0 || lane_t[l] < t || (lane_t[l] == t && k > index)) {
+                    t = lane_t[l];
+                    index = k;
+                }
+            }
+            return index;
+        }
+
+        static kernel_type detect_kernel() {
+#ifdef SPHERE_SET_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return kernel_type::avx2;
+            return kernel_type::sse2;
+#else
+            return kernel_type::scalar;
+#endif
+        }
+
+        // padding helpers: the arrays always hold a multiple of kernel_width entries
+        void unpad() {
+            center_x.resize(count);
+            center_y.resize(count);
+            center_z.resize(count);
+            radius.resize(count);
+        }
+
+        void pad() {
+            size_t padded = ((count + kernel_width - 1) / kernel_width) * kernel_width;
+            const double nan = numeric_limits<double>::quiet_NaN();
+            center_x.resize(padded, nan);
+            center_y.resize(padded, nan);
+            center_z.resize(padded, nan);
+            radius.resize(padded, nan);
+        }
+
+};
+
+#endif
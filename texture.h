@@ -0,0 +1,437 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "rtweekend.h"
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// IMAGE TEXTURES
+// - a texture_cache holds the images of a scene's textures as mip pyramids
+//   (every level half the size of the one below, down to one texel) cut into
+//   tiles of tile_size x tile_size texels, and keeps at most capacity bytes
+//   of tiles in memory: past it the least recently used tile is dropped
+// - nothing is read up front: add() only records the path; the first lookup
+//   of an image maps its file and reads it through once to write the coarser
+//   levels (every texel the mean of the 2 x 2 below it) to an unlinked
+//   temporary file, which is mapped too; after that a tile is made the first
+//   time a lookup needs it by copying its texels out of one of the two
+//   mappings, so a dropped tile costs one copy to make again whatever its
+//   level, and the mapped pages are the kernel's to drop, not the cache's
+// - lookups are trilinear: bilinear in the two levels whose texels are
+//   nearest the footprint in size; every tile repeats the first row and
+//   column of its neighbours (wrapping around the image), so the four texels
+//   of a bilinear lookup are always in one tile
+// - u and v repeat outside [0, 1); v = 0 is the bottom row of the image
+// - files: binary PPM (P6, 8 bit, gamma 2 as image_io.h writes them, turned
+//   back to linear) and color PFM in either byte order
+// - add() must not run while other threads look up; lookup() may run on any
+//   number of threads: the tile table is split by tile key into up to
+//   max_shards shards, each with its own mutex and least recently used list
+//   and an equal share of the capacity, so threads reading different tiles
+//   seldom wait for one another; a shard's mutex is held only to find,
+//   insert and drop tiles, never while a tile is made
+// - a shard gets at least shard_tiles tiles' worth of the capacity, since
+//   dropping the least recently used of a few tiles is close to dropping one
+//   at random: a small cache stays one table
+
+const uint32_t no_texture = UINT32_MAX;
+
+// struct texture_stats
+struct texture_stats {
+    size_t textures = 0;
+    size_t failed = 0;              // images that could not be read; they look up as magenta
+    uint64_t hits = 0;              // tile requests found in memory
+    uint64_t misses = 0;            // tile requests that had to make the tile
+    uint64_t evictions = 0;
+    size_t resident_bytes = 0;      // tiles in memory now
+    size_t peak_bytes = 0;
+    size_t capacity_bytes = 0;
+    size_t pyramid_bytes = 0;       // every level of the images opened so far, all in memory
+
+    double hit_rate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+};
+
+inline ostream& operator<<(ostream& out, const texture_stats& s) {
+    out << "textures: " << s.textures << " images";
+    if (s.failed) out << " (" << s.failed << " unreadable)";
+    return out << ", tile hit rate " << 100.0 * s.hit_rate() << "% (" << s.hits << " hits, " << s.misses
+               << " misses, " << s.evictions << " evictions), " << s.resident_bytes / 1024 << " KiB resident, peak "
+               << s.peak_bytes / 1024 << " KiB of " << s.capacity_bytes / 1024 << " KiB, whole pyramids "
+               << s.pyramid_bytes / 1024 << " KiB";
+}
+
+// struct texture_image
+// - an image of the cache: where its texels are in the mapped file and the
+//   size of every level of its pyramid, once opened
+struct texture_image {
+    string path;
+    atomic<int> state{0};                   // 0 not opened yet, 1 ready, 2 unreadable
+    mutex open_mutex;
+    unique_ptr<mapped_file> file;
+    unique_ptr<mapped_file> coarse;         // levels 1 and up: rgb floats, rows bottom first
+    const unsigned char* texels = nullptr;  // the first texel in the file
+    bool pfm = false;
+    bool swap_bytes = false;                // big endian PFM
+    float ppm_max = 255;
+    vector<int> widths, heights;            // per level, level 0 first
+    vector<size_t> offsets;                 // per level, where it starts in coarse, in floats
+    string error;
+};
+
+// class texture_cache
+class texture_cache {
+
+    public:
+        static const int tile_size = 32;                // texels per side, without the repeated row and column
+        static const int tile_stride = tile_size + 1;
+        static const size_t tile_bytes = 3 * sizeof(float) * tile_stride * tile_stride;
+        static const int max_shards = 16;
+        static const size_t shard_tiles = 64;
+
+        // a tile: tile_stride rows of tile_stride rgb texels, bottom row first
+        using tile = vector<float>;
+
+    public:
+        // CONSTRUCTORS
+        explicit texture_cache(size_t capacity_bytes = size_t(64) << 20)
+            : capacity(max(capacity_bytes, tile_bytes)),
+              shard_count(static_cast<int>(clamp(capacity / (shard_tiles * tile_bytes), size_t(1), size_t(max_shards)))),
+              shard_capacity(capacity / shard_count) {}
+
+        // uint32_t add(const string& path)
+        // - the id of the image at path, added if it is new; reads nothing
+        uint32_t add(const string& path) {
+            for (size_t k = 0 ; k < images.size() ; ++k)
+                if (images[k]->path == path) return static_cast<uint32_t>(k);
+            images.push_back(make_unique<texture_image>());
+            images.back()->path = path;
+            return static_cast<uint32_t>(images.size() - 1);
+        }
+
+        size_t size() const { return images.size(); }
+
+        // color lookup(uint32_t id, real u, real v, real footprint)
+        // - image id at (u, v), filtered over footprint, the width of the lookup
+        //   in units of u and v (0 reads the finest level)
+        color lookup(uint32_t id, real u, real v, real footprint) {
+            texture_image& image = *images[id];
+            if (!ready(image)) return color(1, 0, 1);
+            u -= floor(u);
+            v -= floor(v);
+            const int levels = static_cast<int>(image.widths.size());
+            real texels = footprint * max(image.widths[0], image.heights[0]);
+            real level = texels > 1 ? fmin(log2(texels), real(levels - 1)) : 0;
+            int fine = static_cast<int>(level);
+            real f = level - fine;
+            color c = bilinear(id, image, fine, u, v);
+            if (f > 0 && fine + 1 < levels)
+                c = ((1 - f) * c) + (f * bilinear(id, image, fine + 1, u, v));
+            return c;
+        }
+
+        // texture_stats stats() const
+        texture_stats stats() const {
+            texture_stats s;
+            for (int k = 0 ; k < shard_count ; ++k) {
+                const shard& part = shards[k];
+                lock_guard<mutex> lock(part.lock);
+                s.hits += part.hits;
+                s.misses += part.misses;
+                s.evictions += part.evictions;
+            }
+            s.resident_bytes = resident.load(memory_order_relaxed);
+            s.peak_bytes = peak.load(memory_order_relaxed);
+            s.capacity_bytes = capacity;
+            s.textures = images.size();
+            for (const auto& image : images) {
+                int state = image->state.load(memory_order_acquire);
+                if (state == 2) s.failed++;
+                if (state != 1) continue;
+                for (size_t l = 0 ; l < image->widths.size() ; ++l)
+                    s.pyramid_bytes += 3 * sizeof(float) * size_t(image->widths[l]) * size_t(image->heights[l]);
+            }
+            return s;
+        }
+
+        // string error() const
+        // - why the first unreadable image could not be read; empty if all could
+        string error() const {
+            for (const auto& image : images)
+                if (image->state.load(memory_order_acquire) == 2) return image->error;
+            return string();
+        }
+
+    private:
+        struct entry {
+            shared_ptr<const tile> texels;
+            list<uint64_t>::iterator position;
+        };
+
+        // a part of the tile table, a cache line apart from the next
+        struct alignas(64) shard {
+            mutable mutex lock;
+            unordered_map<uint64_t, entry> tiles;
+            list<uint64_t> lru;             // tile keys, most recently used first
+            size_t resident = 0;
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+        };
+
+        vector<unique_ptr<texture_image>> images;
+        size_t capacity;
+        int shard_count;
+        size_t shard_capacity;
+        shard shards[max_shards];
+        atomic<size_t> resident{0};         // over every shard
+        atomic<size_t> peak{0};
+
+        // bool ready(texture_image& image)
+        // - opens image on its first lookup; false if it cannot be read
+        bool ready(texture_image& image) {
+            int state = image.state.load(memory_order_acquire);
+            if (state == 0) {
+                lock_guard<mutex> lock(image.open_mutex);
+                state = image.state.load(memory_order_relaxed);
+                if (state == 0) {
+                    state = open(image) ? 1 : 2;
+                    image.state.store(state, memory_order_release);
+                }
+            }
+            return state == 1;
+        }
+
+        // bool open(texture_image& image)
+        // - maps the file, reads its header (the size and where the texels
+        //   start) and writes and maps the coarser levels
+        static bool open(texture_image& image) {
+            image.file = make_unique<mapped_file>(image.path);
+            const mapped_file& f = *image.file;
+            if (!f.ok()) {
+                image.error = "cannot read texture " + image.path;
+                return false;
+            }
+            const char* p = f.data;
+            const char* end = f.data + f.size;
+            auto token = [&](string& out) {
+                while (p < end && (isspace(static_cast<unsigned char>(*p)) || *p == '#')) {
+                    if (*p == '#')
+                        while (p < end && *p != '\n') ++p;
+                    else
+                        ++p;
+                }
+                const char* start = p;
+                while (p < end && !isspace(static_cast<unsigned char>(*p))) ++p;
+                out.assign(start, p);
+                return p > start;
+            };
+
+            string magic, w, h, last;
+            bool ok = token(magic) && (magic == "P6" || magic == "PF") && token(w) && token(h) && token(last) && p < end;
+            int width = ok ? atoi(w.c_str()) : 0;
+            int height = ok ? atoi(h.c_str()) : 0;
+            double scale = ok ? atof(last.c_str()) : 0;
+            ++p;    // the one whitespace character before the texels
+            if (!ok || width <= 0 || height <= 0 || scale == 0 || (magic == "P6" && (scale < 0 || scale > 255))) {
+                image.error = image.path + " is not a binary PPM or color PFM texture";
+                return false;
+            }
+            image.pfm = magic == "PF";
+            image.swap_bytes = image.pfm && scale > 0;
+            image.ppm_max = static_cast<float>(scale);
+            size_t texel_bytes = image.pfm ? 3 * sizeof(float) : 3;
+            if (static_cast<size_t>(end - p) < texel_bytes * size_t(width) * size_t(height)) {
+                image.error = image.path + " is truncated";
+                return false;
+            }
+            image.texels = reinterpret_cast<const unsigned char*>(p);
+            // tiles read a few short runs of every row they cover
+            madvise(const_cast<char*>(f.data), f.size, MADV_RANDOM);
+
+            image.widths.assign(1, width);
+            image.heights.assign(1, height);
+            image.offsets.assign(1, 0);
+            size_t coarse_floats = 0;
+            while (image.widths.back() > 1 || image.heights.back() > 1) {
+                image.widths.push_back((image.widths.back() + 1) / 2);
+                image.heights.push_back((image.heights.back() + 1) / 2);
+                image.offsets.push_back(coarse_floats);
+                coarse_floats += 3 * size_t(image.widths.back()) * size_t(image.heights.back());
+            }
+            if (coarse_floats == 0) return true;
+            if (!write_coarse_levels(image)) {
+                image.error = "cannot write the coarser levels of " + image.path + " to a temporary file";
+                return false;
+            }
+            return true;
+        }
+
+        // bool write_coarse_levels(texture_image& image)
+        // - level by level, row by row, from the two rows below; only three
+        //   rows are ever in memory
+        static bool write_coarse_levels(texture_image& image) {
+            FILE* f = tmpfile();
+            if (!f) return false;
+            const int fd = fileno(f);
+            bool ok = true;
+            vector<float> row0, row1, out;
+            for (size_t level = 1 ; ok && level < image.widths.size() ; ++level) {
+                const int w = image.widths[level], h = image.heights[level];
+                const int below_w = image.widths[level - 1], below_h = image.heights[level - 1];
+                row0.resize(3 * size_t(below_w));
+                row1.resize(3 * size_t(below_w));
+                out.resize(3 * size_t(w));
+                auto read_row = [&](int y, vector<float>& row) {
+                    if (level == 1) {
+                        for (int x = 0 ; x < below_w ; ++x) read_texel(image, x, y, &row[3 * size_t(x)]);
+                        return true;
+                    }
+                    size_t bytes = row.size() * sizeof(float);
+                    off_t at = static_cast<off_t>((image.offsets[level - 1] + (3 * size_t(y) * below_w)) * sizeof(float));
+                    return pread(fd, row.data(), bytes, at) == static_cast<ssize_t>(bytes);
+                };
+                for (int y = 0 ; ok && y < h ; ++y) {
+                    ok = read_row(2 * y, row0) && read_row(min((2 * y) + 1, below_h - 1), row1);
+                    for (int x = 0 ; ok && x < w ; ++x) {
+                        size_t x0 = 3 * size_t(2 * x), x1 = 3 * size_t(min((2 * x) + 1, below_w - 1));
+                        for (int k = 0 ; k < 3 ; ++k)
+                            out[(3 * size_t(x)) + k] = 0.25f * (row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k]);
+                    }
+                    size_t bytes = out.size() * sizeof(float);
+                    off_t at = static_cast<off_t>((image.offsets[level] + (3 * size_t(y) * w)) * sizeof(float));
+                    ok = ok && pwrite(fd, out.data(), bytes, at) == static_cast<ssize_t>(bytes);
+                }
+            }
+            if (ok) {
+                image.coarse = make_unique<mapped_file>(fd);
+                ok = image.coarse->ok();
+                if (ok) madvise(const_cast<char*>(image.coarse->data), image.coarse->size, MADV_RANDOM);
+            }
+            fclose(f);      // unlinked already: the file goes when the mapping does
+            return ok;
+        }
+
+        // color bilinear(uint32_t id, texture_image& image, int level, real u, real v)
+        color bilinear(uint32_t id, texture_image& image, int level, real u, real v) {
+            const int w = image.widths[level], h = image.heights[level];
+            real s = (u * w) - real(0.5), t = (v * h) - real(0.5);
+            real x0 = floor(s), y0 = floor(t);
+            real fx = s - x0, fy = t - y0;
+            int x = wrap(static_cast<int64_t>(x0), w), y = wrap(static_cast<int64_t>(y0), h);
+            shared_ptr<const tile> texels = fetch(id, image, level, x / tile_size, y / tile_size);
+            const float* a = &(*texels)[3 * size_t(((y % tile_size) * tile_stride) + (x % tile_size))];
+            const float* b = a + (3 * tile_stride);
+            color c;
+            for (int k = 0 ; k < 3 ; ++k)
+                c[k] = ((1 - fy) * (((1 - fx) * a[k]) + (fx * a[3 + k]))) + (fy * (((1 - fx) * b[k]) + (fx * b[3 + k])));
+            return c;
+        }
+
+        static int wrap(int64_t x, int n) {
+            int64_t m = x % n;
+            return static_cast<int>(m < 0 ? m + n : m);
+        }
+
+        // shared_ptr<const tile> fetch(uint32_t id, texture_image& image, int level, int tx, int ty)
+        // - the tile from the table, or made and put there; a tile another
+        //   thread still holds stays alive after it is dropped from the table
+        shared_ptr<const tile> fetch(uint32_t id, texture_image& image, int level, int tx, int ty) {
+            const uint64_t key = (uint64_t(id) << 39) | (uint64_t(level) << 34) | (uint64_t(ty) << 17) | uint64_t(tx);
+            // by the high bits of a multiplicative hash, so neighbouring tiles land in different shards
+            shard& part = shards[((key * 0x9E3779B97F4A7C15ull) >> 32) % shard_count];
+            {
+                lock_guard<mutex> lock(part.lock);
+                auto it = part.tiles.find(key);
+                if (it != part.tiles.end()) {
+                    part.hits++;
+                    part.lru.splice(part.lru.begin(), part.lru, it->second.position);
+                    return it->second.texels;
+                }
+                part.misses++;
+            }
+
+            shared_ptr<const tile> made = make_tile(image, level, tx, ty);
+            lock_guard<mutex> lock(part.lock);
+            auto it = part.tiles.find(key);
+            if (it != part.tiles.end()) return it->second.texels;  // another thread was quicker
+            part.lru.push_front(key);
+            part.tiles.emplace(key, entry{ made, part.lru.begin() });
+            size_t freed = 0;
+            part.resident += tile_bytes;
+            while (part.resident > shard_capacity && part.lru.size() > 1) {
+                part.tiles.erase(part.lru.back());
+                part.lru.pop_back();
+                part.resident -= tile_bytes;
+                freed += tile_bytes;
+                part.evictions++;
+            }
+            size_t now = freed > tile_bytes ? resident.fetch_sub(freed - tile_bytes, memory_order_relaxed) - (freed - tile_bytes)
+                                            : resident.fetch_add(tile_bytes - freed, memory_order_relaxed) + (tile_bytes - freed);
+            size_t highest = peak.load(memory_order_relaxed);
+            while (now > highest && !peak.compare_exchange_weak(highest, now, memory_order_relaxed)) {}
+            return made;
+        }
+
+        // shared_ptr<const tile> make_tile(const texture_image& image, int level, int tx, int ty)
+        // - copied out of the file at level 0 and out of coarse above it
+        static shared_ptr<const tile> make_tile(const texture_image& image, int level, int tx, int ty) {
+            auto made = make_shared<tile>(3 * size_t(tile_stride) * tile_stride);
+            float* out = made->data();
+            const int w = image.widths[level], h = image.heights[level];
+            const float* coarse = level > 0 ? reinterpret_cast<const float*>(image.coarse->data) + image.offsets[level] : nullptr;
+            for (int j = 0 ; j < tile_stride ; ++j) {
+                int y = ((ty * tile_size) + j) % h;
+                for (int i = 0 ; i < tile_stride ; ++i, out += 3) {
+                    int x = ((tx * tile_size) + i) % w;
+                    if (level == 0)
+                        read_texel(image, x, y, out);
+                    else
+                        memcpy(out, coarse + (3 * ((size_t(y) * w) + x)), 3 * sizeof(float));
+                }
+            }
+            return made;
+        }
+
+        // the level 0 texel (x, y), y counted from the bottom row
+        static void read_texel(const texture_image& image, int x, int y, float* out) {
+            const int w = image.widths[0], h = image.heights[0];
+            if (image.pfm) {
+                // PFM rows run bottom to top
+                const unsigned char* p = image.texels + (3 * sizeof(float) * ((size_t(y) * w) + x));
+                for (int k = 0 ; k < 3 ; ++k) {
+                    unsigned char bytes[4];
+                    memcpy(bytes, p + (4 * k), 4);
+                    if (image.swap_bytes) {
+                        swap(bytes[0], bytes[3]);
+                        swap(bytes[1], bytes[2]);
+                    }
+                    memcpy(&out[k], bytes, 4);
+                }
+            } else {
+                const unsigned char* p = image.texels + (3 * ((size_t(h - 1 - y) * w) + x));
+                for (int k = 0 ; k < 3 ; ++k) {
+                    float v = p[k] / image.ppm_max;
+                    out[k] = v * v;
+                }
+            }
+        }
+
+};
+
+#endif
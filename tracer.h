@@ -0,0 +1,108 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "denoise.h"
+#include "film.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "light.h"
+#include "material.h"
+#include "profile.h"
+#include "renderer.h"
+#include "sampler.h"
+
+#include <optional>
+
+using namespace std;
+
+// class scalar_tracer
+// - renders a tile one recursive ray_color per sample: the one per-pixel
+//   sample loop of raytracer (whole images, progressive passes, frames,
+//   workers and the preview server) and of batch rendering, so they trace the
+//   same samples and share the film, feature and profile hooks; packet.h's
+//   packet_tracer is the packet counterpart
+// - sample s of pixel (i, j) reseeds from (seed, pixel, s), so an image is
+//   the same for any thread count, tile size or split into passes
+// - the world, materials, camera and lights are held by reference: edits to
+//   them (the preview server's, a sequence's camera) apply to the next tile
+class scalar_tracer {
+
+    public:
+        // MEMBERS
+        film* image_film = nullptr;             // splat the samples onto it instead of adding them to the framebuffer
+        feature_buffer* features = nullptr;     // the first hits of the camera rays, for the denoiser
+
+    public:
+        // CONSTRUCTORS
+        scalar_tracer(const hittable& w, const material_table& m, const camera& c, int width, int height,
+                      int depth, int roulette_depth, sample_pattern pattern, uint64_t render_seed,
+                      const light_list* light_sources = nullptr)
+            : world(w), materials(m), cam(c), image_width(width), image_height(height), max_depth(depth),
+              rr_depth(roulette_depth), sampler_pattern(pattern), seed(render_seed), lights(light_sources) {}
+
+        // void render_tile(const tile& t, framebuffer& fb, int first_sample, int end_sample) const
+        // - renders samples [first_sample, end_sample) of every pixel of t and adds
+        //   them to the sums in fb, or splats them onto image_film
+        // - samples are added straight into the sum so it comes out the same
+        //   however the samples are split into passes
+        void render_tile(const tile& t, framebuffer& fb, int first_sample, int end_sample) const {
+            optional<film_tile> staged;
+            if (image_film) staged.emplace(*image_film, t);
+            for (int j = t.y0 ; j < t.y1 ; ++j) {
+                for (int i = t.x0 ; i < t.x1 ; ++i) {
+                    profile_pixel_begin();
+                    pixel_sampler sampler(sampler_pattern, seed, static_cast<uint64_t>(j) * image_width + i);
+                    color& pixel_color = fb.at(i, j);
+                    for (int s = first_sample ; s < end_sample ; ++s) {
+                        sampler.start_sample(s);
+                        double film_x, film_y;
+                        ray r = primary_ray(cam, sampler, i, j, image_width, image_height, film_x, film_y);
+                        path_features first_hit;
+                        color sample = ray_color(r, world, materials, max_depth, rr_depth, lights,
+                                                 features ? &first_hit : nullptr);
+                        if (staged)
+                            staged->add_sample(film_x, film_y, sample);
+                        else
+                            pixel_color += sample;
+                        if (features) features->add(i, j, first_hit, sample);
+                    }
+                    profile_pixel_end(i, j);
+                    flush_render_stats();
+                }
+            }
+            if (staged) image_film->merge(*staged);
+        }
+
+        // color trace_sample(int i, int j, int s) const
+        // - sample s of pixel (i, j), also splatted onto image_film if there is one,
+        //   for renderers that pick samples a pixel at a time (adaptive.h)
+        color trace_sample(int i, int j, int s) const {
+            profile_pixel_begin();
+            pixel_sampler sampler(sampler_pattern, seed, static_cast<uint64_t>(j) * image_width + i);
+            sampler.start_sample(s);
+            double film_x, film_y;
+            ray r = primary_ray(cam, sampler, i, j, image_width, image_height, film_x, film_y);
+            color sample = ray_color(r, world, materials, max_depth, rr_depth, lights);
+            if (image_film) image_film->add_sample(film_x, film_y, sample);
+            profile_pixel_end(i, j);
+            return sample;
+        }
+
+    private:
+        const hittable& world;
+        const material_table& materials;
+        const camera& cam;
+        int image_width;
+        int image_height;
+        int max_depth;
+        int rr_depth;
+        sample_pattern sampler_pattern;
+        uint64_t seed;
+        const light_list* lights;
+
+};
+
+#endif
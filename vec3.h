@@ -6,53 +6,58 @@
 #include <cmath>
 #include <iostream>
 
+#include "precision.h"
+
 using namespace std;
 
-class vec3 {
+class alignas(vec3_lanes == 4 ? sizeof(real) * 4 : alignof(real)) vec3 {
 
     public:
         // MEMBERS
-        double e[3];
+        // - with RAYTRACER_VEC4 e[3] is padding and stays zero (precision.h)
+        real e[vec3_lanes];
 
     public:
         // CONSTRUCTORS
-        vec3() : e{ 0, 0, 0 } {}
-        vec3(double e0, double e1, double e2)
+        vec3() : e{} {}
+        vec3(real e0, real e1, real e2)
             : e{ e0, e1, e2 } {}
 
         // GETTER METHODS
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        real x() const { return e[0]; }
+        real y() const { return e[1]; }
+        real z() const { return e[2]; }
 
-        double length_squared() const {
+        real length_squared() const {
             return (e[0] * e[0]) + (e[1] * e[1]) + (e[2] * e[2]);
         }
 
-        double length() const {
+        real length() const {
             return sqrt(length_squared());
         }
 
         // OPERATOR OVERRIDE METHODS
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        // - element-wise operations loop over all the lanes, so the padded layout
+        //   vectorizes and zero padding stays zero
+        vec3 operator-() const {
+            vec3 r;
+            for (int k = 0 ; k < vec3_lanes ; ++k) r.e[k] = -e[k];
+            return r;
+        }
+        real operator[](int i) const { return e[i]; }
+        real& operator[](int i) { return e[i]; }
 
         vec3& operator+=(const vec3 &v) {
-            e[0] += v.e[0];
-            e[1] += v.e[1];
-            e[2] += v.e[2];
+            for (int k = 0 ; k < vec3_lanes ; ++k) e[k] += v.e[k];
             return *this;
         }
 
-        vec3& operator*=(const double t) {
-            e[0] *= t;
-            e[1] *= t;
-            e[2] *= t;
+        vec3& operator*=(const real t) {
+            for (int k = 0 ; k < vec3_lanes ; ++k) e[k] *= t;
             return *this;
         }
 
-        vec3& operator/=(const double t) {
+        vec3& operator/=(const real t) {
             return *this *= 1 / t;
         }
 
@@ -69,7 +74,7 @@ class vec3 {
         bool near_zero() const {
             // Return true if vec is close to zero in all dimensions
             const auto s = 1e-8;
-            return (fabs(e[0] < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s));
+            return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
         }
 
 };
@@ -84,30 +89,38 @@ inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
 }
 
 inline vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    vec3 r;
+    for (int k = 0 ; k < vec3_lanes ; ++k) r.e[k] = u.e[k] + v.e[k];
+    return r;
 }
 
 inline vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    vec3 r;
+    for (int k = 0 ; k < vec3_lanes ; ++k) r.e[k] = u.e[k] - v.e[k];
+    return r;
 }
 
 inline vec3 operator*(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    vec3 r;
+    for (int k = 0 ; k < vec3_lanes ; ++k) r.e[k] = u.e[k] * v.e[k];
+    return r;
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+inline vec3 operator*(real t, const vec3 &v) {
+    vec3 r;
+    for (int k = 0 ; k < vec3_lanes ; ++k) r.e[k] = t * v.e[k];
+    return r;
 }
 
-inline vec3 operator*(const vec3 &v, double t) {
+inline vec3 operator*(const vec3 &v, real t) {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t) {
+inline vec3 operator/(vec3 v, real t) {
     return (1/t) * v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v) {
+inline real dot(const vec3 &u, const vec3 &v) {
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
          + u.e[2] * v.e[2];
@@ -146,6 +159,26 @@ inline vec3 random_in_unit_disk() {
     }
 }
 
+// inline vec3 square_to_unit_disk(double x, double y)
+// - maps a point of [0, 1)^2 onto the unit disk (Shirley's concentric mapping),
+//   keeping the stratification of low-discrepancy lens samples
+inline vec3 square_to_unit_disk(double x, double y) {
+    const double quarter_pi = 0.78539816339744830962;
+    double a = (2 * x) - 1;
+    double b = (2 * y) - 1;
+    if (a == 0 && b == 0) return vec3(0, 0, 0);
+
+    double r, phi;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = quarter_pi * (b / a);
+    } else {
+        r = b;
+        phi = (2 * quarter_pi) - (quarter_pi * (a / b));
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0);
+}
+
 // inline vec3 reflect(const vec3& v, const vec3& n)
 // - given a ray v and a normal n, returns the reflected ray
 //   which is v + 2b (v points into sphere so need a minus)
@@ -153,10 +186,10 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
     return v - (2 * dot(v, n) * n);
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+    real cos_theta = fmin(dot(-uv, n), real(1));
     vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    vec3 r_out_parallel = -sqrt(fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 